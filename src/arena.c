@@ -0,0 +1,67 @@
+#include <arena.h>
+#include <error.h>
+#include <platform.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *arena_alloc(Arena *arena, usz size, usz alignment) {
+  ASSERT(
+    alignment && !(alignment & (alignment - 1)) && alignment <= ARENA_MAX_ALIGNMENT,
+    "Invalid arena alignment %Z",
+    alignment
+  );
+
+  /// Start a new block if the object doesn’t fit in the current one.
+  ArenaBlock *block = arena->last;
+  usz offset = block ? ALIGN_TO(block->used, alignment) : 0;
+  if (!block || offset + size > block->capacity) {
+    usz block_size = block ? 2 * (ARENA_HEADER_SIZE + block->capacity) : ARENA_MIN_BLOCK_SIZE;
+    if (block_size > ARENA_MAX_BLOCK_SIZE) block_size = ARENA_MAX_BLOCK_SIZE;
+    usz capacity = block_size - ARENA_HEADER_SIZE;
+    if (size > capacity) capacity = size;
+    if (ARENA_HEADER_SIZE + capacity >= ARENA_MAX_BLOCK_SIZE) {
+      block = platform_allocate_pages(ARENA_HEADER_SIZE + capacity);
+    } else {
+      block = malloc(ARENA_HEADER_SIZE + capacity);
+      ASSERT(block, "Memory allocation failure");
+      block->next = NULL;
+      block->used = 0;
+    }
+    block->capacity = capacity;
+    ASAN_POISON(arena_block_data(block), capacity);
+
+    if (arena->last) arena->last->next = block;
+    else arena->first = block;
+    arena->last = block;
+    offset = 0;
+  }
+
+  /// Mapped pages are already zeroed. Heap blocks are zeroed one
+  /// object at a time, so memory that is never used isn’t touched.
+  void *ptr = arena_block_data(block) + offset;
+  ASAN_UNPOISON(ptr, size);
+  if (ARENA_HEADER_SIZE + block->capacity < ARENA_MAX_BLOCK_SIZE) memset(ptr, 0, size);
+  block->used = offset + size;
+  arena->count++;
+  return ptr;
+}
+
+void arena_free(Arena *arena) {
+  for (ArenaBlock *block = arena->first, *next; block; block = next) {
+    next = block->next;
+    usz size = ARENA_HEADER_SIZE + block->capacity;
+    ASAN_UNPOISON(block, size);
+    if (size >= ARENA_MAX_BLOCK_SIZE) platform_free_pages(block, size);
+    else free(block);
+  }
+  *arena = (Arena){0};
+}
+
+void arena_append(Arena *to, Arena *from) {
+  if (!from->first) return;
+  if (to->last) to->last->next = from->first;
+  else to->first = from->first;
+  to->last = from->last;
+  to->count += from->count;
+  *from = (Arena){0};
+}
@@ -0,0 +1,73 @@
+#ifndef INTERCEPT_ARENA_H
+#define INTERCEPT_ARENA_H
+
+#include <utils.h>
+
+/// A block of memory in an arena. The objects follow the header.
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+
+  /// Number of bytes in use and available after the header.
+  usz used;
+  usz capacity;
+} ArenaBlock;
+
+/// A bump allocator. Objects are allocated one after another in large
+/// blocks, and are only ever freed all at once. Allocated memory is zero-initialised.
+///
+/// An arena that only ever holds objects of a single type is a typed
+/// arena; its objects can be iterated over in the order in which they
+/// were allocated using arena_foreach().
+typedef struct Arena {
+  ArenaBlock *first;
+  ArenaBlock *last;
+
+  /// Number of objects allocated in this arena.
+  usz count;
+} Arena;
+
+/// Blocks start out at the minimum size, including their header, and
+/// each block is twice as large as the previous one, up to the maximum
+/// size. This way, arenas that only ever hold a few objects are cheap.
+/// A block is larger than the maximum size only if an object is.
+///
+/// Blocks smaller than the maximum size come from the heap; mapping
+/// and unmapping pages for every short-lived arena costs more than it
+/// saves. Blocks of at least the maximum size are mapped directly.
+#define ARENA_MIN_BLOCK_SIZE ((usz) 1024)
+#define ARENA_MAX_BLOCK_SIZE ((usz) 256 * 1024)
+
+/// Objects are aligned to at most this many bytes.
+#define ARENA_MAX_ALIGNMENT ((usz) 16)
+
+/// Size of the header of a block, rounded up to the maximum alignment.
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_MAX_ALIGNMENT - 1) & ~(ARENA_MAX_ALIGNMENT - 1))
+
+/// Get the first object in a block.
+#define arena_block_data(block) ((char *) (block) + ARENA_HEADER_SIZE)
+
+/// Allocate `size` bytes with the given alignment, which must be a
+/// power of two no larger than ARENA_MAX_ALIGNMENT.
+NODISCARD void *arena_alloc(Arena *arena, usz size, usz alignment);
+
+/// Allocate a zero-initialised object of type `type`.
+#define arena_new(arena, type) ((type *) arena_alloc((arena), sizeof(type), _Alignof(type)))
+
+/// Free all memory in an arena. The arena can be reused afterwards.
+void arena_free(Arena *arena);
+
+/// Move all objects from one arena to the end of another. The objects
+/// stay where they are; `from` is empty afterwards.
+void arena_append(Arena *to, Arena *from);
+
+/// Iterate over all objects in a typed arena, in allocation order.
+/// Since the size of a type is a multiple of its alignment, objects
+/// of the same type are laid out without padding between them.
+#define arena_foreach(type, element, arena)                                              \
+  for (ArenaBlock *CAT(_block_, element) = (arena).first; CAT(_block_, element);         \
+       CAT(_block_, element) = CAT(_block_, element)->next)                              \
+    for (type *element = (type *) arena_block_data(CAT(_block_, element));               \
+         (char *) element < arena_block_data(CAT(_block_, element)) + CAT(_block_, element)->used; \
+         element++)
+
+#endif // INTERCEPT_ARENA_H
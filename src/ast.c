@@ -1,4 +1,5 @@
 #include <ast.h>
+#include <memory_report.h>
 #include <parser.h>
 
 /// ===========================================================================
@@ -12,9 +13,13 @@
   /// A unique ID that is used to compare primitives.
   uint8_t id;
 } TypePrimitive;*/
+/// The builtin types are shared by every module, potentially across
+/// threads, so they are marked as type checked up front to make sure
+/// the typechecker never writes to them.
 static Type t_void_def = {
   .kind = TYPE_PRIMITIVE,
   .source_location = {0},
+  .type_checked = true,
   .primitive = {
     .size = 0,
     .alignment = 0,
@@ -25,12 +30,14 @@ static Type t_void_def = {
 static Type t_void_pointer_def = {
   .kind = TYPE_POINTER,
   .source_location = {0},
+  .type_checked = true,
   .pointer = { .to = &t_void_def },
 };
 
 static Type t_integer_literal_def = {
   .kind = TYPE_PRIMITIVE,
   .source_location = {0},
+  .type_checked = true,
   .primitive = {
     .size = 8,
     .alignment = 8,
@@ -42,6 +49,7 @@ static Type t_integer_literal_def = {
 static Type t_integer_def = {
   .kind = TYPE_PRIMITIVE,
   .source_location = {0},
+  .type_checked = true,
   .primitive = {
     .size = 8,
     .alignment = 8,
@@ -53,6 +61,7 @@ static Type t_integer_def = {
 static Type t_byte_def = {
   .kind = TYPE_PRIMITIVE,
   .source_location = {0},
+  .type_checked = true,
   .primitive = {
     .size = 1,
     .alignment = 1,
@@ -67,33 +76,34 @@ Type *const t_integer_literal = &t_integer_literal_def;
 Type *const t_integer = &t_integer_def;
 Type *const t_byte = &t_byte_def;
 
-Type *primitive_types[4];
+/// The order of these is part of the module format.
+Type *primitive_types[4] = {
+  &t_integer_def,
+  &t_void_def,
+  &t_byte_def,
+  NULL,
+};
 
 /// ===========================================================================
 ///  Scope/symbol functions.
 /// ===========================================================================
-static Scope *scope_create(Scope *parent) {
-  Scope *scope = calloc(1, sizeof(Scope));
+static Scope *scope_create(Module *ast, Scope *parent) {
+  Scope *scope = arena_new(&ast->_scopes_, Scope);
+  memory_record(MEMORY_AST, sizeof(Scope));
+  scope->module = ast;
   scope->parent = parent;
   return scope;
 }
 
 static void scope_delete(Scope *scope) {
-  foreach_val (symbol, scope->symbols) {
-    free(symbol->name.data);
-    free(symbol);
-  }
-
-  vector_delete(scope->symbols);
+  small_vector_delete(scope->symbols);
   vector_delete(scope->children);
-  free(scope);
 }
 
 void scope_push(Module *ast) {
   ASSERT(ast->scope_stack.size, "AST must have a global scope.");
-  Scope *scope = scope_create(vector_back(ast->scope_stack));
+  Scope *scope = scope_create(ast, vector_back(ast->scope_stack));
   vector_push(ast->scope_stack, scope);
-  vector_push(ast->_scopes_, scope);
 }
 
 void scope_pop(Module *ast) {
@@ -101,29 +111,30 @@ void scope_pop(Module *ast) {
   (void) vector_pop(ast->scope_stack);
 }
 
-Symbol *scope_add_symbol_unconditional(Scope *scope, enum SymbolKind kind, span name, void *value) {
-  Symbol *symbol = calloc(1, sizeof(Symbol));
+Symbol *scope_add_symbol_unconditional(Scope *scope, enum SymbolKind kind, atom name, void *value) {
+  Symbol *symbol = arena_new(&scope->module->_symbols_, Symbol);
+  memory_record(MEMORY_AST, sizeof(Symbol));
   symbol->kind = kind;
-  symbol->name = string_dup(name);
+  symbol->name = name;
   symbol->scope = scope;
   if (kind == SYM_TYPE) symbol->val.type = value;
   else symbol->val.node = value;
-  vector_push(scope->symbols, symbol);
+  small_vector_push(scope->symbols, symbol);
   return symbol;
 }
 
 
-Symbol *scope_add_symbol(Scope *scope, enum SymbolKind kind, span name, void *value) {
+Symbol *scope_add_symbol(Scope *scope, enum SymbolKind kind, atom name, void *value) {
   // Check if the symbol already exists.
   if (scope_find_symbol(scope, name, true)) return NULL;
   return scope_add_symbol_unconditional(scope, kind, name, value);
 }
 
-Symbol *scope_find_symbol(Scope *scope, span name, bool this_scope_only) {
+Symbol *scope_find_symbol(Scope *scope, atom name, bool this_scope_only) {
   while (scope) {
     /// Return the symbol if it exists.
     foreach_val (symbol, scope->symbols)
-      if (string_eq(symbol->name, name))
+      if (atom_eq(symbol->name, name))
         return symbol;
 
     /// If we're only looking in the current scope, return NULL.
@@ -137,7 +148,7 @@ Symbol *scope_find_symbol(Scope *scope, span name, bool this_scope_only) {
   return NULL;
 }
 
-Symbol *scope_find_or_add_symbol(Scope *scope, enum SymbolKind kind, span name, bool this_scope_only) {
+Symbol *scope_find_or_add_symbol(Scope *scope, enum SymbolKind kind, atom name, bool this_scope_only) {
   Symbol *symbol = scope_find_symbol(scope, name, this_scope_only);
   if (symbol) return symbol;
   return scope_add_symbol(scope, kind, name, NULL);
@@ -148,19 +159,33 @@ Symbol *scope_find_or_add_symbol(Scope *scope, enum SymbolKind kind, span name,
 /// ===========================================================================
 /// Internal helper to create a node.
 NODISCARD static Node *mknode(Module *ast, enum NodeKind kind, loc source_location) {
-  Node *node = calloc(1, sizeof(Node));
+  Node *node = arena_new(&ast->_nodes_, Node);
+  memory_record(MEMORY_AST, sizeof(Node));
   node->kind = kind;
   node->source_location = source_location;
-  vector_push(ast->_nodes_, node);
   return node;
 }
 
+/// Internal helper to move the contents of a vector into a node list.
+/// The vector is freed.
+NODISCARD static NodeList mklist(Module *ast, Nodes *nodes) {
+  NodeList list = {0};
+  if (nodes->size) {
+    list.data = arena_alloc(&ast->_node_data_, nodes->size * sizeof(Node *), _Alignof(Node *));
+    list.size = nodes->size;
+    memcpy(list.data, nodes->data, nodes->size * sizeof(Node *));
+    memory_record(MEMORY_AST, nodes->size * sizeof(Node *));
+  }
+  vector_delete(*nodes);
+  return list;
+}
+
 /// Internal helper to create a type.
 NODISCARD static Type *mktype(Module *ast, enum TypeKind kind, loc source_location) {
-  Type *type = calloc(1, sizeof(Type));
+  Type *type = arena_new(&ast->_types_, Type);
+  memory_record(MEMORY_AST, sizeof(Type));
   type->kind = kind;
   type->source_location = source_location;
-  vector_push(ast->_types_, type);
   return type;
 }
 
@@ -172,14 +197,16 @@ Node *ast_make_function(
     SymbolLinkage linkage,
     Nodes param_decls,
     Node *body,
-    span name
+    atom name
 ) {
   Node *node = mknode(ast, NODE_FUNCTION, source_location);
-  node->function.name = string_dup(name);
+  node->function = arena_new(&ast->_node_data_, NodeFunction);
+  memory_record(MEMORY_AST, sizeof(NodeFunction));
+  node->function->name = name;
   node->type = type;
-  node->function.linkage = linkage;
-  node->function.body = body;
-  node->function.param_decls = param_decls;
+  node->function->linkage = linkage;
+  node->function->body = body;
+  node->function->param_decls = mklist(ast, &param_decls);
   node->parent = ast->root;
   if (body) body->parent = node;
 
@@ -193,11 +220,11 @@ Node *ast_make_declaration(
     loc source_location,
     Type *type,
     SymbolLinkage linkage,
-    span name,
+    atom name,
     Node *init
 ) {
   Node *node = mknode(ast, NODE_DECLARATION, source_location);
-  node->declaration.name = string_dup(name);
+  node->declaration.name = name;
   node->declaration.linkage = linkage;
   node->type = type;
   if (init) {
@@ -279,8 +306,8 @@ Node *ast_make_block(
     Nodes children
 ) {
   Node *node = mknode(ast, NODE_BLOCK, source_location);
-  node->block.children = children;
-  foreach_val (child, children) child->parent = node;
+  node->block.children = mklist(ast, &children);
+  foreach_val (child, node->block.children) child->parent = node;
   return node;
 }
 
@@ -293,9 +320,9 @@ Node *ast_make_call(
 ) {
   Node *node = mknode(ast, NODE_CALL, source_location);
   node->call.callee = callee;
-  node->call.arguments = arguments;
+  node->call.arguments = mklist(ast, &arguments);
   callee->parent = node;
-  foreach_val (argument, arguments) argument->parent = node;
+  foreach_val (argument, node->call.arguments) argument->parent = node;
   return node;
 }
 
@@ -373,20 +400,14 @@ Node *ast_make_string_literal(
 /// Create a new compound literal.
 Node *ast_make_compound_literal(
   Module *ast,
-    loc source_location
+    loc source_location,
+    Nodes elements
 ) {
   Node *node = mknode(ast, NODE_LITERAL, source_location);
   node->literal.type = TK_LBRACK;
-  vector_clear(node->literal.compound);
+  node->literal.compound = mklist(ast, &elements);
   return node;
 }
-/// Add a node to an existing compound literal.
-void ast_add_to_compound_literal(
-    Node *compound,
-    Node *node
-) {
-  vector_push(compound->literal.compound, node);
-}
 
 Node *ast_make_module_reference(
   Module *ast,
@@ -422,11 +443,11 @@ Node *ast_make_structure_declaration(
 Node *ast_make_member_access(
   Module *ast,
     loc source_location,
-    span ident,
+    atom ident,
     Node *struct_
 ) {
   Node *node = mknode(ast, NODE_MEMBER_ACCESS, source_location);
-  node->member_access.ident = string_dup(ident);
+  node->member_access.ident = ident;
   node->member_access.struct_ = struct_;
   return node;
 }
@@ -435,10 +456,10 @@ Node *ast_make_member_access(
 Node *ast_make_function_reference(
   Module *ast,
     loc source_location,
-    span symbol
+    atom symbol
 ) {
   Node *node = mknode(ast, NODE_FUNCTION_REFERENCE, source_location);
-  node->funcref.name = string_dup(symbol);
+  node->funcref.name = symbol;
   node->funcref.resolved = NULL;
   node->funcref.scope = vector_back(ast->scope_stack);
   return node;
@@ -723,13 +744,13 @@ Module *ast_create() {
   ast->root = mknode(ast, NODE_ROOT, (loc){0, 0});
 
   /// Create the global scope.
-  vector_push(ast->scope_stack, scope_create(NULL));
-  vector_push(ast->_scopes_, vector_back(ast->scope_stack));
+  Scope *global = scope_create(ast, NULL);
+  vector_push(ast->scope_stack, global);
 
   /// Add the builtin types to the global scope.
-  scope_add_symbol(ast->_scopes_.data[0], SYM_TYPE, literal_span("integer"), t_integer);
-  scope_add_symbol(ast->_scopes_.data[0], SYM_TYPE, literal_span("byte"), t_byte);
-  scope_add_symbol(ast->_scopes_.data[0], SYM_TYPE, literal_span("void"), t_void);
+  scope_add_symbol(global, SYM_TYPE, atom_intern(literal_span("integer")), t_integer);
+  scope_add_symbol(global, SYM_TYPE, atom_intern(literal_span("byte")), t_byte);
+  scope_add_symbol(global, SYM_TYPE, atom_intern(literal_span("void")), t_void);
 
   /// Done.
   return ast;
@@ -737,76 +758,36 @@ Module *ast_create() {
 
 /// Free an AST.
 void ast_free(Module *ast) {
-  /// Some nodes may contain strings, vectors, etc.. Iterate over all
-  /// nodes and free all resources they may have.
-  foreach_val(node, ast->_nodes_) {
-    STATIC_ASSERT(NODE_COUNT == 19, "Exhaustive handling of node types when freeing AST.");
-    switch (node->kind) {
-      case NODE_FUNCTION:
-        free(node->function.name.data);
-        vector_delete(node->function.param_decls);
-        continue;
-
-      case NODE_ROOT: vector_delete(node->root.children); continue;
-      case NODE_BLOCK: vector_delete(node->block.children); continue;
-      case NODE_DECLARATION: free(node->declaration.name.data); continue;
-      case NODE_MEMBER_ACCESS: free(node->member_access.ident.data); continue;
-
-      case NODE_INTRINSIC_CALL:
-      case NODE_CALL:
-        vector_delete(node->call.arguments); continue;
-
-      case NODE_IF:
-      case NODE_WHILE:
-      case NODE_FOR:
-      case NODE_RETURN:
-      case NODE_CAST:
-      case NODE_BINARY:
-      case NODE_UNARY:
-      case NODE_LITERAL:
-      case NODE_VARIABLE_REFERENCE:
-      case NODE_MODULE_REFERENCE:
-      case NODE_STRUCTURE_DECLARATION:
-        continue;
-      case NODE_FUNCTION_REFERENCE:
-        free(node->funcref.name.data);
-        continue;
-
-      default: UNREACHABLE();
-    }
-    UNREACHABLE();
-  }
+  parse_free_deferred(ast);
+
+  /// Lists of children and out-of-line node data live in an arena;
+  /// only the children of the root can grow and need to be freed.
+  vector_delete(ast->root->root.children);
 
   /// Now that that’s done, free all nodes.
-  foreach_val(node, ast->_nodes_) free(node);
-  vector_delete(ast->_nodes_);
+  arena_free(&ast->_nodes_);
+  arena_free(&ast->_node_data_);
   vector_delete(ast->functions);
 
   /// Free all types.
-  foreach_val(type, ast->_types_) {
-    if (type->kind == TYPE_FUNCTION) {
-      foreach (param, type->function.parameters) free(param->name.data);
-      vector_delete(type->function.parameters);
-    } else if (type->kind == TYPE_STRUCT) {
-      foreach (member, type->structure.members) free(member->name.data);
-      vector_delete(type->structure.members);
-    }
-    free(type);
+  arena_foreach (Type, type, ast->_types_) {
+    if (type->kind == TYPE_FUNCTION) vector_delete(type->function.parameters);
+    else if (type->kind == TYPE_STRUCT) vector_delete(type->structure.members);
   }
-  vector_delete(ast->_types_);
+  arena_free(&ast->_types_);
 
-  /// Free all scopes. This also deletes all symbols.
-  foreach_val(scope, ast->_scopes_) scope_delete(scope);
-  vector_delete(ast->_scopes_);
+  /// Free all scopes and symbols.
+  arena_foreach (Scope, scope, ast->_scopes_) scope_delete(scope);
+  arena_free(&ast->_scopes_);
+  arena_free(&ast->_symbols_);
   vector_delete(ast->scope_stack);
+  vector_delete(ast->typecheck_stack);
 
-  /// Free all interned strings.
-  foreach (s, ast->strings) free(s->data);
+  /// Free the string table. The strings themselves are atoms.
   vector_delete(ast->strings);
 
-  /// Free the filename and source code.
+  /// Free the filename.
   free(ast->filename.data);
-  free(ast->source.data);
 
   /// Free the AST.
   free(ast);
@@ -817,7 +798,7 @@ static void ast_print_children(
     FILE *file,
     const Node *logical_grandparent,
     const Node *logical_parent,
-    const Nodes *nodes,
+    const NodeList *nodes,
     string_buffer *buf
 );
 
@@ -870,7 +851,10 @@ void ast_print_node_internal(
 
     case NODE_ROOT: {
       fprint(file, "%31Root %35<%u>\n", node->source_location.start);
-      ast_print_children(file, logical_parent, node, &node->root.children, leading_text);
+      ast_print_children(file, logical_parent, node, &(NodeList) {
+        .data = node->root.children.data,
+        .size = node->root.children.size
+      }, leading_text);
     } break;
 
     case NODE_MODULE_REFERENCE: {
@@ -878,25 +862,25 @@ void ast_print_node_internal(
     } break;
 
     case NODE_FUNCTION: {
-      print_linkage(file, node->function.linkage);
+      print_linkage(file, node->function->linkage);
 
       /// Print the function name and type.
       fprint(file, "Function %35<%u> %32%S %31: %T\n",
         node->source_location.start,
-        node->function.name,
+        node->function->name,
         node->type);
 
       /// Print the body.
-      if (node->function.body) {
-        ast_print_children(file, logical_parent, node, &(Nodes) {
-          .data = (Node *[]) {node->function.body},
+      if (node->function->body) {
+        ast_print_children(file, logical_parent, node, &(NodeList) {
+          .data = (Node *[]) {node->function->body},
           .size = 1
         }, leading_text);
       }
     } break;
 
     case NODE_DECLARATION: {
-      print_linkage(file, node->function.linkage);
+      print_linkage(file, node->declaration.linkage);
 
       /// Print the declaration name and type.
       fprint(file, "Variable Declaration %35<%u> %38%S %31: %T\n",
@@ -906,7 +890,7 @@ void ast_print_node_internal(
 
       /// Print the initialiser if there is one exists.
       if (node->declaration.init) {
-        ast_print_children(file, logical_parent, node, &(Nodes) {
+        ast_print_children(file, logical_parent, node, &(NodeList) {
           .data = (Node *[]) {node->declaration.init},
           .size = 1
         }, leading_text);
@@ -918,7 +902,7 @@ void ast_print_node_internal(
       fprint(file, "%31If %35<%u> %T\n", node->source_location.start, node->type);
 
       /// Print the condition and branches.
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {node->if_.condition, node->if_.then, node->if_.else_},
         .size = node->if_.else_ ? 3 : 2
       }, leading_text);
@@ -926,7 +910,7 @@ void ast_print_node_internal(
 
     case NODE_WHILE: {
       fprint(file, "%31While %35<%u>\n", node->source_location.start);
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {node->while_.condition, node->while_.body},
         .size = 2
       }, leading_text);
@@ -934,7 +918,7 @@ void ast_print_node_internal(
 
     case NODE_FOR: {
       fprint(file, "%31For %35<%u>\n", node->source_location.start);
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {
           node->for_.init,
           node->for_.condition,
@@ -948,7 +932,7 @@ void ast_print_node_internal(
     case NODE_RETURN: {
       fprint(file, "%31Return %35<%u> %T\n", node->source_location.start, node->type);
       if (node->return_.value)
-        ast_print_children(file, logical_parent, node, &(Nodes) {
+        ast_print_children(file, logical_parent, node, &(NodeList) {
           .data = (Node *[]) {node->return_.value},
           .size = 1
         }, leading_text);
@@ -963,10 +947,7 @@ void ast_print_node_internal(
       fprint(file, "%31Intrinsic %32%S %35<%u> %T\n", node->call.callee->funcref.name,
         node->source_location.start, node->type);
 
-      Nodes nodes = {0};
-      vector_append(nodes, node->call.arguments);
-      ast_print_children(file, logical_parent, node, &nodes, leading_text);
-      vector_delete(nodes);
+      ast_print_children(file, logical_parent, node, &node->call.arguments, leading_text);
     } break;
 
     case NODE_CALL: {
@@ -975,13 +956,16 @@ void ast_print_node_internal(
       Nodes nodes = {0};
       if (node->call.callee) vector_push(nodes, node->call.callee);
       vector_append(nodes, node->call.arguments);
-      ast_print_children(file, logical_parent, node, &nodes, leading_text);
+      ast_print_children(file, logical_parent, node, &(NodeList) {
+        .data = nodes.data,
+        .size = nodes.size
+      }, leading_text);
       vector_delete(nodes);
     } break;
 
     case NODE_CAST: {
       fprint(file, "%31Cast %35<%u> %T\n", node->source_location.start, node->type);
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {node->cast.value},
         .size = 1
       }, leading_text);
@@ -993,7 +977,7 @@ void ast_print_node_internal(
         token_type_to_string(node->binary.op),
         node->type);
 
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {node->binary.lhs, node->binary.rhs},
         .size = 2
       }, leading_text);
@@ -1005,7 +989,7 @@ void ast_print_node_internal(
         token_type_to_string(node->unary.op),
         node->type);
 
-      ast_print_children(file, logical_parent, node, &(Nodes) {
+      ast_print_children(file, logical_parent, node, &(NodeList) {
         .data = (Node *[]) {node->unary.value},
         .size = 1
       }, leading_text);
@@ -1084,7 +1068,7 @@ void ast_print_node_internal(
                node->member_access.ident,
                node->type);
 
-        ast_print_children(file, logical_parent, node, &(Nodes) {
+        ast_print_children(file, logical_parent, node, &(NodeList) {
           .data = (Node *[]) {node->member_access.struct_},
           .size = 1
         }, leading_text);
@@ -1156,7 +1140,7 @@ void ast_print_scope_tree(FILE *file, const Module *ast) {
     Vector(scope_tree_node) scope_tree = {0};
 
     /// Create a node for each scope.
-    foreach_val (sc, ast->_scopes_) {
+    arena_foreach (Scope, sc, ast->_scopes_) {
         scope_tree_node node = {0};
         node.scope = sc;
         vector_push(scope_tree, node);
@@ -1191,7 +1175,7 @@ static void ast_print_children(
     FILE *file,
     const Node *logical_grandparent,
     const Node *logical_parent,
-    const Nodes *nodes,
+    const NodeList *nodes,
     string_buffer *buf
 ) {
   /// If the logical parent is merely used here, and not defined,
@@ -1217,12 +1201,13 @@ static void ast_print_children(
 
 /// Intern a string.
 size_t ast_intern_string(Module *ast, span str) {
-  /// Check if the string is already interned.
+  /// Check if the string is already in the table.
+  atom a = atom_intern(str);
   foreach_index(i, ast->strings)
-    if (string_eq(ast->strings.data[i], str)) return i;
+    if (atom_eq(ast->strings.data[i], a)) return i;
 
-  /// Intern the string.
-  vector_push(ast->strings, string_dup(str));
+  /// Add the string.
+  vector_push(ast->strings, a);
   return ast->strings.size - 1;
 }
 
@@ -1247,8 +1232,8 @@ void ast_replace_node(Module *ast, Node *old, Node *new) {
       break;
 
     case NODE_FUNCTION:
-      REPLACE_IN_CHILDREN(old->parent->function.param_decls);
-      if (old->parent->function.body == old) old->parent->function.body = new;
+      REPLACE_IN_CHILDREN(old->parent->function->param_decls);
+      if (old->parent->function->body == old) old->parent->function->body = new;
       break;
 
     case NODE_DECLARATION:
@@ -1393,7 +1378,7 @@ IncompleteResult compare_incomplete(Type *a, Type *b) {
     if (type_is_void(a) && type_is_void(b)) return (IncompleteResult){.incomplete = true, .equal = true};
 
     /// If both are named and have the same name, then they’re equal.
-    if (a->kind == TYPE_NAMED && b->kind == TYPE_NAMED && string_eq(a->named->name, b->named->name))
+    if (a->kind == TYPE_NAMED && b->kind == TYPE_NAMED && atom_eq(a->named->name, b->named->name))
       return (IncompleteResult){.incomplete = true, .equal = true};
 
     /// Otherwise, they’re not equal.
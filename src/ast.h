@@ -1,6 +1,8 @@
 #ifndef INTC_AST_H
 #define INTC_AST_H
 
+#include <arena.h>
+#include <atom.h>
 #include <codegen/codegen_forward.h>
 #include <error.h>
 #include <stdio.h>
@@ -117,6 +119,10 @@ enum TokenType {
   // "lex" an expression (which calls into the parser and creates an AST
   // node...).
   TK_AST_NODE,
+  // A backslash, which escapes the token after it. This only appears
+  // in the token stream; the parser turns it and the token it escapes
+  // into an identifier.
+  TK_BACKSLASH,
 
   TK_COUNT
 };
@@ -186,16 +192,24 @@ typedef struct Scope Scope;
 typedef Vector(Node *) Nodes;
 typedef Vector(Type *) Types;
 
+/// A fixed list of nodes. Unlike a vector, this can’t grow; it is
+/// allocated in the module that owns the nodes and never freed on
+/// its own, which keeps nodes small.
+typedef struct NodeList {
+  Node **data;
+  usz size;
+} NodeList;
+
 /// A function parameter.
 typedef struct Parameter {
   Type *type;
-  string name;
+  atom name;
   loc source_location;
 } Parameter;
 
 typedef struct Member {
   Type *type;
-  string name;
+  atom name;
   loc source_location;
   size_t byte_offset;
 } Member;
@@ -209,7 +223,7 @@ typedef struct Symbol {
   enum SymbolKind kind;
 
   /// The name of the symbol.
-  string name;
+  atom name;
 
   /// The scope in which the symbol is defined.
   Scope *scope;
@@ -223,11 +237,14 @@ typedef struct Symbol {
 
 /// A scope in the AST.
 struct Scope {
+  /// The module that owns this scope and its symbols.
+  struct Module *module;
+
   /// The parent scope.
   struct Scope *parent;
 
-  /// The symbols in this scope.
-  Vector(Symbol *) symbols;
+  /// The symbols in this scope. Most scopes only declare a few.
+  SmallVector(Symbol *, 4) symbols;
 
   /// All child scopes.
   Vector(Scope *) children;
@@ -252,19 +269,28 @@ typedef struct NodeRoot {
   Nodes children;
 } NodeRoot;
 
-/// Named function.
+/// Named function. This is stored out of line since it is much
+/// larger than the data of any other node.
 typedef struct NodeFunction {
-  Nodes param_decls;
+  NodeList param_decls;
   Node *body;
-  string name;
+  atom name;
   IRFunction *ir;
   SymbolLinkage linkage;
+
+  /// If parsing the body has been deferred, the indices of its first
+  /// token and of the token after it in the token stream, and how many
+  /// symbols of the global scope were visible there; see
+  /// parse_deferred_body(). Zero otherwise.
+  u32 deferred_body;
+  u32 deferred_body_end;
+  u32 deferred_globals;
 } NodeFunction;
 
 /// Variable declaration.
 typedef struct NodeDeclaration {
   Node *init;
-  string name;
+  atom name;
   SymbolLinkage linkage;
 } NodeDeclaration;
 
@@ -283,13 +309,13 @@ typedef struct NodeWhile {
 
 /// Block.
 typedef struct NodeBlock {
-  Nodes children;
+  NodeList children;
 } NodeBlock;
 
 /// Function call.
 typedef struct NodeCall {
   Node *callee;
-  Nodes arguments;
+  NodeList arguments;
   enum IntrinsicKind intrinsic; /// Only used by intrinsic calls.
 } NodeCall;
 
@@ -318,13 +344,13 @@ typedef struct NodeLiteral {
   union {
     u64 integer;
     usz string_index;
-    Nodes compound;
+    NodeList compound;
   };
 } NodeLiteral;
 
 /// Function refernece.
 typedef struct NodeFunctionReference {
-  string name;
+  atom name;
   Symbol *resolved;
   Scope *scope;
 } NodeFunctionReference;
@@ -333,7 +359,7 @@ typedef struct NodeFunctionReference {
 typedef Symbol *NodeStructDecl;
 
 typedef struct NodeMemberAccess {
-  string ident;
+  atom ident;
   Member *member;
   Node *struct_;
 } NodeMemberAccess;
@@ -428,10 +454,19 @@ struct Type {
 };
 
 /// A node in the AST.
+///
+/// Most nodes are literals, variable references, and binary expressions,
+/// so nodes are kept small: the data of a node must not be larger than
+/// that of a call. Anything larger is stored out of line, and lists of
+/// children are NodeLists rather than vectors.
 struct Node {
   /// Type of the node.
   enum NodeKind kind;
 
+  /// Various flags. These fit in the padding after the kind.
+  bool type_checked : 1; /// Whether this node has been type checked.
+  bool emitted : 1;      /// Whether this node has been emitted.
+
   /// Location of the node.
   loc source_location;
 
@@ -446,14 +481,10 @@ struct Node {
   /// Things that are lvalues store their address here.
   IRInstruction *address;
 
-  /// Various flags.
-  bool type_checked : 1; /// Whether this node has been type checked.
-  bool emitted : 1;      /// Whether this node has been emitted.
-
   /// Node data.
   union {
     NodeRoot root;
-    NodeFunction function;
+    NodeFunction *function;
     NodeDeclaration declaration;
     NodeIf if_;
     NodeWhile while_;
@@ -473,6 +504,15 @@ struct Node {
   };
 };
 
+/// An expression whose operands are being typechecked; see
+/// typecheck_expression().
+typedef struct TypecheckFrame {
+  Node *node;
+
+  /// The index of the next operand.
+  usz step;
+} TypecheckFrame;
+
 /// Data structure that stores an AST; a module.
 // TODO: Rename to "Module"
 typedef struct Module {
@@ -485,16 +525,20 @@ typedef struct Module {
   Vector(struct Module *) imports;
   Vector(Node *) exports;
 
-  /// Filename of the source file and source code.
+  /// Filename of the source file and source code. The source code
+  /// is owned by whoever parsed the module; see parse().
   /// TODO: If we ever allow multiple source files, then we
   ///       need to store (an index to) the source file in `loc`.
   string filename;
-  string source;
+  span source;
 
-  /// All nodes/types/scopes in the AST. NEVER iterate over this, ever.
-  Nodes _nodes_;
-  Types _types_;
-  Vector(Scope *) _scopes_;
+  /// All nodes/types/scopes/symbols in the AST. NEVER iterate over
+  /// these, ever. They are freed all at once when the AST is freed.
+  Arena _nodes_;
+  Arena _node_data_; /// Out-of-line node data and NodeLists.
+  Arena _types_;
+  Arena _scopes_;
+  Arena _symbols_;
 
   /// Counter used for generating unique names.
   usz counter;
@@ -502,11 +546,22 @@ typedef struct Module {
   /// Scopes that are currently being parsed.
   Vector(Scope *) scope_stack;
 
+  /// Expressions whose operands are being typechecked; see
+  /// typecheck_expression().
+  Vector(TypecheckFrame) typecheck_stack;
+
   /// String table.
-  Vector(string) strings;
+  Vector(atom) strings;
 
   /// Functions.
   Vector(Node *) functions;
+
+  /// The parser, if it has deferred parsing any function bodies.
+  struct Parser *parser;
+
+  /// Set if one of those bodies turned out to contain a syntax error,
+  /// which makes typechecking fail; that is still a parse error.
+  bool deferred_parse_error;
 } Module;
 
 /// ===========================================================================
@@ -520,19 +575,19 @@ void scope_pop(Module *ast);
 
 /// Add an empty symbol to a scope, no matter what.
 /// \return The symbol that was added.
-Symbol *scope_add_symbol_unconditional(Scope *scope, enum SymbolKind kind, span name, void *value);
+Symbol *scope_add_symbol_unconditional(Scope *scope, enum SymbolKind kind, atom name, void *value);
 
 /// Add an empty symbol to a scope.
 /// \return The symbol that was added, or NULL if the symbol already exists.
-Symbol *scope_add_symbol(Scope *scope, enum SymbolKind kind, span name, void *value);
+Symbol *scope_add_symbol(Scope *scope, enum SymbolKind kind, atom name, void *value);
 
 /// Find a symbol in a scope.
 /// \return The symbol, or NULL if it was not found.
-Symbol *scope_find_symbol(Scope *scope, span name, bool this_scope_only);
+Symbol *scope_find_symbol(Scope *scope, atom name, bool this_scope_only);
 
 /// Find a symbol in a scope or add it if it does not exist.
 /// \return The symbol.
-Symbol *scope_find_or_add_symbol(Scope *scope, enum SymbolKind kind, span name, bool this_scope_only);
+Symbol *scope_find_or_add_symbol(Scope *scope, enum SymbolKind kind, atom name, bool this_scope_only);
 
 /// ===========================================================================
 ///  Functions to create ast nodes.
@@ -545,7 +600,7 @@ Node *ast_make_function(
     SymbolLinkage linkage,
     Nodes param_decls,
     Node *body,
-    span name
+    atom name
 );
 
 /// Create a new declaration node.
@@ -554,7 +609,7 @@ Node *ast_make_declaration(
     loc source_location,
     Type *type,
     SymbolLinkage linkage, ///< Pass whatever for locals.
-    span name,
+    atom name,
     Node *init
 );
 
@@ -650,12 +705,8 @@ Node *ast_make_string_literal(
 /// Create a new compound literal.
 Node *ast_make_compound_literal(
   Module *ast,
-    loc source_location
-);
-/// Add a node to an existing compound literal.
-void ast_add_to_compound_literal(
-    Node *compound,
-    Node *node
+    loc source_location,
+    Nodes elements
 );
 
 /// Create a new variable reference.
@@ -676,7 +727,7 @@ Node *ast_make_module_reference(
 Node *ast_make_function_reference(
   Module *ast,
     loc source_location,
-    span symbol
+    atom symbol
 );
 
 Node *ast_make_structure_declaration(
@@ -688,7 +739,7 @@ Node *ast_make_structure_declaration(
 Node *ast_make_member_access(
   Module *ast,
     loc source_location,
-    span ident,
+    atom ident,
     Node *struct_
 );
 
@@ -873,7 +924,8 @@ void ast_print_scope_tree(FILE *file, const Module *ast);
 /// Print a node and all of it's children.
 void ast_print_node(const Node *node);
 
-/// Intern a string.
+/// Add a string to the string table of a module.
+/// \return The index of the string in the table.
 size_t ast_intern_string(Module *ast, span string);
 
 /// Replace a node with another node.
@@ -0,0 +1,109 @@
+#include <arena.h>
+#include <atom.h>
+#include <error.h>
+#include <hash.h>
+#include <platform.h>
+#include <stdlib.h>
+
+/// The atom table is split into shards, each with its own lock, so
+/// threads that lex different files at once rarely wait for each
+/// other. The shard of an atom is determined by the top bits of its
+/// hash, and its slot in the shard by the bottom bits.
+#define ATOM_SHARD_BITS 6
+#define ATOM_SHARD_COUNT (1 << ATOM_SHARD_BITS)
+#define ATOM_TABLE_MIN_CAPACITY ((usz) 64)
+
+typedef struct AtomEntry {
+  /// NULL if the slot is empty. This is set after the other fields,
+  /// so a reader that sees it set may read them without the lock.
+  const char *data;
+  usz size;
+  u64 hash;
+} AtomEntry;
+
+/// An open-addressing hash table with linear probing. When a table
+/// grows, the old table is kept around since other threads may still
+/// be reading from it.
+typedef struct AtomTable {
+  struct AtomTable *previous;
+  usz capacity;
+  AtomEntry entries[];
+} AtomTable;
+
+typedef struct AtomShard {
+  /// Must be held to insert into the table or replace it.
+  PlatformMutex lock;
+  AtomTable *table;
+  usz count;
+
+  /// The contents of the atoms in this shard.
+  Arena strings;
+} AtomShard;
+
+static AtomShard shards[ATOM_SHARD_COUNT] = {
+  [0 ... ATOM_SHARD_COUNT - 1] = {.lock = PLATFORM_MUTEX_INIT},
+};
+
+/// Find the slot of a string, or the empty slot where it belongs.
+/// \return True if the string was found.
+static bool find_slot(AtomTable *table, u64 hash, span str, AtomEntry **slot) {
+  usz mask = table->capacity - 1;
+  for (usz i = hash & mask;; i = (i + 1) & mask) {
+    AtomEntry *e = table->entries + i;
+    *slot = e;
+    const char *data = __atomic_load_n(&e->data, __ATOMIC_ACQUIRE);
+    if (!data) return false;
+    if (e->hash == hash && e->size == str.size && memcmp(data, str.data, str.size) == 0) return true;
+  }
+}
+
+/// Replace the table of a shard with one twice as large.
+static void grow(AtomShard *shard) {
+  AtomTable *old = shard->table;
+  usz capacity = old ? 2 * old->capacity : ATOM_TABLE_MIN_CAPACITY;
+  AtomTable *table = calloc(1, sizeof *table + capacity * sizeof(AtomEntry));
+  ASSERT(table, "Memory allocation failure");
+  table->previous = old;
+  table->capacity = capacity;
+
+  if (old) {
+    for (usz i = 0; i < old->capacity; i++) {
+      AtomEntry *e = old->entries + i;
+      if (!e->data) continue;
+      AtomEntry *slot;
+      (void) find_slot(table, e->hash, (span){e->data, e->size}, &slot);
+      *slot = *e;
+    }
+  }
+
+  __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+}
+
+atom atom_intern(span str) {
+  u64 hash = hash64(str);
+  AtomShard *shard = shards + (hash >> (64 - ATOM_SHARD_BITS));
+
+  /// Almost every identifier has been seen before, so try to find it
+  /// without taking the lock first.
+  AtomEntry *e;
+  AtomTable *table = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+  if (table && find_slot(table, hash, str, &e)) return (atom){e->data, e->size};
+
+  /// Otherwise, check again with the lock held, since another thread
+  /// may have added it in the meantime, and add it if it is missing.
+  platform_mutex_lock(&shard->lock);
+  if (!shard->table || 4 * (shard->count + 1) > 3 * shard->table->capacity) grow(shard);
+  if (!find_slot(shard->table, hash, str, &e)) {
+    /// Atoms are NUL-terminated so they can be passed to C functions.
+    char *data = arena_alloc(&shard->strings, str.size + 1, 1);
+    if (str.size) memcpy(data, str.data, str.size);
+    e->size = str.size;
+    e->hash = hash;
+    __atomic_store_n(&e->data, data, __ATOMIC_RELEASE);
+    shard->count++;
+  }
+
+  atom a = {e->data, e->size};
+  platform_mutex_unlock(&shard->lock);
+  return a;
+}
@@ -0,0 +1,25 @@
+#ifndef INTERCEPT_ATOM_H
+#define INTERCEPT_ATOM_H
+
+#include <utils.h>
+
+/// An interned string. There is only ever one atom with any given
+/// contents in the entire process, so two atoms are equal iff their
+/// data pointers are.
+///
+/// This is layout-compatible with a span, so atoms can be printed
+/// with %S and passed to anything that takes a string.
+typedef struct atom {
+  const char *data;
+  usz size;
+} atom;
+
+/// Get the atom for a string, creating it if it doesn’t exist yet.
+/// This may be called from any thread. Atoms are never freed, and
+/// the memory they point to stays valid for the rest of the process.
+NODISCARD atom atom_intern(span str);
+
+/// Check if two atoms are equal.
+#define atom_eq(a, b) ((a).data == (b).data)
+
+#endif // INTERCEPT_ATOM_H
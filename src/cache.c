@@ -0,0 +1,366 @@
+#include <cache.h>
+#include <error.h>
+#include <module.h>
+#include <platform.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector.h>
+
+/// Bump this whenever the layout of the cache directory changes.
+#define CACHE_VERSION 2
+
+#define CACHE_MANIFEST_EXTENSION ".manifest"
+#define CACHE_OUTPUT_EXTENSION ".out"
+#define CACHE_DIAGNOSTICS_EXTENSION ".diagnostics"
+#define CACHE_TEMPORARY_EXTENSION ".tmp"
+
+/// Trim the cache to this fraction of the maximum size, so that
+/// not every compilation has to evict something.
+#define CACHE_TRIM_NUMERATOR 9
+#define CACHE_TRIM_DENOMINATOR 10
+
+/// What the cache did during this invocation. Updated atomically
+/// since several files may be compiled at once.
+typedef struct CacheStats {
+  u64 hits;
+  u64 misses;
+  u64 stores;
+  u64 evictions;
+  u64 evicted_bytes;
+} CacheStats;
+
+static CacheStats stats = {0};
+
+/// Hash of the options that are the same for every input file.
+static Hash128 options_hash;
+static const string *cache_search_paths;
+static usz cache_search_path_count;
+
+/// Used to name temporary files.
+static u64 temporary_file_count = 0;
+
+static void append_hash(string_buffer *buf, Hash128 hash) {
+  vector_append(*buf, ((span){(const char *) &hash, sizeof hash}));
+}
+
+/// Get the path of a file in the cache directory that is named after a hash.
+static string cache_path(Hash128 hash, const char *extension) {
+  char hex[33];
+  hash128_to_hex(hash, hex);
+  string_buffer path = {0};
+  format_to(&path, "%s" PLATFORM_PATH_SEPARATOR "%s%s", cache_directory, hex, extension);
+  string_buf_zterm(&path);
+  return (string){path.data, path.size};
+}
+
+/// Get a path in the cache directory that no other compilation uses.
+static string temporary_path(Hash128 key) {
+  u64 count = __atomic_fetch_add(&temporary_file_count, 1, __ATOMIC_RELAXED);
+  u64 unique[3] = {platform_wall_time(), count, (u64) (uintptr_t) &count};
+  key.low ^= hash128((span){(const char *) unique, sizeof unique}, key.high).low;
+  return cache_path(key, CACHE_TEMPORARY_EXTENSION);
+}
+
+/// Hash the interface of the module in the object file at `path`.
+static bool hash_module_interface(const char *path, Hash128 *hash) {
+  bool ok = false;
+  string object = platform_read_file(path, &ok);
+  if (ok) {
+    span metadata = grab_section_reference(as_span(object), INTC_MODULE_SECTION_NAME);
+    *hash = hash128(metadata, 0);
+  }
+  free(object.data);
+  return ok;
+}
+
+/// Write a file to the cache directory. The file is written to a
+/// temporary file first, so other compilations never see a partial
+/// file; if several compilations store the same file, the last
+/// one wins, which is fine since they all have the same contents.
+static bool write_cache_file(const char *path, Hash128 key, span contents, const char *copy_from) {
+  string temporary = temporary_path(key);
+  bool ok;
+  if (copy_from) {
+    ok = platform_copy_file(copy_from, temporary.data);
+  } else {
+    FILE *file = fopen(temporary.data, "wb");
+    ok = file != NULL;
+    if (ok) {
+      ok = fwrite(contents.data, 1, contents.size, file) == contents.size;
+      ok = fclose(file) == 0 && ok;
+    }
+  }
+
+  if (ok) ok = platform_rename_file(temporary.data, path);
+  if (!ok) remove(temporary.data);
+  free(temporary.data);
+  return ok;
+}
+
+bool cache_init(span options, const char *isel_table, const string *search_paths, usz search_path_count) {
+  if (!platform_create_directory(cache_directory)) {
+    issue_diagnostic(DIAG_ERR, cache_directory, (span){0}, (loc){0}, "Could not create cache directory");
+    return false;
+  }
+
+  /// Outputs of a different version of the compiler can’t be used.
+  string_buffer key = {0};
+  format_to(&key, "intc cache %d\n", CACHE_VERSION);
+  string executable = platform_executable_path();
+  PlatformFileStamp executable_stamp = {0};
+  if (executable.data) platform_file_stamp(executable.data, &executable_stamp);
+  format_to(&key, "%S %U %U\n", executable, executable_stamp.size, executable_stamp.modified);
+  free(executable.data);
+
+  /// Nor can outputs of different ISel tables.
+  bool ok = false;
+  string table = platform_read_file(isel_table, &ok);
+  if (!ok) {
+    issue_diagnostic(DIAG_ERR, isel_table, (span){0}, (loc){0}, "%S", table);
+    free(table.data);
+    vector_delete(key);
+    return false;
+  }
+  append_hash(&key, hash128(as_span(table), 0));
+  free(table.data);
+
+  vector_append(key, options);
+  options_hash = hash128(as_span(key), 0);
+  vector_delete(key);
+
+  cache_search_paths = search_paths;
+  cache_search_path_count = search_path_count;
+  return true;
+}
+
+bool cache_lookup(
+  CacheEntry *entry,
+  const char *infile,
+  span source,
+  string *output_filepath,
+  bool output_filepath_chosen
+) {
+  *entry = (CacheEntry){.enabled = true};
+
+  /// The direct key is a hash of the options, the name of the input
+  /// file, which ends up in the output, and the source code.
+  string_buffer key = {0};
+  append_hash(&key, options_hash);
+  append_hash(&key, hash128(source, 0));
+  vector_append(key, ((span){infile, strlen(infile)}));
+  entry->direct_key = hash128(as_span(key), 0);
+  vector_clear(key);
+  append_hash(&entry->output_key_data, entry->direct_key);
+  append_hash(&key, entry->direct_key);
+
+  /// The manifest has one line per module that is imported, one
+  /// line for the output path if it was not the default, and one
+  /// line if the compilation issued any diagnostics.
+  string manifest_path = cache_path(entry->direct_key, CACHE_MANIFEST_EXTENSION);
+  bool ok = false;
+  string manifest = platform_read_file(manifest_path.data, &ok);
+  string output = {0};
+  bool has_diagnostics = false;
+  span rest = ok ? as_span(manifest) : (span){0};
+  while (ok && rest.size) {
+    const char *eol = memchr(rest.data, '\n', rest.size);
+    if (!eol) break;
+    span line = {rest.data, (usz) (eol - rest.data)};
+    rest.data += line.size + 1;
+    rest.size -= line.size + 1;
+
+    if (string_starts_with(line, literal_span("output "))) {
+      span path = {line.data + 7, line.size - 7};
+      free(output.data);
+      output = string_dup(path);
+    } else if (string_starts_with(line, literal_span("import "))) {
+      span name = {line.data + 7, line.size - 7};
+      string module_path = module_find(name, cache_search_paths, cache_search_path_count);
+      Hash128 module_hash;
+      ok = module_path.data && hash_module_interface(module_path.data, &module_hash);
+      free(module_path.data);
+      if (ok) {
+        vector_append(key, name);
+        vector_push(key, '\0');
+        append_hash(&key, module_hash);
+      }
+    } else if (string_eq(line, literal_span("diagnostics"))) {
+      has_diagnostics = true;
+    }
+  }
+
+  /// Copy the output if it is still there, and so are the diagnostics
+  /// if there were any; an output is useless without them.
+  string output_path = {0};
+  string diagnostics_path = {0};
+  string diagnostics = {0};
+  if (ok) {
+    Hash128 output_key = hash128(as_span(key), 0);
+    output_path = cache_path(output_key, CACHE_OUTPUT_EXTENSION);
+    if (has_diagnostics) {
+      diagnostics_path = cache_path(output_key, CACHE_DIAGNOSTICS_EXTENSION);
+      diagnostics = platform_read_file(diagnostics_path.data, &ok);
+
+      /// The size includes the null terminator.
+      if (ok && diagnostics.size) diagnostics.size--;
+    }
+  }
+  if (ok) {
+    if (output.data && !output_filepath_chosen) {
+      free(output_filepath->data);
+      *output_filepath = output;
+      output = (string){0};
+    }
+    ok = platform_copy_file(output_path.data, output_filepath->data);
+  }
+
+  /// Keep what was used for longer, and report the diagnostics.
+  if (ok) {
+    platform_touch_file(manifest_path.data);
+    platform_touch_file(output_path.data);
+    if (has_diagnostics) {
+      platform_touch_file(diagnostics_path.data);
+      flush_diagnostics(as_span(diagnostics));
+    }
+  }
+
+  __atomic_fetch_add(ok ? &stats.hits : &stats.misses, 1, __ATOMIC_RELAXED);
+  free(output_path.data);
+  free(diagnostics_path.data);
+  free(diagnostics.data);
+  free(output.data);
+  free(manifest.data);
+  free(manifest_path.data);
+  vector_delete(key);
+  return ok;
+}
+
+void cache_record_output_filepath(CacheEntry *entry, span output_filepath) {
+  if (!entry->enabled) return;
+  format_to(&entry->manifest, "output %S\n", output_filepath);
+}
+
+void cache_record_import(CacheEntry *entry, span module_name, const char *path) {
+  if (!entry->enabled) return;
+  Hash128 module_hash;
+  if (!hash_module_interface(path, &module_hash)) {
+    entry->enabled = false;
+    return;
+  }
+
+  format_to(&entry->manifest, "import %S\n", module_name);
+  vector_append(entry->output_key_data, module_name);
+  vector_push(entry->output_key_data, '\0');
+  append_hash(&entry->output_key_data, module_hash);
+}
+
+void cache_store(CacheEntry *entry, const char *output_filepath, span diagnostics) {
+  if (!entry->enabled) return;
+
+  /// Store the output and diagnostics before the manifest that refers to them.
+  Hash128 output_key = hash128(as_span(entry->output_key_data), 0);
+  string output_path = cache_path(output_key, CACHE_OUTPUT_EXTENSION);
+  string diagnostics_path = cache_path(output_key, CACHE_DIAGNOSTICS_EXTENSION);
+  string manifest_path = cache_path(entry->direct_key, CACHE_MANIFEST_EXTENSION);
+  if (diagnostics.size) format_to(&entry->manifest, "diagnostics\n");
+  if (
+    write_cache_file(output_path.data, output_key, (span){0}, output_filepath) &&
+    (!diagnostics.size || write_cache_file(diagnostics_path.data, output_key, diagnostics, NULL)) &&
+    write_cache_file(manifest_path.data, entry->direct_key, as_span(entry->manifest), NULL)
+  ) __atomic_fetch_add(&stats.stores, 1, __ATOMIC_RELAXED);
+
+  free(output_path.data);
+  free(diagnostics_path.data);
+  free(manifest_path.data);
+}
+
+void cache_entry_delete(CacheEntry *entry) {
+  vector_delete(entry->manifest);
+  vector_delete(entry->output_key_data);
+}
+
+/// Sort directory entries by modification time, oldest first.
+static int compare_modified(const void *a, const void *b) {
+  const PlatformDirectoryEntry *x = a, *y = b;
+  if (x->stamp.modified != y->stamp.modified) return x->stamp.modified < y->stamp.modified ? -1 : 1;
+  return 0;
+}
+
+/// Get all files in the cache directory, and their total size.
+static u64 list_cache(PlatformDirectoryEntries *entries) {
+  if (!platform_list_directory(cache_directory, entries)) return 0;
+  u64 size = 0;
+  foreach (e, *entries) size += e->stamp.size;
+  return size;
+}
+
+static void delete_entries(PlatformDirectoryEntries *entries) {
+  foreach (e, *entries) free(e->name.data);
+  vector_delete(*entries);
+}
+
+void cache_trim(void) {
+  /// The cache only grows when something is stored.
+  if (!__atomic_load_n(&stats.stores, __ATOMIC_RELAXED)) return;
+
+  PlatformDirectoryEntries entries = {0};
+  u64 size = list_cache(&entries);
+  if (size <= cache_max_size) {
+    delete_entries(&entries);
+    return;
+  }
+
+  /// Manifests that refer to outputs that were evicted are just
+  /// misses, so everything can be evicted independently.
+  qsort(entries.data, entries.size, sizeof *entries.data, compare_modified);
+  u64 target = cache_max_size / CACHE_TRIM_DENOMINATOR * CACHE_TRIM_NUMERATOR;
+  string_buffer path = {0};
+  foreach (e, entries) {
+    if (size <= target) break;
+    vector_clear(path);
+    format_to(&path, "%s" PLATFORM_PATH_SEPARATOR "%S", cache_directory, e->name);
+    string_buf_zterm(&path);
+    if (remove(path.data) != 0) continue;
+    size -= e->stamp.size;
+    __atomic_fetch_add(&stats.evictions, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.evicted_bytes, e->stamp.size, __ATOMIC_RELAXED);
+  }
+
+  vector_delete(path);
+  delete_entries(&entries);
+}
+
+void cache_print_stats(FILE *file) {
+  PlatformDirectoryEntries entries = {0};
+  u64 size = list_cache(&entries);
+  usz outputs = 0;
+  span extension = literal_span(CACHE_OUTPUT_EXTENSION);
+  foreach (e, entries) {
+    if (
+      e->name.size >= extension.size &&
+      memcmp(e->name.data + e->name.size - extension.size, extension.data, extension.size) == 0
+    ) outputs++;
+  }
+  delete_entries(&entries);
+
+  u64 hits = __atomic_load_n(&stats.hits, __ATOMIC_RELAXED);
+  u64 misses = __atomic_load_n(&stats.misses, __ATOMIC_RELAXED);
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "                         Cache Statistics\n");
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "  %-*s %s\n", 28, "Directory", cache_directory);
+  fprint(file, "  %-*s %*U\n", 28, "Hits", 12, hits);
+  fprint(file, "  %-*s %*U\n", 28, "Misses", 12, misses);
+  fprint(
+    file,
+    "  %-*s %*.1f%%\n",
+    28, "Hit rate",
+    11, hits + misses ? 100.0 * (double) hits / (double) (hits + misses) : 0.0
+  );
+  fprint(file, "  %-*s %*U\n", 28, "Outputs stored", 12, __atomic_load_n(&stats.stores, __ATOMIC_RELAXED));
+  fprint(file, "  %-*s %*U\n", 28, "Files evicted", 12, __atomic_load_n(&stats.evictions, __ATOMIC_RELAXED));
+  fprint(file, "  %-*s %*.1f\n", 28, "Evicted (KiB)", 12, (double) __atomic_load_n(&stats.evicted_bytes, __ATOMIC_RELAXED) / 1024.0);
+  fprint(file, "  %-*s %*Z\n", 28, "Cached outputs", 12, outputs);
+  fprint(file, "  %-*s %*.1f\n", 28, "Cache size (KiB)", 12, (double) size / 1024.0);
+  fprint(file, "  %-*s %*.1f\n", 28, "Maximum size (KiB)", 12, (double) cache_max_size / 1024.0);
+}
@@ -0,0 +1,91 @@
+#ifndef INTERCEPT_CACHE_H
+#define INTERCEPT_CACHE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <utils.h>
+
+/// If set, the directory in which compiler outputs are cached.
+extern const char *cache_directory;
+
+/// The size that the cache directory is trimmed to, in bytes.
+extern u64 cache_max_size;
+
+/// Whether to print how well the cache worked.
+extern bool cache_stats;
+
+/// The cache works in two steps. The direct key is a hash of the
+/// source file and of all options that affect the output. It names
+/// a manifest that lists the modules that the file imports. Hashing
+/// the metadata sections of those modules together with the direct
+/// key then gives the key of the output itself. This way, a hit
+/// neither requires parsing the source file nor loading any module,
+/// but an output is never reused if a module it imports has changed.
+///
+/// Diagnostics issued while compiling a file are stored next to its
+/// output and reported again whenever the output is reused.
+typedef struct CacheEntry {
+  /// Whether to store the output of this compilation.
+  bool enabled;
+  Hash128 direct_key;
+
+  /// The contents of the manifest.
+  string_buffer manifest;
+
+  /// Everything that the output key is a hash of.
+  string_buffer output_key_data;
+} CacheEntry;
+
+/// Set up the cache for this command line.
+///
+/// \param options Everything other than the input file and the
+///        ISel table that affects the output of the compiler.
+/// \param isel_table The path to the ISel table that is used.
+/// \param search_paths The directories that modules are looked up in.
+/// \return Whether the cache can be used; if not, an error is printed.
+bool cache_init(span options, const char *isel_table, const string *search_paths, usz search_path_count);
+
+/// Look up the output of compiling `source`, and copy it to the
+/// output file and report the diagnostics of the compilation that
+/// stored it on a hit. Otherwise, `entry` is set up so that the
+/// output of this compilation can be stored in the cache later.
+///
+/// \param output_filepath The path to write the output to; if the
+///        user did not choose it, this is replaced with the path that
+///        the compilation that stored the output wrote it to.
+/// \param output_filepath_chosen Whether the user chose the output path.
+/// \return Whether the output file was written.
+bool cache_lookup(
+  CacheEntry *entry,
+  const char *infile,
+  span source,
+  string *output_filepath,
+  bool output_filepath_chosen
+);
+
+/// Record that the output path was derived from the source file,
+/// and not from the name of the input file.
+void cache_record_output_filepath(CacheEntry *entry, span output_filepath);
+
+/// Record that the module `module_name` was imported from `path`.
+void cache_record_import(CacheEntry *entry, span module_name, const char *path);
+
+/// Store the output of a successful compilation.
+///
+/// \param diagnostics The diagnostics issued while compiling, as
+///        written to a thread_diagnostics_copy.
+void cache_store(CacheEntry *entry, const char *output_filepath, span diagnostics);
+
+/// Free an entry.
+void cache_entry_delete(CacheEntry *entry);
+
+/// If anything was stored, remove the least recently used files
+/// until the cache is smaller than the maximum size.
+void cache_trim(void);
+
+/// Print what the cache did during this invocation, and how much
+/// is in the cache directory.
+void cache_print_stats(FILE *file);
+
+#endif // INTERCEPT_CACHE_H
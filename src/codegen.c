@@ -1,24 +1,28 @@
 #include <ast.h>
 #include <codegen.h>
 #include <codegen/codegen_forward.h>
+#include <codegen/instruction_selection.h>
 #include <codegen/ir/ir-target.h>
 #include <codegen/llvm/llvm_target.h>
+#include <codegen/machine_ir.h>
 #include <codegen/opt/opt.h>
 #include <codegen/x86_64/arch_x86_64.h>
 #include <error.h>
 #include <ir/ir.h>
 #include <ir_parser.h>
 #include <parser.h>
+#include <platform.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <timing.h>
 #include <utils.h>
 #include <vector.h>
 
 #define DIAG(sev, loc, ...)                                                                                 \
   do {                                                                                                      \
     ctx->has_err = true;                                                                                    \
-    issue_diagnostic(DIAG_ERR, (ctx)->ast->filename.data, as_span((ctx)->ast->source), (loc), __VA_ARGS__); \
+    issue_diagnostic(DIAG_ERR, (ctx)->ast->filename.data, (ctx)->ast->source, (loc), __VA_ARGS__); \
     return;                                                                                                 \
   } while (0)
 
@@ -26,6 +30,15 @@
 
 char codegen_verbose = 1;
 
+/// Debugging options. These are process-wide, so they are set
+/// by the command line interface and never by the library.
+bool debug_ir = false;
+bool print_ir2 = false;
+bool codegen_only = false;
+bool print_dot_cfg = false;
+bool print_dot_dj = false;
+const char *print_dot_function = NULL;
+
 bool parameter_is_in_register(CodegenContext *context, IRFunction *function, usz parameter_index) {
   STATIC_ASSERT(ARCH_COUNT == 2, "Exhaustive handling of architectures");
   switch (context->arch) {
@@ -152,8 +165,10 @@ static void codegen_lvalue(CodegenContext *ctx, Node *lval) {
   }
 }
 
-/// Emit an expression.
-static void codegen_expr(CodegenContext *ctx, Node *expr) {
+/// Emit an expression whose operands may have been emitted already;
+/// see codegen_expr(). Ifs, whiles, and calls are emitted in steps by
+/// codegen_step() instead.
+static void codegen_node(CodegenContext *ctx, Node *expr) {
   if (expr->emitted) return;
   expr->emitted = true;
 
@@ -170,9 +185,9 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
   /// hold on to function references and emit IR function references
   /// for them in here.
   case NODE_FUNCTION:
-      expr->ir = ir_insert_func_ref(ctx, expr->function.ir);
+      expr->ir = ir_insert_func_ref(ctx, expr->function->ir);
       if (expr->type->function.attr_inline)
-        ERR("Cannot take address of inline function '%S'", expr->function.name);
+        ERR("Cannot take address of inline function '%S'", expr->function->name);
       return;
 
   case NODE_MODULE_REFERENCE:
@@ -208,117 +223,6 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
   case NODE_STRUCTURE_DECLARATION:
     return;
 
-  /// If expression.
-  ///
-  /// Each box is a basic block within intermediate representation,
-  /// and edges represent control flow from top to bottom.
-  ///
-  ///      +---------+
-  ///      | current |
-  ///      +---------+
-  ///     /           \
-  /// +------+    +------+
-  /// | then |    | else |
-  /// +------+    +------+
-  ///         \  /
-  ///       +------+
-  ///       | join |
-  ///       +------+
-  ///
-  case NODE_IF: {
-    /// Emit the condition.
-    codegen_expr(ctx, expr->if_.condition);
-
-    IRBlock *then_block = ir_block(ctx);
-    IRBlock *last_then_block = then_block;
-    IRBlock *else_block = ir_block(ctx);
-    IRBlock *last_else_block = else_block;
-    IRBlock *join_block = ir_block(ctx);
-
-    /// Generate the branch.
-    ir_insert_cond_br(ctx, expr->if_.condition->ir, then_block, else_block);
-
-    /// Emit the then block.
-    ir_block_attach(ctx, then_block);
-    codegen_expr(ctx, expr->if_.then);
-
-    /// Branch to the join block to skip the else branch.
-    last_then_block = ctx->insert_point;
-    if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, join_block);
-
-    /// Generate the else block if there is one.
-    ir_block_attach(ctx, else_block);
-    if (expr->if_.else_) {
-      codegen_expr(ctx, expr->if_.else_);
-      last_else_block = ctx->insert_point;
-    }
-
-    /// Branch to the join block from the else branch.
-    if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, join_block);
-
-    /// Attach the join block.
-    ir_block_attach(ctx, join_block);
-
-    /// Insert a phi node for the result of the if in the join block.
-    if (!type_is_void(expr->type)) {
-      IRInstruction *phi = ir_insert_phi(ctx, expr->type);
-      ir_phi_add_arg(phi, last_then_block, expr->if_.then->ir);
-      ir_phi_add_arg(phi, last_else_block, expr->if_.else_->ir);
-      expr->ir = phi;
-    }
-    return;
-  }
-
-  /// While expression.
-  ///
-  /// +---------+
-  /// | current |
-  /// +---------+        ,---------+
-  ///      |             |         |
-  /// +--------------------+       |
-  /// | compute condition  |       |
-  /// | conditional branch |       |
-  /// +--------------------+       |
-  ///      |             |         |
-  ///      |      +------------+   |
-  ///      |      | body       |   |
-  ///      |      +------------+   |
-  ///      |             |         |
-  ///      |            ...        |
-  ///      |             |         |
-  ///  +----------+      `---------+
-  ///  | join     |
-  ///  +----------+
-  case NODE_WHILE: {
-    IRBlock *while_cond_block = ir_block(ctx);
-    IRBlock *join_block = ir_block(ctx);
-
-    /// Branch to the new condition block, then attach that as the current block.
-    ir_insert_br(ctx, while_cond_block);
-    ir_block_attach(ctx, while_cond_block);
-
-    // Emit condition
-    codegen_expr(ctx, expr->while_.condition);
-
-    /// If while body is empty, don't use body block.
-    if (expr->while_.body->block.children.size == 0) {
-      ir_insert_cond_br(ctx, expr->while_.condition->ir, while_cond_block, join_block);
-      ir_block_attach(ctx, join_block);
-      return;
-    }
-
-    /// Otherwise, emit the body of the while loop.
-    IRBlock *while_body_block = ir_block(ctx);
-    ir_insert_cond_br(ctx, expr->while_.condition->ir, while_body_block, join_block);
-    ir_block_attach(ctx, while_body_block);
-    codegen_expr(ctx, expr->while_.body);
-
-    /// Emit a branch to the join block and attach the join block.
-    if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, while_cond_block);
-    ir_block_attach(ctx, join_block);
-    return;
-  }
-
   /// Block expression.
   case NODE_BLOCK: {
     /// Emit everything that isn’t a function.
@@ -339,39 +243,6 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
     return;
   }
 
-  /// Function call.
-  case NODE_CALL: {
-    ASSERT(expr->call.intrinsic == INTRIN_COUNT, "Refusing to codegen intrinsic as a regular call");
-    IRInstruction *call = NULL;
-
-    /// Direct call.
-    if (expr->call.callee->kind == NODE_FUNCTION) {
-      call = ir_create_call(ctx, expr->call.callee->function.ir);
-    }
-
-    /// Indirect call.
-    else {
-      codegen_expr(ctx, expr->call.callee);
-      call = ir_create_call(ctx, expr->call.callee->ir);
-    }
-
-    /// Emit the arguments.
-    foreach_val (arg, expr->call.arguments) {
-      if (type_is_reference(arg->type)) {
-        codegen_lvalue(ctx, arg);
-        ir_call_add_arg(call, arg->address);
-      }
-      else {
-        codegen_expr(ctx, arg);
-        ir_call_add_arg(call, arg->ir);
-      }
-    }
-
-    ir_insert(ctx, call);
-    expr->ir = call;
-    return;
-  }
-
   /// Intrinsic.
   case NODE_INTRINSIC_CALL: {
     ASSERT(expr->call.callee->kind = NODE_FUNCTION_REFERENCE);
@@ -508,7 +379,7 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
       } else if (lhs->kind == NODE_LITERAL && lhs->literal.type == TK_STRING) {
         codegen_expr(ctx, lhs);
         if (rhs->kind == NODE_LITERAL && rhs->literal.type == TK_NUMBER) {
-          string str = ctx->ast->strings.data[lhs->literal.string_index];
+          atom str = ctx->ast->strings.data[lhs->literal.string_index];
           if (rhs->literal.integer >= str.size) {
             ERR("Out of bounds: subscript %U too large for string literal.", rhs->literal.integer);
           }
@@ -645,8 +516,7 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
       // should really have it so that the backend can gracefully
       // handle empty string for static names, and it will
       // automatically generate one (i.e. exactly what we do here).
-      static size_t string_literal_count = 0;
-      IRStaticVariable *var = ir_create_static(ctx, expr, expr->type, format("__str_lit%zu", string_literal_count++));
+      IRStaticVariable *var = ir_create_static(ctx, expr, expr->type, format("__str_lit%zu", ctx->string_literal_count++));
       expr->ir = ir_insert_static_ref(ctx, var);
       // Set static initialiser so backend will properly fill in data from string literal.
       ir_static_var_init(var, ir_create_interned_str_lit(ctx, expr->literal.string_index));
@@ -736,17 +606,243 @@ static void codegen_expr(CodegenContext *ctx, Node *expr) {
   }
 }
 
+/// Get the next operand of an expression that is emitted before
+/// anything else when it is emitted, in order, or NULL if there are
+/// no more.
+static Node *emitted_operand(Node *expr, usz *step) {
+  usz i = (*step)++;
+  switch (expr->kind) {
+    default: return NULL;
+    case NODE_CAST: return i == 0 ? expr->cast.value : NULL;
+
+    /// Assignments emit the RHS before the address of the LHS, and
+    /// subscripts emit their operands depending on what they are.
+    case NODE_BINARY:
+      if (expr->binary.op == TK_LBRACK) return NULL;
+      if (expr->binary.op == TK_COLON_EQ) return i == 0 ? expr->binary.rhs : NULL;
+      return i == 0 ? expr->binary.lhs : i == 1 ? expr->binary.rhs : NULL;
+
+    /// Addressof expressions only emit the address of their operand.
+    case NODE_UNARY:
+      if (expr->unary.op == TK_AMPERSAND && !expr->unary.postfix) return NULL;
+      return i == 0 ? expr->unary.value : NULL;
+
+    /// Blocks emit everything that isn’t a function.
+    case NODE_BLOCK:
+      for (; i < expr->block.children.size; i = (*step)++)
+        if (expr->block.children.data[i]->kind != NODE_FUNCTION)
+          return expr->block.children.data[i];
+      return NULL;
+  }
+}
+
+/// Emit the next part of the expression in a frame; see codegen_expr().
+///
+/// \return An operand that has to be emitted before we can continue with
+///         the expression, or NULL if the expression is done.
+static Node *codegen_step(CodegenContext *ctx, usz index) {
+  CodegenFrame *frame = ctx->expr_stack.data + index;
+  Node *expr = frame->node;
+  switch (expr->kind) {
+  /// Emit the operands, if any, and then the expression.
+  default: {
+    Node *operand = emitted_operand(expr, &frame->step);
+    if (operand) return operand;
+    codegen_node(ctx, expr);
+    return NULL;
+  }
+
+  /// If expression.
+  ///
+  /// Each box is a basic block within intermediate representation,
+  /// and edges represent control flow from top to bottom.
+  ///
+  ///      +---------+
+  ///      | current |
+  ///      +---------+
+  ///     /           \
+  /// +------+    +------+
+  /// | then |    | else |
+  /// +------+    +------+
+  ///         \  /
+  ///       +------+
+  ///       | join |
+  ///       +------+
+  ///
+  case NODE_IF:
+    switch (frame->step++) {
+      /// Emit the condition.
+      case 0:
+        expr->emitted = true;
+        return expr->if_.condition;
+
+      /// Generate the branch and emit the then block.
+      case 1:
+        frame->if_.then_block = ir_block(ctx);
+        frame->if_.else_block = ir_block(ctx);
+        frame->if_.join_block = ir_block(ctx);
+        ir_insert_cond_br(ctx, expr->if_.condition->ir, frame->if_.then_block, frame->if_.else_block);
+        ir_block_attach(ctx, frame->if_.then_block);
+        return expr->if_.then;
+
+      /// Branch to the join block to skip the else branch, and
+      /// generate the else block if there is one.
+      case 2:
+        frame->if_.last_then_block = ctx->insert_point;
+        if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, frame->if_.join_block);
+        ir_block_attach(ctx, frame->if_.else_block);
+        if (expr->if_.else_) return expr->if_.else_;
+        FALLTHROUGH;
+
+      /// Branch to the join block from the else branch, and attach it.
+      default: {
+        IRBlock *last_else_block = ctx->insert_point;
+        if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, frame->if_.join_block);
+        ir_block_attach(ctx, frame->if_.join_block);
+
+        /// Insert a phi node for the result of the if in the join block.
+        if (!type_is_void(expr->type)) {
+          IRInstruction *phi = ir_insert_phi(ctx, expr->type);
+          ir_phi_add_arg(phi, frame->if_.last_then_block, expr->if_.then->ir);
+          ir_phi_add_arg(phi, last_else_block, expr->if_.else_->ir);
+          expr->ir = phi;
+        }
+        return NULL;
+      }
+    }
+
+  /// While expression.
+  ///
+  /// +---------+
+  /// | current |
+  /// +---------+        ,---------+
+  ///      |             |         |
+  /// +--------------------+       |
+  /// | compute condition  |       |
+  /// | conditional branch |       |
+  /// +--------------------+       |
+  ///      |             |         |
+  ///      |      +------------+   |
+  ///      |      | body       |   |
+  ///      |      +------------+   |
+  ///      |             |         |
+  ///      |            ...        |
+  ///      |             |         |
+  ///  +----------+      `---------+
+  ///  | join     |
+  ///  +----------+
+  case NODE_WHILE:
+    switch (frame->step++) {
+      /// Branch to the new condition block, then attach that as the
+      /// current block, and emit the condition.
+      case 0:
+        expr->emitted = true;
+        frame->while_.cond_block = ir_block(ctx);
+        frame->while_.join_block = ir_block(ctx);
+        ir_insert_br(ctx, frame->while_.cond_block);
+        ir_block_attach(ctx, frame->while_.cond_block);
+        return expr->while_.condition;
+
+      /// If while body is empty, don't use body block.
+      case 1: {
+        if (expr->while_.body->block.children.size == 0) {
+          ir_insert_cond_br(ctx, expr->while_.condition->ir, frame->while_.cond_block, frame->while_.join_block);
+          ir_block_attach(ctx, frame->while_.join_block);
+          return NULL;
+        }
+
+        /// Otherwise, emit the body of the while loop.
+        IRBlock *while_body_block = ir_block(ctx);
+        ir_insert_cond_br(ctx, expr->while_.condition->ir, while_body_block, frame->while_.join_block);
+        ir_block_attach(ctx, while_body_block);
+        return expr->while_.body;
+      }
+
+      /// Emit a branch to the join block and attach the join block.
+      default:
+        if (!ir_is_closed(ctx->insert_point)) ir_insert_br(ctx, frame->while_.cond_block);
+        ir_block_attach(ctx, frame->while_.join_block);
+        return NULL;
+    }
+
+  /// Function call.
+  case NODE_CALL: {
+    Node *callee = expr->call.callee;
+    if (frame->step == 0) {
+      ASSERT(expr->call.intrinsic == INTRIN_COUNT, "Refusing to codegen intrinsic as a regular call");
+      expr->emitted = true;
+      frame->step = 1;
+
+      /// Indirect calls emit the callee first.
+      if (callee->kind != NODE_FUNCTION) return callee;
+    }
+
+    /// Direct call.
+    if (!frame->call && callee->kind == NODE_FUNCTION) {
+      frame->call = ir_create_call(ctx, callee->function->ir);
+    }
+
+    /// Indirect call.
+    else if (!frame->call) {
+      frame->call = ir_create_call(ctx, callee->ir);
+    }
+
+    /// Emit the arguments. `step` is one more than the index of the next
+    /// argument, which we add to the call once it has been emitted. The
+    /// address of an argument is emitted directly; since that may push
+    /// frames and thus move ours, we refer to it by index.
+    IRInstruction *call = frame->call;
+    for (usz i = frame->step - 1; i < expr->call.arguments.size; i++) {
+      Node *arg = expr->call.arguments.data[i];
+      if (type_is_reference(arg->type)) {
+        codegen_lvalue(ctx, arg);
+        ir_call_add_arg(call, arg->address);
+        continue;
+      }
+
+      if (!arg->emitted) {
+        ctx->expr_stack.data[index].step = i + 1;
+        return arg;
+      }
+
+      ir_call_add_arg(call, arg->ir);
+    }
+
+    ir_insert(ctx, call);
+    expr->ir = call;
+    return NULL;
+  }
+  }
+}
+
+/// Emit an expression.
+///
+/// Since generated code can nest expressions arbitrarily deeply, we
+/// emit their operands using an explicit stack, in the same order as
+/// if we recursed. Frames below `base` belong to callers that are
+/// emitting other expressions.
+static void codegen_expr(CodegenContext *ctx, Node *expr) {
+  if (expr->emitted) return;
+  usz base = ctx->expr_stack.size;
+  vector_push(ctx->expr_stack, ((CodegenFrame){.node = expr}));
+  while (ctx->expr_stack.size > base) {
+    Node *operand = codegen_step(ctx, ctx->expr_stack.size - 1);
+    if (!operand) (void) vector_pop(ctx->expr_stack);
+    else if (!operand->emitted) vector_push(ctx->expr_stack, ((CodegenFrame){.node = operand}));
+  }
+}
+
 /// Emit a function.
 void codegen_function(CodegenContext *ctx, Node *node) {
-  ASSERT(node->function.body);
-  ctx->insert_point = ir_entry_block(node->function.ir);
-  ctx->function = node->function.ir;
+  ASSERT(node->function->body);
+  ctx->insert_point = ir_entry_block(node->function->ir);
+  ctx->function = node->function->ir;
 
   /// Next, emit all parameter declarations and store
   /// the initial parameter values in them.
   // TODO: Make this backend dependent?
-  foreach_index(i, node->function.param_decls) {
-    Node *decl = node->function.param_decls.data[i];
+  foreach_index(i, node->function->param_decls) {
+    Node *decl = node->function->param_decls.data[i];
     IRInstruction *p = ir_parameter(ctx->function, i);
     if (type_is_reference(decl->type))
       decl->address = p;
@@ -763,13 +859,13 @@ void codegen_function(CodegenContext *ctx, Node *node) {
   }
 
   /// Emit the function body.
-  codegen_expr(ctx, node->function.body);
+  codegen_expr(ctx, node->function->body);
 
   /// If we can return from here, and this function doesn’t return void,
   /// then return the return value; otherwise, just return nothing.
   if (!ir_is_closed(ctx->insert_point)) {
     ir_insert_return(ctx, !type_is_void(node->type->function.return_type)
-        ? node->function.body->ir
+        ? node->function->body->ir
         : NULL);
   }
 }
@@ -804,7 +900,9 @@ void codegen_emit(CodegenContext *context) {
   STATIC_ASSERT(ARCH_COUNT == 2, "Exhaustive handling of architectures");
 
   if (context->target == TARGET_LLVM) {
+    Timer timer = timer_start(PHASE_EMIT);
     codegen_emit_llvm(context);
+    timer_stop(&timer);
     return;
   }
 
@@ -817,30 +915,46 @@ void codegen_emit(CodegenContext *context) {
   }
 }
 
+void codegen_warm_caches(void) {
+  STATIC_ASSERT(ARCH_COUNT == 2, "Exhaustive handling of architectures");
+  codegen_warm_caches_x86_64();
+}
+
+void codegen_clear_caches(void) {
+  isel_patterns_clear_cache();
+}
+
+void codegen_forget_thread_state(void) {
+  ir_use_free_lists(NULL);
+  mir_use_function(NULL);
+}
+
+const char *codegen_isel_table(CodegenArchitecture arch) {
+  STATIC_ASSERT(ARCH_COUNT == 2, "Exhaustive handling of architectures");
+  switch (arch) {
+  case ARCH_X86_64: return codegen_isel_table_x86_64();
+  case ARCH_NONE: FALLTHROUGH;
+  case ARCH_COUNT: UNREACHABLE();
+  }
+  UNREACHABLE();
+}
+
 bool codegen
 (CodegenLanguage lang,
- CodegenArchitecture arch,
- CodegenTarget target,
- CodegenCallingConvention call_convention,
+ const CodegenOptions *options,
  const char *infile,
- const char *outfile, Module *ast,
+ FILE *code,
+ Module *ast,
  string ir
  )
 {
-  if (!outfile) ICE("codegen(): outfile can not be NULL!");
-  // Open file for writing.
-  FILE *code = fopen(outfile, "wb");
-  if (!code) ICE("codegen(): failed to open file at path: \"%s\"\n", outfile);
-
-  CodegenContext *context = codegen_context_create(ast, arch, target, call_convention, code);
+  CodegenContext *context = codegen_context_create(ast, options, code);
 
+  Timer timer = timer_start(PHASE_IRGEN);
   switch (lang) {
     /// Parse an IR file.
     case LANG_IR: {
-        if (!ir_parse(context, infile, ir)) {
-          fclose(code);
-          return false;
-        }
+        if (!ir_parse(context, infile, ir)) return false;
     } break;
 
     /// Codegen an Intercept program.
@@ -849,17 +963,17 @@ bool codegen
         /// Create the main function.
         Type* c_int = ast_make_type_integer(ast, (loc){0}, true, context->ffi.cint_size);
         Parameter argc =  {
-          .name = string_create("__argc__"),
+          .name = atom_intern(literal_span("__argc__")),
           .type = c_int,
           .source_location = {0},
         };
         Parameter argv =  {
-          .name = string_create("__argv__"),
+          .name = atom_intern(literal_span("__argv__")),
           .type = ast_make_type_pointer(ast, (loc){0}, ast_make_type_pointer(ast, (loc){0}, t_byte)),
           .source_location = {0},
         };
         Parameter envp =  {
-          .name = string_create("__envp__"),
+          .name = atom_intern(literal_span("__envp__")),
           .type = ast_make_type_pointer(ast, (loc){0}, ast_make_type_pointer(ast, (loc){0}, t_byte)),
           .source_location = {0},
         };
@@ -882,12 +996,14 @@ bool codegen
 
       /// Create the remaining functions and set the address of each function.
       foreach_val (func, ast->functions) {
-        func->function.ir = ir_create_function(context, string_dup(func->function.name), func->type, func->function.linkage);
-        ir_location(func->function.ir, func->source_location);
+        /// Functions whose bodies were never parsed are never referenced.
+        if (func->function->deferred_body) continue;
+        func->function->ir = ir_create_function(context, string_dup(func->function->name), func->type, func->function->linkage);
+        ir_location(func->function->ir, func->source_location);
 
         /// Handle attributes.
         // TODO: Should we propagate "discardable" to the IR?
-#define F(name, var_name) ir_attribute(func->function.ir, FUNC_ATTR_##name, func->type->function.attr_##var_name);
+#define F(name, var_name) ir_attribute(func->function->ir, FUNC_ATTR_##name, func->type->function.attr_##var_name);
         SHARED_FUNCTION_ATTRIBUTES(F)
 #undef F
       }
@@ -907,29 +1023,37 @@ bool codegen
 
       /// Emit the remaining functions that aren’t extern.
       foreach_val (func, ast->functions)
-        if (ir_func_is_definition(func->function.ir))
+        if (func->function->ir && ir_func_is_definition(func->function->ir))
           codegen_function(context, func);
     } break;
 
     /// Anything else is not supported.
     default: ICE("Language %d not supported.", lang);
   }
+  timer_stop(&timer);
 
   /// Don’t codegen a faulty program.
   if (context->has_err) return false;
 
   /// Perform mandatory inlining.
-  if (!codegen_process_inline_calls(context)) return false;
+  timer = timer_start(PHASE_INLINE);
+  bool inlined = codegen_process_inline_calls(context);
+  timer_stop(&timer);
+  if (!inlined) return false;
 
   if (debug_ir || print_ir2) {
     ir_print(stdout, context);
   }
 
   /// Early lowering before optimisation.
+  timer = timer_start(PHASE_LOWER);
   codegen_early_lowering(context);
+  timer_stop(&timer);
 
-  if (optimise) {
+  if (context->optimise) {
+    timer = timer_start(PHASE_OPTIMISE);
     codegen_optimise(context);
+    timer_stop(&timer);
     if (debug_ir || print_ir2) {
       print("\n====== Optimised ====== \n");
       ir_print(stdout, context);
@@ -949,8 +1073,10 @@ bool codegen
   if (print_ir2) exit(42);
 
   /// No need to lower anything if we’re emitting LLVM IR.
-  if (target != TARGET_LLVM) {
+  if (context->target != TARGET_LLVM) {
+    timer = timer_start(PHASE_LOWER);
     codegen_lower(context);
+    timer_stop(&timer);
 
     if (debug_ir) {
       print("\n====== Lowered ====== \n");
@@ -960,14 +1086,14 @@ bool codegen
 
   codegen_emit(context);
 
-  codegen_context_free(context);
-
-  fclose(code);
+  /// Freeing the IR touches every instruction once more, which is
+  /// wasted effort if the process is about to exit anyway.
+  if (!platform_fast_exit) codegen_context_free(context);
   return true;
 }
 
 
-static void mangle_type_to(string_buffer *buf, Type *t) {
+static void mangle_type_to(CodegenContext *ctx, string_buffer *buf, Type *t) {
   ASSERT(t);
   switch (t->kind) {
     default: TODO("Handle type kind %d in type mangling!", (int)t->kind);
@@ -976,9 +1102,8 @@ static void mangle_type_to(string_buffer *buf, Type *t) {
       if (t->structure.decl->struct_decl->name.size)
         format_to(buf, "%Z%S", t->structure.decl->struct_decl->name.size, t->structure.decl->struct_decl->name);
       else {
-        static usz struct_count = 0;
-        format_to(buf, "%Z%Z", number_width(struct_count), struct_count);
-        ++struct_count;
+        format_to(buf, "%Z%Z", number_width(ctx->anonymous_struct_count), ctx->anonymous_struct_count);
+        ++ctx->anonymous_struct_count;
       }
       break;
 
@@ -988,7 +1113,7 @@ static void mangle_type_to(string_buffer *buf, Type *t) {
 
     case TYPE_NAMED:
       if (!t->named->val.type) format_to(buf, "%Z%S", t->named->name.size, t->named->name);
-      else mangle_type_to(buf, t->named->val.type);
+      else mangle_type_to(ctx, buf, t->named->val.type);
       break;
 
     case TYPE_INTEGER: {
@@ -998,23 +1123,23 @@ static void mangle_type_to(string_buffer *buf, Type *t) {
 
     case TYPE_POINTER:
       format_to(buf, "P");
-      mangle_type_to(buf, t->pointer.to);
+      mangle_type_to(ctx, buf, t->pointer.to);
       break;
 
     case TYPE_REFERENCE:
       format_to(buf, "R");
-      mangle_type_to(buf, t->reference.to);
+      mangle_type_to(ctx, buf, t->reference.to);
       break;
 
     case TYPE_ARRAY:
       format_to(buf, "A%ZE", t->array.size);
-      mangle_type_to(buf, t->array.of);
+      mangle_type_to(ctx, buf, t->array.of);
       break;
 
     case TYPE_FUNCTION:
       format_to(buf, "F");
-      mangle_type_to(buf, t->function.return_type);
-      foreach (param, t->function.parameters) mangle_type_to(buf, param->type);
+      mangle_type_to(ctx, buf, t->function.return_type);
+      foreach (param, t->function.parameters) mangle_type_to(ctx, buf, param->type);
       format_to(buf, "E");
       break;
   }
@@ -1026,7 +1151,7 @@ void mangle_function_name(IRFunction *function) {
   string_buffer buf = {0};
   span name = ir_name(function);
   format_to(&buf, "_XF%Z%S", name.size, name);
-  mangle_type_to(&buf, ir_typeof(function));
+  mangle_type_to(ir_context(function), &buf, ir_typeof(function));
 
   /// FIXME: Mangled name should not override original name.
   ir_name(function, ((string){buf.data, buf.size}));
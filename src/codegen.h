@@ -4,6 +4,7 @@
 #include <codegen/codegen_forward.h>
 #include <codegen/generic_object.h>
 
+#include <arena.h>
 #include <ast.h>
 #include <error.h>
 #include <parser.h>
@@ -13,17 +14,15 @@
 extern bool debug_ir;
 extern bool print_ir2;
 extern bool codegen_only;
-extern bool annotate_code;
 extern bool print_dot_cfg;
 extern bool print_dot_dj;
+extern const char *print_dot_function;
 
 typedef Vector(IRInstruction *) InstructionVector;
 
 CodegenContext *codegen_context_create
 (Module *ast,
- CodegenArchitecture,
- CodegenTarget,
- CodegenCallingConvention call_convention,
+ const CodegenOptions *options,
  FILE* code);
 
 void codegen_context_free(CodegenContext *context);
@@ -45,12 +44,55 @@ typedef struct IRStaticVariable {
   bool referenced;
 } IRStaticVariable;
 
+/// A slab that instructions or blocks are allocated from.
+typedef struct IRSlab {
+#ifdef IR_INDEX_HANDLES
+  /// The chunks of the handle table that belong to this slab. New
+  /// objects are allocated from the last one.
+  Vector(u32) chunks;
+  usz used; /// Objects used in the last chunk.
+#else
+  Arena arena;
+#endif
+} IRSlab;
+
+/// An expression whose operands are being emitted; see codegen_expr().
+typedef struct CodegenFrame {
+  Node *node;
+
+  /// How far along emitting the expression we are.
+  usz step;
+
+  /// What an expression needs once its operands are emitted.
+  union {
+    IRInstruction *call;
+    struct {
+      IRBlock *then_block;
+      IRBlock *else_block;
+      IRBlock *join_block;
+      IRBlock *last_then_block;
+    } if_;
+    struct {
+      IRBlock *cond_block;
+      IRBlock *join_block;
+    } while_;
+  };
+} CodegenFrame;
+
 struct CodegenContext {
   /// The IR
   Vector(IRFunction *) functions;
   Vector(IRStaticVariable *) static_vars;
+
+  /// All instructions, blocks, and functions are allocated from these
+  /// slabs and stay there until the context is freed. Deleted ones are
+  /// put on the free lists and reused.
+  IRSlab instruction_slab;
+  IRSlab block_slab;
+  Arena function_slab;
   IRInstructionVector free_instructions;
   IRBlockVector free_blocks;
+  Vector(IRFunction *) free_functions;
 
   /// Code emission (targets)
   FILE *code;
@@ -62,15 +104,25 @@ struct CodegenContext {
   IRFunction *entry;
   IRBlock *insert_point;
 
+  /// Expressions whose operands are being emitted; see codegen_expr().
+  Vector(CodegenFrame) expr_stack;
+
   /// Options
   CodegenArchitecture arch;
   // TODO: Allow for multiple targets.
   CodegenTarget target;
   CodegenCallingConvention call_convention;
+  int optimise;
+  bool annotate_code;
+  usz backend_jobs;
 
   /// Poison value.
   IRInstruction *poison;
 
+  /// Used to generate names for anonymous entities.
+  usz string_literal_count;
+  usz anonymous_struct_count;
+
   /// Whether there was an error during codegen.
   /// TODO: Move target information up to Sema. Keep this here regardless tho.
   bool has_err;
@@ -90,15 +142,32 @@ struct CodegenContext {
 // TODO/FIXME: Make this a parameter affectable by command line arguments.
 extern char codegen_verbose;
 
+/// Generate code for a module, or for IR if `lang` is LANG_IR, and
+/// write it to `code`. Nothing but the context of this compilation
+/// is modified, so this can be called from several threads at once.
 NODISCARD bool codegen
 (CodegenLanguage,
- CodegenArchitecture arch,
- CodegenTarget target,
- CodegenCallingConvention,
+ const CodegenOptions *options,
  const char *infile,
- const char *outfile, Module *ast,
+ FILE *code,
+ Module *ast,
  string ir);
 
+/// Load everything that the backends of all architectures read
+/// from disk, so that later compilations don’t have to.
+void codegen_warm_caches(void);
+
+/// Free everything that the backends have cached.
+void codegen_clear_caches(void);
+
+/// Forget what a call to codegen() on the calling thread was doing
+/// when it was abandoned because of a fatal error; see
+/// catch_fatal_errors().
+void codegen_forget_thread_state(void);
+
+/// Get the path to the ISel table of an architecture.
+const char *codegen_isel_table(CodegenArchitecture arch);
+
 /// Mangle a function name.
 void mangle_function_name(IRFunction *function);
 
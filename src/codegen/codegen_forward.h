@@ -14,6 +14,18 @@ typedef struct RegisterPool RegisterPool;
 typedef unsigned Register;
 typedef struct CodegenContext CodegenContext;
 
+/// Instructions refer to other instructions and blocks by handle. A
+/// handle is a pointer, unless IR_INDEX_HANDLES is defined, in which
+/// case it is a 32-bit index into a table of all instructions and
+/// blocks. Only the IR implementation knows how to resolve handles.
+#ifdef IR_INDEX_HANDLES
+typedef u32 IRInstructionHandle;
+typedef u32 IRBlockHandle;
+#else
+typedef IRInstruction *IRInstructionHandle;
+typedef IRBlock *IRBlockHandle;
+#endif
+
 typedef Vector(IRBlock *) IRBlockVector;
 typedef Vector(IRInstruction *) IRInstructionVector;
 typedef Vector(IRFunction *) IRFunctionVector;
@@ -70,6 +82,22 @@ typedef enum CodegenLanguage {
   LANG_DEFAULT = LANG_FUN,
 } CodegenLanguage;
 
+/// Everything that affects the code that is generated.
+typedef struct CodegenOptions {
+  CodegenArchitecture arch;
+  CodegenTarget target;
+  CodegenCallingConvention call_convention;
+
+  /// Whether to optimise the generated code.
+  int optimise;
+
+  /// Whether to emit comments in generated code.
+  bool annotate_code;
+
+  /// Maximum number of functions that are optimised or generated at once.
+  usz backend_jobs;
+} CodegenOptions;
+
 // Types of comparison to be implemented by codegen backend.
 enum ComparisonType {
   COMPARE_EQ,
@@ -248,6 +276,7 @@ typedef struct MIRBlock MIRBlock;
 typedef struct MIRInstruction MIRInstruction;
 typedef Vector(MIRFunction*) MIRFunctionVector;
 typedef Vector(MIRBlock*) MIRBlockVector;
+typedef Map(MIRBlock*, usz) MIRBlockVisitCounts;
 typedef Vector(MIRInstruction*) MIRInstructionVector;
 
 typedef struct VReg {
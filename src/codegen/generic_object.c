@@ -24,6 +24,29 @@ Section *get_section_by_name(const Sections sections, const char *name) {
   return NULL;
 }
 
+void generic_object_append_code(GenericObjectFile *object, GenericObjectFile *code) {
+  ASSERT(object && code, "Invalid argument");
+  Section *destination = code_section(object);
+  Section *source = code_section(code);
+  ASSERT(destination && source, "Both objects must have a code section");
+
+  /// Everything in `code` is relative to the start of its code section.
+  usz base = destination->data.bytes.size;
+  vector_append(destination->data.bytes, source->data.bytes);
+  foreach (sym, code->symbols) {
+    sym->byte_offset += base;
+    vector_push(object->symbols, *sym);
+  }
+  foreach (reloc, code->relocs) {
+    reloc->sym.byte_offset += base;
+    vector_push(object->relocs, *reloc);
+  }
+
+  /// Symbols and relocations have been moved into `object`.
+  foreach (section, code->sections) vector_delete(section->data.bytes);
+  generic_object_delete(code);
+}
+
 /// Write 1 byte of data to code.
 void sec_write_1(Section *section, uint8_t value) {
   vector_push(section->data.bytes, value);
@@ -326,7 +349,7 @@ void generic_object_as_elf_x86_64(GenericObjectFile *object, FILE *f) {
       else elf_reloc.r_info = ELF64_R_INFO(sym_index, R_X86_64_PC32);
 
       // DISP*32* -> 32-bit displacement -> 4 byte offset
-      elf_reloc.r_addend = -4;
+      elf_reloc.r_addend = -4 + reloc->addend;
 
     } break;
     case RELOC_DISP32:
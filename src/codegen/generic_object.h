@@ -98,6 +98,12 @@ void mcode_n(GenericObjectFile *object, void* buffer, size_t n);
 
 Section *get_section_by_name(const Sections sections, const char *name);
 
+/// Append the code section of `code` to the code section of `object`,
+/// and move all symbols and relocations of `code` into `object`, while
+/// adjusting their offsets. All of them must refer to the code section.
+/// `code` is deleted afterwards.
+void generic_object_append_code(GenericObjectFile *object, GenericObjectFile *code);
+
 /// Write the given generic object file in ELF object file format into
 /// a given file.
 void generic_object_as_elf_x86_64(GenericObjectFile*, FILE*);
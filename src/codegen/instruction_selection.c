@@ -782,7 +782,7 @@ static MIRInstruction *isel_parse_inst_spec(ISelParser *p) {
       MIROperandRegister r = {0};
       r.value = entry->value.vreg.value;
       r.size = (u32) entry->value.vreg.size;
-      vector_push(out->clobbers, r);
+      mir_add_clobber(out, r);
 
       // Yeet bound identifier
       isel_next_tok(p);
@@ -878,6 +878,28 @@ static CodegenArchitecture isel_arch_from_string(span arch_string) {
   ICE("Invalid architecture string \"%S\"\n", arch_string);
 }
 
+/// Sort patterns such that the ones with the most elements in the
+/// input vector come first; selection tries them in this order.
+static void isel_sort_patterns(ISelPatterns patterns) {
+  foreach_index (i, patterns) {
+    // Can't swap last with last, so don't try.
+    if (i == patterns.size - 1) break;
+    // Find longest in rest of vector
+    ISelPattern *pattern_to_swap = patterns.data + i;
+    ISelPattern *largest = pattern_to_swap;
+    for (size_t j = i + 1; j < patterns.size; ++j) {
+      ISelPattern *largest_candidate = patterns.data + j;
+      if (largest_candidate->input.size > largest->input.size)
+        largest = largest_candidate;
+    }
+    if (pattern_to_swap != largest) {
+      ISelPattern tmp = *pattern_to_swap;
+      *pattern_to_swap = *largest;
+      *largest = tmp;
+    }
+  }
+}
+
 ISelPatterns isel_parse(ISelParser *p) {
   ASSERT(p, "Invalid argument");
   ASSERT(p->global.capacity, "Zero sized environment; forgot to initialise?");
@@ -955,6 +977,9 @@ ISelPatterns isel_parse(ISelParser *p) {
     vector_push(patterns, parsed_pattern);
   }
 
+  /// Patterns are never modified after this point, so the same
+  /// patterns can be used for several functions at once.
+  isel_sort_patterns(patterns);
   return patterns;
 }
 
@@ -976,6 +1001,53 @@ ISelPatterns isel_parse_file(const char *filepath) {
   return out;
 }
 
+/// Patterns of every table parsed so far.
+typedef struct ISelTable {
+  string filepath;
+  ISelPatterns patterns;
+} ISelTable;
+
+static PlatformMutex isel_tables_lock = PLATFORM_MUTEX_INIT;
+static Vector(ISelTable) isel_tables = {0};
+
+ISelPatterns isel_patterns_get(const char *filepath) {
+  platform_mutex_lock(&isel_tables_lock);
+  ISelTable *table = vector_find_if(t, isel_tables, strcmp(t->filepath.data, filepath) == 0);
+  ISelPatterns patterns = table ? table->patterns : (ISelPatterns){0};
+  platform_mutex_unlock(&isel_tables_lock);
+  if (table) return patterns;
+
+  /// Parsing raises a fatal error if the table is broken, so don’t
+  /// hold the lock while we parse. If another thread parsed the table
+  /// in the meantime, use its patterns instead of ours.
+  ISelTable parsed = {string_create(filepath), isel_parse_file(filepath)};
+  platform_mutex_lock(&isel_tables_lock);
+  table = vector_find_if(t, isel_tables, strcmp(t->filepath.data, filepath) == 0);
+  bool published = !table;
+  if (published) {
+    vector_push(isel_tables, parsed);
+    table = &vector_back(isel_tables);
+  }
+  patterns = table->patterns;
+  platform_mutex_unlock(&isel_tables_lock);
+
+  if (!published) {
+    free(parsed.filepath.data);
+    isel_patterns_delete(&parsed.patterns);
+  }
+  return patterns;
+}
+
+void isel_patterns_clear_cache(void) {
+  platform_mutex_lock(&isel_tables_lock);
+  foreach (table, isel_tables) {
+    free(table->filepath.data);
+    isel_patterns_delete(&table->patterns);
+  }
+  vector_delete(isel_tables);
+  platform_mutex_unlock(&isel_tables_lock);
+}
+
 bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructions) {
   /// A pattern that is larger than the instructions given means it will never match.
   if (pattern.input.size > instructions.size) return false;
@@ -1047,70 +1119,91 @@ bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructi
 }
 
 
-typedef Vector(usz) ISelRegisterValues;
+typedef Map(usz, bool) ISelRegisterValues;
 
-static void mark_defining_uses(ISelRegisterValues *regs_seen, MIRBlock *block) {
+/// The registers that were marked as seen, in order, so that we can
+/// forget them again when we go back to a branch.
+typedef Vector(usz) ISelRegisterLog;
+
+static void mark_defining_uses(ISelRegisterValues *regs_seen, ISelRegisterLog *log, MIRBlock *block) {
   foreach_val (inst, block->instructions) {
     FOREACH_MIR_OPERAND(inst, op) {
       if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START) {
-        if (!vector_contains(*regs_seen, op->value.reg.value)) {
+        bool *seen = map_get_default(*regs_seen, op->value.reg.value);
+        if (!*seen) {
           op->value.reg.defining_use = true;
-          vector_push(*regs_seen, op->value.reg.value);
+          *seen = true;
+          vector_push(*log, op->value.reg.value);
         }
       }
     }
   }
 }
 
-/// NOTE: Pass empty vectors for visited and doubly_visited when
-/// calling on entry of function.
-static void calculate_defining_uses_for_block(ISelRegisterValues *regs_seen, MIRBlock *block, MIRBlockVector *visited, MIRBlockVector *doubly_visited) {
-  /// Don't visit the same block thrice.
-  if (vector_contains(*visited, block)) {
-    if (vector_contains(*doubly_visited, block))
-      return;
-    else vector_push(*doubly_visited, block);
-  } else vector_push(*visited, block);
+/// A block with multiple successors, the next of which to follow, and
+/// how many registers had been seen when we got to the block.
+typedef struct ISelBranch {
+  MIRBlock *block;
+  usz successor;
+  usz seen;
+} ISelBranch;
 
+/// NOTE: Pass an empty map for visits when calling on entry of function.
+static void calculate_defining_uses(ISelRegisterValues *regs_seen, MIRBlock *entry, MIRBlockVisitCounts *visits) {
   // At each block of the function, starting at the entry, walk the
   // control flow. The first operand usage of a virtual register will
   // be set to a defining use (i.e. the first place that that register
   // must be classified as "in use" by the register allocator).
+  //
+  // If a block has multiple successors, we will "remember" the
+  // registers that we had seen at the beginning, and reset to that
+  // after following each one. Since control flow can nest arbitrarily
+  // deeply, branches are kept on a stack instead of recursing, and
+  // rather than copying the registers seen for each successor, we
+  // forget the ones that were seen while following it.
+  Vector(ISelBranch) branches = {0};
+  ISelRegisterLog log = {0};
+  MIRBlock *block = entry;
+  while (block) {
+    /// Don't visit the same block thrice.
+    usz *count = map_get_default(*visits, block);
+    if (*count < 2) {
+      ++*count;
+      mark_defining_uses(regs_seen, &log, block);
+
+      // To follow control flow of an exit block, we stop.
+      //
+      // If a block has only a single successor, we don't need to do
+      // anything fancy; just follow the simple control flow for as
+      // long as possible.
+      if (!block->is_exit) {
+        while (block->successors.size == 1) {
+          block = vector_front(block->successors);
+          mark_defining_uses(regs_seen, &log, block);
+        }
 
-  mark_defining_uses(regs_seen, block);
-
-  // To follow control flow of an exit block, we stop.
-  if (block->is_exit) return;
+        if (block->successors.size)
+          vector_push(branches, ((ISelBranch){.block = block, .seen = log.size}));
+      }
+    }
 
-  // If a block has only a single successor, we don't need to do
-  // anything fancy; just follow the simple control flow for as long as
-  // possible.
-  while (block->successors.size == 1) {
-    block = vector_front(block->successors);
-    mark_defining_uses(regs_seen, block);
-  }
-  // If a block has multiple successors, we will "remember" the
-  // registers that we had seen at the beginning, and reset
-  // to that after following each one.
-  // To follow control flow, we sometimes have to come back to a
-  // block after reaching the exit, as some blocks have multiple
-  // successors. We use recursion for this.
-  foreach_val (successor, block->successors) {
-    // Copy registers seen.
-    ISelRegisterValues regs_seen_copy = {0};
-    vector_append(regs_seen_copy, *regs_seen);
-
-    calculate_defining_uses_for_block(&regs_seen_copy, successor, visited, doubly_visited);
-
-    vector_delete(regs_seen_copy);
+    /// Follow the next successor of the innermost branch that has any left.
+    block = NULL;
+    while (branches.size && !block) {
+      ISelBranch *branch = &vector_back(branches);
+      while (log.size > branch->seen) *map_get_default(*regs_seen, vector_pop(log)) = false;
+      if (branch->successor < branch->block->successors.size) block = branch->block->successors.data[branch->successor++];
+      else (void) vector_pop(branches);
+    }
   }
+
+  vector_delete(branches);
+  vector_delete(log);
 }
 
-void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
-  if (!mir.size) return;
+void isel_do_selection_for_function(MIRFunction *f, ISelPatterns patterns) {
   if (!patterns.size) return;
-
-  ISelEnvironment env = isel_env_create(1024);
+  if (!ir_func_is_definition(f->origin)) return;
 
   // TODO: Everything past this point is temporary and will change :P
   // We will eventually use a modified Aho-Corasick pattern matching
@@ -1118,173 +1211,155 @@ void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
   // things started without needing to build an entire Aho-Corasick trie,
   // calculate fail nodes, etc.
 
-  // FOR NOW: Sort patterns largest-first, and simply iterate all the
-  // patterns every time we have instructions to match. This is FOR NOW
-  // because I'm sure the time complexity is n-squared at this point :^&
-
-  // Sort patterns such that the ones with the most elements in the
-  // input vector come first.
-  foreach_index (i, patterns) {
-    // Can't swap last with last, so don't try.
-    if (i == patterns.size - 1) break;
-    // Find longest in rest of vector
-    ISelPattern *pattern_to_swap = patterns.data + i;
-    ISelPattern *largest = pattern_to_swap;
-    for (size_t j = i + 1; j < patterns.size; ++j) {
-      ISelPattern *largest_candidate = patterns.data + j;
-      if (largest_candidate->input.size > largest->input.size)
-        largest = largest_candidate;
-    }
-    if (pattern_to_swap != largest) {
-      ISelPattern tmp = *pattern_to_swap;
-      *pattern_to_swap = *largest;
-      *largest = tmp;
-    }
-  }
-
+  // FOR NOW: Patterns are sorted largest-first (see isel_sort_patterns()),
+  // and we simply iterate all the patterns every time we have
+  // instructions to match. This is FOR NOW because I'm sure the time
+  // complexity is n-squared at this point :^&
   usz longest_pattern_length = patterns.data->input.size;
 
   // Instructions currently being expanded/dealt with.
   MIRInstructionVector instructions = {0};
 
-  foreach_val (f, mir) {
-    if (!ir_func_is_definition(f->origin)) continue;
-
-    foreach_val (bb, f->blocks) {
-      vector_clear(instructions);
-      // Instructions that will be output.
-      MIRInstructionVector new_instructions = {0};
+  foreach_val (bb, f->blocks) {
+    vector_clear(instructions);
+    // Instructions that will be output.
+    MIRInstructionVector new_instructions = {0};
 
-      // Amount of instructions that have been pushed to the
-      // instructions vector for instruction selection. Used to continue
-      // pushing instructions where we left off.
-      usz instructions_handled = 0;
+    // Amount of instructions that have been pushed to the
+    // instructions vector for instruction selection. Used to continue
+    // pushing instructions where we left off.
+    usz instructions_handled = 0;
 
-      /// This label acts as a point of continuation when we need to
-      /// (potentially) (re)fill the instructions vector and then pattern
-      /// match on it.
-    add_instructions:
-      for (; instructions_handled < bb->instructions.size; ++instructions_handled) {
-        // Add (up to) `longest_pattern_length` instructions to the instructions vector.
-        if (instructions.size >= longest_pattern_length) break;
+    /// This label acts as a point of continuation when we need to
+    /// (potentially) (re)fill the instructions vector and then pattern
+    /// match on it.
+  add_instructions:
+    for (; instructions_handled < bb->instructions.size; ++instructions_handled) {
+      // Add (up to) `longest_pattern_length` instructions to the instructions vector.
+      if (instructions.size >= longest_pattern_length) break;
 
-        MIRInstruction *inst = bb->instructions.data[instructions_handled];
+      MIRInstruction *inst = bb->instructions.data[instructions_handled];
 
-        vector_push(instructions, inst);
-      }
+      vector_push(instructions, inst);
+    }
 
-      bool matched = false;
-      foreach (pattern, patterns) {
-        if (isel_does_pattern_match(*pattern, instructions)) {
-          matched = true;
-
-          // Remove first N instructions where N is the amount of
-          // instructions that matched in the pattern.
-          // Put these in a "pattern input" tmp buffer as we remove them.
-          MIRInstructionVector pattern_input = {0};
-          for (usz j = 0; j < pattern->input.size; ++j) {
-            vector_push(pattern_input, vector_front(instructions));
-            vector_remove_index(instructions, 0);
-          }
+    bool matched = false;
+    foreach (pattern, patterns) {
+      if (isel_does_pattern_match(*pattern, instructions)) {
+        matched = true;
+
+        // Remove first N instructions where N is the amount of
+        // instructions that matched in the pattern.
+        // Put these in a "pattern input" tmp buffer as we remove them.
+        MIRInstructionVector pattern_input = {0};
+        for (usz j = 0; j < pattern->input.size; ++j) {
+          vector_push(pattern_input, vector_front(instructions));
+          vector_remove_index(instructions, 0);
+        }
 
-          // Prepend output instructions from pattern to instructions.
-          // Iterate over the pattern output instructions, making a
-          // copy of each and populating operands as necessary,
-          // corresponding to pattern references.
-          MIRInstruction *last_input_inst = vector_back(pattern_input);
-          foreach_index (i, pattern->output) {
-            MIRInstruction *pattern_inst = pattern->output.data[i];
-            MIRInstruction *out = mir_makecopy(pattern_inst);
-            if (i == pattern->output.size - 1)
-              out->reg = last_input_inst->reg;
-            else out->reg = MIR_ARCH_START + f->inst_count++;
-            out->origin = last_input_inst->origin;
-            out->block = bb;
-
-            FOREACH_MIR_OPERAND(out, op) {
-              // Resolve operand and instruction pattern references...
-              if (op->kind == MIR_OP_OP_REF) {
-                ASSERT(op->value.op_ref.pattern_instruction_index < pattern_input.size + pattern->output.size,
-                       "Invalid pattern instruction index in operand reference (parser went wrong)");
-                MIRInstruction *inst = NULL;
-                if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
-                  usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
-                  ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
-                  // Self-reference or backward-reference
-                  if (pattern_output_inst_index == i) inst = out;
-                  else inst = instructions.data[pattern_output_inst_index];
-                }
-                else inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
-
-                // Get operand from resolved instruction reference
-                ASSERT(op->value.op_ref.operand_index < inst->operand_count,
-                       "Invalid operand index (parser went wrong)");
-
-                *op = *mir_get_op(inst, op->value.op_ref.operand_index);
-
-              } else if (op->kind == MIR_OP_INST_REF) {
-                ASSERT(op->value.inst_ref < pattern_input.size + pattern->output.size,
-                       "Invalid pattern instruction index in instruction reference (parser went wrong)");
-                if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
-                  usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
-                  ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
-                  // Self-reference
-                  if (pattern_output_inst_index == i) {
-                    *op = mir_op_reference(out);
-                  } else {
-                    // Create a register reference to the OUTPUT instruction corresponding to the referenced *pattern* output instruction.
-                    MIRInstruction *inst = instructions.data[pattern_output_inst_index];
-                    *op = mir_op_reference(inst);
-                  }
+        // Prepend output instructions from pattern to instructions.
+        // Iterate over the pattern output instructions, making a
+        // copy of each and populating operands as necessary,
+        // corresponding to pattern references.
+        MIRInstruction *last_input_inst = vector_back(pattern_input);
+        foreach_index (i, pattern->output) {
+          MIRInstruction *pattern_inst = pattern->output.data[i];
+          MIRInstruction *out = mir_makecopy(pattern_inst);
+          if (i == pattern->output.size - 1)
+            out->reg = last_input_inst->reg;
+          else out->reg = MIR_ARCH_START + f->inst_count++;
+          out->origin = last_input_inst->origin;
+          out->block = bb;
+
+          FOREACH_MIR_OPERAND(out, op) {
+            // Resolve operand and instruction pattern references...
+            if (op->kind == MIR_OP_OP_REF) {
+              ASSERT(op->value.op_ref.pattern_instruction_index < pattern_input.size + pattern->output.size,
+                     "Invalid pattern instruction index in operand reference (parser went wrong)");
+              MIRInstruction *inst = NULL;
+              if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
+                usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
+                ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
+                // Self-reference or backward-reference
+                if (pattern_output_inst_index == i) inst = out;
+                else inst = instructions.data[pattern_output_inst_index];
+              }
+              else inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
+
+              // Get operand from resolved instruction reference
+              ASSERT(op->value.op_ref.operand_index < inst->operand_count,
+                     "Invalid operand index (parser went wrong)");
+
+              *op = *mir_get_op(inst, op->value.op_ref.operand_index);
+
+            } else if (op->kind == MIR_OP_INST_REF) {
+              ASSERT(op->value.inst_ref < pattern_input.size + pattern->output.size,
+                     "Invalid pattern instruction index in instruction reference (parser went wrong)");
+              if (op->value.op_ref.pattern_instruction_index >= pattern_input.size) {
+                usz pattern_output_inst_index = op->value.op_ref.pattern_instruction_index - pattern_input.size;
+                ASSERT(pattern_output_inst_index <= i, "Cannot forward-reference emission instructions... How'd you even manage this?");
+                // Self-reference
+                if (pattern_output_inst_index == i) {
+                  *op = mir_op_reference(out);
                 } else {
-                  MIRInstruction *inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
+                  // Create a register reference to the OUTPUT instruction corresponding to the referenced *pattern* output instruction.
+                  MIRInstruction *inst = instructions.data[pattern_output_inst_index];
                   *op = mir_op_reference(inst);
                 }
+              } else {
+                MIRInstruction *inst = pattern_input.data[op->value.op_ref.pattern_instruction_index];
+                *op = mir_op_reference(inst);
               }
             }
-
-            vector_insert(instructions, instructions.data + i, out);
           }
 
-          vector_delete(pattern_input);
-
-          // Again attempt to pattern match and do all this over again, until nothing happens.
-          break;
+          vector_insert(instructions, instructions.data + i, out);
         }
+
+        vector_delete(pattern_input);
+
+        // Again attempt to pattern match and do all this over again, until nothing happens.
+        break;
       }
-      // If we get through *all* of the patterns, and none of them
-      // matched, we can pop an instruction off the front and emit it
-      // into the output, before going back to the "add instructions"
-      // bit.
-      if (!matched) {
-        if (instructions.size) {
-          // Add front of `instructions` to emission output.
-          vector_push(new_instructions, instructions.data[0]);
-          // Pop instruction.
-          vector_remove_index(instructions, 0);
-        }
+    }
+    // If we get through *all* of the patterns, and none of them
+    // matched, we can pop an instruction off the front and emit it
+    // into the output, before going back to the "add instructions"
+    // bit.
+    if (!matched) {
+      if (instructions.size) {
+        // Add front of `instructions` to emission output.
+        vector_push(new_instructions, instructions.data[0]);
+        // Pop instruction.
+        vector_remove_index(instructions, 0);
       }
+    }
 
-      // If there are more instructions in this block to match
-      // against, go back and them, pattern match again, etc.
-      if (instructions_handled < bb->instructions.size)
-        goto add_instructions;
+    // If there are more instructions in this block to match
+    // against, go back and them, pattern match again, etc.
+    if (instructions_handled < bb->instructions.size)
+      goto add_instructions;
 
-      // Otherwise, if there are remaining instructions, go again.
-      if (instructions.size != 0) goto add_instructions;
+    // Otherwise, if there are remaining instructions, go again.
+    if (instructions.size != 0) goto add_instructions;
 
-      // Fully handled instructions of block; replace old instructions with newly selected ones.
-      MIRInstructionVector tmp = bb->instructions;
-      bb->instructions = new_instructions; // new_instructions is moved
-      // Delete vector of old instructions.
-      vector_delete(tmp);
-    } // foreach_ptr (MIRBlock*, bb, ...)
-  } // foreach_ptr (MIRFunction*, f, ...)
+    // Fully handled instructions of block; replace old instructions with newly selected ones.
+    MIRInstructionVector tmp = bb->instructions;
+    bb->instructions = new_instructions; // new_instructions is moved
+    // Delete vector of old instructions.
+    vector_delete(tmp);
+  } // foreach_ptr (MIRBlock*, bb, ...)
+
+  vector_delete(instructions);
+}
 
+void isel_mark_defining_uses(MIRFunctionVector mir) {
   // Mark defining uses of virtual register operands for RA.
+  // NOTE: The virtual registers seen are deliberately carried over
+  // from one function to the next, which is why this can't be done
+  // for each function in isolation.
   ISelRegisterValues vregs_seen = {0};
-  MIRBlockVector visited = {0};
-  MIRBlockVector doubly_visited = {0};
+  MIRBlockVisitCounts visits = {0};
   foreach_val (f, mir) {
     if (!ir_func_is_definition(f->origin)) continue;
 
@@ -1292,14 +1367,18 @@ void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
     ASSERT(entry->is_entry, "First block within MIRFunction is not entry point; we should do more work to find the entry, sorry");
 
     // NOTE: This function is an absolute doozy; check it out, iff you must.
-    calculate_defining_uses_for_block(&vregs_seen, entry, &visited, &doubly_visited);
+    calculate_defining_uses(&vregs_seen, entry, &visits);
 
   }
 
-  vector_delete(vregs_seen);
+  map_delete(vregs_seen);
+  map_delete(visits);
+}
 
-  vector_delete(instructions);
-  isel_env_delete(&env);
+void isel_do_selection(MIRFunctionVector mir, ISelPatterns patterns) {
+  if (!patterns.size) return;
+  foreach_val (f, mir) isel_do_selection_for_function(f, patterns);
+  isel_mark_defining_uses(mir);
 }
 
 // Delete ISelPatterns.
@@ -62,11 +62,28 @@ typedef Vector(ISelPattern) ISelPatterns;
 
 ISelPatterns isel_parse_file(const char *filepath);
 
+/// Get the patterns of an ISel table. Each table is only parsed once
+/// per process; the patterns are shared and must not be deleted.
+ISelPatterns isel_patterns_get(const char *filepath);
+
+/// Delete the patterns of all tables returned by isel_patterns_get().
+void isel_patterns_clear_cache(void);
+
 /// Return true iff given instructions match pattern.
 bool isel_does_pattern_match(ISelPattern pattern, MIRInstructionVector instructions);
 
 void isel_do_selection(MIRFunctionVector mir, ISelPatterns);
 
+/// Perform instruction selection on a single function. The patterns
+/// are only read, so this may run for several functions at once.
+///
+/// Afterwards, isel_mark_defining_uses() must be called on all
+/// functions, in order, before register allocation.
+void isel_do_selection_for_function(MIRFunction *f, ISelPatterns);
+
+/// Mark the defining uses of virtual registers for RA.
+void isel_mark_defining_uses(MIRFunctionVector mir);
+
 void isel_patterns_delete(ISelPatterns *patterns);
 
 void isel_print_mir_operand(MIROperand *operand);
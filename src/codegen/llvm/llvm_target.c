@@ -810,7 +810,7 @@ void codegen_emit_llvm(CodegenContext *cg) {
 
   /// Emit named types.
   bool type_emitted = false;
-  foreach_val (t, cg->ast->_types_) {
+  arena_foreach (Type, t, cg->ast->_types_) {
     if (t->kind != TYPE_STRUCT || t->structure.decl->struct_decl->name.size == 0) continue;
     type_emitted = true;
     format_to(&ctx.out, "%%struct.%S = type ", t->structure.decl->struct_decl->name);
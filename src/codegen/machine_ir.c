@@ -3,6 +3,7 @@
 #include <codegen/codegen_forward.h>
 #include <codegen/machine_ir.h>
 #include <ir/ir.h>
+#include <memory_report.h>
 #include <stdarg.h>
 #include <utils.h>
 #include <vector.h>
@@ -161,27 +162,61 @@ MIROperand mir_op_register(RegisterDescriptor reg, uint16_t size, bool defining_
   return out;
 }
 
-static bool mir_make_arch = false;
-static size_t mir_alloc_id = 0;
-static size_t mir_arch_alloc_id = MIR_ARCH_START;
+/// Thread-local so that several modules can be compiled at once.
+static THREAD_LOCAL bool mir_make_arch = false;
+static THREAD_LOCAL size_t mir_alloc_id = 0;
+static THREAD_LOCAL size_t mir_arch_alloc_id = MIR_ARCH_START;
+
+/// Pool that new instructions are allocated in, if any.
+static THREAD_LOCAL Arena *mir_pool = NULL;
+
+/// Push onto one of the vectors of an instruction. If the instruction
+/// is in a pool, so is the data of the vector, and it is never freed
+/// on its own.
+#define mir_vector_push(inst, vector, ...)                                                  \
+  do {                                                                                      \
+    if (!(inst)->pool) {                                                                    \
+      vector_push(vector, __VA_ARGS__);                                                     \
+      break;                                                                                \
+    }                                                                                       \
+    if ((vector).size == (vector).capacity) {                                               \
+      size_t _capacity = (vector).capacity ? 2 * (vector).capacity : 8;                     \
+      void *_data = arena_alloc((inst)->pool, _capacity * sizeof *(vector).data, ARENA_MAX_ALIGNMENT); \
+      if ((vector).size) memcpy(_data, (vector).data, (vector).size * sizeof *(vector).data); \
+      (vector).data = _data;                                                                \
+      (vector).capacity = _capacity;                                                        \
+    }                                                                                       \
+    (vector).data[(vector).size++] = (__VA_ARGS__);                                         \
+  } while (0)
+
+void mir_use_function(MIRFunction *function) {
+  mir_pool = function ? &function->pool : NULL;
+}
+
 MIRInstruction *mir_makenew(uint32_t opcode) {
-  MIRInstruction *mir = calloc(1, sizeof(*mir));
+  MIRInstruction *mir = NULL;
+  if (mir_pool) mir = arena_new(mir_pool, MIRInstruction);
+  else mir = calloc(1, sizeof(*mir));
   ASSERT(mir, "Memory allocation failure");
+  memory_record(MEMORY_MIR, sizeof(*mir));
   if (mir_make_arch)
     mir->id = ++mir_arch_alloc_id;
   else mir->id = ++mir_alloc_id;
   mir->opcode = opcode;
+  mir->pool = mir_pool;
   return mir;
 }
 MIRInstruction *mir_makecopy(MIRInstruction *original) {
   MIRInstruction *mir = mir_makenew(MIR_UNREACHABLE);
   mir->opcode = original->opcode;
-  mir->operand_count = original->operand_count;
-  if (mir->operand_count <= MIR_OPERAND_SSO_THRESHOLD)
+  if (original->operand_count <= MIR_OPERAND_SSO_THRESHOLD) {
+    mir->operand_count = original->operand_count;
     memcpy(mir->operands.arr, original->operands.arr, sizeof(mir->operands.arr));
-  else vector_append(mir->operands.vec, original->operands.vec);
+  } else {
+    FOREACH_MIR_OPERAND(original, op) mir_add_op(mir, *op);
+  }
   mir->origin = original->origin;
-  vector_append(mir->clobbers, original->clobbers);
+  foreach (clobber, original->clobbers) mir_add_clobber(mir, *clobber);
   return mir;
 }
 
@@ -210,6 +245,15 @@ void mir_remove_instruction(MIRInstruction *mi) {
   if (mi->block->function) --mi->block->function->inst_count;
   mi->block = NULL;
 }
+void mir_remove_instructions(MIRBlock *bb, MIRInstructionVector instructions) {
+  ASSERT(bb, "Invalid argument");
+  foreach_val (mi, instructions) {
+    ASSERT(mi->block == bb, "Cannot remove MIR instruction from a block it is not in");
+    if (bb->function) --bb->function->inst_count;
+    mi->block = NULL;
+  }
+  vector_remove_if(mi, bb->instructions, !mi->block);
+}
 void mir_insert_instruction(MIRBlock *bb, MIRInstruction *mi, usz index) {
   ASSERT(bb, "Invalid argument");
   if (bb->function) mir_insert_instruction_with_reg(bb, mi, index, bb->function->inst_count + (size_t)MIR_ARCH_START);
@@ -243,14 +287,44 @@ static void mir_push(MIRFunction *f, MIRInstruction *mi) {
 
 MIRFunction *mir_function(IRFunction *ir_f) {
   MIRFunction* f = calloc(1, sizeof(*f));
+  memory_record(MEMORY_MIR, sizeof(*f));
   f->origin = ir_f;
   f->name = string_dup(ir_name(ir_f));
   ir_mir(ir_f, f);
   return f;
 }
 
+void mir_function_free_code(MIRFunction *function) {
+  foreach_val (bb, function->blocks) {
+    /// Instructions that are not in the pool were created while no
+    /// pool was in use, so they have to be freed one by one.
+    foreach_val (inst, bb->instructions) {
+      if (inst->pool) continue;
+      if (inst->operand_count > MIR_OPERAND_SSO_THRESHOLD) vector_delete(inst->operands.vec);
+      small_vector_delete(inst->clobbers);
+      free(inst);
+    }
+
+    free(bb->name.data);
+    vector_delete(bb->instructions);
+    vector_delete(bb->predecessors);
+    vector_delete(bb->successors);
+  }
+
+  vector_delete(function->frame_objects);
+  vector_delete(function->blocks);
+  arena_free(&function->pool);
+}
+
+void mir_function_free(MIRFunction *function) {
+  mir_function_free_code(function);
+  free(function->name.data);
+  free(function);
+}
+
 MIRBlock *mir_block_makenew(MIRFunction *function, span name) {
-  MIRBlock* bb = calloc(1, sizeof(*bb));
+  MIRBlock* bb = arena_new(&function->pool, MIRBlock);
+  memory_record(MEMORY_MIR, sizeof(*bb));
   bb->function = function;
   bb->name = string_dup(name);
   vector_push(function->blocks, bb);
@@ -332,28 +406,20 @@ static bool needs_register(IRInstruction *instruction) {
 /// include them at all is to satisfy `phi` nonsense, among other
 /// things.
 static void remove_inlined(MIRFunction *function) {
-  MIRInstructionVector instructions_to_remove = {0};
   foreach_val (block, function->blocks) {
-    // Gather immediate instructions to remove
-    vector_clear(instructions_to_remove);
-    foreach_val (instruction, block->instructions) {
-      if (instruction->opcode != MIR_IMMEDIATE && instruction->opcode != MIR_FUNC_REF) continue;
-      vector_push(instructions_to_remove, instruction);
-    }
-    // Remove gathered instructions
-    foreach_val (to_remove, instructions_to_remove) {
-      vector_remove_element(block->instructions, to_remove);
-    }
+    vector_remove_if(
+      instruction,
+      block->instructions,
+      instruction->opcode == MIR_IMMEDIATE || instruction->opcode == MIR_FUNC_REF
+    );
   }
-  vector_delete(instructions_to_remove);
 }
 
 /// For each argument of each phi instruction, add in a copy to the phi's virtual register.
 static void phi2copy(MIRFunction *function) {
   IRBlock *last_block = NULL;
-  MIRInstructionVector instructions_to_remove = {0};
   foreach_val (block, function->blocks) {
-    vector_clear(instructions_to_remove);
+    MIRInstruction *phi_to_remove = NULL;
     foreach_val (instruction, block->instructions) {
       if (instruction->opcode != MIR_PHI) continue;
       IRInstruction *phi = instruction->origin;
@@ -447,19 +513,16 @@ static void phi2copy(MIRFunction *function) {
         default: UNREACHABLE();
         }
 
-        // Add index of phi instruction to list of instructions to remove.
-        vector_push(instructions_to_remove, instruction);
-      }
-
-      foreach_val (to_remove, instructions_to_remove) {
-        vector_remove_element(block->instructions, to_remove);
+        // The copies replace the phi instruction.
+        phi_to_remove = instruction;
       }
     }
+
+    if (phi_to_remove) vector_remove_if(instruction, block->instructions, instruction == phi_to_remove);
   }
-  vector_delete(instructions_to_remove);
 }
 
-MIRFunctionVector mir_from_ir(CodegenContext *context) {
+MIRFunctionVector mir_create_functions(CodegenContext *context) {
   MIRFunctionVector out = {0};
   // Forward function references require this.
   foreach_val (f, context->functions) {
@@ -469,237 +532,247 @@ MIRFunctionVector mir_from_ir(CodegenContext *context) {
       (void)mir_block(function, bb);
     vector_push(out, function);
   }
-  foreach_val (function, out) {
-    // NOTE for devs: function->origin == IRFunction*
-    if (!ir_func_is_definition(function->origin)) continue;
-
-    ASSERT(function->blocks.size, "Zero blocks in non-extern MIRFunction... what have you done?!");
-    // NOTE: This assumes the first block of the function is the entry
-    // point; it may be smart to set the entry point within the IR,
-    // that reordering optimisations may truly happen to any block.
-    vector_front(function->blocks)->is_entry = true;
-
-    foreach_val (mir_bb, function->blocks) {
-      IRBlock *bb = mir_bb->origin;
-      ASSERT(bb, "Origin of general MIR block not set (what gives?)");
-
-      STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
-      FOREACH_INSTRUCTION(inst, bb) {
-        switch (ir_kind(inst)) {
-
-        case IR_POISON: ICE("Refusing to codegen poison value");
-
-        case IR_IMMEDIATE: {
-          MIRInstruction *mir = mir_makenew(MIR_IMMEDIATE);
-          mir->origin = inst;
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_FUNC_REF: {
-          MIRInstruction *mir = mir_makenew(MIR_FUNC_REF);
-          ir_mir(inst, mir);
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_reference_ir(function, inst));
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_REGISTER:
-          break;
-
-        case IR_PHI: {
-          MIRInstruction *mir = mir_makenew(MIR_PHI);
-          mir->origin = inst;
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_INTRINSIC: {
-          MIRInstruction *mir = mir_makenew(MIR_INTRINSIC);
-          mir->origin = inst;
-          ir_mir(inst, mir);
-
-          // Intrinsic kind
-          mir_add_op(mir, mir_op_immediate(ir_intrinsic_kind(inst)));
-
-          // Call arguments
-          for(usz i = 0; i < ir_call_args_count(inst); i++)
-            mir_add_op(mir, mir_op_reference_ir(function, ir_call_arg(inst, i)));
-
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_CALL: {
-          MIRInstruction *mir = mir_makenew(MIR_CALL);
-          mir->origin = inst;
-          ir_mir(inst, mir);
-
-          // Call target (destination)
-          IRValue callee = ir_callee(inst);
-          if (!ir_call_is_direct(inst)) mir_add_op(mir, mir_op_reference_ir(function, callee.inst));
-          else mir_add_op(mir, mir_op_function(ir_mir(callee.func)));
-
-          // Call arguments
-          for (usz i = 0; i < ir_call_args_count(inst); i++)
-            mir_add_op(mir, mir_op_reference_ir(function, ir_call_arg(inst, i)));
-
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_LOAD: {
-          MIRInstruction *mir = mir_makenew(MIR_LOAD);
-          mir->origin = inst;
-
-          // Address of load
-          MIROperand addr = mir_op_reference_ir(function, ir_operand(inst));
-          mir_add_op(mir, addr);
-          // Size of load (if needed)
-          if (addr.kind == MIR_OP_REGISTER) {
-            MIROperand size = mir_op_immediate((i64)type_sizeof(ir_typeof(inst)));
-            mir_add_op(mir, size);
-          }
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_NOT: FALLTHROUGH;
-        case IR_BITCAST: {
-          MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_ZERO_EXTEND: FALLTHROUGH;
-        case IR_SIGN_EXTEND: FALLTHROUGH;
-        case IR_TRUNCATE: {
-          MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
-          mir->origin = inst;
-          // Thing to truncate
-          mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
-          // Amount of bytes to truncate from
-          mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(ir_operand(inst)))));
-          // Amount of bytes to truncate to
-          mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(inst))));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_COPY: {
-          MIRInstruction *mir = mir_from_ir_copy(function, inst);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_RETURN: {
-          MIRInstruction *mir = mir_makenew(MIR_RETURN);
-          mir->origin = inst;
-          if (ir_operand(inst)) mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-          mir_bb->is_exit = true;
-        } break;
-        case IR_BRANCH: {
-          MIRInstruction *mir = mir_makenew(MIR_BRANCH);
-          MIRBlock *dest = ir_mir(ir_dest(inst));
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_block(dest));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-          // CFG
-          vector_push(mir_bb->successors, dest);
-          vector_push(dest->predecessors, mir_bb);
-        } break;
-        case IR_BRANCH_CONDITIONAL: {
-          MIRInstruction *mir = mir_makenew(MIR_BRANCH_CONDITIONAL);
-          MIRBlock *mir_then = ir_mir(ir_then(inst));
-          MIRBlock *mir_else = ir_mir(ir_else(inst));
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_reference_ir(function, ir_cond(inst)));
-          mir_add_op(mir, mir_op_block(mir_then));
-          mir_add_op(mir, mir_op_block(mir_else));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-          // CFG
-          vector_push(mir_bb->successors, mir_then);
-          vector_push(mir_bb->successors, mir_else);
-          vector_push(mir_then->predecessors, mir_bb);
-          vector_push(mir_else->predecessors, mir_bb);
-        } break;
-        case IR_ADD:
-        case IR_SUB:
-        case IR_MUL:
-        case IR_DIV:
-        case IR_MOD:
-        case IR_SHL:
-        case IR_SAR:
-        case IR_SHR:
-        case IR_AND:
-        case IR_OR:
-        case IR_LT:
-        case IR_LE:
-        case IR_GT:
-        case IR_GE:
-        case IR_EQ:
-        case IR_NE: {
-          MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_reference_ir(function, ir_lhs(inst)));
-          mir_add_op(mir, mir_op_reference_ir(function, ir_rhs(inst)));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-        case IR_STATIC_REF: {
-          MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
-          ir_mir(inst, mir);
-          mir->origin = inst;
-          mir_add_op(mir, mir_op_reference_ir(function, inst));
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-        case IR_STORE: {
-          MIRInstruction *mir = mir_makenew(MIR_STORE);
-          mir->origin = inst;
-          MIROperand value = mir_op_reference_ir(function, ir_store_value(inst));
-          MIROperand addr = mir_op_reference_ir(function, ir_store_addr(inst));
-          mir_add_op(mir, value);
-          mir_add_op(mir, addr);
-          // Size of store (if needed)
-          if (addr.kind == MIR_OP_REGISTER && value.kind == MIR_OP_IMMEDIATE)
-            mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(ir_store_value(inst)))));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-        case IR_ALLOCA: {
-          MIRInstruction *mir = mir_makenew(MIR_ALLOCA);
-          mir->origin = inst;
-          ir_alloca_offset(inst, (usz)-1); // Implementation detail for referencing frame objects
-          mir_add_op(mir, mir_op_local_ref_ir(function, inst));
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-        } break;
-
-        case IR_UNREACHABLE: {
-          MIRInstruction *mir = mir_makenew(MIR_UNREACHABLE);
-          mir->origin = inst;
-          ir_mir(inst, mir);
-          mir_push_into_block(function, mir_bb, mir);
-          mir_bb->is_exit = true;
-        } break;
-
-        case IR_PARAMETER:
-        case IR_LIT_INTEGER:
-        case IR_LIT_STRING:
-        case IR_COUNT: UNREACHABLE();
+  return out;
+}
 
-        } // switch (ir_kind(inst))
-      }
+void mir_from_ir_function(MIRFunction *function) {
+  mir_make_arch = false;
+  // NOTE for devs: function->origin == IRFunction*
+  if (!ir_func_is_definition(function->origin)) return;
+  mir_use_function(function);
+
+  ASSERT(function->blocks.size, "Zero blocks in non-extern MIRFunction... what have you done?!");
+  // NOTE: This assumes the first block of the function is the entry
+  // point; it may be smart to set the entry point within the IR,
+  // that reordering optimisations may truly happen to any block.
+  vector_front(function->blocks)->is_entry = true;
+
+  foreach_val (mir_bb, function->blocks) {
+    IRBlock *bb = mir_bb->origin;
+    ASSERT(bb, "Origin of general MIR block not set (what gives?)");
+
+    STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
+    FOREACH_INSTRUCTION(inst, bb) {
+      switch (ir_kind(inst)) {
+
+      case IR_POISON: ICE("Refusing to codegen poison value");
+
+      case IR_IMMEDIATE: {
+        MIRInstruction *mir = mir_makenew(MIR_IMMEDIATE);
+        mir->origin = inst;
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_FUNC_REF: {
+        MIRInstruction *mir = mir_makenew(MIR_FUNC_REF);
+        ir_mir(inst, mir);
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_reference_ir(function, inst));
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_REGISTER:
+        break;
+
+      case IR_PHI: {
+        MIRInstruction *mir = mir_makenew(MIR_PHI);
+        mir->origin = inst;
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_INTRINSIC: {
+        MIRInstruction *mir = mir_makenew(MIR_INTRINSIC);
+        mir->origin = inst;
+        ir_mir(inst, mir);
+
+        // Intrinsic kind
+        mir_add_op(mir, mir_op_immediate(ir_intrinsic_kind(inst)));
+
+        // Call arguments
+        for(usz i = 0; i < ir_call_args_count(inst); i++)
+          mir_add_op(mir, mir_op_reference_ir(function, ir_call_arg(inst, i)));
+
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_CALL: {
+        MIRInstruction *mir = mir_makenew(MIR_CALL);
+        mir->origin = inst;
+        ir_mir(inst, mir);
+
+        // Call target (destination)
+        IRValue callee = ir_callee(inst);
+        if (!ir_call_is_direct(inst)) mir_add_op(mir, mir_op_reference_ir(function, callee.inst));
+        else mir_add_op(mir, mir_op_function(ir_mir(callee.func)));
+
+        // Call arguments
+        for (usz i = 0; i < ir_call_args_count(inst); i++)
+          mir_add_op(mir, mir_op_reference_ir(function, ir_call_arg(inst, i)));
+
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_LOAD: {
+        MIRInstruction *mir = mir_makenew(MIR_LOAD);
+        mir->origin = inst;
+
+        // Address of load
+        MIROperand addr = mir_op_reference_ir(function, ir_operand(inst));
+        mir_add_op(mir, addr);
+        // Size of load (if needed)
+        if (addr.kind == MIR_OP_REGISTER) {
+          MIROperand size = mir_op_immediate((i64)type_sizeof(ir_typeof(inst)));
+          mir_add_op(mir, size);
+        }
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_NOT: FALLTHROUGH;
+      case IR_BITCAST: {
+        MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_ZERO_EXTEND: FALLTHROUGH;
+      case IR_SIGN_EXTEND: FALLTHROUGH;
+      case IR_TRUNCATE: {
+        MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
+        mir->origin = inst;
+        // Thing to truncate
+        mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
+        // Amount of bytes to truncate from
+        mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(ir_operand(inst)))));
+        // Amount of bytes to truncate to
+        mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(inst))));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_COPY: {
+        MIRInstruction *mir = mir_from_ir_copy(function, inst);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_RETURN: {
+        MIRInstruction *mir = mir_makenew(MIR_RETURN);
+        mir->origin = inst;
+        if (ir_operand(inst)) mir_add_op(mir, mir_op_reference_ir(function, ir_operand(inst)));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+        mir_bb->is_exit = true;
+      } break;
+      case IR_BRANCH: {
+        MIRInstruction *mir = mir_makenew(MIR_BRANCH);
+        MIRBlock *dest = ir_mir(ir_dest(inst));
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_block(dest));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+        // CFG
+        vector_push(mir_bb->successors, dest);
+        vector_push(dest->predecessors, mir_bb);
+      } break;
+      case IR_BRANCH_CONDITIONAL: {
+        MIRInstruction *mir = mir_makenew(MIR_BRANCH_CONDITIONAL);
+        MIRBlock *mir_then = ir_mir(ir_then(inst));
+        MIRBlock *mir_else = ir_mir(ir_else(inst));
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_reference_ir(function, ir_cond(inst)));
+        mir_add_op(mir, mir_op_block(mir_then));
+        mir_add_op(mir, mir_op_block(mir_else));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+        // CFG
+        vector_push(mir_bb->successors, mir_then);
+        vector_push(mir_bb->successors, mir_else);
+        vector_push(mir_then->predecessors, mir_bb);
+        vector_push(mir_else->predecessors, mir_bb);
+      } break;
+      case IR_ADD:
+      case IR_SUB:
+      case IR_MUL:
+      case IR_DIV:
+      case IR_MOD:
+      case IR_SHL:
+      case IR_SAR:
+      case IR_SHR:
+      case IR_AND:
+      case IR_OR:
+      case IR_LT:
+      case IR_LE:
+      case IR_GT:
+      case IR_GE:
+      case IR_EQ:
+      case IR_NE: {
+        MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_reference_ir(function, ir_lhs(inst)));
+        mir_add_op(mir, mir_op_reference_ir(function, ir_rhs(inst)));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+      case IR_STATIC_REF: {
+        MIRInstruction *mir = mir_makenew((uint32_t)ir_kind(inst));
+        ir_mir(inst, mir);
+        mir->origin = inst;
+        mir_add_op(mir, mir_op_reference_ir(function, inst));
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+      case IR_STORE: {
+        MIRInstruction *mir = mir_makenew(MIR_STORE);
+        mir->origin = inst;
+        MIROperand value = mir_op_reference_ir(function, ir_store_value(inst));
+        MIROperand addr = mir_op_reference_ir(function, ir_store_addr(inst));
+        mir_add_op(mir, value);
+        mir_add_op(mir, addr);
+        // Size of store (if needed)
+        if (addr.kind == MIR_OP_REGISTER && value.kind == MIR_OP_IMMEDIATE)
+          mir_add_op(mir, mir_op_immediate((i64)type_sizeof(ir_typeof(ir_store_value(inst)))));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+      case IR_ALLOCA: {
+        MIRInstruction *mir = mir_makenew(MIR_ALLOCA);
+        mir->origin = inst;
+        ir_alloca_offset(inst, (usz)-1); // Implementation detail for referencing frame objects
+        mir_add_op(mir, mir_op_local_ref_ir(function, inst));
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+      } break;
+
+      case IR_UNREACHABLE: {
+        MIRInstruction *mir = mir_makenew(MIR_UNREACHABLE);
+        mir->origin = inst;
+        ir_mir(inst, mir);
+        mir_push_into_block(function, mir_bb, mir);
+        mir_bb->is_exit = true;
+      } break;
+
+      case IR_PARAMETER:
+      case IR_LIT_INTEGER:
+      case IR_LIT_STRING:
+      case IR_COUNT: UNREACHABLE();
+
+      } // switch (ir_kind(inst))
     }
-
-    phi2copy(function);
-    remove_inlined(function);
   }
 
+  phi2copy(function);
+  remove_inlined(function);
+
+  mir_use_function(NULL);
   mir_make_arch = true;
+}
+
+MIRFunctionVector mir_from_ir(CodegenContext *context) {
+  MIRFunctionVector out = mir_create_functions(context);
+  foreach_val (function, out) mir_from_ir_function(function);
   return out;
 }
 
@@ -925,16 +998,24 @@ void mir_add_op(MIRInstruction *inst, MIROperand op) {
     memcpy(tmp, inst->operands.arr, sizeof(inst->operands.arr[0]) * MIR_OPERAND_SSO_THRESHOLD);
     memset(&inst->operands.vec, 0, sizeof(inst->operands.vec));
     for (size_t i = 0; i < MIR_OPERAND_SSO_THRESHOLD; ++i)
-      vector_push(inst->operands.vec, tmp[i]);
+      mir_vector_push(inst, inst->operands.vec, tmp[i]);
 
-    vector_push(inst->operands.vec, op);
+    mir_vector_push(inst, inst->operands.vec, op);
   } else {
     // inst->operand_count > MIR_OPERAND_SSO_THRESHOLD
-    vector_push(inst->operands.vec, op);
+    mir_vector_push(inst, inst->operands.vec, op);
   }
   ++inst->operand_count;
 }
 
+void mir_add_clobber(MIRInstruction *inst, MIROperandRegister reg) {
+  ASSERT(inst, "Invalid argument");
+  /// The inline storage is used before the pool or the heap.
+  if (!inst->pool || inst->clobbers.size < small_vector_inline_capacity(inst->clobbers))
+    small_vector_push(inst->clobbers, reg);
+  else mir_vector_push(inst, inst->clobbers, reg);
+}
+
 MIROperand *mir_get_op(MIRInstruction *inst, size_t index) {
   ASSERT(inst, "Invalid argument");
   ASSERT(index < inst->operand_count, "Index out of bounds (greater than operand count)");
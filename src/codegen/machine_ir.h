@@ -1,6 +1,7 @@
 #ifndef MACHINE_IR_H
 #define MACHINE_IR_H
 
+#include <arena.h>
 #include <codegen/codegen_forward.h>
 #include <inttypes.h>
 #include <stddef.h>
@@ -56,7 +57,9 @@ typedef struct MIROperandRegister {
 
   bool defining_use;
 } MIROperandRegister;
-typedef Vector(MIROperandRegister) MIROperandRegisters;
+
+/// Few instructions clobber more than a couple of registers.
+typedef SmallVector(MIROperandRegister, 2) MIROperandRegisters;
 
 typedef usz MIROperandLocal; // index into function FrameObject vector
 typedef const char* MIROperandName;
@@ -118,8 +121,14 @@ typedef struct MIRInstruction {
     Vector(MIROperand) vec;
   } operands;
 
+  /// Use mir_add_clobber() to add to this.
   MIROperandRegisters clobbers;
 
+  /// The pool that this instruction, its operands, and its clobbers
+  /// are allocated in, or NULL if they are on the heap, as is the case
+  /// for ISel patterns.
+  Arena *pool;
+
   MIRBlock *block;
 
   // Keep track of originating IR instruction.
@@ -181,8 +190,16 @@ typedef struct MIRFunction {
   MIRBlockVector blocks;
 
   IRFunction *origin;
+
+  /// Owns all instructions and blocks of this function. Everything in
+  /// it is freed at once by mir_function_free_code().
+  Arena pool;
 } MIRFunction;
 
+/// Make the calling thread allocate new instructions in the pool of
+/// `function`. Pass NULL to allocate them on the heap again.
+void mir_use_function(MIRFunction *function);
+
 /// dwisott
 MIRInstruction *mir_makenew(uint32_t opcode);
 /// Copy the entire instruction
@@ -194,6 +211,16 @@ void mir_op_clear(MIRInstruction *);
 /// Caller is responsible for calling vector_delete() on returned vector.
 MIRFunctionVector mir_from_ir(CodegenContext *context);
 
+/// Create a MIRFunction, along with all of its blocks, for every
+/// function in the context, without lowering any instructions.
+/// Caller is responsible for calling vector_delete() on returned vector.
+MIRFunctionVector mir_create_functions(CodegenContext *context);
+
+/// Lower the instructions of a function created by mir_create_functions().
+/// This only touches the given function, so different functions may
+/// be lowered concurrently.
+void mir_from_ir_function(MIRFunction *function);
+
 const char *mir_operand_kind_string(MIROperandKind);
 
 /// If opcode is within common opcode range (less than or equal to
@@ -235,6 +262,7 @@ MIROperand mir_op_register(RegisterDescriptor reg, uint16_t size, bool defining_
 bool mir_operand_kinds_match(MIRInstruction *inst, usz operand_count, ...);
 
 void mir_add_op(MIRInstruction *inst, MIROperand op);
+void mir_add_clobber(MIRInstruction *inst, MIROperandRegister reg);
 /// Return a pointer to operand at index within instruction.
 MIROperand *mir_get_op(MIRInstruction *inst, size_t index);
 
@@ -242,6 +270,10 @@ MIROperand *mir_get_op(MIRInstruction *inst, size_t index);
 MIRFrameObject *mir_get_frame_object(MIRFunction *function, MIROperandLocal op);
 
 void mir_remove_instruction(MIRInstruction *mi);
+/// Remove several instructions from a block at once. Unlike calling
+/// mir_remove_instruction() for each of them, this takes time linear
+/// in the size of the block.
+void mir_remove_instructions(MIRBlock *bb, MIRInstructionVector instructions);
 
 void mir_insert_instruction_with_reg(MIRBlock *bb, MIRInstruction *mi, usz index, MIRRegister reg);
 /// NOTE: Automatically sets vreg of instruction iff block has MIRFunction reference.
@@ -258,6 +290,14 @@ MIRInstruction *mir_find_by_vreg(MIRFunction *mir, size_t reg);
 /// Create an MIR function from an IR function.
 MIRFunction *mir_function(IRFunction *ir_f);
 
+/// Free the blocks and instructions of an MIR function, but not the
+/// function itself, since the code of other functions may still refer
+/// to it by name.
+void mir_function_free_code(MIRFunction *function);
+
+/// Free an MIR function along with all of its blocks and instructions.
+void mir_function_free(MIRFunction *function);
+
 /// Create an MIR basic block from an IR basic block
 MIRBlock *mir_block(MIRFunction *function, IRBlock *ir_bb);
 
@@ -1,4 +1,7 @@
 #include <codegen/opt/opt-internal.h>
+#include <platform.h>
+#include <stats.h>
+#include <timing.h>
 
 typedef Vector(IRBlock *) BlockVector;
 
@@ -458,6 +461,7 @@ bool opt_try_convert_to_tail_call(IRInstruction *i) {
     /// The actual tail call optimisation takes place in the code generator.
     ir_call_tail(i, true);
     ir_make_unreachable(ir_parent(i));
+    stats_add(STAT_OPT_TAIL_CALLS, 1);
     return true;
   }
 
@@ -530,7 +534,7 @@ static bool opt_mem2reg(IRFunction *f) {
                 issue_diagnostic(
                   DIAG_WARN,
                   ctx->ast->filename.data,
-                  as_span(ctx->ast->source),
+                  ctx->ast->source,
                   ir_location(f), /// FIXME: Should be location of the load.
                   "Load of uninitialised variable in function %S",
                   ir_name(f)
@@ -837,14 +841,14 @@ static bool collect_preds_and_prune(IRFunction *f, Predecessors *preds) {
 /// Perform jump threading and similar optimisations.
 static bool opt_jump_threading(CodegenContext *ctx, IRFunction *f, Predecessors *preds) {
   bool changed = false;
-  IRBlockVector to_remove = {0};
+  Map(IRBlock *, bool) to_remove = {0};
 
   /// Remove blocks that consist of a single direct branch.
   ///
   /// Also simplify conditional branches whose true and false
   /// blocks are the same and fold chains of unconditional branches.
   FOREACH_BLOCK (b, f) {
-    if (vector_contains(to_remove, b)) continue;
+    if (map_get(to_remove, b)) continue;
     IRInstruction *last = ir_terminator(b);
 
     /// Merge trivially connected blocks.
@@ -889,7 +893,7 @@ static bool opt_jump_threading(CodegenContext *ctx, IRFunction *f, Predecessors
       /// from the destination block into this block.
       ir_remove(last);
       ir_merge_blocks(b, successor);
-      vector_push(to_remove, successor);
+      map_set(to_remove, successor, true);
       changed = true;
     }
 
@@ -901,8 +905,8 @@ static bool opt_jump_threading(CodegenContext *ctx, IRFunction *f, Predecessors
   }
 
   /// Remove all blocks that we have marked for removal.
-  foreach_val (b, to_remove) ir_delete_block(b);
-  vector_delete(to_remove);
+  foreach (entry, to_remove) ir_delete_block(entry->key);
+  map_delete(to_remove);
 
   /// Done.
   return changed;
@@ -1078,6 +1082,62 @@ static bool opt_store_forwarding(IRFunction *f) {
 PUSH_IGNORE_WARNING("-Wbitwise-instead-of-logical")
 #endif
 
+/// Run a pass and record it in the trace and statistics. `what` is the
+/// function the pass is run on, or an empty span for cross-function passes.
+#define OPT_PASS(what, pass, ...) ({                  \
+  Timer _timer = timer_start_span(#pass, what);       \
+  PassStats *_previous = stats_begin_pass(#pass);     \
+  bool _changed = pass(__VA_ARGS__);                  \
+  stats_end_pass(_previous);                          \
+  timer_stop(&_timer);                                \
+  _changed;                                           \
+})
+
+/// Optimise a single function until nothing changes anymore.
+static void opt_function(CodegenContext *ctx, IRFunction *f) {
+  if (!ir_func_is_definition(f) || ir_attribute(f, FUNC_ATTR_NOOPT)) return;
+  Timer timer = timer_start_function(PHASE_OPTIMISE, ir_name(f));
+  do {
+    /// Uncomment this to debug optimisation passes.
+    /// print("====== OPTIMISATION PASS over %S ======\n", ir_name(f));
+    /// ir_set_func_ids(f);
+    /// ir_print_function(stdout, f);
+  } while (
+    OPT_PASS(ir_name(f), opt_simplify_cfg, ctx, f) |
+    OPT_PASS(ir_name(f), opt_instcombine, ctx, f) |
+    OPT_PASS(ir_name(f), opt_dce, f) |
+    OPT_PASS(ir_name(f), opt_mem2reg, f) |
+    OPT_PASS(ir_name(f), opt_store_forwarding, f) |
+    OPT_PASS(ir_name(f), opt_tail_call_elim, f)
+  );
+  timer_stop(&timer);
+}
+
+/// State shared by threads that optimise functions at once.
+typedef struct OptimiseJob {
+  CodegenContext *ctx;
+
+  /// Free lists of each function, so the threads don’t
+  /// have to share the free lists of the context.
+  IRFreeLists *free_lists;
+
+  /// Diagnostics issued while optimising each function; these are
+  /// reported in order once all functions are done.
+  string *diagnostics;
+} OptimiseJob;
+
+static void opt_function_job(usz index, void *data) {
+  OptimiseJob *job = data;
+  PlatformMemoryStream stream = {0};
+  platform_memory_stream_open(&stream);
+  thread_diagnostics_stream = stream.file;
+  ir_use_free_lists(job->free_lists + index);
+  opt_function(job->ctx, job->ctx->functions.data[index]);
+  ir_use_free_lists(NULL);
+  thread_diagnostics_stream = NULL;
+  job->diagnostics[index] = platform_memory_stream_close(&stream);
+}
+
 void codegen_optimise(CodegenContext *ctx) {
   opt_analyse_functions(ctx);
 
@@ -1086,23 +1146,26 @@ void codegen_optimise(CodegenContext *ctx) {
   /// ir_set_ids(ctx);
   /// ir_print(stdout, ctx);
 
-  /// Optimise each function individually.
+  /// Optimise each function individually. The passes involved only
+  /// ever touch the function they are given, so several functions can
+  /// be optimised at once.
   do {
-    foreach_val (f, ctx->functions) {
-      if (!ir_func_is_definition(f) || ir_attribute(f, FUNC_ATTR_NOOPT)) continue;
-      do {
-        /// Uncomment this to debug optimisation passes.
-        /// print("====== OPTIMISATION PASS over %S ======\n", ir_name(f));
-        /// ir_set_func_ids(f);
-        /// ir_print_function(stdout, f);
-      } while (
-        opt_simplify_cfg(ctx, f) |
-        opt_instcombine(ctx, f) |
-        opt_dce(f) |
-        opt_mem2reg(f) |
-        opt_store_forwarding(f) |
-        opt_tail_call_elim(f)
-      );
+    if (ctx->backend_jobs > 1) {
+      OptimiseJob job = {0};
+      job.ctx = ctx;
+      job.free_lists = calloc(ctx->functions.size, sizeof *job.free_lists);
+      job.diagnostics = calloc(ctx->functions.size, sizeof *job.diagnostics);
+      ASSERT(job.free_lists && job.diagnostics, "Memory allocation failure");
+      platform_parallel_for(ctx->functions.size, ctx->backend_jobs, opt_function_job, &job);
+      foreach_index (i, ctx->functions) {
+        ir_merge_free_lists(ctx, job.free_lists + i);
+        flush_diagnostics(as_span(job.diagnostics[i]));
+        free(job.diagnostics[i].data);
+      }
+      free(job.free_lists);
+      free(job.diagnostics);
+    } else {
+      foreach_val (f, ctx->functions) opt_function(ctx, f);
     }
   }
 
@@ -1113,7 +1176,11 @@ void codegen_optimise(CodegenContext *ctx) {
   /// otherwise cause tests to fail when we try and emit those functions.
   /// At some point, we should comment out this pass here and fix all
   /// the backend errors that that will inevitably cause.
-  while (opt_inline(ctx, 20) | opt_analyse_functions(ctx) | opt_remove_globals(ctx));
+  while (
+    OPT_PASS((span){0}, opt_inline, ctx, 20) |
+    OPT_PASS((span){0}, opt_analyse_functions, ctx) |
+    OPT_PASS((span){0}, opt_remove_globals, ctx)
+  );
 }
 
 /// Called after RA.
@@ -3,8 +3,6 @@
 
 #include <codegen/codegen_forward.h>
 
-extern int optimise;
-
 /// Currently, we don’t have optimisation levels, so this
 /// will simply perform all available optimisations.
 void codegen_optimise(CodegenContext *ctx);
@@ -6,6 +6,8 @@
 #include <error.h>
 #include <ir/dom.h>
 #include <ir/ir.h>
+#include <memory_report.h>
+#include <stats.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -90,16 +92,27 @@ static bool needs_register(IRInstruction *instruction) {
 
 //==== BEG ADJACENCY MATRIX ====
 
+/// Functions with at most this many registers store their interference
+/// graph as a bit matrix (of at most 4 MiB).
+#define ADJM_DENSE_LIMIT ((usz) 8192)
+
+/// The interference graph of a function. Only the lower left triangle
+/// of the matrix is stored, since it is symmetric. A bit matrix is the
+/// fastest representation for most functions, but it doesn't even fit
+/// in memory for functions with a few hundred thousand values, so those
+/// store their edges in a set instead; their graphs are sparse anyway.
 typedef struct AdjacencyMatrix {
   usz size;
-  bool *data;
+  u64 *bits;
+  Map(u64, bool) edges;
 } AdjacencyMatrix;
 
-bool *adjm_entry(AdjacencyMatrix m, usz x, usz y) {
-  if (x > m.size) {
+/// Get the index of an entry in the lower left triangle of the matrix.
+usz adjm_index(AdjacencyMatrix *m, usz x, usz y) {
+  if (x >= m->size) {
     ICE("Can not access adjacency matrix because X is out of bounds.");
   }
-  if (y > m.size) {
+  if (y >= m->size) {
     ICE("Can not access adjacency matrix because Y is out of bounds.");
   }
   // Coordinate translation for lower left triangle matrix
@@ -108,19 +121,29 @@ bool *adjm_entry(AdjacencyMatrix m, usz x, usz y) {
     x = y;
     y = old_x;
   }
-  return &m.data[y * m.size + x];
+  return m->bits ? x * (x + 1) / 2 + y : x << 32 | y;
 }
 
-void adjm_set(AdjacencyMatrix m, usz x, usz y) {
-  *adjm_entry(m, x, y) = 1;
+void adjm_set(AdjacencyMatrix *m, usz x, usz y) {
+  usz i = adjm_index(m, x, y);
+  if (m->bits) m->bits[i / 64] |= (u64) 1 << (i % 64);
+  else map_set(m->edges, (u64) i, true);
 }
 
-void adjm_clear(AdjacencyMatrix m, usz x, usz y) {
-  *adjm_entry(m, x, y) = 0;
+void adjm_clear(AdjacencyMatrix *m, usz x, usz y) {
+  usz i = adjm_index(m, x, y);
+  if (m->bits) m->bits[i / 64] &= ~((u64) 1 << (i % 64));
+  else {
+    bool *edge = map_get(m->edges, (u64) i);
+    if (edge) *edge = false;
+  }
 }
 
-bool adjm(AdjacencyMatrix m, usz x, usz y) {
-  return *adjm_entry(m, x, y);
+bool adjm(AdjacencyMatrix *m, usz x, usz y) {
+  usz i = adjm_index(m, x, y);
+  if (m->bits) return (m->bits[i / 64] >> (i % 64)) & 1;
+  bool *edge = map_get(m->edges, (u64) i);
+  return edge && *edge;
 }
 
 typedef struct AdjacencyList AdjacencyList;
@@ -131,37 +154,57 @@ typedef struct AdjacencyGraph {
   AdjacencyMatrix matrix;
   usz *regmasks;
   AdjacencyLists lists;
+
+  /// The registers that need coloured; hardware registers come first.
+  VRegVector *vregs;
+
+  /// One plus the index of each virtual register in the list of
+  /// registers, by value - MIR_ARCH_START, or zero if it isn't in it.
+  Vector(usz) indices;
 } AdjacencyGraph;
 
 void allocate_adjacency_graph(AdjacencyGraph *G, usz size) {
-  if (G->matrix.data) { free(G->matrix.data); }
+  if (G->matrix.bits) { free(G->matrix.bits); }
   if (G->regmasks) { free(G->regmasks); }
+  if (size > UINT32_MAX) ICE("Too many registers to allocate: %Z", size);
   G->matrix.size = size;
-  G->matrix.data = calloc(1, size * size + 1);
-  G->regmasks = calloc(1, size * sizeof(usz));
+  G->matrix.bits = NULL;
+  map_clear(G->matrix.edges);
+  if (size <= ADJM_DENSE_LIMIT) {
+    usz words = (size * (size + 1) / 2 + 63) / 64;
+    G->matrix.bits = calloc(words, sizeof(u64));
+    memory_record(MEMORY_RA, words * sizeof(u64));
+  }
+  G->regmasks = calloc(size, sizeof(usz));
+  memory_record(MEMORY_RA, size * sizeof(usz));
 }
 
-/// Walk over all possible paths in the control flow graph upwards from
-/// given block, computing instruction interferences based on the values
-/// that are currently live.
-static void collect_interferences_from_block
-(const MachineDescription *desc,
- MIRBlock *b,
- VRegVector *live_vals,
- VRegVector *vregs,
- MIRBlockVector *visited,
- MIRBlockVector *doubly_visited,
- AdjacencyGraph *G
- )
-{
-  /// Don't visit the same block thrice.
-  if (vector_contains(*visited, b)) {
-    if (vector_contains(*doubly_visited, b))
-      return;
-    else vector_push(*doubly_visited, b);
-  } else vector_push(*visited, b);
+/// Get the index of a register in the list of registers, or -1 if it
+/// isn't in it.
+static usz register_index(AdjacencyGraph *G, usz value) {
+  if (value < MIR_ARCH_START) {
+    for (usz i = 0; i < G->order; i++)
+      if (G->vregs->data[i].value == value) return i;
+    return (usz) -1;
+  }
 
+  value -= MIR_ARCH_START;
+  if (value >= G->indices.size) return (usz) -1;
+  return G->indices.data[value] - 1;
+}
 
+/// Add a virtual register to the list of registers.
+static void add_virtual_register(AdjacencyGraph *G, VReg r) {
+  usz value = r.value - MIR_ARCH_START;
+  if (value >= G->indices.size) vector_resize(G->indices, value + 1);
+  G->indices.data[value] = G->vregs->size + 1;
+  vector_push(*G->vregs, r);
+}
+
+/// Collect interferences for the instructions in a block, given the
+/// values that are live at its end; afterwards, `live_vals` contains
+/// the values that are live at its start.
+static void collect_interferences_in_block(MIRBlock *b, VRegVector *live_vals, AdjacencyGraph *G) {
   DEBUG("  from block...\n");
 
   // Collect interferences for virtual registers in this block.
@@ -206,13 +249,7 @@ static void collect_interferences_from_block
     FOREACH_MIR_OPERAND(inst, oper) {
       if (oper->kind == MIR_OP_REGISTER) {
         // Get index within adjacency matrix of reg operand.
-        usz live_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == oper->value.reg.value) {
-            live_idx = i;
-            break;
-          }
-        }
+        usz live_idx = register_index(G, oper->value.reg.value);
         if (oper->value.reg.value >= MIR_ARCH_START)
           ASSERT(live_idx != (usz)-1,
                  "Could not find vreg from live values vector in list of vregs: %V\n",
@@ -236,8 +273,7 @@ static void collect_interferences_from_block
 #ifdef DEBUG_RA
           print("Setting r%Z interfere with r%Z (used in same instruction)\n", A->op->value.reg.value, B->op->value.reg.value);
 #endif
-          adjm_set(G->matrix, A->live_idx, B->live_idx);
-          adjm_set(G->matrix, B->live_idx, A->live_idx);
+          adjm_set(&G->matrix, A->live_idx, B->live_idx);
         }
       }
     }
@@ -245,17 +281,10 @@ static void collect_interferences_from_block
     foreach (A, reg_operands) {
       foreach (clobbered, inst->clobbers) {
         // Get index of clobbered register.
-        usz clobbered_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == clobbered->value) {
-            clobbered_idx = i;
-            break;
-          }
-        }
+        usz clobbered_idx = register_index(G, clobbered->value);
         ASSERT(clobbered_idx != (usz)-1, "Could not find register from clobbers list in list of registers: %V\n", clobbered->value);
 
-        adjm_set(G->matrix, A->live_idx, clobbered_idx);
-        adjm_set(G->matrix, clobbered_idx, A->live_idx);
+        adjm_set(&G->matrix, A->live_idx, clobbered_idx);
       }
     }
     // Make all reg operands interfere with all currently live values
@@ -268,13 +297,7 @@ static void collect_interferences_from_block
           continue;
         }
 
-        usz live_idx = (usz)-1;
-        foreach_index (i, *vregs) {
-          if (vregs->data[i].value == live_val->value) {
-            live_idx = i;
-            break;
-          }
-        }
+        usz live_idx = register_index(G, live_val->value);
         ASSERT(live_idx != (usz)-1, "Could not find vreg from live values vector in list of vregs: %V\n", live_val->value);
 
         DEBUG("--Setting live value %V (%Z) within %V (%Z)\n", live_val->value, live_idx, inst->reg, A->live_idx);
@@ -282,8 +305,7 @@ static void collect_interferences_from_block
         if (live_idx >= G->matrix.size) ICE("Index out of bounds (live value vreg index)", live_idx);
         if (A->live_idx >= G->matrix.size) ICE("Index out of bounds (instruction vreg index)", live_idx);
 
-        adjm_set(G->matrix, A->live_idx, live_idx);
-        adjm_set(G->matrix, live_idx, A->live_idx);
+        adjm_set(&G->matrix, A->live_idx, live_idx);
       }
     }
     vector_delete(reg_operands);
@@ -303,26 +325,71 @@ static void collect_interferences_from_block
     }
   }
 
-  // The entry block has no predecessors.
-  if (b->is_entry) return;
+}
+
+/// A block whose interferences are yet to be collected, and the values
+/// that are live at its end.
+typedef struct RABlockToVisit {
+  MIRBlock *block;
+  VRegVector live_vals;
+} RABlockToVisit;
 
+/// Walk over all possible paths in the control flow graph upwards from
+/// given block, computing instruction interferences based on the values
+/// that are currently live.
+///
+/// Since control flow can nest arbitrarily deeply, blocks are kept on
+/// a stack instead of recursing; each predecessor of a block gets its
+/// own copy of the values live at the start of that block, and they
+/// are visited in the same order as if we recursed.
+static void collect_interferences_from_block
+(MIRBlock *exit,
+ VRegVector *live_vals,
+ MIRBlockVisitCounts *visits,
+ AdjacencyGraph *G
+ )
+{
+  Vector(RABlockToVisit) stack = {0};
+  RABlockToVisit first = {.block = exit};
+  foreach (lv, *live_vals) vector_push(first.live_vals, *lv);
+  vector_push(stack, first);
+
+  while (stack.size) {
+    RABlockToVisit visit = vector_pop(stack);
+    MIRBlock *b = visit.block;
+
+    /// Don't visit the same block thrice.
+    usz *count = map_get_default(*visits, b);
+    if (*count == 2) {
+      vector_delete(visit.live_vals);
+      continue;
+    }
+    ++*count;
+
+    collect_interferences_in_block(b, &visit.live_vals, G);
+
+    // The entry block has no predecessors.
+    if (!b->is_entry) {
 #ifdef DEBUG_RA
-  foreach_ptr (MIRBlock*, parent, b->predecessors) {
-    print("  Parent block:\n");
-    print_mir_block(parent);
-  }
+      foreach_ptr (MIRBlock*, parent, b->predecessors) {
+        print("  Parent block:\n");
+        print_mir_block(parent);
+      }
 #endif
 
-  foreach_val (parent, b->predecessors) {
-    // Copy live vals
-    VRegVector live_vals_copy = {0};
-    foreach (lv, *live_vals)
-      vector_push(live_vals_copy, *lv);
-
-    collect_interferences_from_block(desc, parent, &live_vals_copy, vregs, visited, doubly_visited, G);
+      /// Push the predecessors in reverse so the first one is visited first.
+      for (usz i = b->predecessors.size; i--;) {
+        // Copy live vals
+        RABlockToVisit parent = {.block = b->predecessors.data[i]};
+        foreach (lv, visit.live_vals) vector_push(parent.live_vals, *lv);
+        vector_push(stack, parent);
+      }
+    }
 
-    vector_delete(live_vals_copy);
+    vector_delete(visit.live_vals);
   }
+
+  vector_delete(stack);
 }
 
 /// For each exit block `b` in given function, collect interferences
@@ -354,20 +421,17 @@ static void collect_interferences_for_function
 #endif
 
   VRegVector live_vals = {0};
-  MIRBlockVector visited = {0};
-  MIRBlockVector doubly_visited = {0};
+  MIRBlockVisitCounts visits = {0};
 
   // From each exit block (collected above), follow control flow to the
   // root of the function (entry block), or to a block already visited.
   foreach_val (b, exits) {
     vector_clear(live_vals);
-    vector_clear(visited);
-    vector_clear(doubly_visited);
-    collect_interferences_from_block(desc, b, &live_vals, vregs, &visited, &doubly_visited, G);
+    map_clear(visits);
+    collect_interferences_from_block(b, &live_vals, &visits, G);
   }
 
-  vector_delete(doubly_visited);
-  vector_delete(visited);
+  map_delete(visits);
   vector_delete(live_vals);
   vector_delete(exits);
 }
@@ -417,7 +481,7 @@ static void build_adjacency_graph(MIRFunction *f, const MachineDescription *desc
     usz regmask = 0;
     foreach_ptr (IRInstruction *, B, *instructions) {
       if (A == B) { break; } /// (!)
-      if (!adjm(G->matrix, A->index, B->index)) { continue; }
+      if (!adjm(&G->matrix, A->index, B->index)) { continue; }
       regmask |= desc->instruction_register_interference(B);
       if (B->result) regmask |= 1 << (B->result - 1);
     }
@@ -439,7 +503,7 @@ void print_adjacency_matrix(AdjacencyMatrix m) {
   for (usz y = 0; y < m.size; ++y) {
     printf("%6zu|", y);
     for (usz x = 0; x < y; ++x) {
-      bool adj = adjm(m, x, y);
+      bool adj = adjm(&m, x, y);
       adj ? printf("%4u", adj) : printf("    ");
     }
     printf("\n");
@@ -502,6 +566,7 @@ void build_adjacency_lists(VRegVector *vregs, AdjacencyGraph *G) {
 
   foreach_index (i, *vregs) {
     AdjacencyList *list = calloc(1, sizeof(AdjacencyList));
+    memory_record(MEMORY_RA, sizeof(AdjacencyList));
     G->lists.data[i] = list;
     list->index = i;
     list->vreg = vregs->data[i];
@@ -511,16 +576,34 @@ void build_adjacency_lists(VRegVector *vregs, AdjacencyGraph *G) {
     list->regmask = G->regmasks[i];
   }
 
-  foreach_index (A, *vregs) {
-    foreach_index (B, *vregs) {
-      if (A == B) { break; } /// (!)
-      if (adjm(G->matrix, A, B)) {
+  /// Values don’t interfere with themselves.
+  if (G->matrix.bits) {
+    foreach_index (A, *vregs) {
+      usz row = A * (A + 1) / 2;
+      for (usz B = 0; B < A; B++) {
+        /// Skip the rest of the word if it is empty.
+        u64 word = G->matrix.bits[(row + B) / 64] >> ((row + B) % 64);
+        if (!word) {
+          B += 63 - (row + B) % 64;
+          continue;
+        }
+        if (!(word & 1)) continue;
         AdjacencyList *a_list = G->lists.data[A];
         AdjacencyList *b_list = G->lists.data[B];
         vector_push(a_list->adjacencies, B);
         vector_push(b_list->adjacencies, A);
       }
     }
+  } else {
+    foreach (edge, G->matrix.edges) {
+      usz A = (usz) (edge->key >> 32);
+      usz B = (usz) (edge->key & UINT32_MAX);
+      if (!edge->value || A == B) continue;
+      AdjacencyList *a_list = G->lists.data[A];
+      AdjacencyList *b_list = G->lists.data[B];
+      vector_push(a_list->adjacencies, B);
+      vector_push(b_list->adjacencies, A);
+    }
   }
 }
 
@@ -583,7 +666,7 @@ void coalesce(IRFunction *f, const MachineDescription *desc, IRInstructions *ins
       /// To is precoloured, from is not, and from does not interfere
       /// with the precoloured register: assign the precoloured register to
       /// from, replace all uses of to with from, and eliminate the copy.
-      if (to->result && !from->result && !adjm(G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[from->index], to)) {
+      if (to->result && !from->result && !adjm(&G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[from->index], to)) {
         from->result = to->result;
         DEBUG("To is coloured, from is not, and from doesn't interfere.\n");
         goto eliminate;
@@ -607,7 +690,7 @@ void coalesce(IRFunction *f, const MachineDescription *desc, IRInstructions *ins
         }
       }
 
-      if (!to_use_from_interference && !to->result && from->result && !adjm(G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[to->index], from)) {
+      if (!to_use_from_interference && !to->result && from->result && !adjm(&G->matrix, to->index, from->index) && !check_register_interference(G->regmasks[to->index], from)) {
         /// Collect all PHI nodes that use to.
         vector_clear(phis);
         foreach_ptr (IRInstruction *, phi, *instructions) {
@@ -632,7 +715,7 @@ void coalesce(IRFunction *f, const MachineDescription *desc, IRInstructions *ins
 
       /// Neither from nor to are precoloured, and they do not interfere.
       /// Replace all uses of to with from, and eliminate the copy.
-      //if (!to->result && !from->result && !adjm(G->matrix, to->index, from->index)) {
+      //if (!to->result && !from->result && !adjm(&G->matrix, to->index, from->index)) {
       //  DEBUG("Neither from nor to are coloured, and no interference\n");
       //  goto eliminate;
       //}
@@ -854,6 +937,9 @@ void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
   // List of all virtual registers that need coloured.
   // TODO: List of all *registers* that need coloured.
   VRegVector vregs = {0};
+  AdjacencyGraph G = {0};
+  G.order = desc->register_count;
+  G.vregs = &vregs;
 
   // Populate list of registers, first using hardware registers, then using virtual registers.
   for (usz i = 0; i < desc->register_count; ++i) {
@@ -866,19 +952,17 @@ void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
       FOREACH_MIR_OPERAND(inst, op) {
         if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START) {
           // Only push if vector does not already contain the value.
-          if (!vreg_vector_contains(&vregs, op->value.reg.value)) {
+          if (register_index(&G, op->value.reg.value) == (usz) -1) {
             VReg v  = {0};
             v.value = op->value.reg.value;
             v.size = op->value.reg.size;
-            vector_push(vregs, v);
+            add_virtual_register(&G, v);
           }
         }
       }
     }
   }
 
-  AdjacencyGraph G = {0};
-  G.order = desc->register_count;
   build_adjacency_graph(f, desc, &vregs, &G);
   PRINT_ADJACENCY_MATRIX(G.matrix);
 
@@ -914,25 +998,40 @@ void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
 
   color(desc, &stack, &G);
 
-  foreach_val (list, G.lists) {
-    VReg vreg = list->vreg;
-    if (vreg.value < MIR_ARCH_START) continue;
-
-    Register color = list->color;
-
-    foreach_val (bb, f->blocks) {
-      foreach_val (inst, bb->instructions) {
-        if (inst->reg == vreg.value) inst->reg = color;
-        FOREACH_MIR_OPERAND(inst, op) {
-          if (op->kind == MIR_OP_REGISTER && op->value.reg.value == vreg.value) {
-            op->value.reg.value = color;
-            op->value.reg.size = (uint16_t)vreg.size;
-          }
+  /// Replace each virtual register with its colour.
+  foreach_val (bb, f->blocks) {
+    foreach_val (inst, bb->instructions) {
+      if (inst->reg >= MIR_ARCH_START) {
+        usz index = register_index(&G, inst->reg);
+        if (index != (usz) -1) inst->reg = G.lists.data[index]->color;
+      }
+      FOREACH_MIR_OPERAND(inst, op) {
+        if (op->kind == MIR_OP_REGISTER && op->value.reg.value >= MIR_ARCH_START) {
+          AdjacencyList *list = G.lists.data[register_index(&G, op->value.reg.value)];
+          op->value.reg.value = list->color;
+          op->value.reg.size = (uint16_t)list->vreg.size;
         }
       }
     }
+  }
+
+  foreach_val (list, G.lists) {
+    if (list->vreg.value < MIR_ARCH_START) continue;
+    DEBUG("Vreg %V mapped to HWreg %V\n", (usz)list->vreg.value, (usz)list->color);
+  }
+
+  if (STATS_ENABLED()) {
+    usz edges = 0;
+    usz colours = 0;
+    foreach_val (list, G.lists) {
+      edges += list->adjacencies.size;
+      if (list->vreg.value >= MIR_ARCH_START && list->color) colours |= (usz)1 << (list->color - 1);
+    }
 
-    DEBUG("Vreg %V mapped to HWreg %V\n", (usz)vreg.value, (usz)color);
+    /// Every edge is in the adjacency lists of both of its vertices.
+    stats_add(STAT_RA_VIRTUAL_REGISTERS, vregs.size - desc->register_count);
+    stats_add(STAT_RA_INTERFERENCE_EDGES, edges / 2);
+    stats_max(STAT_RA_MAX_COLOURS_USED, (u64)__builtin_popcountll(colours));
   }
 
   DEBUG("After coloring\n");
@@ -954,7 +1053,9 @@ void allocate_registers(MIRFunction *f, const MachineDescription *desc) {
   vector_delete(G.lists);
   vector_delete(vregs);
   vector_delete(stack);
-  free(G.matrix.data);
+  free(G.matrix.bits);
+  map_delete(G.matrix.edges);
+  vector_delete(G.indices);
   free(G.regmasks);
   vector_delete(vregs);
 }
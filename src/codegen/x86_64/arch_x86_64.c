@@ -15,25 +15,29 @@
 #include <ir/ir.h>
 #include <module.h>
 #include <parser.h>
+#include <platform.h>
+#include <stats.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <timing.h>
 #include <typechecker.h>
 #include <utils.h>
 #include <vector.h>
 
 #define X86_64_GENERATE_MACHINE_CODE
 
-/// FIXME: JANK.
-Register *caller_saved_registers = NULL;
-size_t caller_saved_register_count = 0;
+/// FIXME: JANK. These are set when a context is created; they are
+/// thread-local so that several modules can be compiled at once.
+THREAD_LOCAL Register *caller_saved_registers = NULL;
+THREAD_LOCAL size_t caller_saved_register_count = 0;
 
 /// FIXME: JANK.
-Register *argument_registers = NULL;
-size_t argument_register_count = 0;
+THREAD_LOCAL Register *argument_registers = NULL;
+THREAD_LOCAL size_t argument_register_count = 0;
 
 span unreferenced_block_name = literal_span_raw("");
 
@@ -59,12 +63,29 @@ static const usz max_register_size = 8;
 
 #endif // X86_64_GENERATE_MACHINE_CODE
 
+/// Set the registers of the given calling convention for this thread.
+static void use_calling_convention(CodegenCallingConvention call_convention) {
+  STATIC_ASSERT(CG_CALL_CONV_COUNT == 2, "Exhaustive handling of calling conventions");
+  switch (call_convention) {
+  case CG_CALL_CONV_MSWIN:
+    caller_saved_register_count = MSWIN_CALLER_SAVED_REGISTER_COUNT;
+    caller_saved_registers = mswin_caller_saved_registers;
+    argument_register_count = MSWIN_ARGUMENT_REGISTER_COUNT;
+    argument_registers = mswin_argument_registers;
+    break;
+  case CG_CALL_CONV_SYSV:
+    caller_saved_register_count = LINUX_CALLER_SAVED_REGISTER_COUNT;
+    caller_saved_registers = linux_caller_saved_registers;
+    argument_register_count = LINUX_ARGUMENT_REGISTER_COUNT;
+    argument_registers = linux_argument_registers;
+    break;
+  default: ICE("Unhandled calling convention");
+  }
+}
+
 /// Creates a context for the CG_FMT_x86_64_MSWIN architecture.
 CodegenContext *codegen_context_x86_64_mswin_create() {
-  caller_saved_register_count = MSWIN_CALLER_SAVED_REGISTER_COUNT;
-  caller_saved_registers = mswin_caller_saved_registers;
-  argument_register_count = MSWIN_ARGUMENT_REGISTER_COUNT;
-  argument_registers = mswin_argument_registers;
+  use_calling_convention(CG_CALL_CONV_MSWIN);
 
   CodegenContext *cg_ctx = calloc(1,sizeof(CodegenContext));
   cg_ctx->ffi.cchar_size = 8;
@@ -79,10 +100,7 @@ CodegenContext *codegen_context_x86_64_mswin_create() {
 
 /// Creates a context for the x86_64/CG_CALL_CONV_SYSV.
 CodegenContext *codegen_context_x86_64_linux_create() {
-  caller_saved_register_count = LINUX_CALLER_SAVED_REGISTER_COUNT;
-  caller_saved_registers = linux_caller_saved_registers;
-  argument_register_count = LINUX_ARGUMENT_REGISTER_COUNT;
-  argument_registers = linux_argument_registers;
+  use_calling_convention(CG_CALL_CONV_SYSV);
 
   CodegenContext *cg_ctx = calloc(1,sizeof(CodegenContext));
   cg_ctx->ffi.cchar_size = 8;
@@ -956,7 +974,733 @@ static void mir_x86_64_function_exit_at(enum StackFrameKind frame_kind, MIRBlock
   }
 }
 
+/// Lower truncation and intrinsics before instruction selection.
+static void lower_before_isel(CodegenContext *context, MIRFunction *function) {
+  if (!function->origin || !ir_func_is_definition(function->origin)) return;
+  foreach_val (block, function->blocks) {
+    MIRInstructionVector instructions_to_remove = {0};
+    foreach_index (i, block->instructions) {
+      MIRInstruction* instruction = block->instructions.data[i];
+      switch (instruction->opcode) {
+      default: break;
+
+      case MIR_TRUNCATE: {
+        vector_push(instructions_to_remove, instruction);
+
+        MIROperand *src = mir_get_op(instruction, 0);
+        MIROperand *from_op = mir_get_op(instruction, 1);
+        MIROperand *to_op = mir_get_op(instruction, 2);
+        i64 sz_from = from_op->value.imm;
+        i64 sz_to = to_op->value.imm;
+        ASSERT(sz_from > sz_to, "Truncate must be from larger to smaller size");
+        ASSERT(sz_from <= 8, "Cannot truncate something larger than a register!");
+
+        i64 mask = 0;
+        switch (sz_to) {
+        case 1: mask = 0xff; break;
+        case 2: mask = 0xffff; break;
+        case 4: mask = 0xffffffff; break;
+        default: ICE("Unhandled truncate \"to\" size %I", sz_to);
+        }
+
+        if (src->kind == MIR_OP_IMMEDIATE) {
+          i64 imm = src->value.imm & mask;
+          MIRInstruction *move = mir_makenew(MX64_MOV);
+          mir_add_op(move, mir_op_immediate(imm));
+          mir_add_op(move, mir_op_reference(instruction));
+          mir_insert_instruction_with_reg(instruction->block, move, i++, instruction->reg);
+          break;
+        }
+
+        MIRInstruction *move = mir_makenew(MX64_MOV);
+        mir_add_op(move, *src);
+        mir_add_op(move, mir_op_reference(instruction));
+        mir_insert_instruction(instruction->block, move, i++);
+
+        MIRInstruction *and = mir_makenew(MX64_AND);
+        mir_add_op(and, mir_op_immediate(mask));
+        mir_add_op(and, mir_op_reference(instruction));
+        mir_insert_instruction_with_reg(instruction->block, and, i++, instruction->reg);
+      } break; // case MIR_TRUNCATE
+
+      /// Handle low-level intrinsics. The first operand
+      /// is the intrinsic kind.
+      case MIR_INTRINSIC: {
+        MIROperand *kind = mir_get_op(instruction, 0);
+        ASSERT(kind->kind == MIR_OP_IMMEDIATE, "Intrinsic kind must be an immediate");
+        STATIC_ASSERT(INTRIN_BACKEND_COUNT == 3, "Handle backend intrinsics in codegen");
+        switch (kind->value.imm) {
+          IGNORE_FRONTEND_INTRINSICS();
+
+          /// Memcpy should already have been lowered.
+          case INTRIN_BUILTIN_MEMCPY: UNREACHABLE();
+
+          /// For syscalls, just emit a bunch of moves and the syscall.
+          case INTRIN_BUILTIN_SYSCALL: {
+            ASSERT(context->call_convention == CG_CALL_CONV_SYSV);
+            ASSERT(instruction->operand_count <= 7);
+
+            /// Syscall argument registers are slightly different from
+            /// the regular C calling convention. Note: The syscall number
+            /// is treated as the first argument by us.
+            static enum Registers_x86_64 syscall_arg_regs[7] = {
+              REG_RAX, REG_RDI, REG_RSI, REG_RDX, REG_R10, REG_R8, REG_R9
+            };
+
+            enum Registers_x86_64* arg_regs = syscall_arg_regs;
+            bool first = true;
+            FOREACH_MIR_OPERAND (instruction, op) {
+              /// Don’t emit the intrinsic kind.
+              if (first) {
+                first = false;
+                continue;
+              }
+
+              MIRInstruction *mov = mir_makenew(MIR_COPY);
+              mir_add_op(mov, *op);
+              mir_insert_instruction_with_reg(instruction->block, mov, i++, *arg_regs++);
+            }
+
+            /// Insert syscall.
+            MIRInstruction *sys = mir_makenew(MX64_SYSCALL);
+            mir_add_op(sys, mir_op_register(REG_RAX, r64, true));
+            mir_insert_instruction_with_reg(instruction->block, sys, i++, REG_RAX);
+
+            /// Syscalls clobber rcx as well as r8-r11.
+            static enum Registers_x86_64 syscall_clobbers[5] = {
+              REG_RCX, REG_R8, REG_R9, REG_R10, REG_R11
+            };
+
+            MIROperandRegister clobbered = {0};
+            clobbered.size = r64;
+            for (usz r = 0; r < sizeof syscall_clobbers / sizeof *syscall_clobbers; r++) {
+              clobbered.value = syscall_clobbers[r];
+              mir_add_clobber(sys, clobbered);
+            }
+
+            /// Yeet intrinsic call.
+            vector_push(instructions_to_remove, instruction);
+          } break;
+
+          /// For a debug trap, emit an int 3.
+          case INTRIN_BUILTIN_DEBUGTRAP: {
+            MIRInstruction *int3 = mir_makenew(MX64_INT3);
+            mir_insert_instruction(instruction->block, int3, i++);
+            vector_push(instructions_to_remove, instruction);
+          } break;
+        }
+      } break; // case MIR_INTRINSIC
+
+      }
+    } // foreach (MIRInstruction)
+
+    mir_remove_instructions(block, instructions_to_remove);
+    vector_delete(instructions_to_remove);
+
+  } // foreach (MIRBlock)
+}
+
+/// After RA, the last fixups before code emission are applied.
+/// Calculate stack offsets
+/// Lowering of MIR_CALL, among other things (caller-saved registers)
+/// Remove register to register moves when value and size are equal.
+/// Saving/restoration of callee-saved registers used in function.
+static void lower_after_ra(CodegenContext *context, MIRFunction *function, const MachineDescription *desc) {
+  if (!function->origin || !ir_func_is_definition(function->origin)) return;
+
+  // Calculate stack offsets of frame objects
+  isz offset = 0;
+  foreach (fo, function->frame_objects) {
+    offset -= (isz) fo->size;
+    fo->offset = offset;
+  }
+
+  ASSERT(function->blocks.size, "Zero blocks within non-extern MIRFunction... How did you manage this?");
+
+  size_t func_regs = ir_func_regs_in_use(function->origin);
+
+  { // Save callee-saved registers used in this function
+    MIRBlock *first_block = vector_front(function->blocks);
+    for (Register r = 1; r < sizeof(func_regs) * 8; ++r) {
+      if (r == desc->result_register) continue;
+      if (func_regs & ((usz)1 << r) && is_callee_saved(r)) {
+        MIRInstruction *push = mir_makenew(MX64_PUSH);
+        mir_add_op(push, mir_op_register(r, r64, false));
+        mir_insert_instruction(first_block, push, 0);
+      }
+    }
+  }
+
+  { // Restore callee-saved registers used in this function
+    // Okay, I know this looks weird to insert push and pop without
+    // reversing iteration direction, but the key here is the insert
+    // function we are using; this one adds to the end, whereas the push
+    // one adds to the beginning. Therefore, we can do the same loop but
+    // have reversed order of output instructions.
+    for (Register r = 1; r < sizeof(func_regs) * 8; ++r) {
+      if (r == desc->result_register) continue;
+      if (func_regs & ((usz)1 << r) && is_callee_saved(r)) {
+        MIRInstruction *pop = mir_makenew(MX64_POP);
+        mir_add_op(pop, mir_op_register(r, r64, false));
+        mir_append_instruction(function, pop);
+      }
+    }
+  }
+
+  foreach_index (block_index, function->blocks) {
+    MIRBlock *block = function->blocks.data[block_index];
+    MIRInstructionVector instructions_to_remove = {0};
+    foreach_index (i, block->instructions) {
+      MIRInstruction *instruction = block->instructions.data[i];
+      switch (instruction->opcode) {
+      default: break;
+
+      // Basic jump threading
+      case MX64_JMP: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
+          MIROperand *op = mir_get_op(instruction, 0);
+          MIRBlock *destination = op->value.block;
+
+          // Remove a jump if it is to the next sequential block to be output in
+          // code. This means we will fallthrough with no branch, increasing more
+          // space for actually useful jumps in the BTB.
+          MIRBlock *next_block = NULL;
+          if (block_index + 1 < function->blocks.size)
+            next_block = function->blocks.data[block_index + 1];
+          if (destination == next_block) vector_push(instructions_to_remove, instruction);
+        }
+      } break; // case MX64_JMP
+
+      case MIR_CALL: {
+        // Tail call.
+        if (ir_call_tail(instruction->origin)) {
+          // Restore the frame pointer if we have one.
+          mir_x86_64_function_exit_at(stack_frame_kind(instruction->block->function), instruction->block, &i);
+          MIRInstruction *jump = mir_makenew(MX64_JMP);
+          mir_add_op(jump, *mir_get_op(instruction, 0));
+          mir_insert_instruction(instruction->block, jump, i++);
+
+          /// Don’t forget to remove the call instruction.
+          vector_push(instructions_to_remove, instruction);
+          break;
+        }
+
+        size_t regs_pushed_count = 0;
+
+        // Save return register if it is not the result of this
+        // function call already; if it is, the RA has already asserted
+        // that RAX can be clobbered by this instruction.
+        // TODO: Determine a better way to figure out if we actually
+        // need to save the result register over this call boundary.
+        if (instruction->reg < MIR_ARCH_START && instruction->reg != desc->result_register && func_regs & (1 << desc->result_register)) {
+          MIRInstruction *push = mir_makenew(MX64_PUSH);
+          mir_add_op(push, mir_op_register(desc->result_register, r64, false));
+          mir_insert_instruction(instruction->block, push, i++);
+          regs_pushed_count++;
+        }
+
+        // Count caller-saved registers used in function, excluding result register (counted above).
+        size_t x = func_regs;
+        for (size_t r = REG_RAX + 1; r < sizeof(x) * 8; ++r)
+          if (x & ((usz)1 << r) && is_caller_saved((MIRRegister)r))
+            regs_pushed_count++;
+
+        // Push caller saved registers
+        // TODO: Don't push registers that are used for arguments.
+        for (Register r = REG_RAX + 1; r < sizeof(func_regs) * 8; ++r) {
+          if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
+            MIRInstruction *push = mir_makenew(MX64_PUSH);
+            mir_add_op(push, mir_op_register(r, r64, false));
+            mir_insert_instruction(instruction->block, push, i++);
+          }
+        }
+
+        // The amount of bytes that need to be pushed onto/popped off
+        // of the stack, not including saving/restoring of registers.
+        isz bytes_pushed = 0;
+
+        if (context->call_convention == CG_CALL_CONV_MSWIN) {
+          // Push arguments, if need be.
+          isz argument_registers_left = (isz)argument_register_count;
+          bool first = true;
+          FOREACH_MIR_OPERAND(instruction, arg) {
+            if (first) {
+              first = false;
+              continue;
+            }
+            --argument_registers_left;
+            // If argument is passed on stack due to ABI.
+            if (arg->kind == MIR_OP_LOCAL_REF) {
+              // Push the base pointer.
+              MIRInstruction *push = mir_makenew(MX64_PUSH);
+              mir_add_op(push, mir_op_register(REG_RBP, r64, false));
+              mir_insert_instruction(instruction->block, push, i++);
+              bytes_pushed += 8;
+              // Subtract local's offset from base pointer from the newly pushed base pointer.
+              MIRInstruction *sub = mir_makenew(MX64_SUB);
+              ASSERT(arg->value.local_ref < function->frame_objects.size, "Referenced frame object does not exist");
+              mir_add_op(sub, mir_op_immediate(-function->frame_objects.data[arg->value.local_ref].offset)); // value to subtract
+              mir_add_op(sub, mir_op_register(REG_RSP, r64, false)); // base address
+              mir_add_op(sub, mir_op_immediate(0)); // zero offset from rsp
+              mir_add_op(sub, mir_op_immediate(8)); // 8 == sizeof address on stack
+              mir_insert_instruction(instruction->block, sub, i++);
+            } else if (argument_registers_left < 0) {
+              if (arg->kind == MIR_OP_REGISTER) {
+                if (arg->value.reg.size == r64) {
+                  MIRInstruction *push = mir_makenew(MX64_PUSH);
+                  mir_add_op(push, *arg);
+                  mir_insert_instruction(instruction->block, push, i++);
+                  bytes_pushed += 8;
+                } else if (arg->value.reg.size == r32) {
+                  MIRInstruction *move = mir_makenew(MX64_MOV);
+                  mir_add_op(move, *arg);
+                  mir_add_op(move, mir_op_register(REG_RAX, r32, false));
+                  mir_insert_instruction(instruction->block, move, i++);
+                  MIRInstruction *push = mir_makenew(MX64_PUSH);
+                  mir_add_op(push, mir_op_register(REG_RAX, r64, false));
+                  mir_insert_instruction(instruction->block, push, i++);
+                  bytes_pushed += 8;
+                } else {
+                  MIRInstruction *move = mir_makenew(MX64_MOVZX);
+                  mir_add_op(move, *arg);
+                  mir_add_op(move, mir_op_register(REG_RAX, r64, false));
+                  mir_insert_instruction(instruction->block, move, i++);
+                  MIRInstruction *push = mir_makenew(MX64_PUSH);
+                  mir_add_op(push, mir_op_register(REG_RAX, r64, false));
+                  mir_insert_instruction(instruction->block, push, i++);
+                  bytes_pushed += 8;
+                }
+              } else if (arg->kind == MIR_OP_IMMEDIATE) {
+                MIRInstruction *move = mir_makenew(MX64_MOV);
+                mir_add_op(move, *arg);
+                if (arg->value.imm >= INT32_MIN && arg->value.imm <= INT32_MAX)
+                  mir_add_op(move, mir_op_register(REG_RAX, r32, false));
+                else mir_add_op(move, mir_op_register(REG_RAX, r64, false));
+                mir_insert_instruction(instruction->block, move, i++);
+                MIRInstruction *push = mir_makenew(MX64_PUSH);
+                mir_add_op(push, mir_op_register(REG_RAX, r64, false));
+                mir_insert_instruction(instruction->block, push, i++);
+                bytes_pushed += 8;
+              } else {
+                print_mir_operand(function, arg);
+                TODO("Unhandled stack argument operand with kind %s", mir_operand_kind_string(arg->kind));
+              }
+            }
+          }
+        }
+
+        isz bytes_to_push = 0;
+        // Align stack pointer before call, if necessary.
+        if (regs_pushed_count & 0b1)
+          bytes_to_push += 8;
+        // Shadow stack
+        if (context->call_convention == CG_CALL_CONV_MSWIN)
+          bytes_to_push += 32;
+
+        if (bytes_to_push) {
+          MIRInstruction *sub = mir_makenew(MX64_SUB);
+          mir_add_op(sub, mir_op_immediate(bytes_to_push));
+          mir_add_op(sub, mir_op_register(REG_RSP, r64, false));
+          mir_insert_instruction(instruction->block, sub, i++);
+          bytes_pushed += bytes_to_push;
+        }
+
+        MIRInstruction *call = mir_makenew(MX64_CALL);
+        call->origin = instruction->origin;
+        instruction->lowered = call;
+        mir_add_op(call, *mir_get_op(instruction, 0));
+        mir_insert_instruction_with_reg(instruction->block, call, i++, instruction->reg);
+
+        // Restore stack
+        if (bytes_pushed) {
+          MIRInstruction *add = mir_makenew(MX64_ADD);
+          mir_add_op(add, mir_op_immediate((isz)bytes_pushed));
+          mir_add_op(add, mir_op_register(REG_RSP, r64, false));
+          mir_insert_instruction(instruction->block, add, i++);
+        }
+
+        // Restore caller saved registers used in called function.
+        for (Register r = sizeof(func_regs) * 8 - 1; r > REG_RAX; --r) {
+          if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
+            MIRInstruction *pop = mir_makenew(MX64_POP);
+            mir_add_op(pop, mir_op_register(r, r64, false));
+            mir_insert_instruction(instruction->block, pop, i++);
+          }
+        }
+
+        // If inst->reg is still a virtual register, then this call's
+        // result just gets discarded (no use of it's vreg) so we can just
+        // /not/ do this part.
+        if (instruction->reg < MIR_ARCH_START && instruction->reg != desc->result_register) {
+          MIRInstruction *move = mir_makenew(MX64_MOV);
+          mir_add_op(move, mir_op_register(desc->result_register, r64, false));
+          mir_add_op(move, mir_op_register(instruction->reg, r64, false));
+          mir_insert_instruction(instruction->block, move, i++);
+
+          // Restore return register.
+          if (func_regs & (1 << desc->result_register)) {
+            MIRInstruction *pop = mir_makenew(MX64_POP);
+            mir_add_op(pop, mir_op_register(desc->result_register, r64, false));
+            mir_insert_instruction(instruction->block, pop, i++);
+          }
+        }
+
+        vector_push(instructions_to_remove, instruction);
+
+      } break; // case MIR_CALL
+
+      case MX64_MOVZX: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          // There is no movzx r32, r64 ... that's just called a
+          // `mov r32, r32`, due to false dependency nonsense. And we
+          // don't even need to do that, because the register that we
+          // *would* be zeroing out the top bits of has already had to
+          // have been moved into or something that clears the top bits.
+          if (src->value.reg.size == r32) vector_push(instructions_to_remove, instruction);
+        }
+      } break; // case MX64_MOVZX
+
+      case MPSEUDO_R2R: {
+        if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER))
+          ICE("MPSEUDO_R2R instruction does not have two register operands.");
+        MIROperand *src = mir_get_op(instruction, 0);
+        MIROperand *dst = mir_get_op(instruction, 1);
+
+        // Register move from self to self is a no-op.
+        if (src->value.reg.value == dst->value.reg.value && src->value.reg.size == dst->value.reg.size)
+          vector_push(instructions_to_remove, instruction);
+        else if (src->value.reg.size < dst->value.reg.size) {
+          // Register move from smaller register to larger register requires zero extension.
+          instruction->opcode = MX64_MOVZX;
+        } else if (src->value.reg.size > dst->value.reg.size) {
+          // Register move from larger register to smaller register requires truncation.
+          // To accomplish this, we simply move from a smaller version of the
+          // same register; by reducing the source, we have effectively truncated
+          // the result.
+          instruction->opcode = MX64_MOV;
+          src->value.reg.size = dst->value.reg.size;
+        }
+
+      } break;
+
+      case MX64_MOV: {
+        // MOV(eax, rax) -> ERROR (mov cannot move between mismatched size registers)
+        // MOV(REG x, REG x) -> NOP (remove)
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *lhs = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!lhs->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
+            putchar('\n');
+            lhs->value.reg.size = r64;
+          }
+          if (!rhs->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
+            putchar('\n');
+            rhs->value.reg.size = r64;
+          }
+          if (lhs->value.reg.size != rhs->value.reg.size)
+            ICE("x86_64 cannot move between mismatched-sized registers %s and %s, sorry", regname(lhs->value.reg.value, lhs->value.reg.size), regname(rhs->value.reg.value, rhs->value.reg.size));
+          if (lhs->value.reg.value == rhs->value.reg.value && lhs->value.reg.size == rhs->value.reg.size) {
+            vector_push(instructions_to_remove, instruction);
+          }
+        }
+      } break;
+
+      } // switch (instruction->opcode)
+
+    } // foreach (MIRInstruction*)
+
+    mir_remove_instructions(block, instructions_to_remove);
+    vector_delete(instructions_to_remove);
+
+  } // foreach (MIRBlock*)
+}
+
+const char *codegen_isel_table_x86_64(void) {
+  // TODO: Either embed x86_64 isel or somehow make this path knowable (i.e. via install).
+  return ISEL_TABLE_LOCATION_X86_64;
+}
+
+/// Get the ISel patterns for x86_64.
+static ISelPatterns isel_patterns_x86_64(void) {
+  return isel_patterns_get(codegen_isel_table_x86_64());
+}
+
+void codegen_warm_caches_x86_64(void) {
+  (void) isel_patterns_x86_64();
+}
+
+/// Lower a function to MIR.
+static void generate_mir(MIRFunction *function) {
+  Timer timer = timer_start_function(PHASE_MIR, as_span(function->name));
+  mir_from_ir_function(function);
+  timer_stop(&timer);
+}
+
+/// Count the instructions in a function for statistics.
+static usz mir_instruction_count(MIRFunction *function) {
+  usz count = 0;
+  foreach_val (block, function->blocks) count += block->instructions.size;
+  return count;
+}
+
+/// Perform instruction selection for a function.
+static void select_instructions(CodegenContext *context, MIRFunction *function, ISelPatterns patterns) {
+  Timer timer = timer_start_function(PHASE_ISEL, as_span(function->name));
+  mir_use_function(function);
+
+  // ISel in code...
+  lower_before_isel(context, function);
+
+  // ISel using DSL
+  if (STATS_ENABLED()) stats_add(STAT_ISEL_MIR_BEFORE, mir_instruction_count(function));
+  isel_do_selection_for_function(function, patterns);
+  if (STATS_ENABLED()) stats_add(STAT_ISEL_MIR_AFTER, mir_instruction_count(function));
+
+  mir_use_function(NULL);
+  timer_stop(&timer);
+}
+
+/// Allocate registers for a function.
+static void allocate_function_registers(MIRFunction *function, const MachineDescription *desc) {
+  Timer timer = timer_start_function(PHASE_RA, as_span(function->name));
+  mir_use_function(function);
+  allocate_registers(function, desc);
+  mir_use_function(NULL);
+  timer_stop(&timer);
+}
+
+/// Apply the last fixups to a function and emit its code.
+static void emit_function(CodegenContext *context, MIRFunction *function, const MachineDescription *desc) {
+  Timer timer = timer_start_function(PHASE_EMIT, as_span(function->name));
+
+  /// After RA, the last fixups before code emission are applied.
+  mir_use_function(function);
+  lower_after_ra(context, function, desc);
+  mir_use_function(NULL);
+  if (debug_ir) print_mir_function_with_mnemonic(function, mir_x86_64_opcode_mnemonic);
+
+  STATIC_ASSERT(TARGET_COUNT == 6, "Exhaustive handling of target formats in x86_64 backend");
+
+  // EMIT ASSEMBLY CODE
+  if (context->target == TARGET_GNU_ASM_ATT || context->target == TARGET_GNU_ASM_INTEL)
+    emit_x86_64_assembly_function(context, function);
+
+#ifdef X86_64_GENERATE_MACHINE_CODE
+
+  // EMIT MACHINE CODE (GENERAL OBJECT FILE)
+  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT)
+    emit_x86_64_generic_object_function(context, function);
+#endif // x86_64_GENERATE_MACHINE_CODE
+
+  timer_stop(&timer);
+}
+
+/// Emit everything that precedes the code of the functions.
+static void emit_header(CodegenContext *context, MIRFunctionVector functions) {
+  STATIC_ASSERT(TARGET_COUNT == 6, "Exhaustive handling of target formats in x86_64 backend");
+  if (context->target == TARGET_GNU_ASM_ATT || context->target == TARGET_GNU_ASM_INTEL)
+    emit_x86_64_assembly_header(context, functions);
+
+#ifdef X86_64_GENERATE_MACHINE_CODE
+  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT)
+    emit_x86_64_generic_object_metadata(context);
+#else
+  (void) functions;
+#endif // x86_64_GENERATE_MACHINE_CODE
+}
+
+/// Run the backend on one function after the other.
+static void codegen_functions_serial(CodegenContext *context, const MachineDescription *desc) {
+  Timer timer = timer_start(PHASE_MIR);
+  MIRFunctionVector machine_instructions_from_ir = mir_create_functions(context);
+  foreach_val (function, machine_instructions_from_ir)
+    generate_mir(function);
+  timer_stop(&timer);
+
+  timer = timer_start(PHASE_ISEL);
+
+  ISelPatterns patterns = isel_patterns_x86_64();
+
+  //isel_print_patterns(&patterns, mir_x86_64_opcode_mnemonic);
+
+  if (debug_ir) {
+    print("================ ISel ================\n"
+          "Before:\n");
+    foreach_val (f, machine_instructions_from_ir)
+      print_mir_function_with_mnemonic(f, mir_x86_64_opcode_mnemonic);
+  }
+
+  foreach_val (function, machine_instructions_from_ir)
+    select_instructions(context, function, patterns);
+  if (patterns.size) isel_mark_defining_uses(machine_instructions_from_ir);
+
+  if (debug_ir) {
+    print("After:\n");
+    foreach_val (f, machine_instructions_from_ir)
+      print_mir_function_with_mnemonic(f, mir_x86_64_opcode_mnemonic);
+  }
+
+  timer_stop(&timer);
+
+  if (debug_ir)
+    print("================ RA ================\n");
+
+  // RA -- Register Allocation
+  timer = timer_start(PHASE_RA);
+  foreach_val (f, machine_instructions_from_ir)
+    allocate_function_registers(f, desc);
+  timer_stop(&timer);
+
+  // CODE EMISSION
+  // TODO: Allow for multiple targets here?
+  timer = timer_start(PHASE_EMIT);
+  emit_header(context, machine_instructions_from_ir);
+
+  /// The code of a function is no longer needed once it has been
+  /// emitted. Freeing it right away means that the MIR of the whole
+  /// module is never alive at the same time as the emitted code.
+  foreach_val (function, machine_instructions_from_ir) {
+    emit_function(context, function, desc);
+    mir_function_free_code(function);
+  }
+  foreach_val (function, machine_instructions_from_ir) mir_function_free(function);
+  vector_delete(machine_instructions_from_ir);
+  timer_stop(&timer);
+}
+
+/// State shared by the workers of the parallel backend.
+typedef struct BackendJob {
+  CodegenContext *context;
+  const MachineDescription *desc;
+  MIRFunctionVector functions;
+  ISelPatterns patterns;
+
+  /// Code emitted for each function, in function order. Depending
+  /// on the target, either the assembly or an object that contains
+  /// only a code section is used.
+  string *assembly;
+  GenericObjectFile *objects;
+} BackendJob;
+
+static void backend_mir_job(usz index, void *data) {
+  BackendJob *job = data;
+  generate_mir(job->functions.data[index]);
+}
+
+static void backend_isel_job(usz index, void *data) {
+  BackendJob *job = data;
+  use_calling_convention(job->context->call_convention);
+  select_instructions(job->context, job->functions.data[index], job->patterns);
+}
+
+static void backend_ra_job(usz index, void *data) {
+  BackendJob *job = data;
+  use_calling_convention(job->context->call_convention);
+  allocate_function_registers(job->functions.data[index], job->desc);
+}
+
+/// Emit the code of a function into its own buffer.
+static void backend_emit_job(usz index, void *data) {
+  BackendJob *job = data;
+  use_calling_convention(job->context->call_convention);
+
+  /// Emission only ever writes to `code` or `object`, so a shallow
+  /// copy of the context is enough to redirect it.
+  CodegenContext context = *job->context;
+  PlatformMemoryStream stream = {0};
+  STATIC_ASSERT(TARGET_COUNT == 6, "Exhaustive handling of target formats in x86_64 backend");
+  if (context.target == TARGET_GNU_ASM_ATT || context.target == TARGET_GNU_ASM_INTEL) {
+    platform_memory_stream_open(&stream);
+    context.code = stream.file;
+  }
+
+#ifdef X86_64_GENERATE_MACHINE_CODE
+  if (context.target == TARGET_COFF_OBJECT || context.target == TARGET_ELF_OBJECT) {
+    GenericObjectFile *object = job->objects + index;
+    Section sec_code = {0};
+    sec_code.name = ".text";
+    sec_code.attributes |= SEC_ATTR_EXECUTABLE;
+    vector_push(object->sections, sec_code);
+    context.object = object;
+  }
+#endif // x86_64_GENERATE_MACHINE_CODE
+
+  emit_function(&context, job->functions.data[index], job->desc);
+  mir_function_free_code(job->functions.data[index]);
+  if (stream.file) job->assembly[index] = platform_memory_stream_close(&stream);
+}
+
+/// Run the backend on several functions at once.
+///
+/// Every function is lowered, selected, allocated, and emitted on
+/// its own; the only serial step in between is marking defining uses,
+/// as that carries state from one function to the next. The code of
+/// each function is then appended to the output in function order,
+/// so the result is the same as that of the serial backend.
+static void codegen_functions_parallel(CodegenContext *context, const MachineDescription *desc) {
+  BackendJob job = {0};
+  job.context = context;
+  job.desc = desc;
+
+  Timer timer = timer_start(PHASE_MIR);
+  job.functions = mir_create_functions(context);
+  platform_parallel_for(job.functions.size, context->backend_jobs, backend_mir_job, &job);
+  timer_stop(&timer);
+
+  timer = timer_start(PHASE_ISEL);
+
+  job.patterns = isel_patterns_x86_64();
+  platform_parallel_for(job.functions.size, context->backend_jobs, backend_isel_job, &job);
+  if (job.patterns.size) isel_mark_defining_uses(job.functions);
+  timer_stop(&timer);
+
+  timer = timer_start(PHASE_RA);
+  platform_parallel_for(job.functions.size, context->backend_jobs, backend_ra_job, &job);
+  timer_stop(&timer);
+
+  timer = timer_start(PHASE_EMIT);
+  job.assembly = calloc(job.functions.size, sizeof *job.assembly);
+  job.objects = calloc(job.functions.size, sizeof *job.objects);
+  ASSERT(job.assembly && job.objects, "Memory allocation failure");
+  platform_parallel_for(job.functions.size, context->backend_jobs, backend_emit_job, &job);
+
+  emit_header(context, job.functions);
+  STATIC_ASSERT(TARGET_COUNT == 6, "Exhaustive handling of target formats in x86_64 backend");
+  if (context->target == TARGET_GNU_ASM_ATT || context->target == TARGET_GNU_ASM_INTEL) {
+    foreach_index (i, job.functions) {
+      fwrite(job.assembly[i].data, 1, job.assembly[i].size, context->code);
+      free(job.assembly[i].data);
+    }
+  }
+
+#ifdef X86_64_GENERATE_MACHINE_CODE
+  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT) {
+    foreach_index (i, job.functions)
+      generic_object_append_code(context->object, job.objects + i);
+  }
+#endif // x86_64_GENERATE_MACHINE_CODE
+
+  free(job.assembly);
+  free(job.objects);
+
+  /// The MIR is no longer needed once the code has been emitted.
+  foreach_val (function, job.functions) mir_function_free(function);
+  vector_delete(job.functions);
+  timer_stop(&timer);
+}
+
 void codegen_emit_x86_64(CodegenContext *context) {
+  /// Static variables are emitted along with the code.
+  Timer timer = timer_start(PHASE_EMIT);
+
   const MachineDescription desc = {
     .registers = general,
     .register_count = GENERAL_REGISTER_COUNT,
@@ -996,7 +1740,7 @@ void codegen_emit_x86_64(CodegenContext *context) {
   bool have_data_section = false;
   foreach_val (var, context->static_vars) {
     /// Do not emit unused variables.
-    if (optimise) {
+    if (context->optimise) {
       bool used = false;
       foreach_val (ref, var->references) {
         if (ir_use_count(ref)) {
@@ -1194,512 +1938,24 @@ void codegen_emit_x86_64(CodegenContext *context) {
   /*ir_set_ids(context);
   ir_print(stdout, context);*/
 
-  MIRFunctionVector machine_instructions_from_ir = mir_from_ir(context);
-
-  // TODO: Either embed x86_64 isel or somehow make this path knowable (i.e. via install).
-  ISelPatterns patterns =  isel_parse_file(ISEL_TABLE_LOCATION_X86_64);
-
-  //isel_print_patterns(&patterns, mir_x86_64_opcode_mnemonic);
-
-  if (debug_ir) {
-    print("================ ISel ================\n"
-          "Before:\n");
-    foreach_val (f, machine_instructions_from_ir)
-      print_mir_function_with_mnemonic(f, mir_x86_64_opcode_mnemonic);
-  }
-
-  // ISel in code...
-  foreach_val (function, machine_instructions_from_ir) {
-    if (!function->origin || !ir_func_is_definition(function->origin)) continue;
-    foreach_val (block, function->blocks) {
-      MIRInstructionVector instructions_to_remove = {0};
-      foreach_index (i, block->instructions) {
-        MIRInstruction* instruction = block->instructions.data[i];
-        switch (instruction->opcode) {
-        default: break;
-
-        case MIR_TRUNCATE: {
-          vector_push(instructions_to_remove, instruction);
-
-          MIROperand *src = mir_get_op(instruction, 0);
-          MIROperand *from_op = mir_get_op(instruction, 1);
-          MIROperand *to_op = mir_get_op(instruction, 2);
-          i64 sz_from = from_op->value.imm;
-          i64 sz_to = to_op->value.imm;
-          ASSERT(sz_from > sz_to, "Truncate must be from larger to smaller size");
-          ASSERT(sz_from <= 8, "Cannot truncate something larger than a register!");
-
-          i64 mask = 0;
-          switch (sz_to) {
-          case 1: mask = 0xff; break;
-          case 2: mask = 0xffff; break;
-          case 4: mask = 0xffffffff; break;
-          default: ICE("Unhandled truncate \"to\" size %I", sz_to);
-          }
-
-          if (src->kind == MIR_OP_IMMEDIATE) {
-            i64 imm = src->value.imm & mask;
-            MIRInstruction *move = mir_makenew(MX64_MOV);
-            mir_add_op(move, mir_op_immediate(imm));
-            mir_add_op(move, mir_op_reference(instruction));
-            mir_insert_instruction_with_reg(instruction->block, move, i++, instruction->reg);
-            break;
-          }
-
-          MIRInstruction *move = mir_makenew(MX64_MOV);
-          mir_add_op(move, *src);
-          mir_add_op(move, mir_op_reference(instruction));
-          mir_insert_instruction(instruction->block, move, i++);
-
-          MIRInstruction *and = mir_makenew(MX64_AND);
-          mir_add_op(and, mir_op_immediate(mask));
-          mir_add_op(and, mir_op_reference(instruction));
-          mir_insert_instruction_with_reg(instruction->block, and, i++, instruction->reg);
-        } break; // case MIR_TRUNCATE
-
-        /// Handle low-level intrinsics. The first operand
-        /// is the intrinsic kind.
-        case MIR_INTRINSIC: {
-          MIROperand *kind = mir_get_op(instruction, 0);
-          ASSERT(kind->kind == MIR_OP_IMMEDIATE, "Intrinsic kind must be an immediate");
-          STATIC_ASSERT(INTRIN_BACKEND_COUNT == 3, "Handle backend intrinsics in codegen");
-          switch (kind->value.imm) {
-            IGNORE_FRONTEND_INTRINSICS();
-
-            /// Memcpy should already have been lowered.
-            case INTRIN_BUILTIN_MEMCPY: UNREACHABLE();
-
-            /// For syscalls, just emit a bunch of moves and the syscall.
-            case INTRIN_BUILTIN_SYSCALL: {
-              ASSERT(context->call_convention == CG_CALL_CONV_SYSV);
-              ASSERT(instruction->operand_count <= 7);
-
-              /// Syscall argument registers are slightly different from
-              /// the regular C calling convention. Note: The syscall number
-              /// is treated as the first argument by us.
-              static enum Registers_x86_64 syscall_arg_regs[7] = {
-                REG_RAX, REG_RDI, REG_RSI, REG_RDX, REG_R10, REG_R8, REG_R9
-              };
-
-              enum Registers_x86_64* arg_regs = syscall_arg_regs;
-              bool first = true;
-              FOREACH_MIR_OPERAND (instruction, op) {
-                /// Don’t emit the intrinsic kind.
-                if (first) {
-                  first = false;
-                  continue;
-                }
-
-                MIRInstruction *mov = mir_makenew(MIR_COPY);
-                mir_add_op(mov, *op);
-                mir_insert_instruction_with_reg(instruction->block, mov, i++, *arg_regs++);
-              }
-
-              /// Insert syscall.
-              MIRInstruction *sys = mir_makenew(MX64_SYSCALL);
-              mir_add_op(sys, mir_op_register(REG_RAX, r64, true));
-              mir_insert_instruction_with_reg(instruction->block, sys, i++, REG_RAX);
-
-              /// Syscalls clobber rcx as well as r8-r11.
-              static enum Registers_x86_64 syscall_clobbers[5] = {
-                REG_RCX, REG_R8, REG_R9, REG_R10, REG_R11
-              };
-
-              MIROperandRegister clobbered = {0};
-              clobbered.size = r64;
-              for (usz r = 0; r < sizeof syscall_clobbers / sizeof *syscall_clobbers; r++) {
-                clobbered.value = syscall_clobbers[r];
-                vector_push(sys->clobbers, clobbered);
-              }
-
-              /// Yeet intrinsic call.
-              vector_push(instructions_to_remove, instruction);
-            } break;
-
-            /// For a debug trap, emit an int 3.
-            case INTRIN_BUILTIN_DEBUGTRAP: {
-              MIRInstruction *int3 = mir_makenew(MX64_INT3);
-              mir_insert_instruction(instruction->block, int3, i++);
-              vector_push(instructions_to_remove, instruction);
-            } break;
-          }
-        } break; // case MIR_INTRINSIC
-
-        }
-      } // foreach (MIRInstruction)
+  timer_stop(&timer);
 
-      foreach_val (instruction, instructions_to_remove) {
-        mir_remove_instruction(instruction);
-      }
-      vector_delete(instructions_to_remove);
-
-    } // foreach (MIRBlock)
-  } // foreach (MIRFunction)
-
-  // ISel using DSL
-  isel_do_selection(machine_instructions_from_ir, patterns);
-
-  if (debug_ir) {
-    print("After:\n");
-    foreach_val (f, machine_instructions_from_ir)
-      print_mir_function_with_mnemonic(f, mir_x86_64_opcode_mnemonic);
-  }
-
-  isel_patterns_delete(&patterns);
-
-  if (debug_ir)
-    print("================ RA ================\n");
-
-  // RA -- Register Allocation
-  foreach_val (f, machine_instructions_from_ir) {
-    allocate_registers(f, &desc);
-  }
-
-  /// After RA, the last fixups before code emission are applied.
-  /// Calculate stack offsets
-  /// Lowering of MIR_CALL, among other things (caller-saved registers)
-  /// Remove register to register moves when value and size are equal.
-  /// Saving/restoration of callee-saved registers used in function.
-  foreach_val (function, machine_instructions_from_ir) {
-    if (!function->origin || !ir_func_is_definition(function->origin)) continue;
-
-    // Calculate stack offsets of frame objects
-    isz offset = 0;
-    foreach (fo, function->frame_objects) {
-      offset -= (isz) fo->size;
-      fo->offset = offset;
-    }
+  if (context->backend_jobs > 1 && !debug_ir) codegen_functions_parallel(context, &desc);
+  else codegen_functions_serial(context, &desc);
 
-    ASSERT(function->blocks.size, "Zero blocks within non-extern MIRFunction... How did you manage this?");
-
-    size_t func_regs = ir_func_regs_in_use(function->origin);
-
-    { // Save callee-saved registers used in this function
-      MIRBlock *first_block = vector_front(function->blocks);
-      for (Register r = 1; r < sizeof(func_regs) * 8; ++r) {
-        if (r == desc.result_register) continue;
-        if (func_regs & ((usz)1 << r) && is_callee_saved(r)) {
-          MIRInstruction *push = mir_makenew(MX64_PUSH);
-          mir_add_op(push, mir_op_register(r, r64, false));
-          mir_insert_instruction(first_block, push, 0);
-        }
-      }
-    }
-
-    { // Restore callee-saved registers used in this function
-      // Okay, I know this looks weird to insert push and pop without
-      // reversing iteration direction, but the key here is the insert
-      // function we are using; this one adds to the end, whereas the push
-      // one adds to the beginning. Therefore, we can do the same loop but
-      // have reversed order of output instructions.
-      for (Register r = 1; r < sizeof(func_regs) * 8; ++r) {
-        if (r == desc.result_register) continue;
-        if (func_regs & ((usz)1 << r) && is_callee_saved(r)) {
-          MIRInstruction *pop = mir_makenew(MX64_POP);
-          mir_add_op(pop, mir_op_register(r, r64, false));
-          mir_append_instruction(function, pop);
-        }
+#ifdef X86_64_GENERATE_MACHINE_CODE
+  timer = timer_start(PHASE_OBJECT);
+  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT) {
+    if (debug_ir) generic_object_print(&object);
+
+    if (STATS_ENABLED()) {
+      foreach (section, object.sections) {
+        if (section->attributes & SEC_ATTR_SPAN_FILL) stats_add_section(section->name, section->data.fill.amount);
+        else stats_add_section(section->name, section->data.bytes.size);
       }
+      stats_add(STAT_OBJECT_RELOCATIONS, object.relocs.size);
     }
-
-    foreach_index (block_index, function->blocks) {
-      MIRBlock *block = function->blocks.data[block_index];
-      MIRInstructionVector instructions_to_remove = {0};
-      foreach_index (i, block->instructions) {
-        MIRInstruction *instruction = block->instructions.data[i];
-        switch (instruction->opcode) {
-        default: break;
-
-        // Basic jump threading
-        case MX64_JMP: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
-            MIROperand *op = mir_get_op(instruction, 0);
-            MIRBlock *destination = op->value.block;
-
-            // Remove a jump if it is to the next sequential block to be output in
-            // code. This means we will fallthrough with no branch, increasing more
-            // space for actually useful jumps in the BTB.
-            MIRBlock *next_block = NULL;
-            if (block_index + 1 < function->blocks.size)
-              next_block = function->blocks.data[block_index + 1];
-            if (destination == next_block) vector_push(instructions_to_remove, instruction);
-          }
-        } break; // case MX64_JMP
-
-        case MIR_CALL: {
-          // Tail call.
-          if (ir_call_tail(instruction->origin)) {
-            // Restore the frame pointer if we have one.
-            mir_x86_64_function_exit_at(stack_frame_kind(instruction->block->function), instruction->block, &i);
-            MIRInstruction *jump = mir_makenew(MX64_JMP);
-            mir_add_op(jump, *mir_get_op(instruction, 0));
-            mir_insert_instruction(instruction->block, jump, i++);
-
-            /// Don’t forget to remove the call instruction.
-            vector_push(instructions_to_remove, instruction);
-            break;
-          }
-
-          size_t regs_pushed_count = 0;
-
-          // Save return register if it is not the result of this
-          // function call already; if it is, the RA has already asserted
-          // that RAX can be clobbered by this instruction.
-          // TODO: Determine a better way to figure out if we actually
-          // need to save the result register over this call boundary.
-          if (instruction->reg < MIR_ARCH_START && instruction->reg != desc.result_register && func_regs & (1 << desc.result_register)) {
-            MIRInstruction *push = mir_makenew(MX64_PUSH);
-            mir_add_op(push, mir_op_register(desc.result_register, r64, false));
-            mir_insert_instruction(instruction->block, push, i++);
-            regs_pushed_count++;
-          }
-
-          // Count caller-saved registers used in function, excluding result register (counted above).
-          size_t x = func_regs;
-          for (size_t r = REG_RAX + 1; r < sizeof(x) * 8; ++r)
-            if (x & ((usz)1 << r) && is_caller_saved((MIRRegister)r))
-              regs_pushed_count++;
-
-          // Push caller saved registers
-          // TODO: Don't push registers that are used for arguments.
-          for (Register r = REG_RAX + 1; r < sizeof(func_regs) * 8; ++r) {
-            if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
-              MIRInstruction *push = mir_makenew(MX64_PUSH);
-              mir_add_op(push, mir_op_register(r, r64, false));
-              mir_insert_instruction(instruction->block, push, i++);
-            }
-          }
-
-          // The amount of bytes that need to be pushed onto/popped off
-          // of the stack, not including saving/restoring of registers.
-          isz bytes_pushed = 0;
-
-          if (context->call_convention == CG_CALL_CONV_MSWIN) {
-            // Push arguments, if need be.
-            isz argument_registers_left = (isz)argument_register_count;
-            bool first = true;
-            FOREACH_MIR_OPERAND(instruction, arg) {
-              if (first) {
-                first = false;
-                continue;
-              }
-              --argument_registers_left;
-              // If argument is passed on stack due to ABI.
-              if (arg->kind == MIR_OP_LOCAL_REF) {
-                // Push the base pointer.
-                MIRInstruction *push = mir_makenew(MX64_PUSH);
-                mir_add_op(push, mir_op_register(REG_RBP, r64, false));
-                mir_insert_instruction(instruction->block, push, i++);
-                bytes_pushed += 8;
-                // Subtract local's offset from base pointer from the newly pushed base pointer.
-                MIRInstruction *sub = mir_makenew(MX64_SUB);
-                ASSERT(arg->value.local_ref < function->frame_objects.size, "Referenced frame object does not exist");
-                mir_add_op(sub, mir_op_immediate(-function->frame_objects.data[arg->value.local_ref].offset)); // value to subtract
-                mir_add_op(sub, mir_op_register(REG_RSP, r64, false)); // base address
-                mir_add_op(sub, mir_op_immediate(0)); // zero offset from rsp
-                mir_add_op(sub, mir_op_immediate(8)); // 8 == sizeof address on stack
-                mir_insert_instruction(instruction->block, sub, i++);
-              } else if (argument_registers_left < 0) {
-                if (arg->kind == MIR_OP_REGISTER) {
-                  if (arg->value.reg.size == r64) {
-                    MIRInstruction *push = mir_makenew(MX64_PUSH);
-                    mir_add_op(push, *arg);
-                    mir_insert_instruction(instruction->block, push, i++);
-                    bytes_pushed += 8;
-                  } else if (arg->value.reg.size == r32) {
-                    MIRInstruction *move = mir_makenew(MX64_MOV);
-                    mir_add_op(move, *arg);
-                    mir_add_op(move, mir_op_register(REG_RAX, r32, false));
-                    mir_insert_instruction(instruction->block, move, i++);
-                    MIRInstruction *push = mir_makenew(MX64_PUSH);
-                    mir_add_op(push, mir_op_register(REG_RAX, r64, false));
-                    mir_insert_instruction(instruction->block, push, i++);
-                    bytes_pushed += 8;
-                  } else {
-                    MIRInstruction *move = mir_makenew(MX64_MOVZX);
-                    mir_add_op(move, *arg);
-                    mir_add_op(move, mir_op_register(REG_RAX, r64, false));
-                    mir_insert_instruction(instruction->block, move, i++);
-                    MIRInstruction *push = mir_makenew(MX64_PUSH);
-                    mir_add_op(push, mir_op_register(REG_RAX, r64, false));
-                    mir_insert_instruction(instruction->block, push, i++);
-                    bytes_pushed += 8;
-                  }
-                } else if (arg->kind == MIR_OP_IMMEDIATE) {
-                  MIRInstruction *move = mir_makenew(MX64_MOV);
-                  mir_add_op(move, *arg);
-                  if (arg->value.imm >= INT32_MIN && arg->value.imm <= INT32_MAX)
-                    mir_add_op(move, mir_op_register(REG_RAX, r32, false));
-                  else mir_add_op(move, mir_op_register(REG_RAX, r64, false));
-                  mir_insert_instruction(instruction->block, move, i++);
-                  MIRInstruction *push = mir_makenew(MX64_PUSH);
-                  mir_add_op(push, mir_op_register(REG_RAX, r64, false));
-                  mir_insert_instruction(instruction->block, push, i++);
-                  bytes_pushed += 8;
-                } else {
-                  print_mir_operand(function, arg);
-                  TODO("Unhandled stack argument operand with kind %s", mir_operand_kind_string(arg->kind));
-                }
-              }
-            }
-          }
-
-          isz bytes_to_push = 0;
-          // Align stack pointer before call, if necessary.
-          if (regs_pushed_count & 0b1)
-            bytes_to_push += 8;
-          // Shadow stack
-          if (context->call_convention == CG_CALL_CONV_MSWIN)
-            bytes_to_push += 32;
-
-          if (bytes_to_push) {
-            MIRInstruction *sub = mir_makenew(MX64_SUB);
-            mir_add_op(sub, mir_op_immediate(bytes_to_push));
-            mir_add_op(sub, mir_op_register(REG_RSP, r64, false));
-            mir_insert_instruction(instruction->block, sub, i++);
-            bytes_pushed += bytes_to_push;
-          }
-
-          MIRInstruction *call = mir_makenew(MX64_CALL);
-          call->origin = instruction->origin;
-          instruction->lowered = call;
-          mir_add_op(call, *mir_get_op(instruction, 0));
-          mir_insert_instruction_with_reg(instruction->block, call, i++, instruction->reg);
-
-          // Restore stack
-          if (bytes_pushed) {
-            MIRInstruction *add = mir_makenew(MX64_ADD);
-            mir_add_op(add, mir_op_immediate((isz)bytes_pushed));
-            mir_add_op(add, mir_op_register(REG_RSP, r64, false));
-            mir_insert_instruction(instruction->block, add, i++);
-          }
-
-          // Restore caller saved registers used in called function.
-          for (Register r = sizeof(func_regs) * 8 - 1; r > REG_RAX; --r) {
-            if (func_regs & ((usz)1 << r) && is_caller_saved(r)) {
-              MIRInstruction *pop = mir_makenew(MX64_POP);
-              mir_add_op(pop, mir_op_register(r, r64, false));
-              mir_insert_instruction(instruction->block, pop, i++);
-            }
-          }
-
-          // If inst->reg is still a virtual register, then this call's
-          // result just gets discarded (no use of it's vreg) so we can just
-          // /not/ do this part.
-          if (instruction->reg < MIR_ARCH_START && instruction->reg != desc.result_register) {
-            MIRInstruction *move = mir_makenew(MX64_MOV);
-            mir_add_op(move, mir_op_register(desc.result_register, r64, false));
-            mir_add_op(move, mir_op_register(instruction->reg, r64, false));
-            mir_insert_instruction(instruction->block, move, i++);
-
-            // Restore return register.
-            if (func_regs & (1 << desc.result_register)) {
-              MIRInstruction *pop = mir_makenew(MX64_POP);
-              mir_add_op(pop, mir_op_register(desc.result_register, r64, false));
-              mir_insert_instruction(instruction->block, pop, i++);
-            }
-          }
-
-          vector_push(instructions_to_remove, instruction);
-
-        } break; // case MIR_CALL
-
-        case MX64_MOVZX: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            // There is no movzx r32, r64 ... that's just called a
-            // `mov r32, r32`, due to false dependency nonsense. And we
-            // don't even need to do that, because the register that we
-            // *would* be zeroing out the top bits of has already had to
-            // have been moved into or something that clears the top bits.
-            if (src->value.reg.size == r32) vector_push(instructions_to_remove, instruction);
-          }
-        } break; // case MX64_MOVZX
-
-        case MPSEUDO_R2R: {
-          if (!mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER))
-            ICE("MPSEUDO_R2R instruction does not have two register operands.");
-          MIROperand *src = mir_get_op(instruction, 0);
-          MIROperand *dst = mir_get_op(instruction, 1);
-
-          // Register move from self to self is a no-op.
-          if (src->value.reg.value == dst->value.reg.value && src->value.reg.size == dst->value.reg.size)
-            vector_push(instructions_to_remove, instruction);
-          else if (src->value.reg.size < dst->value.reg.size) {
-            // Register move from smaller register to larger register requires zero extension.
-            instruction->opcode = MX64_MOVZX;
-          } else if (src->value.reg.size > dst->value.reg.size) {
-            // Register move from larger register to smaller register requires truncation.
-            // To accomplish this, we simply move from a smaller version of the
-            // same register; by reducing the source, we have effectively truncated
-            // the result.
-            instruction->opcode = MX64_MOV;
-            src->value.reg.size = dst->value.reg.size;
-          }
-
-        } break;
-
-        case MX64_MOV: {
-          // MOV(eax, rax) -> ERROR (mov cannot move between mismatched size registers)
-          // MOV(REG x, REG x) -> NOP (remove)
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *lhs = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!lhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
-              putchar('\n');
-              lhs->value.reg.size = r64;
-            }
-            if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
-              putchar('\n');
-              rhs->value.reg.size = r64;
-            }
-            if (lhs->value.reg.size != rhs->value.reg.size)
-              ICE("x86_64 cannot move between mismatched-sized registers %s and %s, sorry", regname(lhs->value.reg.value, lhs->value.reg.size), regname(rhs->value.reg.value, rhs->value.reg.size));
-            if (lhs->value.reg.value == rhs->value.reg.value && lhs->value.reg.size == rhs->value.reg.size) {
-              vector_push(instructions_to_remove, instruction);
-            }
-          }
-        } break;
-
-        } // switch (instruction->opcode)
-
-      } // foreach (MIRInstruction*)
-
-      foreach_val (instruction, instructions_to_remove) {
-        mir_remove_instruction(instruction);
-      }
-      vector_delete(instructions_to_remove);
-
-    } // foreach (MIRBlock*)
-
-    if (debug_ir) print_mir_function_with_mnemonic(function, mir_x86_64_opcode_mnemonic);
-  } // foreach (MIRFunction*)
-
-
-  // CODE EMISSION
-  // TODO: Allow for multiple targets here?
-
-  STATIC_ASSERT(TARGET_COUNT == 6, "Exhaustive handling of target formats in x86_64 backend");
-
-  // EMIT ASSEMBLY CODE
-  if (context->target == TARGET_GNU_ASM_ATT || context->target == TARGET_GNU_ASM_INTEL)
-    emit_x86_64_assembly(context, machine_instructions_from_ir);
-
-#ifdef X86_64_GENERATE_MACHINE_CODE
-
-  // EMIT MACHINE CODE (GENERAL OBJECT FILE)
-  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT)
-    emit_x86_64_generic_object(context, machine_instructions_from_ir);
-
-  if (context->target == TARGET_COFF_OBJECT || context->target == TARGET_ELF_OBJECT)
-    generic_object_print(&object);
+  }
 
   if (context->target == TARGET_COFF_OBJECT)
     generic_object_as_coff_x86_64(&object, context->code);
@@ -1707,5 +1963,6 @@ void codegen_emit_x86_64(CodegenContext *context) {
     generic_object_as_elf_x86_64(&object, context->code);
 
   generic_object_delete(&object);
+  timer_stop(&timer);
 #endif // x86_64_GENERATE_MACHINE_CODE
 }
@@ -39,10 +39,16 @@ void codegen_lower_x86_64(CodegenContext *context);
 void codegen_lower_early_x86_64(CodegenContext *context);
 void codegen_emit_x86_64(CodegenContext *context);
 
+/// Parse the ISel table ahead of time.
+void codegen_warm_caches_x86_64(void);
+
+/// Get the path to the ISel table.
+const char *codegen_isel_table_x86_64(void);
+
 /// Values only valid once codegen_context_x86_64_*_create() has been called and returned.
-extern Register *caller_saved_registers;
-extern size_t caller_saved_register_count;
-extern Register *argument_registers;
-extern size_t argument_register_count;
+extern THREAD_LOCAL Register *caller_saved_registers;
+extern THREAD_LOCAL size_t caller_saved_register_count;
+extern THREAD_LOCAL Register *argument_registers;
+extern THREAD_LOCAL size_t argument_register_count;
 
 #endif // ARCH_X86_64_H
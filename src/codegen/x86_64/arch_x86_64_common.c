@@ -164,7 +164,7 @@ IndirectJumpType comparison_to_jump_type(enum ComparisonType comparison) {
 StackFrameKind stack_frame_kind(MIRFunction *f) {
   ASSERT(f->origin, "Cannot get stack frame kind of MIRFunction with no IRFunction origin set");
   /// Always emit a frame if we’re not optimising.
-  if (!optimise) return FRAME_FULL;
+  if (!ir_context(f->origin)->optimise) return FRAME_FULL;
 
   /// Emit a frame if we have local variables.
   /// FIXME: I don’t think we’re setting this anywhere?
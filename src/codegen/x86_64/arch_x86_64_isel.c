@@ -113,7 +113,7 @@ static void divmod(CodegenContext *context, IRInstruction *inst) {
 static void emit_instruction(CodegenContext *context, IRInstruction *inst) {
   STATIC_ASSERT(IR_COUNT == 40, "Handle all IR instructions");
 
-  if (annotate_code) {
+  if (context->annotate_code) {
     // TODO: Base comment syntax on dialect or smth.
     fprint(context->code, ";;#;");
     thread_use_colours = false;
@@ -243,16 +243,16 @@ static void emit_instruction(CodegenContext *context, IRInstruction *inst) {
 
     /// If either target is the next block, arrange the jumps in such a way
     /// that we can save one and simply fallthrough to the next block.
-    if (optimise && branch->then == inst->parent_block->next)
+    if (context->optimise && branch->then == inst->parent_block->next)
       append_mir(context->mir, mir_jcc(JUMP_TYPE_Z, branch->else_->name.data), inst);
-    else if (optimise && branch->else_ == inst->parent_block->next)
+    else if (context->optimise && branch->else_ == inst->parent_block->next)
       append_mir(context->mir, mir_jcc(JUMP_TYPE_NZ, branch->then->name.data), inst);
     else {
       append_mir(context->mir, mir_jcc(JUMP_TYPE_Z, branch->else_->name.data), inst);
       append_mir(context->mir, mir_name(I_JMP, branch->then->name.data), inst);
     }
 
-    if (optimise && inst->parent_block) inst->parent_block->done = true;
+    if (context->optimise && inst->parent_block) inst->parent_block->done = true;
   } break;
 
   case IR_DIV: {
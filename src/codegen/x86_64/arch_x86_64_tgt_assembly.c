@@ -488,7 +488,7 @@ static void femit_none(CodegenContext *context, MIROpcodex86_64 instruction) {
   }
 }
 
-void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_instructions) {
+void emit_x86_64_assembly_header(CodegenContext *context, MIRFunctionVector machine_instructions) {
   // Emit module metadata
   if (context->ast->is_module) {
     string module_cereal = serialise_module(context, context->ast);
@@ -517,531 +517,537 @@ void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_ins
       if (ir_linkage(function->origin) == LINKAGE_EXPORTED || ir_linkage(function->origin) == LINKAGE_USED)
         fprint(context->code, ".global %S\n", function->name);
   }
-  foreach_val (function, machine_instructions) {
-    // Generate function entry label if function has definition.
-    if (!ir_func_is_definition(function->origin)) continue;
-
-    fprint(context->code, "\n%s:\n", function->name.data);
-
-    // Calculate stack offsets, frame size
-    isz frame_offset = 0;
-    isz frame_size = 0;
-    foreach (fo, function->frame_objects) {
-      frame_size += (isz) fo->size;
-      frame_offset -= (isz) fo->size;
-      fo->offset = frame_offset;
-    }
+}
 
-    if (function->origin && !ir_func_is_definition(function->origin)) continue;
+void emit_x86_64_assembly_function(CodegenContext *context, MIRFunction *function) {
+  // Generate function entry label if function has definition.
+  if (!ir_func_is_definition(function->origin)) return;
 
-    STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-    StackFrameKind frame_kind = stack_frame_kind(function);
-    switch (frame_kind) {
-    case FRAME_NONE: break;
+  fprint(context->code, "\n%s:\n", function->name.data);
 
-    case FRAME_MINIMAL: {
-      femit_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-    } break;
+  // Calculate stack offsets, frame size
+  isz frame_offset = 0;
+  isz frame_size = 0;
+  foreach (fo, function->frame_objects) {
+    frame_size += (isz) fo->size;
+    frame_offset -= (isz) fo->size;
+    fo->offset = frame_offset;
+  }
 
-    case FRAME_FULL: {
-      // PUSH %RBP
-      // MOV %RSP, %RBP
-      femit_reg(context, MX64_PUSH, REG_RBP, r64);
-      femit_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
-      if (frame_size) femit_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
-    } break;
+  if (function->origin && !ir_func_is_definition(function->origin)) return;
 
-    case FRAME_COUNT: FALLTHROUGH;
-    default: UNREACHABLE();
+  STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+  StackFrameKind frame_kind = stack_frame_kind(function);
+  switch (frame_kind) {
+  case FRAME_NONE: break;
 
-    }
+  case FRAME_MINIMAL: {
+    femit_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
+  } break;
+
+  case FRAME_FULL: {
+    // PUSH %RBP
+    // MOV %RSP, %RBP
+    femit_reg(context, MX64_PUSH, REG_RBP, r64);
+    femit_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
+    if (frame_size) femit_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
+  } break;
 
-    foreach_index (block_index, function->blocks) {
-      MIRBlock *block = function->blocks.data[block_index];
+  case FRAME_COUNT: FALLTHROUGH;
+  default: UNREACHABLE();
 
-      /// Emit block symbol if it is used.
-      if (block->name.size)
-        fprint(context->code, "%s:\n", block->name.data);
+  }
 
-      foreach_val (instruction, block->instructions) {
-        if (instruction->opcode < MX64_START) {
-          eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
-          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-          ICE("It seems instruction selection has not lowered a general MIR instruction");
-        }
-        if (annotate_code && instruction->origin) {
-          fprint(context->code, ";;#; ");
-          thread_use_colours = false;
-          ir_print_instruction(context->code, instruction->origin);
-          thread_use_colours = true;
-        }
-        switch ((MIROpcodex86_64)instruction->opcode) {
-        default: {
-          print("Unhandled opcode: %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
-        } break;
+  foreach_index (block_index, function->blocks) {
+    MIRBlock *block = function->blocks.data[block_index];
+
+    /// Emit block symbol if it is used.
+    if (block->name.size)
+      fprint(context->code, "%s:\n", block->name.data);
 
-        case MX64_LEA: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(local->kind == MIR_OP_LOCAL_REF && local->value.local_ref != (usz)-1,
-                   "LEA expected second operand to be frame object reference");
-            ASSERT(destination->kind == MIR_OP_REGISTER,
-                   "LEA requires third operand to be a destination register");
-            if (!destination->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              destination->value.reg.size = r64;
-            }
-            femit_mem_to_reg(context, MX64_LEA, REG_RBP, mir_get_frame_object(function, local->value.local_ref)->offset, destination->value.reg.value, destination->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            MIROperand *object = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              femit_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            femit_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
-            MIROperand *f = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              femit_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            femit_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+    foreach_val (instruction, block->instructions) {
+      if (instruction->opcode < MX64_START) {
+        eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
+        print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+        ICE("It seems instruction selection has not lowered a general MIR instruction");
+      }
+      if (context->annotate_code && instruction->origin) {
+        fprint(context->code, ";;#; ");
+        thread_use_colours = false;
+        ir_print_instruction(context->code, instruction->origin);
+        thread_use_colours = true;
+      }
+      switch ((MIROpcodex86_64)instruction->opcode) {
+      default: {
+        print("Unhandled opcode: %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      } break;
+
+      case MX64_LEA: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(local->kind == MIR_OP_LOCAL_REF && local->value.local_ref != (usz)-1,
+                 "LEA expected second operand to be frame object reference");
+          ASSERT(destination->kind == MIR_OP_REGISTER,
+                 "LEA requires third operand to be a destination register");
+          if (!destination->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            destination->value.reg.size = r64;
           }
-        } break; // case MX64_LEA
-
-        case MX64_CALL: {
-          MIROperand *dst = mir_get_op(instruction, 0);
-
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION))
-            femit_name(context, MX64_CALL, dst->value.function->name.data);
-          else if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER))
-            femit_indirect_branch(context, MX64_CALL, dst->value.reg.value);
-          else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME))
-            femit_name(context, MX64_CALL, dst->value.name);
-          else if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK))
-            femit_name(context, MX64_CALL, dst->value.block->name.data);
-          else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          femit_mem_to_reg(context, MX64_LEA, REG_RBP, mir_get_frame_object(function, local->value.local_ref)->offset, destination->value.reg.value, destination->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          MIROperand *object = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-
-        } break; // case MX64_CALL
-
-        case MX64_MOV: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16) reg->value.reg.size = r32;
-            femit_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
-            // imm to mem (local) | imm, local
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
-                   (int)local->value.local_ref, function->frame_objects.size);
-            MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
-            femit_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
-            // imm to mem (static) | imm, static
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            femit_imm_to_offset_name(context, MX64_MOV,
-                                     imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
-                                     REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
-              femit_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
-            femit_reg_to_reg(context, MX64_MOV,
-                             src->value.reg.value, src->value.reg.size,
-                             dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            // mem (static) to reg | static, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            if (!dst->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              dst->value.reg.size = r64;
-            }
-            if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
-              femit_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
-            femit_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(src->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
-            // reg to mem (local) | src, local
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming same size as local...\n");
-              putchar('\n');
-              reg->value.reg.size = regsize_from_bytes(function->frame_objects.data[local->value.local_ref].size);
-            }
-
-            femit_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
-            // reg to mem (static) | src, static
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            femit_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                              REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            // mem (local) to reg | local, src
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming same size as local...\n");
-              putchar('\n');
-              reg->value.reg.size = regsize_from_bytes(function->frame_objects.data[local->value.local_ref].size);
-            }
-
-            femit_mem_to_reg(context, MX64_MOV,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
-                             reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            TODO("MOV(IMM, REG, IMM) would normally be 'imm to mem' form, but that requires a fourth memory size operand");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, addr, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            femit_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // reg to mem | src, addr, offset
-            MIROperand *reg_source = mir_get_op(instruction, 0);
-            if (!reg_source->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg_source->value.reg.size = r64;
-            }
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            if (!reg_address->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg_address->value.reg.size = r64;
-            }
-            MIROperand *offset = mir_get_op(instruction, 2);
-            femit_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            TODO("MOV(REG, IMM, REG) would normally be 'mem to reg' form, but that requires a fourth memory size operand");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // mem to reg | addr, offset, dst, size
-            MIROperand *reg_address = mir_get_op(instruction, 0);
-            MIROperand *offset = mir_get_op(instruction, 1);
-            MIROperand *reg_dst = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            femit_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            femit_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          femit_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
+          MIROperand *f = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            femit_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          femit_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_LEA
+
+      case MX64_CALL: {
+        MIROperand *dst = mir_get_op(instruction, 0);
+
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION))
+          femit_name(context, MX64_CALL, dst->value.function->name.data);
+        else if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER))
+          femit_indirect_branch(context, MX64_CALL, dst->value.reg.value);
+        else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME))
+          femit_name(context, MX64_CALL, dst->value.name);
+        else if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK))
+          femit_name(context, MX64_CALL, dst->value.block->name.data);
+        else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
 
-        } break; // case MX64_MOV
-
-        case MX64_IMUL: {
-          // TODO: Three address versions of imul.
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            femit_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      } break; // case MX64_CALL
+
+      case MX64_MOV: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_IMUL
-
-        case MX64_NOT: FALLTHROUGH;
-        case MX64_DIV: FALLTHROUGH;
-        case MX64_IDIV: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16) reg->value.reg.size = r32;
+          femit_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+          // imm to mem (local) | imm, local
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
+                 (int)local->value.local_ref, function->frame_objects.size);
+          MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
+          femit_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
+          // imm to mem (static) | imm, static
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          femit_imm_to_offset_name(context, MX64_MOV,
+                                   imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
+                                   REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
+            femit_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
+          femit_reg_to_reg(context, MX64_MOV,
+                           src->value.reg.value, src->value.reg.size,
+                           dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          // mem (static) to reg | static, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          if (!dst->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            dst->value.reg.size = r64;
           }
-        } break; // case MX64_IDIV
-
-        case MX64_AND: FALLTHROUGH;
-        case MX64_OR: FALLTHROUGH;
-        case MX64_ADD: FALLTHROUGH;
-        case MX64_SUB: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            femit_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, address, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *addr = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            femit_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
+            femit_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
+          femit_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(src->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+          // reg to mem (local) | src, local
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming same size as local...\n");
+            putchar('\n');
+            reg->value.reg.size = regsize_from_bytes(function->frame_objects.data[local->value.local_ref].size);
           }
-        } break; // case MX64_ADD
-
-        case MX64_RET: {
-          STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-          switch (frame_kind) {
-          case FRAME_NONE: break;
-
-          case FRAME_FULL: {
-            // MOV %RBP, %RSP
-            // POP %RBP
-            femit_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
-            femit_reg(context, MX64_POP, REG_RBP, r64);
-          } break;
-
-          case FRAME_MINIMAL: {
-            // ADD $OFFSET, %RSP
-            femit_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-          } break;
-
-          case FRAME_COUNT: FALLTHROUGH;
-          default: UNREACHABLE();
 
+          femit_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
+          // reg to mem (static) | src, static
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-
-          femit_none(context, MX64_RET);
-
-        } break;
-
-        case MX64_SHL: FALLTHROUGH;
-        case MX64_SAR: FALLTHROUGH;
-        case MX64_SHR: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          femit_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                            REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          // mem (local) to reg | local, src
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming same size as local...\n");
+            putchar('\n');
+            reg->value.reg.size = regsize_from_bytes(function->frame_objects.data[local->value.local_ref].size);
           }
-        } break;
 
-        case MX64_POP: FALLTHROUGH;
-        case MX64_PUSH: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          femit_mem_to_reg(context, MX64_MOV,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
+                           reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          TODO("MOV(IMM, REG, IMM) would normally be 'imm to mem' form, but that requires a fourth memory size operand");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, addr, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          femit_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // reg to mem | src, addr, offset
+          MIROperand *reg_source = mir_get_op(instruction, 0);
+          if (!reg_source->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg_source->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_JMP: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            femit_name(context, MX64_JMP, destination->value.block->name.data);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            femit_name(context, MX64_JMP, destination->value.function->name.data);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            femit_name(context, MX64_JMP, destination->value.name);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          if (!reg_address->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg_address->value.reg.size = r64;
           }
-        } break;
+          MIROperand *offset = mir_get_op(instruction, 2);
+          femit_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          TODO("MOV(REG, IMM, REG) would normally be 'mem to reg' form, but that requires a fourth memory size operand");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // mem to reg | addr, offset, dst, size
+          MIROperand *reg_address = mir_get_op(instruction, 0);
+          MIROperand *offset = mir_get_op(instruction, 1);
+          MIROperand *reg_dst = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          femit_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
 
-        case MX64_CMP: FALLTHROUGH;
-        case MX64_TEST: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *lhs = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!lhs->value.reg.size && !rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Both lhs and rhs are zero sized registers, assuming 64-bit...\n");
-              putchar('\n');
-              lhs->value.reg.size = r64;
-              rhs->value.reg.size = r64;
-            } else if (!lhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register on lhs, assuming 64-bit...\n");
-              putchar('\n');
-              lhs->value.reg.size = r64;
-            } else if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
-              putchar('\n');
-              rhs->value.reg.size = r64;
-            }
-            femit_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            femit_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      } break; // case MX64_MOV
+
+      case MX64_IMUL: {
+        // TODO: Three address versions of imul.
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_SETCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *compare_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
-            femit_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          femit_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_IMUL
+
+      case MX64_NOT: FALLTHROUGH;
+      case MX64_DIV: FALLTHROUGH;
+      case MX64_IDIV: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_IDIV
+
+      case MX64_AND: FALLTHROUGH;
+      case MX64_OR: FALLTHROUGH;
+      case MX64_ADD: FALLTHROUGH;
+      case MX64_SUB: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
+          femit_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, address, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *addr = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          femit_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_ADD
+
+      case MX64_RET: {
+        STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+        switch (frame_kind) {
+        case FRAME_NONE: break;
+
+        case FRAME_FULL: {
+          // MOV %RBP, %RSP
+          // POP %RBP
+          femit_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
+          femit_reg(context, MX64_POP, REG_RBP, r64);
         } break;
 
-        case MX64_SYSCALL:
-        case MX64_UD2:
-        case MX64_INT3:
-        case MX64_CWD:
-        case MX64_CDQ:
-        case MX64_CQO: {
-          femit_none(context, (MIROpcodex86_64)instruction->opcode);
+        case FRAME_MINIMAL: {
+          // ADD $OFFSET, %RSP
+          femit_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
         } break;
 
-        case MX64_JCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
-            MIROperand *jump_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
-            femit_jcc(context, (IndirectJumpType)jump_type->value.imm, destination->value.block->name.data);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+        case FRAME_COUNT: FALLTHROUGH;
+        default: UNREACHABLE();
+
+        }
+
+        femit_none(context, MX64_RET);
+
+      } break;
+
+      case MX64_SHL: FALLTHROUGH;
+      case MX64_SAR: FALLTHROUGH;
+      case MX64_SHR: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
+
+      case MX64_POP: FALLTHROUGH;
+      case MX64_PUSH: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          femit_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
+
+      case MX64_JMP: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          femit_name(context, MX64_JMP, destination->value.block->name.data);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          femit_name(context, MX64_JMP, destination->value.function->name.data);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          femit_name(context, MX64_JMP, destination->value.name);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
+
+      case MX64_CMP: FALLTHROUGH;
+      case MX64_TEST: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *lhs = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!lhs->value.reg.size && !rhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break; // case MX64_JCC
-
-        case MX64_MOVSX: FALLTHROUGH;
-        case MX64_MOVZX: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+            print("%35WARNING%m: Both lhs and rhs are zero sized registers, assuming 64-bit...\n");
+            putchar('\n');
+            lhs->value.reg.size = r64;
+            rhs->value.reg.size = r64;
+          } else if (!lhs->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register on lhs, assuming 64-bit...\n");
+            putchar('\n');
+            lhs->value.reg.size = r64;
+          } else if (!rhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register on rhs, assuming 64-bit...\n");
+            putchar('\n');
+            rhs->value.reg.size = r64;
           }
-        } break; // case MX64_MOVZX
+          femit_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          femit_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
+
+      case MX64_SETCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *compare_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
+          femit_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
+
+      case MX64_SYSCALL:
+      case MX64_UD2:
+      case MX64_INT3:
+      case MX64_CWD:
+      case MX64_CDQ:
+      case MX64_CQO: {
+        femit_none(context, (MIROpcodex86_64)instruction->opcode);
+      } break;
+
+      case MX64_JCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
+          MIROperand *jump_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
+          femit_jcc(context, (IndirectJumpType)jump_type->value.imm, destination->value.block->name.data);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_JCC
+
+      case MX64_MOVSX: FALLTHROUGH;
+      case MX64_MOVZX: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          femit_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_MOVZX
 
-        case MX64_XOR: FALLTHROUGH;
-        case MX64_XCHG:
-          TODO("Implement assembly emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      case MX64_XOR: FALLTHROUGH;
+      case MX64_XCHG:
+        TODO("Implement assembly emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
 
-        case MX64_START: FALLTHROUGH;
-        case MX64_END: FALLTHROUGH;
-        case MX64_COUNT: UNREACHABLE();
-        }
+      case MX64_START: FALLTHROUGH;
+      case MX64_END: FALLTHROUGH;
+      case MX64_COUNT: UNREACHABLE();
       }
     }
   }
 }
 
+void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_instructions) {
+  emit_x86_64_assembly_header(context, machine_instructions);
+  foreach_val (function, machine_instructions)
+    emit_x86_64_assembly_function(context, function);
+}
@@ -6,4 +6,13 @@
 /// Emits into `context->code` file.
 void emit_x86_64_assembly(CodegenContext *context, MIRFunctionVector machine_instructions);
 
+/// Emit everything that precedes the functions (module metadata,
+/// section directives, global symbols) into `context->code`.
+void emit_x86_64_assembly_header(CodegenContext *context, MIRFunctionVector machine_instructions);
+
+/// Emit a single function into `context->code`. This only reads the
+/// context, so different functions may be emitted concurrently if
+/// each one uses a copy of the context with its own `code` stream.
+void emit_x86_64_assembly_function(CodegenContext *context, MIRFunction *function);
+
 #endif /* ARCH_X86_64_TGT_ASSEMBLY_H */
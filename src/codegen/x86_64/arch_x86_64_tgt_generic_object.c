@@ -575,8 +575,63 @@ static void mcode_imm_to_mem(CodegenContext *context, MIROpcodex86_64 inst, int6
 }
 
 static void mcode_imm_to_offset_name(CodegenContext *context, MIROpcodex86_64 inst, int64_t immediate, RegSize size, RegisterDescriptor address_register, const char *name, int64_t offset) {
-  TODO("Implement instruction %d (%s) in `imm to offset name` form",
-       inst, mir_x86_64_opcode_mnemonic(inst));
+  switch (inst) {
+
+  case MX64_MOV: {
+    if (address_register != REG_RIP)
+      TODO("Implement instruction %d (%s) in `imm to offset name` form relative to a register other than RIP",
+           inst, mir_x86_64_opcode_mnemonic(inst));
+
+    // 0xc6 /0 ib
+    // 0x66 + 0xc7 /0 iw
+    // 0xc7 /0 id
+    // REX.W + 0xc7 /0 id
+    int64_t immediate_size = 0;
+    switch (size) {
+    default: ICE("Unhandled register size");
+    case r8: immediate_size = 1; break;
+    case r16: immediate_size = 2; mcode_1(context->object, 0x66); break;
+    case r32: immediate_size = 4; break;
+    case r64: immediate_size = 4; mcode_1(context->object, rexw_byte()); break;
+    }
+
+    // RIP-relative ModRM byte
+    // Mod == 0b00
+    // Reg == Opcode Extension
+    // R/M == 0b101
+    uint8_t modrm = modrm_byte(0b00, 0, 0b101);
+    mcode_2(context->object, size == r8 ? 0xc6 : 0xc7, modrm);
+
+    // Make RIP-relative disp32 relocation. RIP points past the
+    // immediate, which comes after the displacement, so account for
+    // it in the addend. COFF relocations take their addend from the
+    // displacement itself, so write it there as well.
+    RelocationEntry reloc = {0};
+    Section *sec_code = code_section(context->object);
+    ASSERT(sec_code, "NO CODE SECTION, WHAT HAVE YOU DONE?");
+    reloc.sym.byte_offset = sec_code->data.bytes.size;
+    reloc.sym.name = strdup(name);
+    reloc.sym.section_name = strdup(sec_code->name);
+    reloc.type = RELOC_DISP32_PCREL;
+    reloc.addend = offset - immediate_size;
+    vector_push(context->object->relocs, reloc);
+
+    int32_t disp32 = (int32_t)reloc.addend;
+    mcode_n(context->object, &disp32, 4);
+    if (size == r8) {
+      int8_t imm8 = (int8_t)immediate;
+      mcode_1(context->object, (uint8_t)imm8);
+    } else if (size == r16) {
+      int16_t imm16 = (int16_t)immediate;
+      mcode_n(context->object, &imm16, 2);
+    } else {
+      int32_t imm32 = (int32_t)immediate;
+      mcode_n(context->object, &imm32, 4);
+    }
+  } break; // case MX64_MOV
+
+  default: ICE("ERROR: mcode_imm_to_offset_name(): Unsupported instruction %d (%s)", inst, mir_x86_64_opcode_mnemonic(inst));
+  }
 }
 
 static void mcode_mem_to_reg(CodegenContext *context, MIROpcodex86_64 inst, RegisterDescriptor address_register, int64_t offset, RegisterDescriptor destination_register, enum RegSize size) {
@@ -2234,7 +2289,7 @@ static void mcode_jcc(CodegenContext *context, IndirectJumpType type, const char
   mcode_n(context->object, &disp32, 4);
 }
 
-void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machine_instructions) {
+void emit_x86_64_generic_object_metadata(CodegenContext *context) {
   DBGASSERT(context, "Invalid argument");
   ASSERT(context->object, "Cannot emit into NULL generic object");
 
@@ -2247,550 +2302,572 @@ void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machi
     sec_module_metadata.data.bytes.capacity = module_cereal.size;
     vector_push(context->object->sections, sec_module_metadata);
   }
+}
 
-  foreach_val (function, machine_instructions) {
-    { // Function symbol
-      GObjSymbol sym = {0};
-      sym.type = !ir_func_is_definition(function->origin) ? GOBJ_SYMTYPE_EXTERNAL : GOBJ_SYMTYPE_FUNCTION;
-      sym.name = strdup(function->name.data);
-      sym.section_name = strdup(code_section(context->object)->name);
-      sym.byte_offset = code_section(context->object)->data.bytes.size;
-      vector_push(context->object->symbols, sym);
-    }
-    if (function->origin && !ir_func_is_definition(function->origin)) continue;
-
-    // Calculate stack offsets, frame size
-    isz frame_offset = 0;
-    isz frame_size = 0;
-    foreach (fo, function->frame_objects) {
-      frame_size += (isz) fo->size;
-      frame_offset -= (isz) fo->size;
-      fo->offset = frame_offset;
+/// Resolve relocations to local labels that were emitted after the
+/// given reloc and symbol indices, and remove the local label symbols.
+static void resolve_local_labels(CodegenContext *context, usz first_reloc, usz first_symbol) {
+  // Resolve local label (".Lxxxx") relocations. Local labels are only
+  // ever referenced from within the function they are defined in, so we
+  // only need to look at what was emitted for this function.
+  Vector(size_t) relocations_to_remove = {0};
+  for (usz idx = first_reloc; idx < context->object->relocs.size; ++idx) {
+    RelocationEntry *reloc = context->object->relocs.data + idx;
+    GObjSymbol *sym = &reloc->sym;
+    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0) {
+      // We have to go sym->byte_offset bytes into the ByteBuffer of
+      // the code section and then fill in the next bytes depending on the
+      // relocation type.
+      GObjSymbol *label_sym = NULL;
+      for (GObjSymbol *s = context->object->symbols.data + first_symbol; s < context->object->symbols.data + context->object->symbols.size; ++s) {
+        if (strcmp(s->name, sym->name) == 0) {
+          label_sym = s;
+          break;
+        }
+      }
+      if (!label_sym) ICE("Could not find local label referenced by relocation: \"%s\"", sym->name);
+
+      // TODO: Handle endianess
+      // NOTE: 4 == sizeof relocation displacement
+      int32_t disp32 = (int32_t)label_sym->byte_offset - (4 + (int32_t)sym->byte_offset);
+      uint8_t *src_it = (uint8_t*)&disp32;
+      uint8_t *dst_it = code_section(context->object)->data.bytes.data + sym->byte_offset;
+      for (int i = 0; i < 4; ++i)
+        *dst_it++ = *src_it++;
+
+      vector_push(relocations_to_remove, idx);
     }
+  }
+  foreach_rev (idx, relocations_to_remove) {
+    vector_remove_index(context->object->relocs, *idx);
+  }
+  vector_delete(relocations_to_remove);
 
-    STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-    StackFrameKind frame_kind = stack_frame_kind(function);
-    switch (frame_kind) {
-    case FRAME_NONE: break;
+  // Remove all local label symbols (".Lxxxx")
+  Vector(size_t) symbols_to_remove = {0};
+  for (usz idx = first_symbol; idx < context->object->symbols.size; ++idx) {
+    GObjSymbol *sym = context->object->symbols.data + idx;
+    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0)
+      vector_push(symbols_to_remove, idx);
+  }
+  foreach_rev (idx, symbols_to_remove) {
+    vector_remove_index(context->object->symbols, *idx);
+  }
+  vector_delete(symbols_to_remove);
+}
 
-    case FRAME_MINIMAL: {
-      mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-    } break;
+void emit_x86_64_generic_object_function(CodegenContext *context, MIRFunction *function) {
+  DBGASSERT(context, "Invalid argument");
+  ASSERT(context->object, "Cannot emit into NULL generic object");
 
-    case FRAME_FULL: {
-      // PUSH %RBP
-      // MOV %RSP, %RBP
-      mcode_reg(context, MX64_PUSH, REG_RBP, r64);
-      mcode_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
-      if (frame_size) mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
-    } break;
+  usz first_reloc = context->object->relocs.size;
+  usz first_symbol = context->object->symbols.size;
 
-    case FRAME_COUNT: FALLTHROUGH;
-    default: UNREACHABLE();
+  { // Function symbol
+    GObjSymbol sym = {0};
+    sym.type = !ir_func_is_definition(function->origin) ? GOBJ_SYMTYPE_EXTERNAL : GOBJ_SYMTYPE_FUNCTION;
+    sym.name = strdup(function->name.data);
+    sym.section_name = strdup(code_section(context->object)->name);
+    sym.byte_offset = code_section(context->object)->data.bytes.size;
+    vector_push(context->object->symbols, sym);
+  }
+  if (function->origin && !ir_func_is_definition(function->origin)) return;
+
+  // Calculate stack offsets, frame size
+  isz frame_offset = 0;
+  isz frame_size = 0;
+  foreach (fo, function->frame_objects) {
+    frame_size += (isz) fo->size;
+    frame_offset -= (isz) fo->size;
+    fo->offset = frame_offset;
+  }
 
-    }
+  STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+  StackFrameKind frame_kind = stack_frame_kind(function);
+  switch (frame_kind) {
+  case FRAME_NONE: break;
 
-    foreach_index (block_index, function->blocks) {
-      MIRBlock* block = function->blocks.data[block_index];
-      { // Block label symbol
-        GObjSymbol sym = {0};
-        sym.type = GOBJ_SYMTYPE_STATIC;
-        sym.name = strdup(block->name.data);
-        sym.section_name = strdup(code_section(context->object)->name);
-        sym.byte_offset = code_section(context->object)->data.bytes.size;
-        vector_push(context->object->symbols, sym);
+  case FRAME_MINIMAL: {
+    mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
+  } break;
+
+  case FRAME_FULL: {
+    // PUSH %RBP
+    // MOV %RSP, %RBP
+    mcode_reg(context, MX64_PUSH, REG_RBP, r64);
+    mcode_reg_to_reg(context, MX64_MOV, REG_RSP, r64, REG_RBP, r64);
+    if (frame_size) mcode_imm_to_reg(context, MX64_SUB, ALIGN_TO(frame_size, 16), REG_RSP, r64);
+  } break;
+
+  case FRAME_COUNT: FALLTHROUGH;
+  default: UNREACHABLE();
+
+  }
+
+  foreach_index (block_index, function->blocks) {
+    MIRBlock* block = function->blocks.data[block_index];
+    { // Block label symbol
+      GObjSymbol sym = {0};
+      sym.type = GOBJ_SYMTYPE_STATIC;
+      sym.name = strdup(block->name.data);
+      sym.section_name = strdup(code_section(context->object)->name);
+      sym.byte_offset = code_section(context->object)->data.bytes.size;
+      vector_push(context->object->symbols, sym);
+    }
+    foreach_val (instruction, block->instructions) {
+      if (instruction->opcode < MX64_START) {
+        eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
+        print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+        ICE("It seems instruction selection has not lowered a general MIR instruction");
       }
-      foreach_val (instruction, block->instructions) {
-        if (instruction->opcode < MX64_START) {
-          eprint("\n\n%31UNLOWERED INSTRUCTION:%m\n");
+      switch ((MIROpcodex86_64)instruction->opcode) {
+      default: {
+        print("Unhandled opcode (mcode): %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      } break;
+
+      case MX64_IMUL: {
+        // TODO: Three address versions of imul.
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
+          }
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
           print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-          ICE("It seems instruction selection has not lowered a general MIR instruction");
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
         }
-        switch ((MIROpcodex86_64)instruction->opcode) {
-        default: {
-          print("Unhandled opcode (mcode): %u (%s)\n", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
-        } break;
-
-        case MX64_IMUL: {
-          // TODO: Three address versions of imul.
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      } break; // case MX64_IMUL
+
+      case MX64_NOT: FALLTHROUGH;
+      case MX64_DIV: FALLTHROUGH;
+      case MX64_IDIV: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_IDIV
+
+      case MX64_AND: FALLTHROUGH;
+      case MX64_OR: FALLTHROUGH;
+      case MX64_ADD: FALLTHROUGH;
+      case MX64_SUB: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_IMUL
-
-        case MX64_NOT: FALLTHROUGH;
-        case MX64_DIV: FALLTHROUGH;
-        case MX64_IDIV: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, address, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *addr = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break; // case MX64_ADD
+
+      case MX64_MOV: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          // imm to reg | imm, dst
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_IDIV
-
-        case MX64_AND: FALLTHROUGH;
-        case MX64_OR: FALLTHROUGH;
-        case MX64_ADD: FALLTHROUGH;
-        case MX64_SUB: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, address, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *addr = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_imm_to_mem(context, instruction->opcode, imm->value.imm, addr->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
+          // imm to mem (local) | imm, local
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
+                 (int)local->value.local_ref, function->frame_objects.size);
+          MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
+          mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
+          // imm to mem (static) | imm, static
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          mcode_imm_to_offset_name(context, MX64_MOV,
+                                   imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
+                                   REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          // reg to reg | src, dst
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
+          mcode_reg_to_reg(context, MX64_MOV, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
+          // reg to mem (static) | src, static
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *stc = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break; // case MX64_ADD
-
-        case MX64_MOV: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            // imm to reg | imm, dst
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, MX64_MOV, imm->value.imm, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_LOCAL_REF)) {
-            // imm to mem (local) | imm, local
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "MX64_MOV(imm, local): local index %d is greater than amount of frame objects in function: %Z",
-                   (int)local->value.local_ref, function->frame_objects.size);
-            MIRFrameObject *fo = function->frame_objects.data + local->value.local_ref;
-            mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, REG_RBP, fo->offset, (RegSize)fo->size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_STATIC_REF)) {
-            // imm to mem (static) | imm, static
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            mcode_imm_to_offset_name(context, MX64_MOV,
-                                     imm->value.imm, (RegSize)type_sizeof(ir_static_ref_var(stc->value.static_ref)->type),
-                                     REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, 0);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            // reg to reg | src, dst
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            if (dst->value.reg.size == r8 || dst->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, dst->value.reg.value, r32);
-            mcode_reg_to_reg(context, MX64_MOV, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_STATIC_REF)) {
-            // reg to mem (static) | src, static
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *stc = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                              REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
-            // reg to mem (local) | src, local
-            MIROperand *reg = mir_get_op(instruction, 0);
-            MIROperand *local = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              reg->value.reg.size = r64;
-            }
-
-            mcode_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            TODO("MOV(IMM, REG, IMM) would normally be in the 'imm to mem' form, but an extra size operand is required (how many bytes to store)");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
-            // imm to mem | imm, addr, offset, size
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            MIROperand *offset = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // reg to mem | src, addr, offset
-            MIROperand *reg_source = mir_get_op(instruction, 0);
-            if (!reg_source->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized source register, assuming 64-bit...\n\n");
-              reg_source->value.reg.size = r64;
-            }
-            MIROperand *reg_address = mir_get_op(instruction, 1);
-            if (!reg_address->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized address register, assuming 64-bit...\n\n");
-              reg_address->value.reg.size = r64;
-            }
-            MIROperand *offset = mir_get_op(instruction, 2);
-            mcode_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            TODO("MOV(REG, IMM, REG) would normally be in the 'mem to reg' form, but an extra size operand is required (how many bytes to store)");
-          } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
-            // mem to reg | addr, offset, dst, size
-            MIROperand *reg_address = mir_get_op(instruction, 0);
-            MIROperand *offset = mir_get_op(instruction, 1);
-            MIROperand *reg_dst = mir_get_op(instruction, 2);
-            MIROperand *size = mir_get_op(instruction, 3);
-            mcode_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            // mem (local) to reg | local, src
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-
-            ASSERT(function->frame_objects.size,
-                   "Cannot reference local at index %Z when there are no frame objects in this function",
-                   local->value.local_ref);
-            ASSERT(local->value.local_ref < function->frame_objects.size,
-                   "Local reference index %Z is larger than maximum possible local index %Z",
-                   local->value.local_ref, function->frame_objects.size - 1);
-
-            mcode_mem_to_reg(context, MX64_MOV,
-                             REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
-                             reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            // mem (static) to reg | static, dst
-            MIROperand *stc = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_reg_to_name(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                            REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_LOCAL_REF)) {
+          // reg to mem (local) | src, local
+          MIROperand *reg = mir_get_op(instruction, 0);
+          MIROperand *local = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            reg->value.reg.size = r64;
           }
 
-        } break; // case MX64_MOV
+          mcode_reg_to_mem(context, MX64_MOV, reg->value.reg.value, reg->value.reg.size,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          TODO("MOV(IMM, REG, IMM) would normally be in the 'imm to mem' form, but an extra size operand is required (how many bytes to store)");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_IMMEDIATE)) {
+          // imm to mem | imm, addr, offset, size
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          MIROperand *offset = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_imm_to_mem(context, MX64_MOV, imm->value.imm, reg_address->value.reg.value, offset->value.imm, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // reg to mem | src, addr, offset
+          MIROperand *reg_source = mir_get_op(instruction, 0);
+          if (!reg_source->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized source register, assuming 64-bit...\n\n");
+            reg_source->value.reg.size = r64;
+          }
+          MIROperand *reg_address = mir_get_op(instruction, 1);
+          if (!reg_address->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized address register, assuming 64-bit...\n\n");
+            reg_address->value.reg.size = r64;
+          }
+          MIROperand *offset = mir_get_op(instruction, 2);
+          mcode_reg_to_mem(context, MX64_MOV, reg_source->value.reg.value, reg_source->value.reg.size, reg_address->value.reg.value, offset->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 3, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          TODO("MOV(REG, IMM, REG) would normally be in the 'mem to reg' form, but an extra size operand is required (how many bytes to store)");
+        } else if (mir_operand_kinds_match(instruction, 4, MIR_OP_REGISTER, MIR_OP_IMMEDIATE, MIR_OP_REGISTER, MIR_OP_IMMEDIATE)) {
+          // mem to reg | addr, offset, dst, size
+          MIROperand *reg_address = mir_get_op(instruction, 0);
+          MIROperand *offset = mir_get_op(instruction, 1);
+          MIROperand *reg_dst = mir_get_op(instruction, 2);
+          MIROperand *size = mir_get_op(instruction, 3);
+          mcode_mem_to_reg(context, MX64_MOV, reg_address->value.reg.value, offset->value.imm, reg_dst->value.reg.value, (RegSize)size->value.imm);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          // mem (local) to reg | local, src
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+
+          ASSERT(function->frame_objects.size,
+                 "Cannot reference local at index %Z when there are no frame objects in this function",
+                 local->value.local_ref);
+          ASSERT(local->value.local_ref < function->frame_objects.size,
+                 "Local reference index %Z is larger than maximum possible local index %Z",
+                 local->value.local_ref, function->frame_objects.size - 1);
+
+          mcode_mem_to_reg(context, MX64_MOV,
+                           REG_RBP, function->frame_objects.data[local->value.local_ref].offset,
+                           reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          // mem (static) to reg | static, dst
+          MIROperand *stc = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_name_to_reg(context, MX64_MOV, REG_RIP, ir_static_ref_var(stc->value.static_ref)->name.data, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
 
-        case MX64_CALL: {
-          MIROperand *dst = mir_get_op(instruction, 0);
+      } break; // case MX64_MOV
 
-          switch (dst->kind) {
+      case MX64_CALL: {
+        MIROperand *dst = mir_get_op(instruction, 0);
 
-          case MIR_OP_REGISTER: {
-            mcode_indirect_branch(context, MX64_CALL, dst->value.reg.value);
-          } break;
-          case MIR_OP_NAME: {
-            mcode_name(context, MX64_CALL, dst->value.name, false);
-          } break;
-          case MIR_OP_BLOCK: {
-            mcode_name(context, MX64_CALL, dst->value.block->name.data, false);
-          } break;
-          case MIR_OP_FUNCTION: {
-            mcode_name(context, MX64_CALL, dst->value.function->name.data, true);
-          } break;
+        switch (dst->kind) {
 
-          default: ICE("Unhandled operand kind in CALL: %d (%s)", dst->kind, mir_operand_kind_string(dst->kind));
+        case MIR_OP_REGISTER: {
+          mcode_indirect_branch(context, MX64_CALL, dst->value.reg.value);
+        } break;
+        case MIR_OP_NAME: {
+          mcode_name(context, MX64_CALL, dst->value.name, false);
+        } break;
+        case MIR_OP_BLOCK: {
+          mcode_name(context, MX64_CALL, dst->value.block->name.data, false);
+        } break;
+        case MIR_OP_FUNCTION: {
+          mcode_name(context, MX64_CALL, dst->value.function->name.data, true);
+        } break;
 
-          } // switch (dst->kind)
+        default: ICE("Unhandled operand kind in CALL: %d (%s)", dst->kind, mir_operand_kind_string(dst->kind));
 
-        } break;
+        } // switch (dst->kind)
 
-        case MX64_RET: {
+      } break;
 
-          STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
-          switch (frame_kind) {
-          case FRAME_NONE: break;
+      case MX64_RET: {
 
-          case FRAME_FULL: {
-            // MOV %RBP, %RSP
-            // POP %RBP
-            mcode_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
-            mcode_reg(context, MX64_POP, REG_RBP, r64);
-          } break;
+        STATIC_ASSERT(FRAME_COUNT == 3, "Exhaustive handling of x86_64 frame kinds");
+        switch (frame_kind) {
+        case FRAME_NONE: break;
 
-          case FRAME_MINIMAL: {
-            mcode_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
-          } break;
+        case FRAME_FULL: {
+          // MOV %RBP, %RSP
+          // POP %RBP
+          mcode_reg_to_reg(context, MX64_MOV, REG_RBP, r64, REG_RSP, r64);
+          mcode_reg(context, MX64_POP, REG_RBP, r64);
+        } break;
 
-          case FRAME_COUNT: FALLTHROUGH;
-          default: UNREACHABLE();
+        case FRAME_MINIMAL: {
+          mcode_imm_to_reg(context, MX64_ADD, ALIGN_TO(frame_size, 16) + 8, REG_RSP, r64);
+        } break;
 
-          }
+        case FRAME_COUNT: FALLTHROUGH;
+        default: UNREACHABLE();
 
-          mcode_none(context, MX64_RET);
+        }
 
-        } break;
+        mcode_none(context, MX64_RET);
 
-        case MX64_SHL: FALLTHROUGH;
-        case MX64_SAR: FALLTHROUGH;
-        case MX64_SHR: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      } break;
 
-        case MX64_POP: FALLTHROUGH;
-        case MX64_PUSH: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
-            MIROperand *reg = mir_get_op(instruction, 0);
-            mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      case MX64_SHL: FALLTHROUGH;
+      case MX64_SAR: FALLTHROUGH;
+      case MX64_SHR: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_LEA: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
-            MIROperand *local = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            mcode_mem_to_reg(context, MX64_LEA, REG_RBP, function->frame_objects.data[local->value.local_ref].offset, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
-            MIROperand *object = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            mcode_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
-            MIROperand *f = mir_get_op(instruction, 0);
-            MIROperand *reg = mir_get_op(instruction, 1);
-            if (!reg->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
-              putchar('\n');
-              reg->value.reg.size = r64;
-            }
-            if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
-              mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
-            mcode_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
-            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
-          }
-        } break;
+      case MX64_POP: FALLTHROUGH;
+      case MX64_PUSH: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_REGISTER)) {
+          MIROperand *reg = mir_get_op(instruction, 0);
+          mcode_reg(context, instruction->opcode, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_JMP: {
-          if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.block->name.data, false);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.function->name.data, true);
-          } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
-            MIROperand *destination = mir_get_op(instruction, 0);
-            mcode_name(context, MX64_JMP, destination->value.name, false);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      case MX64_LEA: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_LOCAL_REF, MIR_OP_REGISTER)) {
+          MIROperand *local = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_CMP: FALLTHROUGH;
-        case MX64_TEST: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *lhs = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!lhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              lhs->value.reg.size = r64;
-            }
-            if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              rhs->value.reg.size = r64;
-            }
-            mcode_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
-          } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *imm = mir_get_op(instruction, 0);
-            MIROperand *rhs = mir_get_op(instruction, 1);
-            if (!rhs->value.reg.size) {
-              putchar('\n');
-              print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-              print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
-              rhs->value.reg.size = r64;
-            }
-            mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          mcode_mem_to_reg(context, MX64_LEA, REG_RBP, function->frame_objects.data[local->value.local_ref].offset, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_STATIC_REF, MIR_OP_REGISTER)) {
+          MIROperand *object = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_SETCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
-            MIROperand *compare_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
-            mcode_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          mcode_name_to_reg(context, MX64_LEA, REG_RIP, ir_static_ref_var(object->value.static_ref)->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_FUNCTION, MIR_OP_REGISTER)) {
+          MIROperand *f = mir_get_op(instruction, 0);
+          MIROperand *reg = mir_get_op(instruction, 1);
+          if (!reg->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n");
+            putchar('\n');
+            reg->value.reg.size = r64;
           }
-        } break;
+          if (reg->value.reg.size == r8 || reg->value.reg.size == r16)
+            mcode_imm_to_reg(context, MX64_MOV, 0, reg->value.reg.value, r32);
+          mcode_name_to_reg(context, MX64_LEA, REG_RIP, f->value.function->name.data, reg->value.reg.value, reg->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_SYSCALL:
-        case MX64_UD2:
-        case MX64_INT3:
-        case MX64_CWD:
-        case MX64_CDQ:
-        case MX64_CQO: {
-          mcode_none(context, (MIROpcodex86_64)instruction->opcode);
-        } break;
+      case MX64_JMP: {
+        if (mir_operand_kinds_match(instruction, 1, MIR_OP_BLOCK)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_name(context, MX64_JMP, destination->value.block->name.data, false);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_FUNCTION)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_name(context, MX64_JMP, destination->value.function->name.data, true);
+        } else if (mir_operand_kinds_match(instruction, 1, MIR_OP_NAME)) {
+          MIROperand *destination = mir_get_op(instruction, 0);
+          mcode_name(context, MX64_JMP, destination->value.name, false);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_JCC: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
-            MIROperand *jump_type = mir_get_op(instruction, 0);
-            MIROperand *destination = mir_get_op(instruction, 1);
-            ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
-            mcode_jcc(context, (IndirectJumpType)jump_type->value.imm, destination->value.block->name.data, false);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+      case MX64_CMP: FALLTHROUGH;
+      case MX64_TEST: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *lhs = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!lhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            lhs->value.reg.size = r64;
           }
-        } break;
-
-        case MX64_MOVSX: FALLTHROUGH;
-        case MX64_MOVZX: {
-          if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
-            MIROperand *src = mir_get_op(instruction, 0);
-            MIROperand *dst = mir_get_op(instruction, 1);
-            mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
-          } else {
-            print("\n\nUNHANDLED INSTRUCTION:\n");
+          if (!rhs->value.reg.size) {
+            putchar('\n');
+            print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            rhs->value.reg.size = r64;
+          }
+          mcode_reg_to_reg(context, instruction->opcode, lhs->value.reg.value, lhs->value.reg.size, rhs->value.reg.value, rhs->value.reg.size);
+        } else if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *imm = mir_get_op(instruction, 0);
+          MIROperand *rhs = mir_get_op(instruction, 1);
+          if (!rhs->value.reg.size) {
+            putchar('\n');
             print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
-            ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+            print("%35WARNING%m: Zero sized register, assuming 64-bit...\n\n");
+            rhs->value.reg.size = r64;
           }
-        } break; // case MX64_MOVZX
+          mcode_imm_to_reg(context, instruction->opcode, imm->value.imm, rhs->value.reg.value, rhs->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_XOR: FALLTHROUGH;
-        case MX64_XCHG:
-          TODO("Implement machine code emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
+      case MX64_SETCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_REGISTER)) {
+          MIROperand *compare_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(compare_type->value.imm < COMPARE_COUNT, "Invalid compare type for setcc: %I", compare_type->value.imm);
+          mcode_setcc(context, (enum ComparisonType)compare_type->value.imm, destination->value.reg.value);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-        case MX64_START: FALLTHROUGH;
-        case MX64_END: FALLTHROUGH;
-        case MX64_COUNT: UNREACHABLE();
+      case MX64_SYSCALL:
+      case MX64_UD2:
+      case MX64_INT3:
+      case MX64_CWD:
+      case MX64_CDQ:
+      case MX64_CQO: {
+        mcode_none(context, (MIROpcodex86_64)instruction->opcode);
+      } break;
 
-        } // switch (instruction->opcode)
-      }
-    }
-  }
+      case MX64_JCC: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_IMMEDIATE, MIR_OP_BLOCK)) {
+          MIROperand *jump_type = mir_get_op(instruction, 0);
+          MIROperand *destination = mir_get_op(instruction, 1);
+          ASSERT(jump_type->value.imm < JUMP_TYPE_COUNT, "Invalid jump type for jcc: %I", jump_type->value.imm);
+          mcode_jcc(context, (IndirectJumpType)jump_type->value.imm, destination->value.block->name.data, false);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
+        }
+      } break;
 
-  // Resolve local label (".Lxxxx") relocations.
-  Vector(size_t) relocations_to_remove = {0};
-  foreach_index (idx, context->object->relocs) {
-    RelocationEntry *reloc = context->object->relocs.data + idx;
-    GObjSymbol *sym = &reloc->sym;
-    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0) {
-      // We have to go sym->byte_offset bytes into the ByteBuffer of
-      // the code section and then fill in the next bytes depending on the
-      // relocation type.
-      GObjSymbol *label_sym = NULL;
-      foreach (s, context->object->symbols) {
-        if (strcmp(s->name, sym->name) == 0) {
-          label_sym = s;
-          break;
+      case MX64_MOVSX: FALLTHROUGH;
+      case MX64_MOVZX: {
+        if (mir_operand_kinds_match(instruction, 2, MIR_OP_REGISTER, MIR_OP_REGISTER)) {
+          MIROperand *src = mir_get_op(instruction, 0);
+          MIROperand *dst = mir_get_op(instruction, 1);
+          mcode_reg_to_reg(context, instruction->opcode, src->value.reg.value, src->value.reg.size, dst->value.reg.value, dst->value.reg.size);
+        } else {
+          print("\n\nUNHANDLED INSTRUCTION:\n");
+          print_mir_instruction_with_mnemonic(instruction, mir_x86_64_opcode_mnemonic);
+          ICE("[x86_64/CodeEmission]: Unhandled instruction, sorry");
         }
-      }
-      if (!label_sym) ICE("Could not find local label referenced by relocation: \"%s\"", sym->name);
+      } break; // case MX64_MOVZX
 
-      // TODO: Handle endianess
-      // NOTE: 4 == sizeof relocation displacement
-      int32_t disp32 = (int32_t)label_sym->byte_offset - (4 + (int32_t)sym->byte_offset);
-      uint8_t *src_it = (uint8_t*)&disp32;
-      uint8_t *dst_it = code_section(context->object)->data.bytes.data + sym->byte_offset;
-      for (int i = 0; i < 4; ++i)
-        *dst_it++ = *src_it++;
+      case MX64_XOR: FALLTHROUGH;
+      case MX64_XCHG:
+        TODO("Implement machine code emission from opcode %d (%s)", instruction->opcode, mir_x86_64_opcode_mnemonic(instruction->opcode));
 
-      vector_push(relocations_to_remove, idx);
+      case MX64_START: FALLTHROUGH;
+      case MX64_END: FALLTHROUGH;
+      case MX64_COUNT: UNREACHABLE();
+
+      } // switch (instruction->opcode)
     }
   }
-  foreach_rev (idx, relocations_to_remove) {
-    vector_remove_index(context->object->relocs, *idx);
-  }
 
-  // Remove all local label symbols (".Lxxxx")
-  Vector(size_t) symbols_to_remove = {0};
-  foreach_index (idx, context->object->symbols) {
-    GObjSymbol *sym = context->object->symbols.data + idx;
-    if (strlen(sym->name) > 2 && memcmp(sym->name, ".L", 2) == 0)
-      vector_push(symbols_to_remove, idx);
-  }
-  foreach_rev (idx, symbols_to_remove) {
-    vector_remove_index(context->object->symbols, *idx);
-  }
+  resolve_local_labels(context, first_reloc, first_symbol);
+}
+
+void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machine_instructions) {
+  emit_x86_64_generic_object_metadata(context);
+  foreach_val (function, machine_instructions)
+    emit_x86_64_generic_object_function(context, function);
 }
@@ -6,4 +6,13 @@
 /// Emits into `context->object` GenericObjectFile. JUST emits the code section, and some symbols for functions.
 void emit_x86_64_generic_object(CodegenContext *context, MIRFunctionVector machine_instructions);
 
+/// Emit the module metadata section, if any, into `context->object`.
+void emit_x86_64_generic_object_metadata(CodegenContext *context);
+
+/// Emit a single function into the code section of `context->object`,
+/// and resolve references to its local labels. This only reads the
+/// context, so different functions may be emitted concurrently if
+/// each one uses a copy of the context with its own object.
+void emit_x86_64_generic_object_function(CodegenContext *context, MIRFunction *function);
+
 #endif /* ARCH_X86_64_TGT_GENERIC_OBJECT_H */
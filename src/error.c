@@ -2,6 +2,7 @@
 
 #include <math.h>
 #include <platform.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -9,6 +10,26 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#  include <signal.h>
+#endif
+
+/// Size of the stack that signal handlers run on; see catch_fatal_errors().
+#define FATAL_ERROR_SIGNAL_STACK_SIZE (256 * 1024)
+
+THREAD_LOCAL FILE *thread_diagnostics_stream = NULL;
+THREAD_LOCAL FILE *thread_diagnostics_copy = NULL;
+
+/// Serialises diagnostics written to stderr.
+static PlatformMutex diagnostics_lock = PLATFORM_MUTEX_INIT;
+static bool first_diagnostic = true;
+
+/// Where to go if the calling thread raises a fatal error, if anywhere.
+static THREAD_LOCAL jmp_buf *fatal_error_jump = NULL;
+
+/// Called before a fatal error exits the process, if set.
+static FatalExitHandler fatal_exit_handler = NULL;
+
 static const char *diagnostic_level_names[DIAG_COUNT] = {
     "Note",
     "Warning",
@@ -58,13 +79,33 @@ void vissue_diagnostic
  const char *fmt,
  va_list ap) {
   ASSERT(level >= 0 && level < DIAG_COUNT);
+
+  /// If the diagnostic is to be copied, write it to a stream first,
+  /// and let flush_diagnostics() write it to stderr and the copy.
+  if (thread_diagnostics_copy && !thread_diagnostics_stream) {
+    PlatformMemoryStream stream;
+    platform_memory_stream_open(&stream);
+    thread_diagnostics_stream = stream.file;
+    vissue_diagnostic(level, filename, source, location, fmt, ap);
+    thread_diagnostics_stream = NULL;
+    string diagnostic = platform_memory_stream_close(&stream);
+    flush_diagnostics(as_span(diagnostic));
+    free(diagnostic.data);
+    return;
+  }
+
+  /// Diagnostics are printed piecemeal, so make sure that diagnostics
+  /// issued by different threads don’t end up interleaved. Nobody else
+  /// writes to the stream of a thread.
+  FILE *out = thread_diagnostics_stream ? thread_diagnostics_stream : stderr;
+  if (!thread_diagnostics_stream) platform_mutex_lock(&diagnostics_lock);
   bool save_thread_disable_type_colours = thread_disable_type_colours;
   thread_disable_type_colours = true;
 
-  /// Print an empty line before every diagnostic except the very first.
-  static bool first_diagnostic = true;
-  if (first_diagnostic) first_diagnostic = false;
-  else eprint("\n");
+  /// Print an empty line before every diagnostic except the very first;
+  /// flush_diagnostics() takes care of that for the stream of a thread.
+  if (first_diagnostic && !thread_diagnostics_stream) first_diagnostic = false;
+  else fprint(out, "\n");
 
   /// Print a detailed error message if we have access to the source code.
   if (source.data && source.size) {
@@ -76,60 +117,77 @@ void vissue_diagnostic
     seek_location(source, location, &line, &line_start, &line_end);
 
     /// Print the filename, line and column, severity and message.
-    eprint("%B38%s:%u:%u: ", filename, line, location.start - line_start);
-    if (colours_blink) eprint("\033[5m\a\a\a\a");
-    eprint("%C%s: %B38", diagnostic_level_colours[level], diagnostic_level_names[level]);
-    vfprint(stderr, fmt, ap);
+    fprint(out, "%B38%s:%u:%u: ", filename, line, location.start - line_start);
+    if (colours_blink) fprint(out, "\033[5m\a\a\a\a");
+    fprint(out, "%C%s: %B38", diagnostic_level_colours[level], diagnostic_level_names[level]);
+    vfprint(out, fmt, ap);
 
     /// Print the line, if source location is valid.
     if (location.start != location.end) {
-      eprint("%m\n %u | ", line);
+      fprint(out, "%m\n %u | ", line);
       for (u32 i = line_start; i < location.start; ++i) {
-        if (source.data[i] == '\t') eprint("    ");
-        else fputc(source.data[i], stderr);
+        if (source.data[i] == '\t') fprint(out, "    ");
+        else fputc(source.data[i], out);
       }
-      eprint("%C", diagnostic_level_colours[level]);
+      fprint(out, "%C", diagnostic_level_colours[level]);
       for (u32 i = location.start; i < location.end; ++i) {
-        if (source.data[i] == '\t') eprint("    ");
-        else fputc(source.data[i], stderr);
+        if (source.data[i] == '\t') fprint(out, "    ");
+        else fputc(source.data[i], out);
       }
-      eprint("%m");
+      fprint(out, "%m");
       for (u32 i = location.end; i < line_end; ++i) {
-        if (source.data[i] == '\t') eprint("    ");
-        else fputc(source.data[i], stderr);
+        if (source.data[i] == '\t') fprint(out, "    ");
+        else fputc(source.data[i], out);
       }
-      eprint("\n");
+      fprint(out, "\n");
 
       /// Underline the region with tildes.
       size_t spaces = !line ? 1 : (u32) (log10(line) + 1);
-      for (size_t i = 0; i < spaces; i++) eprint(" ");
-      eprint("  | ");
-      if (colours_blink) eprint("\033[5m");
-      eprint("%C", diagnostic_level_colours[level]);
+      for (size_t i = 0; i < spaces; i++) fprint(out, " ");
+      fprint(out, "  | ");
+      if (colours_blink) fprint(out, "\033[5m");
+      fprint(out, "%C", diagnostic_level_colours[level]);
       for (u32 i = line_start; i < location.start; ++i) {
-        if (source.data[i] == '\t') eprint("    ");
-        else fputc(' ', stderr);
+        if (source.data[i] == '\t') fprint(out, "    ");
+        else fputc(' ', out);
       }
       for (u32 i = location.start; i < location.end; ++i) {
-        if (source.data[i] == '\t') eprint("~~~~");
-        else fputc('~', stderr);
+        if (source.data[i] == '\t') fprint(out, "~~~~");
+        else fputc('~', out);
       }
     }
   }
 
   /// Otherwise, just print a simple error message.
   else {
-    eprint("%B38%s: %C%C%s: %B38",
+    fprint(out, "%B38%s: %C%C%s: %B38",
       filename,
       colours_blink ? "\033[5m" : "", diagnostic_level_colours[level], diagnostic_level_names[level]
     );
-    vfprint(stderr, fmt, ap);
+    vfprint(out, fmt, ap);
   }
 
-  eprint("%m\n");
+  fprint(out, "%m\n");
   thread_disable_type_colours = save_thread_disable_type_colours;
+  if (!thread_diagnostics_stream) platform_mutex_unlock(&diagnostics_lock);
  }
 
+void flush_diagnostics(span diagnostics) {
+  if (!diagnostics.size) return;
+  if (thread_diagnostics_copy) fwrite(diagnostics.data, 1, diagnostics.size, thread_diagnostics_copy);
+  platform_mutex_lock(&diagnostics_lock);
+
+  /// Every diagnostic in the stream starts with an empty line.
+  if (first_diagnostic) {
+    first_diagnostic = false;
+    diagnostics.data++;
+    diagnostics.size--;
+  }
+
+  fwrite(diagnostics.data, 1, diagnostics.size, stderr);
+  platform_mutex_unlock(&diagnostics_lock);
+}
+
 void raise_fatal_error_impl (
     const char *file,
     const char *func,
@@ -185,23 +243,74 @@ void raise_fatal_error_impl (
   platform_print_backtrace(is_signal_or_exception ? 9 : 2);
 #endif
 
+  /// Go back to where the error is caught, if anywhere, but only if
+  /// the process is still in a consistent state. After a crash, the
+  /// heap may be corrupt, or the crash may have happened with a lock
+  /// held somewhere we can’t see, e.g. in malloc(). And if we hold a
+  /// lock ourselves, whoever tries to take it next would hang.
+  if (fatal_error_jump && !is_signal_or_exception && !platform_mutex_held())
+    longjmp(*fatal_error_jump, 1);
+
   /// Exit.
+  if (fatal_exit_handler) fatal_exit_handler();
   _Exit(1);
 }
 
+bool catch_fatal_errors(FatalErrorCallback callback, void *data) {
+  jmp_buf jump;
+  jmp_buf *enclosing = fatal_error_jump;
+
+#ifndef _WIN32
+  /// Run signal handlers on a stack of their own so that we can still
+  /// report running out of stack. Nested calls use the outermost one.
+  stack_t stack = {.ss_size = FATAL_ERROR_SIGNAL_STACK_SIZE}, previous_stack;
+  if (!enclosing) {
+    stack.ss_sp = malloc(stack.ss_size);
+    if (sigaltstack(&stack, &previous_stack)) ICE("Failed to install signal stack");
+  }
+#endif
+
+  fatal_error_jump = &jump;
+  bool ok = !setjmp(jump);
+  if (ok) callback(data);
+  fatal_error_jump = enclosing;
+
+#ifndef _WIN32
+  if (!enclosing) {
+    sigaltstack(&previous_stack, NULL);
+    free(stack.ss_sp);
+  }
+#endif
+  return ok;
+}
+
+bool fatal_errors_are_caught(void) {
+  return fatal_error_jump != NULL;
+}
+
+void rethrow_fatal_error(void) {
+  if (fatal_error_jump) longjmp(*fatal_error_jump, 1);
+  if (fatal_exit_handler) fatal_exit_handler();
+  _Exit(1);
+}
+
+void set_fatal_exit_handler(FatalExitHandler handler) {
+  fatal_exit_handler = handler;
+}
+
 void seek_location(span source, loc location, u32 *o_line, u32 *o_line_start, u32 *o_line_end) {
   /// Seek to the start of the line. Keep track of the line number.
   u32 line = 1;
   u32 line_start = 0;
   for (u32 i = location.start; i > 0; --i) {
-    if (source.data[i] == '\n') {
+    if (i < source.size && source.data[i] == '\n') {
       if (!line_start) line_start = i + 1;
       ++line;
     }
   }
 
   /// Don’t include the newline in the line.
-  if (source.data[line_start] == '\n') ++line_start;
+  if (line_start < source.size && source.data[line_start] == '\n') ++line_start;
 
   /// Seek to the end of the line.
   u32 line_end = location.end;
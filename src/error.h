@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <utils.h>
@@ -94,6 +95,19 @@ void vissue_diagnostic
  va_list ap);
 
 
+/// If set, diagnostics issued by the calling thread are written to
+/// this stream instead of stderr; see flush_diagnostics().
+extern THREAD_LOCAL FILE *thread_diagnostics_stream;
+
+/// If set, diagnostics that the calling thread writes to stderr are
+/// also written to this stream, each starting with an empty line, so
+/// that they can be replayed later with flush_diagnostics().
+extern THREAD_LOCAL FILE *thread_diagnostics_copy;
+
+/// Write diagnostics that were written to a thread_diagnostics_stream
+/// or a thread_diagnostics_copy to stderr.
+void flush_diagnostics(span diagnostics);
+
 /// Used by ASSERT()/ICE()/TODO().
 /// You probably don't want to use this directly.
 NORETURN
@@ -108,4 +122,34 @@ void raise_fatal_error_impl (
     ...
 );
 
+/// Callback for catch_fatal_errors().
+FUNCTION_POINTER(void, FatalErrorCallback, void *data);
+
+/// Call `callback(data)`. If it raises a fatal error, i.e. an ICE, a
+/// failed assertion, or a TODO(), the error is reported as usual, but
+/// rather than exiting, we return false.
+///
+/// Whatever the callback was doing is abandoned: nothing it allocated
+/// is freed, and thread-local state it changed stays changed, so the
+/// caller has to clean up after it. Crashes and fatal errors raised
+/// while the thread holds a lock still exit, since the process may be
+/// left in an inconsistent state; never raise one with a lock held.
+bool catch_fatal_errors(FatalErrorCallback callback, void *data);
+
+/// Whether the calling thread is within a call to catch_fatal_errors().
+bool fatal_errors_are_caught(void);
+
+/// Return false from the innermost catch_fatal_errors() on this thread
+/// without reporting anything, or exit if there is none. Use this to
+/// pass on a fatal error that was caught and reported elsewhere.
+NORETURN void rethrow_fatal_error(void);
+
+/// Called right before a fatal error exits the process.
+FUNCTION_POINTER(void, FatalExitHandler, void);
+
+/// Set the function that is called right before a fatal error exits
+/// the process, e.g. to remove temporary files. It may be called from
+/// a signal handler, so it must only do what is safe to do there.
+void set_fatal_exit_handler(FatalExitHandler handler);
+
 #endif /* COMPILER_ERROR_H */
@@ -0,0 +1,100 @@
+#include <hash.h>
+
+static FORCEINLINE u64 rotl64(u64 x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static FORCEINLINE u64 fmix64(u64 k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/// Read 8 bytes in little-endian order; the data need not be aligned.
+static FORCEINLINE u64 read64(const u8 *p) {
+  u64 v = 0;
+  for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+  return v;
+}
+
+Hash128 hash128(span data, u64 seed) {
+  const u8 *bytes = (const u8 *) data.data;
+  const usz blocks = data.size / 16;
+  const u64 c1 = 0x87c37b91114253d5ULL;
+  const u64 c2 = 0x4cf5ad432745937fULL;
+  u64 h1 = seed, h2 = seed;
+
+  /// Body.
+  for (usz i = 0; i < blocks; i++) {
+    u64 k1 = read64(bytes + i * 16);
+    u64 k2 = read64(bytes + i * 16 + 8);
+
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  /// Tail.
+  const u8 *tail = bytes + blocks * 16;
+  u64 k1 = 0, k2 = 0;
+  switch (data.size & 15) {
+    case 15: k2 ^= (u64) tail[14] << 48; FALLTHROUGH;
+    case 14: k2 ^= (u64) tail[13] << 40; FALLTHROUGH;
+    case 13: k2 ^= (u64) tail[12] << 32; FALLTHROUGH;
+    case 12: k2 ^= (u64) tail[11] << 24; FALLTHROUGH;
+    case 11: k2 ^= (u64) tail[10] << 16; FALLTHROUGH;
+    case 10: k2 ^= (u64) tail[9] << 8; FALLTHROUGH;
+    case 9:
+      k2 ^= (u64) tail[8];
+      k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+      FALLTHROUGH;
+    case 8: k1 ^= (u64) tail[7] << 56; FALLTHROUGH;
+    case 7: k1 ^= (u64) tail[6] << 48; FALLTHROUGH;
+    case 6: k1 ^= (u64) tail[5] << 40; FALLTHROUGH;
+    case 5: k1 ^= (u64) tail[4] << 32; FALLTHROUGH;
+    case 4: k1 ^= (u64) tail[3] << 24; FALLTHROUGH;
+    case 3: k1 ^= (u64) tail[2] << 16; FALLTHROUGH;
+    case 2: k1 ^= (u64) tail[1] << 8; FALLTHROUGH;
+    case 1:
+      k1 ^= (u64) tail[0];
+      k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+      break;
+    default: break;
+  }
+
+  /// Finalisation.
+  h1 ^= (u64) data.size;
+  h2 ^= (u64) data.size;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  return (Hash128){h1, h2};
+}
+
+u64 hash64(span data) {
+  u64 h = 0xcbf29ce484222325ULL;
+  for (usz i = 0; i < data.size; i++) {
+    h ^= (u8) data.data[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  /// FNV-1a mixes the low bits much better than the high bits.
+  return fmix64(h);
+}
+
+void hash128_to_hex(Hash128 hash, char out[33]) {
+  static const char digits[] = "0123456789abcdef";
+  for (int i = 0; i < 16; i++) {
+    out[i] = digits[(hash.high >> (60 - 4 * i)) & 15];
+    out[16 + i] = digits[(hash.low >> (60 - 4 * i)) & 15];
+  }
+  out[32] = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef INTERCEPT_HASH_H
+#define INTERCEPT_HASH_H
+
+#include <utils.h>
+
+/// A 128-bit hash, used to identify contents.
+typedef struct Hash128 {
+  u64 low;
+  u64 high;
+} Hash128;
+
+/// Hash data using MurmurHash3 (x64, 128-bit variant). This is
+/// not a cryptographic hash, but collisions are astronomically
+/// unlikely for data that isn't crafted to collide.
+Hash128 hash128(span data, u64 seed);
+
+/// Hash a short string, e.g. an identifier, using FNV-1a. This is
+/// much cheaper than hash128() for short strings, but only suitable
+/// for hash tables.
+u64 hash64(span data);
+
+/// Format a hash as 32 lowercase hex digits followed by a NUL.
+void hash128_to_hex(Hash128 hash, char out[33]);
+
+#endif // INTERCEPT_HASH_H
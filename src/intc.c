@@ -0,0 +1,110 @@
+#include <ast.h>
+#include <codegen.h>
+#include <intc.h>
+#include <module.h>
+#include <parser.h>
+#include <platform.h>
+#include <stats.h>
+#include <stdlib.h>
+#include <timing.h>
+#include <typechecker.h>
+#include <vector.h>
+
+IntcOptions intc_default_options(void) {
+  return (IntcOptions){
+    .filename = NULL,
+    .codegen = {
+      .arch = ARCH_DEFAULT,
+      .target = TARGET_DEFAULT,
+      .call_convention = CG_CALL_CONV_DEFAULT,
+      .optimise = 0,
+      .annotate_code = false,
+      .backend_jobs = 1,
+    },
+    .search_paths = NULL,
+    .search_path_count = 0,
+    .colours = false,
+    .lazy_function_bodies = false,
+  };
+}
+
+IntcStatus intc_compile(const IntcOptions *options, span source, string *output) {
+  return intc_compile_with_hooks(options, source, &(IntcHooks){0}, output);
+}
+
+IntcStatus intc_compile_with_hooks(
+  const IntcOptions *options,
+  span source,
+  const IntcHooks *hooks,
+  string *output
+) {
+  if (output) *output = (string){0};
+  const char *filename = options->filename ? options->filename : "<source>";
+
+  /// Diagnostics of this compilation use the colours it asked for.
+  bool use_colours = thread_use_colours;
+  thread_use_colours = options->colours;
+
+  Vector(string) search_paths = {0};
+  for (usz i = 0; i < options->search_path_count; i++)
+    vector_push(search_paths, string_create(options->search_paths[i]));
+
+  /// Parse the file. The module refers to the source, which
+  /// outlives it since the module is freed before we return.
+  IntcStatus status = INTC_OK;
+  Timer timer = timer_start(PHASE_PARSE);
+  Module *ast = parse(source, filename, options->lazy_function_bodies);
+  timer_stop(&timer);
+  if (!ast) {
+    status = INTC_PARSE_ERROR;
+    goto free_input;
+  }
+  if (hooks->parsed && !hooks->parsed(hooks->data, ast)) goto done;
+
+  /// Resolve imported modules.
+  timer = timer_start(PHASE_IMPORTS);
+  bool ok = module_resolve_imports(ast, search_paths.data, search_paths.size, hooks->resolved_import, hooks->data);
+  timer_stop(&timer);
+  if (!ok) {
+    status = INTC_PARSE_ERROR;
+    goto done;
+  }
+
+  /// Perform semantic analysis.
+  timer = timer_start(PHASE_TYPECHECK);
+  ok = typecheck_expression(ast, ast->root);
+  timer_stop(&timer);
+  if (!ok) {
+    status = ast->deferred_parse_error ? INTC_PARSE_ERROR : INTC_TYPE_ERROR;
+    goto done;
+  }
+  if (hooks->checked) hooks->checked(hooks->data, ast);
+
+  /// Generate code into the output stream, or into memory.
+  if (hooks->open_output) {
+    FILE *code = hooks->open_output(hooks->data, ast);
+    ok = codegen(LANG_FUN, &options->codegen, filename, code, ast, (string){0});
+    if (hooks->close_output) hooks->close_output(hooks->data, code);
+    else fclose(code);
+  } else {
+    PlatformMemoryStream code;
+    platform_memory_stream_open(&code);
+    ok = codegen(LANG_FUN, &options->codegen, filename, code.file, ast, (string){0});
+    string generated = platform_memory_stream_close(&code);
+    if (ok && output) *output = generated;
+    else free(generated.data);
+  }
+  if (!ok) status = INTC_CODEGEN_ERROR;
+
+done:
+  stats_add(STAT_AST_NODES, ast->_nodes_.count);
+  stats_add(STAT_AST_TYPES, ast->_types_.count);
+  stats_add(STAT_AST_SCOPES, ast->_scopes_.count);
+  if (!hooks->keep_module) ast_free(ast);
+
+free_input:
+  foreach (path, search_paths) free(path->data);
+  vector_delete(search_paths);
+  thread_use_colours = use_colours;
+  return status;
+}
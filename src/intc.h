@@ -0,0 +1,100 @@
+#ifndef INTERCEPT_INTC_H
+#define INTERCEPT_INTC_H
+
+#include <codegen/codegen_forward.h>
+#include <stdbool.h>
+#include <utils.h>
+
+/// Options for a single compilation.
+typedef struct IntcOptions {
+  /// The name of the source file. This is used in diagnostics and
+  /// ends up in the output. If NULL, "<source>" is used.
+  const char *filename;
+
+  /// What code to generate.
+  CodegenOptions codegen;
+
+  /// The directories that imported modules are looked up in, in order.
+  const char *const *search_paths;
+  usz search_path_count;
+
+  /// Whether to use colours in diagnostics.
+  bool colours;
+
+  /// Only parse the bodies of top-level functions that are referenced.
+  bool lazy_function_bodies;
+} IntcOptions;
+
+/// The result of a compilation. These are also the exit codes of intc.
+typedef enum IntcStatus {
+  INTC_OK = 0,
+
+  /// The source code could not be parsed, or a module it imports
+  /// could not be found.
+  INTC_PARSE_ERROR = 1,
+
+  /// The program is ill-formed.
+  INTC_TYPE_ERROR = 2,
+
+  /// Code generation failed.
+  INTC_CODEGEN_ERROR = 3,
+} IntcStatus;
+
+/// Get the options that intc uses if none are given on the command line.
+IntcOptions intc_default_options(void);
+
+/// Compile Intercept source code to an object file, assembly, or
+/// LLVM IR in memory, depending on `options->codegen.target`.
+///
+/// Nothing but the state of this compilation is modified, so this may
+/// be called from any number of threads at once. Diagnostics are
+/// printed to stderr. Compiler bugs still abort the process.
+///
+/// \param source The source code; it need not be NUL-terminated.
+/// \param output Set to the generated code on success; the caller is
+///        responsible for freeing it. Set to an empty string otherwise.
+///        If NULL, the code is generated and then discarded.
+/// \return INTC_OK on success, or what went wrong.
+IntcStatus intc_compile(const IntcOptions *options, span source, string *output);
+
+typedef struct Module Module;
+
+/// Hooks into the stages of a compilation. The command line interface
+/// uses these to print the AST, cache outputs, and write code to a file.
+/// Any of the functions may be NULL.
+typedef struct IntcHooks {
+  /// Passed to every hook.
+  void *data;
+
+  /// Called once the source has been parsed. If this returns false,
+  /// the compilation stops there and succeeds.
+  bool (*parsed)(void *data, Module *ast);
+
+  /// Called for every module that the source imports.
+  void (*resolved_import)(span module_name, const char *path, void *data);
+
+  /// Called once the module has been typechecked successfully.
+  void (*checked)(void *data, Module *ast);
+
+  /// Open the stream that code is written to, which is closed when
+  /// code generation is done. If NULL, code is generated in memory.
+  FILE *(*open_output)(void *data, Module *ast);
+
+  /// Close the stream returned by `open_output`. If NULL, the stream
+  /// is closed with fclose().
+  void (*close_output)(void *data, FILE *output);
+
+  /// Don't free the module, because the process exits right after.
+  bool keep_module;
+} IntcHooks;
+
+/// Like intc_compile(), but call `hooks` between the stages of the
+/// compilation. If `hooks->open_output` is set, `output` is not used.
+IntcStatus intc_compile_with_hooks(
+  const IntcOptions *options,
+  span source,
+  const IntcHooks *hooks,
+  string *output
+);
+
+#endif // INTERCEPT_INTC_H
@@ -259,10 +259,10 @@ DominatorTree dom_tree_build(IRFunction *f) {
 
   /// Create dominator tree.
   DominatorTree dom = {0};
-  vector_reserve(dom.doms, st->verts_by_id.size);
   foreach_val (v, st->verts_by_id) map_set(dom.doms, v, IDOM(v));
 
   /// Delete state.
+  map_delete(st->ids_by_vert);
   vector_delete(st->verts_by_id);
   vector_delete(st->label);
   vector_delete(st->parent);
@@ -279,5 +279,5 @@ DominatorTree dom_tree_build(IRFunction *f) {
 }
 
 void dom_tree_delete(DominatorTree *info) {
-  vector_delete(info->doms);
+  map_delete(info->doms);
 }
@@ -1,5 +1,6 @@
 #include <codegen/opt/opt-internal.h>
 #include <ir/ir-impl.h>
+#include <stats.h>
 
 #define ROOT_INLINE_ENTRY ((usz) -1)
 
@@ -49,7 +50,7 @@ static inline_result ir_inline_call(
 ) {
   /// Save the instruction before and after the call.
   IRFunction *const callee = call->call.callee_function;
-  IRBlock *const call_block = call->parent_block;
+  IRBlock *const call_block = BLOCK(call->parent_block);
   const bool is_tail_call = call->call.tail_call;
   usz call_history_index = 0;
   bool may_fail = ictx->may_fail && !call->call.force_inline;
@@ -91,11 +92,11 @@ static inline_result ir_inline_call(
             issue_diagnostic(
               DIAG_ERR,
               ctx->ast->filename.data,
-              as_span(ctx->ast->source),
+              ctx->ast->source,
               (loc){0},
               "Failed to inline function %S into %S: Infinite loop detected",
               callee->name,
-              call->parent_block->function->name
+              BLOCK(call->parent_block)->function->name
             );
           }
 
@@ -155,9 +156,10 @@ static inline_result ir_inline_call(
   /// to the blocks, except that the first block, i.e. the block into which
   /// we start inserting, is mapped to the block containing the call.
   vector_push(blocks, call_block);
-  for (usz i = 0; i < (usz) count; i++) vector_push(instructions, calloc(1, sizeof(IRInstruction)));
+  for (usz i = 0; i < (usz) count; i++)
+    vector_push(instructions, ir_allocate_instruction(ctx, IR_COUNT));
   for (usz i = 1; i < block_count; i++) {
-    IRBlock *b = calloc(1, sizeof(IRBlock));
+    IRBlock *b = ir_block(ctx);
     b->function = call_block->function;
     vector_push(blocks, b);
   }
@@ -185,13 +187,18 @@ static inline_result ir_inline_call(
   /// Put the arguments at the end of the instructions vector.
   foreach_index (i, call->call.arguments) {
     u32 mapped_index = (u32) ((usz) count - callee->parameters.size + i);
-    instructions.data[mapped_index] = call->call.arguments.data[i];
+    instructions.data[mapped_index] = INST(call->call.arguments.data[i]);
   }
 
   /// Map an instruction or block to its replacement.
 #define MAP(inst)        instructions.data[(inst)->id]
 #define MAP_BLOCK(block) blocks.data[(block)->id]
 
+  /// Map the instruction or block a handle refers to, and return the
+  /// handle of its replacement.
+#define MAP_HANDLE(handle)       HANDLE(MAP(INST(handle)))
+#define MAP_BLOCK_HANDLE(handle) HANDLE(MAP_BLOCK(BLOCK(handle)))
+
   /// PHI and return block in case the callee contains more
   /// than one return instruction and returns a value.
   IRInstruction *return_value = NULL;
@@ -245,10 +252,10 @@ static inline_result ir_inline_call(
         case IR_CALL: {
           copy->call.is_indirect = inst->call.is_indirect;
           copy->call.tail_call = inst->call.tail_call;
-          if (inst->call.is_indirect) copy->call.callee_instruction = MAP(inst->call.callee_instruction);
+          if (inst->call.is_indirect) copy->call.callee_instruction = MAP_HANDLE(inst->call.callee_instruction);
           else copy->call.callee_function = inst->call.callee_function;
-          foreach_val (arg, inst->call.arguments)
-            vector_push(copy->call.arguments, MAP(arg));
+          foreach (arg, inst->call.arguments)
+            small_vector_push(copy->call.arguments, MAP_HANDLE(*arg));
 
           /// Record the origin of this call.
           if (inst->kind == IR_CALL) {
@@ -270,7 +277,7 @@ static inline_result ir_inline_call(
         case IR_TRUNCATE:
         case IR_BITCAST:
         case IR_NOT:
-          copy->operand = MAP(inst->operand);
+          copy->operand = MAP_HANDLE(inst->operand);
           break;
 
         case IR_ADD:
@@ -289,23 +296,23 @@ static inline_result ir_inline_call(
         case IR_GE:
         case IR_EQ:
         case IR_NE:
-          copy->lhs = MAP(inst->lhs);
-          copy->rhs = MAP(inst->rhs);
+          copy->lhs = MAP_HANDLE(inst->lhs);
+          copy->rhs = MAP_HANDLE(inst->rhs);
           break;
 
         case IR_STORE:
-          copy->store.value = MAP(inst->store.value);
-          copy->store.addr = MAP(inst->store.addr);
+          copy->store.value = MAP_HANDLE(inst->store.value);
+          copy->store.addr = MAP_HANDLE(inst->store.addr);
           break;
 
         case IR_BRANCH:
-          copy->destination_block = MAP_BLOCK(inst->destination_block);
+          copy->destination_block = MAP_BLOCK_HANDLE(inst->destination_block);
           break;
 
         case IR_BRANCH_CONDITIONAL:
-          copy->cond_br.condition = MAP(inst->cond_br.condition);
-          copy->cond_br.then = MAP_BLOCK(inst->cond_br.then);
-          copy->cond_br.else_ = MAP_BLOCK(inst->cond_br.else_);
+          copy->cond_br.condition = MAP_HANDLE(inst->cond_br.condition);
+          copy->cond_br.then = MAP_BLOCK_HANDLE(inst->cond_br.then);
+          copy->cond_br.else_ = MAP_BLOCK_HANDLE(inst->cond_br.else_);
           break;
 
         case IR_PHI:
@@ -314,7 +321,7 @@ static inline_result ir_inline_call(
               .value = MAP(inst->phi_args.data[arg].value),
               .block = MAP_BLOCK(inst->phi_args.data[arg].block),
             };
-            vector_push(copy->phi_args, new);
+            small_vector_push(copy->phi_args, new);
             inlined--; /// This doesn’t count.
           }
           break;
@@ -327,7 +334,7 @@ static inline_result ir_inline_call(
         case IR_RETURN: {
           /// If this is a tail call, just emit the return instruction.
           if (is_tail_call) {
-            copy->operand = MAP(inst->operand);
+            copy->operand = MAP_HANDLE(inst->operand);
             break;
           }
 
@@ -337,7 +344,7 @@ static inline_result ir_inline_call(
           if (!return_block) {
             if (block == vector_back(callee->blocks) && inst == vector_back(block->instructions)) {
               if (inst->operand) {
-                return_value = MAP(inst->operand);
+                return_value = MAP(INST(inst->operand));
                 MAP(inst) = call; /// See below.
               }
 
@@ -349,21 +356,20 @@ static inline_result ir_inline_call(
             /// separate return block.
             return_block = ir_block(ctx);
             if (inst->operand) {
-              return_value = calloc(1, sizeof(IRInstruction));
-              return_value->kind = IR_PHI;
+              return_value = ir_allocate_instruction(ctx, IR_PHI);
               ir_insert_at_end(return_block, return_value);
             }
           }
 
           /// Add to the PHI and branch.
           copy->kind = IR_BRANCH;
-          copy->destination_block = return_block;
+          copy->destination_block = HANDLE(return_block);
           if (inst->operand) {
             IRPhiArgument new = {
-              .value = MAP(inst->operand),
+              .value = MAP(INST(inst->operand)),
               .block = block,
             };
-            vector_push(return_value->phi_args, new);
+            small_vector_push(return_value->phi_args, new);
 
             /// Replace ourselves with the call instruction in
             /// the vector so uses are updated correctly later on.
@@ -381,8 +387,8 @@ static inline_result ir_inline_call(
   /// Fix up uses.
   FOREACH_INSTRUCTION_IN_FUNCTION (instruction, b, callee) {
     IRInstruction *copy = MAP(instruction);
-    foreach_val (user, instruction->users)
-      mark_used(copy, MAP(user));
+    foreach (user, instruction->users)
+      mark_used(copy, MAP(INST(*user)));
   }
 
   /// Fix up the return value by replacing all uses of the
@@ -441,7 +447,7 @@ static inline_result ir_inline_call(
   /// Free unused instructions.
   foreach_val (i, instructions)
     if (i != call && !i->parent_block)
-      free(i);
+      ir_free_instruction(ctx, i);
 
   /// Delete vectors.
   vector_delete(instructions);
@@ -502,7 +508,7 @@ again:
               if (may_fail) issue_diagnostic(
                 DIAG_ERR,
                 ctx->ast->filename.data,
-                as_span(ctx->ast->source),
+                ctx->ast->source,
                 (loc){0},
                 "Sorry, could not inline non-tail-recursive call"
               );
@@ -518,7 +524,10 @@ again:
 
         /// Inline it.
         inline_result inlined = ir_inline_call(ctx, ictx, inst, threshold);
-        if (inlined.changed) res.changed = true;
+        if (inlined.changed) {
+          res.changed = true;
+          stats_add(STAT_OPT_CALLS_INLINED, 1);
+        }
         if (inlined.failed) {
           res.failed = true;
           vector_push(ictx->not_inlinable, inst);
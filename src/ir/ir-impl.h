@@ -7,11 +7,51 @@
 /// Internal header. Do not include this in non-IR-implementation files.
 ///
 
+/// Handles.
+///
+/// Fields that refer to other instructions or blocks store handles;
+/// use INST() and BLOCK() to get the instruction or block a handle
+/// refers to, and HANDLE() to get the handle of an instruction or
+/// block. NULL and the handle 0 correspond to each other.
+///
+/// With IR_INDEX_HANDLES, instructions and blocks are allocated in
+/// chunks of IR_CHUNK_SIZE objects, and a handle is the index of its
+/// chunk in `ir_chunks` followed by the index of the object in that
+/// chunk. Chunk 0 is never used, so it maps the handle 0 to NULL.
+#ifdef IR_INDEX_HANDLES
+#  define IR_CHUNK_BITS 11
+#  define IR_CHUNK_SIZE ((u32) 1 << IR_CHUNK_BITS)
+#  define IR_CHUNK_COUNT ((usz) 1 << (32 - IR_CHUNK_BITS))
+extern char *ir_chunks[IR_CHUNK_COUNT];
+
+#  define IR_RESOLVE(type, handle) ((type *) ((uintptr_t) ir_chunks[(handle) >> IR_CHUNK_BITS] + \
+                                             ((handle) & (IR_CHUNK_SIZE - 1)) * sizeof(type)))
+#  define INST(handle) IR_RESOLVE(IRInstruction, (IRInstructionHandle) (handle))
+#  define BLOCK(handle) IR_RESOLVE(IRBlock, (IRBlockHandle) (handle))
+#  define HANDLE(obj) _Generic((obj), \
+    IRInstruction *: ir_instruction_handle, \
+    IRBlock *: ir_block_handle \
+  )(obj)
+#  define SET_HANDLE(obj, handle) ((obj)->handle = (handle))
+#else
+#  define INST(handle) ((IRInstruction *) (handle))
+#  define BLOCK(handle) ((IRBlock *) (handle))
+#  define HANDLE(obj) (obj)
+#  define SET_HANDLE(obj, handle) ((void) (handle))
+#endif
+
+/// Most instructions have only a handful of users, and most calls and
+/// phis only a handful of arguments, so these are stored inline in the
+/// instruction; instructions never move, so this is safe.
+typedef SmallVector(IRInstructionHandle, 4) IRCallArguments;
+typedef SmallVector(IRPhiArgument, 2) IRPhiArguments;
+typedef SmallVector(IRInstructionHandle, 2) IRUsers;
+
 typedef struct IRCall {
-  IRInstructionVector arguments;
+  IRCallArguments arguments;
   // TODO: Make this a named union!
   union {
-    IRInstruction *callee_instruction;
+    IRInstructionHandle callee_instruction;
     IRFunction *callee_function;
   };
   enum IntrinsicKind intrinsic; /// Only used by intrinsic calls.
@@ -21,9 +61,9 @@ typedef struct IRCall {
 } IRCall;
 
 typedef struct IRBranchConditional {
-  IRInstruction *condition;
-  IRBlock *then;
-  IRBlock *else_;
+  IRInstructionHandle condition;
+  IRBlockHandle then;
+  IRBlockHandle else_;
 } IRBranchConditional;
 
 typedef struct IRStackAllocation {
@@ -42,37 +82,41 @@ typedef struct IRInstruction {
   Type *type;
 
   u32 id;
+#ifdef IR_INDEX_HANDLES
+  IRInstructionHandle handle; /// The handle of this instruction.
+#else
   u32 padding : 32; /// Add flags etc. here.
+#endif
 
   /// List of instructions using this instruction.
-  InstructionVector users;
+  IRUsers users;
 
-  IRBlock *parent_block;
+  IRBlockHandle parent_block;
 
   /// Source location of the instruction.
   loc source_location;
 
   union {
-    IRBlock *destination_block;
-    IRInstruction *operand;
+    IRBlockHandle destination_block;
+    IRInstructionHandle operand;
     u64 imm;
     IRCall call;
-    Vector(IRPhiArgument) phi_args;
+    IRPhiArguments phi_args;
     IRBranchConditional cond_br;
     struct {
-      IRInstruction *addr;
-      IRInstruction *value;
+      IRInstructionHandle addr;
+      IRInstructionHandle value;
     } store;
     struct {
-      IRInstruction *lhs;
-      IRInstruction *rhs;
+      IRInstructionHandle lhs;
+      IRInstructionHandle rhs;
     };
     IRStaticVariable* static_ref;
     IRFunction *function_ref;
     IRStackAllocation alloca;
     CodegenContext *ctx; /// Used by IR_POISON.
     struct {
-      string str;
+      atom str;
       usz string_index;
     };
   };
@@ -91,6 +135,9 @@ typedef struct IRBlock {
 
   // Unique ID (among blocks)
   u32 id;
+#ifdef IR_INDEX_HANDLES
+  IRBlockHandle handle; /// The handle of this block.
+#endif
 
   // MIRBlock that was created to represent this IRBlock.
   MIRBlock *machine_block;
@@ -135,6 +182,11 @@ struct IR {
   Vector(IRFunction*) functions;
 };
 
+#ifdef IR_INDEX_HANDLES
+static inline IRInstructionHandle ir_instruction_handle(IRInstruction *i) { return i ? i->handle : 0; }
+static inline IRBlockHandle ir_block_handle(IRBlock *b) { return b ? b->handle : 0; }
+#endif
+
 /// Get the index of an instruction in a block. The instruction
 /// must have a parent block.
 usz index_in_block(IRInstruction* inst);
@@ -157,7 +209,7 @@ void ir_free_instruction_data(IRInstruction *instruction);
 /// \param data User data that is passed to the callback.
 void ir_for_each_child(
     IRInstruction *inst,
-    void callback(IRInstruction *user, IRInstruction **child, void *data),
+    void callback(IRInstruction *user, IRInstructionHandle *child, void *data),
     void *data
 );
 
@@ -4,7 +4,9 @@
 #include <ir/dom.h>
 #include <ir/ir-impl.h>
 #include <ir/ir.h>
+#include <memory_report.h>
 #include <platform.h>
+#include <stats.h>
 #include <stdlib.h>
 #include <utils.h>
 
@@ -15,14 +17,98 @@ typedef IRBlock Block;
 typedef IRFunction Func;
 typedef IRValue Value;
 
+/// ===========================================================================
+///  Slabs
+/// ===========================================================================
+#ifdef IR_INDEX_HANDLES
+char *ir_chunks[IR_CHUNK_COUNT];
+
+/// Protects everything below. Chunks are only claimed and released
+/// under this lock; entries of `ir_chunks` are only read by threads
+/// that hold handles into them.
+static PlatformMutex chunks_lock = PLATFORM_MUTEX_INIT;
+static u32 chunks_used = 1; /// Chunk 0 is never used; see ir-impl.h.
+static Vector(u32) free_chunks;
+
+/// Allocate a zeroed object and store its handle in `handle`.
+NODISCARD static void *slab_alloc(IRSlab *slab, usz size, usz alignment, u32 *handle) {
+  (void) alignment; /// Chunks are page-aligned.
+
+  /// Claim a new chunk if the current one is full. Chunks are mapped
+  /// directly, so the pages of a chunk are only touched once they are
+  /// actually used; most slabs only ever use a small part of a chunk.
+  if (!slab->chunks.size || slab->used == IR_CHUNK_SIZE) {
+    char *data = platform_allocate_pages(IR_CHUNK_SIZE * size);
+    platform_mutex_lock(&chunks_lock);
+    u32 chunk = free_chunks.size ? vector_pop(free_chunks) : chunks_used++;
+    if (chunk < IR_CHUNK_COUNT) ir_chunks[chunk] = data;
+    platform_mutex_unlock(&chunks_lock);
+    ASSERT(chunk < IR_CHUNK_COUNT, "Too many IR instructions and blocks");
+    vector_push(slab->chunks, chunk);
+    slab->used = 0;
+  }
+
+  u32 chunk = vector_back(slab->chunks);
+  *handle = chunk << IR_CHUNK_BITS | (u32) slab->used;
+  return ir_chunks[chunk] + slab->used++ * size;
+}
+
+/// Move all objects from one slab to another.
+static void slab_append(IRSlab *to, IRSlab *from) {
+  if (!from->chunks.size) return;
+
+  /// Keep allocating from the last chunk of `to`, if there is one.
+  if (to->chunks.size) {
+    usz last = to->chunks.size - 1;
+    vector_append(to->chunks, from->chunks);
+    u32 tmp = to->chunks.data[last];
+    to->chunks.data[last] = vector_back(to->chunks);
+    vector_back(to->chunks) = tmp;
+  } else {
+    vector_append(to->chunks, from->chunks);
+    to->used = from->used;
+  }
+
+  vector_delete(from->chunks);
+  *from = (IRSlab){0};
+}
+
+/// Free all objects in a slab. `size` must be the size of the objects.
+static void slab_free(IRSlab *slab, usz size) {
+  platform_mutex_lock(&chunks_lock);
+  foreach (chunk, slab->chunks) {
+    ASAN_UNPOISON(ir_chunks[*chunk], IR_CHUNK_SIZE * size);
+    platform_free_pages(ir_chunks[*chunk], IR_CHUNK_SIZE * size);
+    ir_chunks[*chunk] = NULL;
+    vector_push(free_chunks, *chunk);
+  }
+  platform_mutex_unlock(&chunks_lock);
+  vector_delete(slab->chunks);
+  *slab = (IRSlab){0};
+}
+
+IRInstruction *ir_instruction_impl(IRInstructionHandle handle) { return INST(handle); }
+#else
+NODISCARD static void *slab_alloc(IRSlab *slab, usz size, usz alignment, u32 *handle) {
+  *handle = 0;
+  return arena_alloc(&slab->arena, size, alignment);
+}
+
+static void slab_append(IRSlab *to, IRSlab *from) { arena_append(&to->arena, &from->arena); }
+static void slab_free(IRSlab *slab, usz size) {
+  (void) size;
+  arena_free(&slab->arena);
+}
+#endif
+
+#define slab_new(slab, type, handle) ((type *) slab_alloc((slab), sizeof(type), _Alignof(type), (handle)))
+
 /// ===========================================================================
 ///  Context Creation
 /// ===========================================================================
 CodegenContext *codegen_context_create(
   Module *ast,
-  CodegenArchitecture arch,
-  CodegenTarget target,
-  CodegenCallingConvention call_convention,
+  const CodegenOptions *options,
   FILE *code
 ) {
   CodegenContext *context;
@@ -31,12 +117,12 @@ CodegenContext *codegen_context_create(
   STATIC_ASSERT(TARGET_COUNT == 6, "codegen_context_create() must exhaustively handle all codegen targets.");
   STATIC_ASSERT(CG_CALL_CONV_COUNT == 2, "codegen_context_create() must exhaustively handle all codegen calling conventions.");
 
-  switch (arch) {
+  switch (options->arch) {
     case ARCH_X86_64:
       // Handle call_convention for creating codegen context!
-      if (call_convention == CG_CALL_CONV_MSWIN) {
+      if (options->call_convention == CG_CALL_CONV_MSWIN) {
         context = codegen_context_x86_64_mswin_create();
-      } else if (call_convention == CG_CALL_CONV_SYSV) {
+      } else if (options->call_convention == CG_CALL_CONV_SYSV) {
         context = codegen_context_x86_64_linux_create();
       } else {
         ICE("Unrecognized calling convention!");
@@ -45,13 +131,20 @@ CodegenContext *codegen_context_create(
     default: UNREACHABLE();
   }
 
-  context->poison = calloc(1, sizeof(IRInstruction));
+  u32 handle;
+  context->poison = slab_new(&context->instruction_slab, IRInstruction, &handle);
+  SET_HANDLE(context->poison, handle);
+  memory_record(MEMORY_IR, sizeof(IRInstruction));
   context->poison->kind = IR_POISON;
   context->poison->ctx = context;
+  stats_ir_instruction_created();
 
-  context->arch = arch;
-  context->target = target;
-  context->call_convention = call_convention;
+  context->arch = options->arch;
+  context->target = options->target;
+  context->call_convention = options->call_convention;
+  context->optimise = options->optimise;
+  context->annotate_code = options->annotate_code;
+  context->backend_jobs = options->backend_jobs;
 
   context->ast = ast;
   context->code = code;
@@ -78,10 +171,10 @@ void codegen_context_free(CodegenContext *context) {
   vector_delete(context->static_vars);
 
   /// Free free lists.
-  foreach_val (b, context->free_blocks) free(b);
-  foreach_val (i, context->free_instructions) free(i);
   vector_delete(context->free_blocks);
   vector_delete(context->free_instructions);
+  vector_delete(context->free_functions);
+  vector_delete(context->expr_stack);
 
   /// Free backend-specific data.
   STATIC_ASSERT(ARCH_COUNT == 2, "Exhaustive handling of architectures");
@@ -96,6 +189,11 @@ void codegen_context_free(CodegenContext *context) {
     } break;
   }
 
+  /// Free all instructions, blocks, and functions at once.
+  slab_free(&context->instruction_slab, sizeof(IRInstruction));
+  slab_free(&context->block_slab, sizeof(IRBlock));
+  arena_free(&context->function_slab);
+
   /// Free the context itself.
   free(context);
 }
@@ -104,7 +202,8 @@ void codegen_context_free(CodegenContext *context) {
 ///  Helper Functions
 /// ===========================================================================
 void mark_used(IRInstruction *usee, IRInstruction *user) {
-  vector_push_unique(usee->users, user);
+  IRInstructionHandle handle = HANDLE(user);
+  if (!vector_contains(usee->users, handle)) small_vector_push(usee->users, handle);
 }
 
 void remove_use(IRInstruction *usee, IRInstruction *user) {
@@ -114,17 +213,25 @@ void remove_use(IRInstruction *usee, IRInstruction *user) {
   eprint("[Use] Removing use of %%%u in %%%u\n", usee ? -1u : usee->id, user->id);
 #endif
 
-  vector_remove_element_unordered(usee->users, user);
+  IRInstructionHandle handle = HANDLE(user);
+  vector_remove_element_unordered(usee->users, handle);
 }
 
-static void ir_internal_unmark_usee(IRInstruction *user, IRInstruction **child, void *_) {
+static void ir_internal_unmark_usee(IRInstruction *user, IRInstructionHandle *child, void *_) {
   (void) _;
-  foreach_val (child_user, (*child)->users) {
-    if (child_user == user) {
-      vector_remove_element_unordered((*child)->users, child_user);
-      break;
-    }
-  }
+  IRInstructionHandle handle = HANDLE(user);
+  vector_remove_element_unordered(INST(*child)->users, handle);
+}
+
+/// Protects the reference lists of static variables, since functions
+/// that reference the same variable may be modified at once.
+static PlatformMutex static_references_lock = PLATFORM_MUTEX_INIT;
+
+/// Remove a static reference from the references of its variable.
+static void unlink_static_ref(IRInstruction *ref) {
+  platform_mutex_lock(&static_references_lock);
+  vector_remove_element_unordered(ref->static_ref->references, ref);
+  platform_mutex_unlock(&static_references_lock);
 }
 
 void ir_free_instruction_data(IRInstruction *i) {
@@ -135,20 +242,20 @@ void ir_free_instruction_data(IRInstruction *i) {
     default: break;
     case IR_INTRINSIC:
     case IR_CALL:
-      vector_delete(i->call.arguments);
+      small_vector_delete(i->call.arguments);
       break;
 
     case IR_PHI:
-      vector_delete(i->phi_args);
+      small_vector_delete(i->phi_args);
       break;
 
     case IR_STATIC_REF:
-      vector_remove_element_unordered(i->static_ref->references, i);
+      unlink_static_ref(i);
       break;
   }
 
   /// Free usage data.
-  vector_delete(i->users);
+  small_vector_delete(i->users);
 }
 
 /// This implements printing a single instruction.
@@ -208,10 +315,10 @@ static void ir_emit_instruction(
 
     format_to(out, "%31(");
     bool first = true;
-    foreach_val (i, inst->call.arguments) {
+    foreach (arg, inst->call.arguments) {
       if (!first) { format_to(out, "%31, "); }
       else first = false;
-      format_to(out, "%34%%%u", i->id);
+      format_to(out, "%34%%%u", INST(*arg)->id);
     }
     format_to(out, "%31)");
   } break;
@@ -222,14 +329,14 @@ static void ir_emit_instruction(
       string name = inst->call.callee_function->name;
       format_to(out, "%33call %32%S", name);
     } else {
-      format_to(out, "%33call %34%%%u", inst->call.callee_instruction->id);
+      format_to(out, "%33call %34%%%u", INST(inst->call.callee_instruction)->id);
     }
     format_to(out, "%31(");
     bool first = true;
-    foreach_val (i, inst->call.arguments) {
+    foreach (arg, inst->call.arguments) {
       if (!first) { format_to(out, "%31, "); }
       else first = false;
-      format_to(out, "%34%%%u", i->id);
+      format_to(out, "%34%%%u", INST(*arg)->id);
     }
     format_to(out, "%31)");
   } break;
@@ -241,32 +348,32 @@ static void ir_emit_instruction(
     break;
 
 #define PRINT_BINARY_INSTRUCTION(enumerator, name) case IR_##enumerator: \
-    format_to(out, "%33" #name " %34%%%u%31, %34%%%u", inst->lhs->id, inst->rhs->id); break;
+    format_to(out, "%33" #name " %34%%%u%31, %34%%%u", INST(inst->lhs)->id, INST(inst->rhs)->id); break;
     ALL_BINARY_INSTRUCTION_TYPES(PRINT_BINARY_INSTRUCTION)
 #undef PRINT_BINARY_INSTRUCTION
 
   case IR_NOT:
-    format_to(out, "%33not %34%%%u", inst->operand->id);
+    format_to(out, "%33not %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_ZERO_EXTEND:
-    format_to(out, "%33z.ext %34%%%u", inst->operand->id);
+    format_to(out, "%33z.ext %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_SIGN_EXTEND:
-    format_to(out, "%33s.ext %34%%%u", inst->operand->id);
+    format_to(out, "%33s.ext %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_TRUNCATE:
-    format_to(out, "%33truncate %34%%%u", inst->operand->id);
+    format_to(out, "%33truncate %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_BITCAST:
-    format_to(out, "%33bitcast %34%%%u", inst->operand->id);
+    format_to(out, "%33bitcast %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_COPY:
-    format_to(out, "%33copy %34%%%u", inst->operand->id);
+    format_to(out, "%33copy %34%%%u", INST(inst->operand)->id);
     break;
 
   case IR_PARAMETER:
@@ -274,15 +381,15 @@ static void ir_emit_instruction(
     break;
 
   case IR_RETURN:
-    if (inst->operand) format_to(out, "%33ret %34%%%u", inst->operand->id);
+    if (inst->operand) format_to(out, "%33ret %34%%%u", INST(inst->operand)->id);
     else format_to(out, "%33ret");
     break;
   case IR_BRANCH:
-    format_to(out, "%33br bb%u", inst->destination_block->id);
+    format_to(out, "%33br bb%u", BLOCK(inst->destination_block)->id);
     break;
   case IR_BRANCH_CONDITIONAL:
     format_to(out, "%33br.cond %34%%%u%31, %33bb%u%31, %33bb%u",
-            inst->cond_br.condition->id, inst->cond_br.then->id, inst->cond_br.else_->id);
+            INST(inst->cond_br.condition)->id, BLOCK(inst->cond_br.then)->id, BLOCK(inst->cond_br.else_)->id);
     break;
   case IR_PHI: {
     format_to(out, "%33phi ");
@@ -295,10 +402,10 @@ static void ir_emit_instruction(
   } break;
 
   case IR_LOAD:
-    format_to(out, "%33load %34%%%u", inst->operand->id);
+    format_to(out, "%33load %34%%%u", INST(inst->operand)->id);
     break;
   case IR_STORE:
-    format_to(out, "%33store into %34%%%u%31, %T %34%%%u", inst->store.addr->id, inst->store.value->type, inst->store.value->id);
+    format_to(out, "%33store into %34%%%u%31, %T %34%%%u", INST(inst->store.addr)->id, INST(inst->store.value)->type, INST(inst->store.value)->id);
     break;
   case IR_REGISTER:
     format_to(out, "%31.reg %34%%%u", inst->result);
@@ -322,8 +429,8 @@ static void ir_emit_instruction(
 #ifdef DEBUG_USES
   /// Print users
   format_to(out, "%m\033[60GUsers: ");
-  foreach_val (user, inst->users) {
-    format_to(out, "%%%u, ", user->id);
+  foreach (user, inst->users) {
+    format_to(out, "%%%u, ", INST(*user)->id);
   }
 #endif
 
@@ -334,7 +441,7 @@ typedef struct {
   IRInstruction *usee;
   IRInstruction *replacement;
 } ir_internal_replace_use_t;
-static void ir_internal_replace_use(IRInstruction *user, IRInstruction **child, void *data) {
+static void ir_internal_replace_use(IRInstruction *user, IRInstructionHandle *child, void *data) {
   ir_internal_replace_use_t *replace = data;
 
 #ifdef DEBUG_USES
@@ -343,27 +450,30 @@ static void ir_internal_replace_use(IRInstruction *user, IRInstruction **child,
 #endif
 
   if (user == replace->replacement) return;
-  if (*child == replace->usee) {
-    *child = replace->replacement;
+  if (INST(*child) == replace->usee) {
+    *child = HANDLE(replace->replacement);
     remove_use(replace->usee, user);
     mark_used(replace->replacement, user);
   }
 }
 
 usz index_in_block(Inst *inst) {
-  return (usz) (ir_it(inst) - inst->parent_block->instructions.data);
+  return (usz) (ir_it(inst) - BLOCK(inst->parent_block)->instructions.data);
 }
 
 void ir_for_each_child(
   IRInstruction *user,
-  void callback(IRInstruction *user, IRInstruction **child, void *data),
+  void callback(IRInstruction *user, IRInstructionHandle *child, void *data),
   void *data
 ) {
   STATIC_ASSERT(IR_COUNT == 40, "Handle all instruction types.");
   switch (user->kind) {
   case IR_PHI:
-      foreach (arg, user->phi_args) {
-      callback(user, &arg->value, data);
+    /// Phi arguments are part of the API, so they store pointers.
+    foreach (arg, user->phi_args) {
+      IRInstructionHandle value = HANDLE(arg->value);
+      callback(user, &value, data);
+      arg->value = INST(value);
     }
     break;
   case IR_LOAD:
@@ -479,25 +589,43 @@ void ir_print_defun(FILE *file, IRFunction *f) {
 #undef F
 }
 
-/// Clean up context free list so we don’t leak memory.
-static void clean_free_list(CodegenContext *ctx) {
-  /// Clean up free blocks list.
-  if (ctx->free_blocks.size > 1000) {
-    for (usz i = 0; i < 500; i++) {
-      Block *b = vector_pop(ctx->free_blocks);
-      free(b);
-    }
-  }
+/// Free lists set by ir_use_free_lists(), if any.
+static THREAD_LOCAL IRFreeLists *thread_free_lists = NULL;
 
-  /// Clean up free instructions list.
-  if (ctx->free_instructions.size > 10000) {
-    for (usz i = 0; i < 5000; i++) {
-      Inst *inst = vector_pop(ctx->free_instructions);
-      free(inst);
-    }
-  }
+void ir_use_free_lists(IRFreeLists *lists) {
+  thread_free_lists = lists;
+}
+
+/// Get the list of free instructions to use for a context.
+static IRInstructionVector *free_instructions(CodegenContext *ctx) {
+  return thread_free_lists ? &thread_free_lists->instructions : &ctx->free_instructions;
+}
+
+/// Get the list of free blocks to use for a context.
+static IRBlockVector *free_blocks(CodegenContext *ctx) {
+  return thread_free_lists ? &thread_free_lists->blocks : &ctx->free_blocks;
+}
+
+/// Get the slab to allocate new instructions from for a context.
+static IRSlab *instruction_slab(CodegenContext *ctx) {
+  return thread_free_lists ? &thread_free_lists->instruction_slab : &ctx->instruction_slab;
+}
+
+/// Get the slab to allocate new blocks from for a context.
+static IRSlab *block_slab(CodegenContext *ctx) {
+  return thread_free_lists ? &thread_free_lists->block_slab : &ctx->block_slab;
+}
+
+void ir_merge_free_lists(CodegenContext *ctx, IRFreeLists *lists) {
+  vector_append(ctx->free_instructions, lists->instructions);
+  vector_append(ctx->free_blocks, lists->blocks);
+  vector_delete(lists->instructions);
+  vector_delete(lists->blocks);
+  slab_append(&ctx->instruction_slab, &lists->instruction_slab);
+  slab_append(&ctx->block_slab, &lists->block_slab);
 }
 
+
 /// Free data used by a block.
 static void free_block_data(Block *block) {
   if (block->name.size) free(block->name.data);
@@ -507,19 +635,21 @@ static void free_block_data(Block *block) {
 static void ir_remove_impl(CodegenContext *ctx, IRInstruction *i) {
   if (i->users.size) {
     eprint("Cannot remove used instruction.\nInstruction:\n");
-    if (i->parent_block->function) {
-      ir_set_func_ids(i->parent_block->function);
+    if (BLOCK(i->parent_block)->function) {
+      ir_set_func_ids(BLOCK(i->parent_block)->function);
       ir_print_instruction(stderr, i);
       eprint("In function:\n");
-      ir_print_function(stderr, i->parent_block->function);
+      ir_print_function(stderr, BLOCK(i->parent_block)->function);
     } else {
       ir_print_instruction(stderr, i);
     }
     ICE("Cannot remove used instruction.");
   }
 
+  stats_ir_instruction_removed();
+
   /// Remove the instruction if it’s inserted in a block.
-  if (i->parent_block) vector_remove_element(i->parent_block->instructions, i);
+  if (i->parent_block) vector_remove_element(BLOCK(i->parent_block)->instructions, i);
 
   /// Unmark usees.
   ir_for_each_child(i, ir_internal_unmark_usee, NULL);
@@ -532,21 +662,17 @@ static void ir_remove_impl(CodegenContext *ctx, IRInstruction *i) {
   if (i->kind == IR_POISON && i->ctx && i == i->ctx->poison) return;
 
   /// Unlink static refs.
-  if (i->kind == IR_STATIC_REF)
-    vector_remove_element_unordered(i->static_ref->references, i);
+  if (i->kind == IR_STATIC_REF) unlink_static_ref(i);
 
   /// Parameters should not be freed here.
   if (i->kind == IR_PARAMETER) return;
 
-  /// Free the instruction.
-  if (ctx) {
-    i->kind = IR_COUNT;
-    ASAN_POISON(i, sizeof(Inst));
-    vector_push(ctx->free_instructions, i);
-    clean_free_list(ctx);
-  } else {
-    free(i);
-  }
+  /// Recycle the instruction. If it isn’t part of a function, we
+  /// don’t know its context, so just leave it in the slab it was
+  /// allocated from; it is freed along with the context.
+  i->kind = IR_COUNT;
+  ASAN_POISON(i, sizeof(Inst));
+  if (ctx) vector_push(*free_instructions(ctx), i);
 }
 
 static void dot_print_block(FILE *file, IRBlock *block, string_buffer *sb) {
@@ -593,11 +719,11 @@ static void ir_print_dot_cfg_function(IRFunction *f, FILE* file) {
     switch (term->kind) {
       default: break;
       case IR_BRANCH:
-        fprint(file, "    Block%p -> Block%p;\n", block, term->destination_block);
+        fprint(file, "    Block%p -> Block%p;\n", block, BLOCK(term->destination_block));
         break;
       case IR_BRANCH_CONDITIONAL:
-        fprint(file, "    Block%p -> Block%p;\n", block, term->cond_br.then);
-        fprint(file, "    Block%p -> Block%p;\n", block, term->cond_br.else_);
+        fprint(file, "    Block%p -> Block%p;\n", block, BLOCK(term->cond_br.then));
+        fprint(file, "    Block%p -> Block%p;\n", block, BLOCK(term->cond_br.else_));
         break;
     }
 
@@ -629,7 +755,6 @@ static void ir_print_dot_dj_function(IRFunction *f, FILE* file) {
   vector_delete(sb);
 }
 
-extern const char *print_dot_function;
 static void print_dot_impl(CodegenContext *ctx, void print_dot (IRFunction *f, FILE* file)) {
   ASSERT(print_dot_function);
   span s = {
@@ -659,33 +784,56 @@ static void print_dot_impl(CodegenContext *ctx, void print_dot (IRFunction *f, F
 NODISCARD static Inst *alloc(CodegenContext *ctx, IRType kind) {
   Inst *inst = NULL;
 
-  if (ctx && ctx->free_instructions.size) {
-    inst = vector_pop(ctx->free_instructions);
+  if (free_instructions(ctx)->size) {
+    inst = vector_pop(*free_instructions(ctx));
     ASAN_UNPOISON(inst, sizeof(Inst));
+    IRInstructionHandle handle = HANDLE(inst);
     *inst = (Inst){0};
+    SET_HANDLE(inst, handle);
   } else {
-    inst = calloc(1, sizeof *inst);
+    u32 handle;
+    inst = slab_new(instruction_slab(ctx), Inst, &handle);
+    SET_HANDLE(inst, handle);
+    memory_record(MEMORY_IR, sizeof *inst);
   }
 
   inst->kind = kind;
   inst->type = t_void;
+  stats_ir_instruction_created();
   return inst;
 }
 
 NODISCARD static Block* alloc_block(CodegenContext *ctx) {
   Block *block = NULL;
 
-  if (ctx && ctx->free_blocks.size) {
-    block = vector_pop(ctx->free_blocks);
+  if (free_blocks(ctx)->size) {
+    block = vector_pop(*free_blocks(ctx));
     ASAN_UNPOISON(block, sizeof(Block));
+    IRBlockHandle handle = HANDLE(block);
     *block = (Block){0};
+    SET_HANDLE(block, handle);
   } else {
-    block = calloc(1, sizeof *block);
+    u32 handle;
+    block = slab_new(block_slab(ctx), Block, &handle);
+    SET_HANDLE(block, handle);
+    memory_record(MEMORY_IR, sizeof *block);
   }
 
   return block;
 }
 
+Inst *ir_allocate_instruction(CodegenContext *ctx, IRType kind) {
+  return alloc(ctx, kind);
+}
+
+void ir_free_instruction(CodegenContext *ctx, IRInstruction *i) {
+  ASSERT(!i->parent_block, "Use ir_remove() to delete inserted instructions");
+  stats_ir_instruction_removed();
+  i->kind = IR_COUNT;
+  ASAN_POISON(i, sizeof(Inst));
+  vector_push(*free_instructions(ctx), i);
+}
+
 /// Create a basic block.
 Block *ir_block(CodegenContext *ctx) { return alloc_block(ctx); }
 
@@ -698,7 +846,18 @@ Func *ir_create_function(
 ) {
   ASSERT(function_type->kind == TYPE_FUNCTION, "Cannot create function of non-function type");
 
-  IRFunction *function = calloc(1, sizeof(IRFunction));
+  /// Functions are only ever created and deleted by the thread that
+  /// owns the context, so there are no per-thread lists for them.
+  IRFunction *function = NULL;
+  if (ctx->free_functions.size) {
+    function = vector_pop(ctx->free_functions);
+    ASAN_UNPOISON(function, sizeof(IRFunction));
+    *function = (IRFunction){0};
+  } else {
+    function = arena_new(&ctx->function_slab, IRFunction);
+    memory_record(MEMORY_IR, sizeof(IRFunction));
+  }
+
   function->name = name;
   function->type = function_type;
 
@@ -748,7 +907,7 @@ Inst *ir_create_bitcast(
   Inst *value
 ) {
   Inst *bitcast = alloc(ctx, IR_BITCAST);
-  bitcast->operand = value;
+  bitcast->operand = HANDLE(value);
   bitcast->type = to_type;
   mark_used(value, bitcast);
   return bitcast;
@@ -759,7 +918,7 @@ Inst *ir_create_br(
   Block *destination
 ) {
   Inst *br = alloc(ctx, IR_BRANCH);
-  br->destination_block = destination;
+  br->destination_block = HANDLE(destination);
   return br;
 }
 
@@ -770,9 +929,9 @@ Inst *ir_create_cond_br(
   Block *else_block
 ) {
   Inst *br = alloc(ctx, IR_BRANCH_CONDITIONAL);
-  br->cond_br.condition = condition;
-  br->cond_br.then = then_block;
-  br->cond_br.else_ = else_block;
+  br->cond_br.condition = HANDLE(condition);
+  br->cond_br.then = HANDLE(then_block);
+  br->cond_br.else_ = HANDLE(else_block);
   mark_used(condition, br);
   return br;
 }
@@ -782,7 +941,7 @@ Inst *ir_create_copy(
   Inst *source
 ) {
   Inst *copy = alloc(ctx, IR_COPY);
-  copy->operand = source;
+  copy->operand = HANDLE(source);
   copy->type = source->type;
   mark_used(source, copy);
   return copy;
@@ -835,7 +994,7 @@ Inst *ir_create_load(
 ) {
   Inst *load = alloc(ctx, IR_LOAD);
   load->type = type;
-  load->operand = address;
+  load->operand = HANDLE(address);
   mark_used(address, load);
   return load;
 }
@@ -847,9 +1006,9 @@ IRInstruction *ir_create_memcpy(
   IRInstruction *size
 ) {
   IRInstruction *call = ir_create_intrinsic(context, t_void, INTRIN_BUILTIN_MEMCPY);
-  vector_push(call->call.arguments, dest);
-  vector_push(call->call.arguments, src);
-  vector_push(call->call.arguments, size);
+  small_vector_push(call->call.arguments, HANDLE(dest));
+  small_vector_push(call->call.arguments, HANDLE(src));
+  small_vector_push(call->call.arguments, HANDLE(size));
   mark_used(dest, call);
   mark_used(src, call);
   mark_used(size, call);
@@ -862,7 +1021,7 @@ Inst *ir_create_not(
   Inst *op
 ) {
   Inst *not = alloc(ctx, IR_NOT);
-  not->operand = op;
+  not->operand = HANDLE(op);
   not->type = op->type;
   mark_used(op, not);
   return not;
@@ -892,7 +1051,7 @@ Inst *ir_create_return(
   Inst *retval
 ) {
   Inst *ret = alloc(ctx, IR_RETURN);
-  ret->operand = retval;
+  ret->operand = HANDLE(retval);
   if (retval) mark_used(retval, ret);
   return ret;
 }
@@ -904,7 +1063,7 @@ Inst *ir_create_sext(
 ) {
   Inst *sext = alloc(ctx, IR_SIGN_EXTEND);
   sext->type = result_type;
-  sext->operand = value;
+  sext->operand = HANDLE(value);
   mark_used(value, sext);
   return sext;
 }
@@ -929,7 +1088,9 @@ IRStaticVariable *ir_create_static(
 Inst *ir_create_static_ref(CodegenContext *ctx, IRStaticVariable *var) {
   Inst *ref = alloc(ctx, IR_STATIC_REF);
   ref->static_ref = var;
+  platform_mutex_lock(&static_references_lock);
   vector_push(var->references, ref);
+  platform_mutex_unlock(&static_references_lock);
   ref->type = ast_make_type_pointer(ctx->ast, var->type->source_location, var->type);
   return ref;
 }
@@ -940,8 +1101,8 @@ Inst *ir_create_store(
   Inst *address
 ) {
   Inst *store = alloc(ctx, IR_STORE);
-  store->store.addr = address;
-  store->store.value = data;
+  store->store.addr = HANDLE(address);
+  store->store.value = HANDLE(data);
   mark_used(address, store);
   mark_used(data, store);
   return store;
@@ -954,7 +1115,7 @@ Inst *ir_create_trunc(
 ) {
   Inst *trunc = alloc(ctx, IR_TRUNCATE);
   trunc->type = result_type;
-  trunc->operand = value;
+  trunc->operand = HANDLE(value);
   mark_used(value, trunc);
   return trunc;
 }
@@ -970,7 +1131,7 @@ Inst *ir_create_zext(
 ) {
   Inst *zext = alloc(ctx, IR_ZERO_EXTEND);
   zext->type = result_type;
-  zext->operand = value;
+  zext->operand = HANDLE(value);
   mark_used(value, zext);
   return zext;
 }
@@ -979,8 +1140,8 @@ Inst *ir_create_zext(
   Inst *ir_create_##name(CodegenContext *ctx, Inst *lhs, Inst *rhs) { \
     Inst *x = alloc(ctx, IR_##enumerator);                            \
     x->type = lhs->type;                                              \
-    x->lhs = lhs;                                                     \
-    x->rhs = rhs;                                                     \
+    x->lhs = HANDLE(lhs);                                             \
+    x->rhs = HANDLE(rhs);                                             \
     mark_used(lhs, x);                                                \
     mark_used(rhs, x);                                                \
     return x;                                                         \
@@ -991,8 +1152,8 @@ Inst *ir_create_zext(
   Inst *ir_create_##name(CodegenContext *ctx, Inst *lhs, Inst *rhs) { \
     Inst *x = alloc(ctx, IR_##enumerator);                            \
     x->type = t_integer;                                              \
-    x->lhs = lhs;                                                     \
-    x->rhs = rhs;                                                     \
+    x->lhs = HANDLE(lhs);                                             \
+    x->rhs = HANDLE(rhs);                                             \
     mark_used(lhs, x);                                                \
     mark_used(rhs, x);                                                \
     return x;                                                         \
@@ -1044,10 +1205,10 @@ Inst *ir_insert_after(
 ) {
   ASSERT(after->parent_block, "Cannot insert after floating instruction");
   ASSERT(!instruction->parent_block, "Cannot insert instruction that is already inserted");
-  Inst **it = vector_find_if(el, after->parent_block->instructions, *el == after);
+  Inst **it = vector_find_if(el, BLOCK(after->parent_block)->instructions, *el == after);
 
   ASSERT(it, "Instruction not found in parent block");
-  vector_insert(after->parent_block->instructions, it + 1, instruction);
+  vector_insert(BLOCK(after->parent_block)->instructions, it + 1, instruction);
   instruction->parent_block = after->parent_block;
   return instruction;
 }
@@ -1066,7 +1227,7 @@ Inst *ir_force_insert_at_end(
   Inst *instruction
 ) {
   vector_push(block->instructions, instruction);
-  instruction->parent_block = block;
+  instruction->parent_block = HANDLE(block);
   return instruction;
 }
 
@@ -1077,10 +1238,10 @@ Inst *ir_insert_before(
 ) {
   ASSERT(before->parent_block, "Cannot insert before floating instruction");
   ASSERT(!instruction->parent_block, "Cannot insert instruction that is already inserted");
-  Inst **it = vector_find_if(el, before->parent_block->instructions, *el == before);
+  Inst **it = vector_find_if(el, BLOCK(before->parent_block)->instructions, *el == before);
 
   ASSERT(it, "Instruction not found in parent block");
-  vector_insert(before->parent_block->instructions, it, instruction);
+  vector_insert(BLOCK(before->parent_block)->instructions, it, instruction);
   instruction->parent_block = before->parent_block;
   return instruction;
 }
@@ -1172,7 +1333,7 @@ Block *ir_block_get(Func *function, usz n) {
 
 void ir_call_add_arg(Inst *call, Inst *value) {
   ASSERT(call->kind == IR_CALL || call->kind == IR_INTRINSIC);
-  vector_push(call->call.arguments, value);
+  small_vector_push(call->call.arguments, HANDLE(value));
   mark_used(value, call);
 }
 
@@ -1184,9 +1345,9 @@ usz ir_call_args_count(Inst *call) {
 Type *ir_call_callee_type(Inst *call) {
   ASSERT(call->kind == IR_CALL);
   if (call->call.is_indirect) {
-    return type_is_pointer(call->call.callee_instruction->type)
-           ? call->call.callee_instruction->type->pointer.to
-           : call->call.callee_instruction->type;
+    return type_is_pointer(INST(call->call.callee_instruction)->type)
+           ? INST(call->call.callee_instruction)->type->pointer.to
+           : INST(call->call.callee_instruction)->type;
   } else {
     return call->call.callee_function->type;
   }
@@ -1194,7 +1355,8 @@ Type *ir_call_callee_type(Inst *call) {
 
 void ir_call_insert_arg(Inst *call, usz n, Inst *value) {
   ASSERT(call->kind == IR_CALL || call->kind == IR_INTRINSIC);
-  vector_insert_index(call->call.arguments, n, value);
+  small_vector_reserve(call->call.arguments, 1);
+  vector_insert_index(call->call.arguments, n, HANDLE(value));
   mark_used(value, call);
 }
 
@@ -1206,14 +1368,14 @@ bool ir_call_is_direct(Inst *call) {
 void ir_call_remove_arg(Inst *call, usz n) {
   ASSERT(call->kind == IR_CALL || call->kind == IR_INTRINSIC);
   ASSERT(n < call->call.arguments.size);
-  remove_use(call->call.arguments.data[n], call);
+  remove_use(INST(call->call.arguments.data[n]), call);
   vector_remove_index(call->call.arguments, n);
 }
 
 void ir_call_replace_arg(Inst *call, usz n, Inst *value) {
   ASSERT(call->kind == IR_CALL || call->kind == IR_INTRINSIC);
-  remove_use(call->call.arguments.data[n], call);
-  call->call.arguments.data[n] = value;
+  remove_use(INST(call->call.arguments.data[n]), call);
+  call->call.arguments.data[n] = HANDLE(value);
   mark_used(value, call);
 }
 
@@ -1308,7 +1470,7 @@ void ir_phi_add_arg(Inst *phi, Block *from, Inst *value) {
 
   /// Otherwise, add a new entry.
   IRPhiArgument arg = {.block = from, .value = value};
-  vector_push(phi->phi_args, arg);
+  small_vector_push(phi->phi_args, arg);
   mark_used(value, phi);
 }
 
@@ -1354,7 +1516,7 @@ usz ir_use_count(Inst *i) {
 
 Inst *ir_user_get(Inst *inst, usz n) {
   ASSERT(n < inst->users.size);
-  return inst->users.data[n];
+  return INST(inst->users.data[n]);
 }
 
 /// ===========================================================================
@@ -1370,9 +1532,9 @@ void ir_delete_block(IRBlock *block) {
     Inst* i = vector_back(block->instructions);
 
     /// Remove this instruction from PHIs that use it.
-    foreach_val (user, i->users)
-      if (user->kind == IR_PHI)
-        ir_phi_remove_arg(user, block);
+    foreach (user, i->users)
+      if (INST(*user)->kind == IR_PHI)
+        ir_phi_remove_arg(INST(*user), block);
 
     /// Remove it from the block.
     ir_remove(i);
@@ -1385,17 +1547,10 @@ void ir_delete_block(IRBlock *block) {
   if (block->function)
     vector_remove_element(block->function->blocks, block);
 
-  /// Add block to free list if possible or free it otherwise.
-  if (block->function) {
-    CodegenContext *ctx = block->function->context;
-    ASAN_POISON(block, sizeof(Block));
-    vector_push(ctx->free_blocks, block);
-
-    /// Clean up free list a bit if its too big.
-    clean_free_list(ctx);
-  } else {
-    free(block);
-  }
+  /// Add block to free list if possible. Otherwise, it stays in the
+  /// slab it was allocated from until the context is freed.
+  if (block->function) vector_push(*free_blocks(block->function->context), block);
+  ASAN_POISON(block, sizeof(Block));
 }
 
 void ir_delete_function(IRFunction *f) {
@@ -1409,6 +1564,7 @@ void ir_delete_function(IRFunction *f) {
     while (b->instructions.size) {
       Inst *i = vector_pop(b->instructions);
       if (i->kind == IR_PARAMETER) continue;
+      stats_ir_instruction_removed();
       ir_free_instruction_data(i);
       ASAN_POISON(i, sizeof(Inst));
       vector_push(ctx->free_instructions, i);
@@ -1423,6 +1579,7 @@ void ir_delete_function(IRFunction *f) {
   /// Free each parameter instruction.
   while (f->parameters.size) {
     Inst *i = vector_pop(f->parameters);
+    stats_ir_instruction_removed();
     ir_free_instruction_data(i);
     ASAN_POISON(i, sizeof(Inst));
     vector_push(ctx->free_instructions, i);
@@ -1433,23 +1590,18 @@ void ir_delete_function(IRFunction *f) {
   vector_delete(f->parameters);
   vector_delete(f->blocks);
 
-  /// Free the function itself.
-  free(f);
-
   /// Remove it from the list of functions.
   vector_remove_element(ctx->functions, f);
 
-  /// Clean up free lists.
-  clean_free_list(ctx);
+  /// Recycle the function itself.
+  ASAN_POISON(f, sizeof(IRFunction));
+  vector_push(ctx->free_functions, f);
 }
 
 void ir_force_remove(IRInstruction *instruction) {
-  ASSERT(instruction->parent_block);
-  if (instruction->parent_block->function) {
-    ir_replace(instruction, instruction->parent_block->function->context->poison);
-  } else {
-    ir_replace(instruction, alloc(NULL, IR_POISON));
-  }
+  /// ir_replace() needs the context of the instruction.
+  ASSERT(instruction->parent_block && BLOCK(instruction->parent_block)->function);
+  ir_replace(instruction, BLOCK(instruction->parent_block)->function->context->poison);
 }
 
 void ir_make_unreachable(IRBlock *block) {
@@ -1484,7 +1636,7 @@ void ir_merge_blocks(IRBlock *into, IRBlock *from) {
   /// collect any PHIs that need fixing.
   IRInstructionVector phis_to_replace = {0};
   foreach_val (i, from->instructions) {
-    i->parent_block = into;
+    i->parent_block = HANDLE(into);
     if (i->kind == IR_PHI) {
       /// Any PHIs that have an incoming value from the block we’re
       /// inserting into are replaced with that value.
@@ -1569,8 +1721,8 @@ void ir_print_dot_dj(CodegenContext *ctx) {
 }
 
 void ir_remove(IRInstruction *i) {
-  if (i->parent_block && i->parent_block->function) {
-    ir_remove_impl(i->parent_block->function->context, i);
+  if (i->parent_block && BLOCK(i->parent_block)->function) {
+    ir_remove_impl(BLOCK(i->parent_block)->function->context, i);
   } else {
     ir_remove_impl(NULL, i);
   }
@@ -1595,7 +1747,7 @@ IRInstruction *ir_replace(IRInstruction *old, IRInstruction *new) {
 
   /// Insert new instruction if need be.
   if (!new->parent_block) {
-    vector_replace_element(old->parent_block->instructions, old, new);
+    vector_replace_element(BLOCK(old->parent_block)->instructions, old, new);
     new->parent_block = old->parent_block;
   }
 
@@ -1609,7 +1761,7 @@ IRInstruction *ir_replace(IRInstruction *old, IRInstruction *new) {
   );
 
   /// Delete it.
-  ir_remove_impl(old->parent_block->function->context, old);
+  ir_remove_impl(BLOCK(old->parent_block)->function->context, old);
   return new;
 }
 
@@ -1621,13 +1773,14 @@ void ir_replace_uses(IRInstruction *inst, IRInstruction *replacement) {
 
   /// Note: We need to handle the case of an instruction being 
   /// replaced with an instruction that uses it.
-  bool used_by_replacement = vector_contains(inst->users, replacement);
+  IRInstructionHandle replacement_handle = HANDLE(replacement);
+  bool used_by_replacement = vector_contains(inst->users, replacement_handle);
   if (used_by_replacement) remove_use(inst, replacement);
 
   /// Replace the remaining uses.
   while (inst->users.size) {
     ir_internal_replace_use_t replace = { inst, replacement };
-    ir_for_each_child(inst->users.data[0], ir_internal_replace_use, &replace);
+    ir_for_each_child(INST(inst->users.data[0]), ir_internal_replace_use, &replace);
   }
 
   /// Add the use by the replacement back in.
@@ -1707,7 +1860,7 @@ NODISCARD static Inst* ir_create_call_impl(CodegenContext *ctx, bool direct, Val
     call->call.callee_function = val.func;
     call->type = val.func->type->function.return_type;
   } else {
-    call->call.callee_instruction = val.inst;
+    call->call.callee_instruction = HANDLE(val.inst);
     call->type = ir_call_callee_type(call)->function.return_type;
     mark_used(val.inst, call);
   }
@@ -1770,14 +1923,14 @@ Block **ir_blocks_begin_impl(Func *f) { return f->blocks.data; }
 Block **ir_blocks_end_impl(Func *f) { return f->blocks.data + f->blocks.size; }
 Inst **ir_instructions_begin_impl(Block *b) { return b->instructions.data; }
 Inst **ir_instructions_end_impl(Block *b) { return b->instructions.data + b->instructions.size; }
-Inst **ir_users_begin_impl(Inst *i) { return i->users.data; }
-Inst **ir_users_end_impl(Inst *i) { return i->users.data + i->users.size; }
-Block *ir_parent_impl_i(Inst *i) { return i->parent_block; }
+IRInstructionHandle *ir_users_begin_impl(Inst *i) { return i->users.data; }
+IRInstructionHandle *ir_users_end_impl(Inst *i) { return i->users.data + i->users.size; }
+Block *ir_parent_impl_i(Inst *i) { return BLOCK(i->parent_block); }
 Func *ir_parent_impl_b(Block *b) { return b->function; }
 
 Inst **ir_it_impl_i(Inst *i) {
   ASSERT(i->parent_block);
-  return vector_find_if(el, i->parent_block->instructions, *el == i);
+  return vector_find_if(el, BLOCK(i->parent_block)->instructions, *el == i);
 }
 
 Block **ir_it_impl_b(Block *b) {
@@ -1823,14 +1976,14 @@ void ir_alloca_size_impl_set(Inst *obj, usz val) {
 Inst *ir_call_arg_impl_get(Inst *i, usz n) {
   ASSERT(i->kind == IR_CALL || i->kind == IR_INTRINSIC);
   ASSERT(n < i->call.arguments.size);
-  return i->call.arguments.data[n];
+  return INST(i->call.arguments.data[n]);
 }
 
 void ir_call_arg_impl_set(Inst *i, usz n, Inst *val) {
   ASSERT(i->kind == IR_CALL || i->kind == IR_INTRINSIC);
   ASSERT(n < i->call.arguments.size);
-  remove_use(i->call.arguments.data[n], i);
-  i->call.arguments.data[n] = val;
+  remove_use(INST(i->call.arguments.data[n]), i);
+  i->call.arguments.data[n] = HANDLE(val);
   mark_used(val, i);
 }
 
@@ -1856,14 +2009,14 @@ void ir_call_tail_impl_set(Inst *obj, bool val) {
 
 Value ir_callee_impl_get(Inst *call) {
   ASSERT(call->kind == IR_CALL);
-  if (call->call.is_indirect) return (Value){.inst = call->call.callee_instruction};
+  if (call->call.is_indirect) return (Value){.inst = INST(call->call.callee_instruction)};
   else return (Value){.func = call->call.callee_function};
 }
 
 void ir_callee_impl_set(Inst *call, Value val, bool direct) {
   ASSERT(call->kind == IR_CALL);
   if (call->call.is_indirect && call->call.callee_instruction)
-    remove_use(call->call.callee_instruction, call);
+    remove_use(INST(call->call.callee_instruction), call);
 
   if (direct) {
     call->call.is_indirect = false;
@@ -1871,7 +2024,7 @@ void ir_callee_impl_set(Inst *call, Value val, bool direct) {
     call->type = val.func->type->function.return_type;
   } else {
     call->call.is_indirect = true;
-    call->call.callee_instruction = val.inst;
+    call->call.callee_instruction = HANDLE(val.inst);
     call->type = ir_call_callee_type(call)->function.return_type;
     mark_used(val.inst, call);
   }
@@ -1879,34 +2032,34 @@ void ir_callee_impl_set(Inst *call, Value val, bool direct) {
 
 Inst *ir_cond_impl_get(Inst *i) {
   ASSERT(i->kind == IR_BRANCH_CONDITIONAL);
-  return i->cond_br.condition;
+  return INST(i->cond_br.condition);
 }
 
 void ir_cond_impl_set(Inst *i, Inst *val) {
   ASSERT(i->kind == IR_BRANCH_CONDITIONAL);
-  remove_use(i->cond_br.condition, i);
-  i->cond_br.condition = val;
+  remove_use(INST(i->cond_br.condition), i);
+  i->cond_br.condition = HANDLE(val);
   mark_used(val, i);
 }
 
 Block *ir_dest_impl_get(Inst *obj) {
   ASSERT(obj->kind == IR_BRANCH);
-  return obj->destination_block;
+  return BLOCK(obj->destination_block);
 }
 
 void ir_dest_impl_set(Inst *obj, Block *val) {
   ASSERT(obj->kind == IR_BRANCH);
-  obj->destination_block = val;
+  obj->destination_block = HANDLE(val);
 };
 
 Block *ir_else_impl_get(Inst *obj) {
   ASSERT(obj->kind == IR_BRANCH_CONDITIONAL);
-  return obj->cond_br.else_;
+  return BLOCK(obj->cond_br.else_);
 }
 
 void ir_else_impl_set(Inst *obj, Block *val) {
   ASSERT(obj->kind == IR_BRANCH_CONDITIONAL);
-  obj->cond_br.else_ = val;
+  obj->cond_br.else_ = HANDLE(val);
 };
 
 u32 ir_id_i_impl_get(Inst *i) { return i->id; }
@@ -1936,37 +2089,37 @@ void ir_intrinsic_kind_impl_set(IRInstruction *obj, enum IntrinsicKind val) {
 
 Inst *ir_lhs_impl_get(Inst *i) {
   assert_is_binary(i);
-  return i->lhs;
+  return INST(i->lhs);
 }
 
 void ir_lhs_impl_set(Inst *i, Inst *val) {
   assert_is_binary(i);
-  remove_use(i->lhs, i);
-  i->lhs = val;
+  remove_use(INST(i->lhs), i);
+  i->lhs = HANDLE(val);
   mark_used(val, i);
 }
 
 Inst *ir_operand_impl_get(Inst *i) {
   assert_has_operand(i);
-  return i->operand;
+  return INST(i->operand);
 }
 
 void ir_operand_impl_set(Inst *i, Inst *val) {
   assert_has_operand(i);
-  if (i->operand) remove_use(i->operand, i);
-  i->operand = val;
+  if (i->operand) remove_use(INST(i->operand), i);
+  i->operand = HANDLE(val);
   mark_used(val, i);
 }
 
 Inst *ir_rhs_impl_get(Inst *i) {
   assert_is_binary(i);
-  return i->rhs;
+  return INST(i->rhs);
 }
 
 void ir_rhs_impl_set(Inst *i, Inst *val) {
   assert_is_binary(i);
-  remove_use(i->rhs, i);
-  i->rhs = val;
+  remove_use(INST(i->rhs), i);
+  i->rhs = HANDLE(val);
   mark_used(val, i);
 }
 
@@ -1982,36 +2135,36 @@ void ir_static_var_init_impl_set(IRStaticVariable *var, Inst *val) {
 
 Inst *ir_store_addr_impl_get(Inst *i) {
   ASSERT(i->kind == IR_STORE);
-  return i->store.addr;
+  return INST(i->store.addr);
 }
 
 void ir_store_addr_impl_set(Inst *i, Inst *val) {
   ASSERT(i->kind == IR_STORE);
-  remove_use(i->store.addr, i);
-  i->store.addr = val;
+  remove_use(INST(i->store.addr), i);
+  i->store.addr = HANDLE(val);
   mark_used(val, i);
 }
 
 Inst *ir_store_value_impl_get(Inst *i) {
   ASSERT(i->kind == IR_STORE);
-  return i->store.value;
+  return INST(i->store.value);
 }
 
 void ir_store_value_impl_set(Inst *i, Inst *val) {
   ASSERT(i->kind == IR_STORE);
-  remove_use(i->store.value, i);
-  i->store.value = val;
+  remove_use(INST(i->store.value), i);
+  i->store.value = HANDLE(val);
   mark_used(val, i);
 }
 
 Block *ir_then_impl_get(Inst *obj) {
   ASSERT(obj->kind == IR_BRANCH_CONDITIONAL);
-  return obj->cond_br.then;
+  return BLOCK(obj->cond_br.then);
 }
 
 void ir_then_impl_set(Inst *obj, Block *val) {
   ASSERT(obj->kind == IR_BRANCH_CONDITIONAL);
-  obj->cond_br.then = val;
+  obj->cond_br.then = HANDLE(val);
 };
 
 /// Only to be used for trivial get/set pairs.
@@ -62,14 +62,18 @@ typedef union IRValue {
            CAT(inst, _ptr) != CAT(inst, _end_ptr) ? (inst = *CAT(inst, _ptr), true) : false; \
        ++CAT(inst, _ptr))
 
-#define FOREACH_USER(user, inst)                                                             \
-  for (IRInstruction * user,                                                                 \
-       ** const CAT(user, _begin_ptr) = ir_users_begin_impl(inst),                           \
-       **CAT(user, _ptr) = CAT(user, _begin_ptr),                                            \
-       ** const CAT(user, _end_ptr) = ir_users_end_impl(inst);                               \
-       DEBUG_ITERATOR(user, inst, users) &&                                                  \
-           CAT(user, _ptr) != CAT(user, _end_ptr) ? (user = *CAT(user, _ptr), true) : false; \
-       ++CAT(user, _ptr))
+#define FOREACH_USER(user, inst)                                                     \
+  for (IRInstruction * user, **CAT(user, _once) = &user; CAT(user, _once);           \
+       CAT(user, _once) = NULL)                                                      \
+    for (IRInstructionHandle                                                         \
+         * const CAT(user, _begin_ptr) = ir_users_begin_impl(inst),                  \
+         *CAT(user, _ptr) = CAT(user, _begin_ptr),                                   \
+         * const CAT(user, _end_ptr) = ir_users_end_impl(inst);                      \
+         DEBUG_ITERATOR(user, inst, users) &&                                        \
+             CAT(user, _ptr) != CAT(user, _end_ptr)                                  \
+           ? (user = ir_instruction_impl(*CAT(user, _ptr)), true)                    \
+           : false;                                                                  \
+         ++CAT(user, _ptr))
 
 /// Helper to detect iterator invalitation.
 #ifdef NDEBUG
@@ -686,6 +690,34 @@ void ir_delete_function(IRFunction *f);
 /// if it is still used.
 void ir_force_remove(IRInstruction *instruction);
 
+/// Instructions and blocks that have been freed and can be reused,
+/// and the slabs that new ones are allocated from.
+typedef struct IRFreeLists {
+  IRInstructionVector instructions;
+  IRBlockVector blocks;
+  IRSlab instruction_slab;
+  IRSlab block_slab;
+} IRFreeLists;
+
+/// Make the calling thread allocate and recycle instructions and
+/// blocks through the given free lists instead of those of their
+/// context. This is what allows several functions of one context to
+/// be modified at once. Pass NULL to use the free lists of the context
+/// again.
+void ir_use_free_lists(IRFreeLists *lists);
+
+/// Move all entries of `lists` and everything allocated from its
+/// slabs to a context.
+void ir_merge_free_lists(CodegenContext *ctx, IRFreeLists *lists);
+
+/// Allocate an instruction that is zeroed except for its kind, for
+/// code that builds instructions by hand, e.g. the inliner.
+IRInstruction *ir_allocate_instruction(CodegenContext *ctx, IRType kind);
+
+/// Reuse an instruction that was allocated with ir_allocate_instruction()
+/// but was never inserted into a block.
+void ir_free_instruction(CodegenContext *ctx, IRInstruction *i);
+
 /// Mark a block as ending w/ `unreachable` and remove it
 /// from PHIs etc.
 void ir_make_unreachable(IRBlock *block);
@@ -778,8 +810,13 @@ NODISCARD IRBlock **ir_blocks_begin_impl(IRFunction *);
 NODISCARD IRBlock **ir_blocks_end_impl(IRFunction *);
 NODISCARD IRInstruction **ir_instructions_begin_impl(IRBlock *);
 NODISCARD IRInstruction **ir_instructions_end_impl(IRBlock *);
-NODISCARD IRInstruction **ir_users_begin_impl(IRInstruction *);
-NODISCARD IRInstruction **ir_users_end_impl(IRInstruction *);
+NODISCARD IRInstructionHandle *ir_users_begin_impl(IRInstruction *);
+NODISCARD IRInstructionHandle *ir_users_end_impl(IRInstruction *);
+#ifdef IR_INDEX_HANDLES
+NODISCARD IRInstruction *ir_instruction_impl(IRInstructionHandle);
+#else
+#  define ir_instruction_impl(handle) (handle)
+#endif
 NODISCARD IRBlock *ir_parent_impl_i(IRInstruction *);
 NODISCARD IRFunction *ir_parent_impl_b(IRBlock *);
 NODISCARD IRInstruction **ir_it_impl_i(IRInstruction *);
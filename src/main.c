@@ -1,66 +1,87 @@
 #include <ast.h>
+#include <cache.h>
 #include <codegen.h>
+#include <errno.h>
 #include <error.h>
+#include <intc.h>
 #include <locale.h>
+#include <memory_report.h>
 #include <parser.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <typechecker.h>
 #include <platform.h>
+#include <server.h>
+#include <stats.h>
+#include <timing.h>
 #include <utils.h>
 #include <vector.h>
 
 // TODO: TMP
 #include <module.h>
-#include <codegen/coff.h>
-#include <codegen/elf.h>
 
 static void print_usage(char **argv) {
-  print("\nUSAGE: %s [FLAGS] [OPTIONS] <path to file to compile>\n", 0[argv]);
+  print("\nUSAGE: %s [FLAGS] [OPTIONS] <path to file to compile>...\n", 0[argv]);
   print("Flags:\n"
         "   `-h`, `--help`      :: Show this help and usage information.\n"
         "   `-as`, `--archs`    :: List acceptable architectures.\n"
         "   `-ts`, `--targets`  :: List acceptable targets.\n"
         "   `-ccs`, `--callings`:: List acceptable calling conventions.\n"
         "   `--syntax-only      :: Exit just after parsing, before semantic analysis.\n"
+        "   `--lazy-bodies`     :: Only parse the bodies of top-level functions that are referenced.\n"
         "   `--print-ast        :: Print the syntax tree.\n"
         "   `--print-scopes     :: Print the scope tree.\n"
         "   `--print-ir`        :: Print the intermediate representation.\n"
         "   `--annotate-code    :: Emit comments in generated code.\n"
         "   `-O`, `--optimize`  :: Optimize the generated code.\n"
-        "   `-v`, `--verbose`   :: Print out more information.\n");
+        "   `-v`, `--verbose`   :: Print out more information.\n"
+        "   `--time-report`     :: Print how long each phase took; with `-v`, also the slowest functions.\n"
+        "   `--mem-report`      :: Print how much memory each subsystem allocated, and the RSS before and after each phase.\n"
+        "   `--trace-json=<path>`:: Write a Chrome trace of each phase, function and pass to the given file.\n"
+        "   `--stats-json=<path>`:: Write counters collected by each phase to the given file.\n"
+        "   `--cache-stats`     :: Print how many outputs were reused from the cache; works without input files.\n");
   print("Options:\n"
         "    `-o`, `--output`   :: Set the output filepath to the one given.\n"
         "    `-a`, `--arch`     :: Set the output architecture to the one given.\n"
         "    `-t`, `--target`   :: Set the output target to the one given.\n"
         "    `-cc`, `--calling` :: Set the calling convention to the one given.\n"
+        "    `-j`, `--jobs`     :: Compile up to this many input files at once (default: number of processors).\n"
+        "   `--backend-jobs`    :: Optimise and generate code for up to this many functions at once (default: 1).\n"
         "   `--dot-cfg <func>`  :: Print the control flow graph of a function in DOT format and exit.\n"
         "   `--dot-dj <func>`   :: Print the DJ-graph of a function in DOT format and exit.\n"
         "    `-L`               :: Check for modules within the given directory.\n"
+        "   `--cache-dir=<dir>` :: Reuse outputs of earlier compilations that are cached in the given directory.\n"
+        "   `--cache-max-size=<MiB>`:: Evict the least recently used outputs beyond this size (default: 1024).\n"
         "    `--colours`        :: Set whether to use colours in diagnostics.\n"
-        "Anything other arguments are treated as input filepaths (source code).\n");
+        "Anything other arguments are treated as input filepaths (source code).\n"
+        "If more than one input file is given, each one is compiled separately,\n"
+        "and `-o` may not be used.\n");
+  print("Compile server:\n"
+        "   `--serve <socket>`  :: Run a compile server that listens on the given Unix domain socket.\n"
+        "   `--connect <socket> [FLAGS] [OPTIONS] <path>...`\n"
+        "                       :: Have the server at the given socket compile the rest of the command line.\n"
+        "Both of these must be the first argument.\n");
 }
 
-int input_filepath_index = -1;
-int output_filepath_index = -1;
+Vector(const char *) input_filepaths = {0};
+const char *output_filepath_argument = NULL;
+usz jobs = 0;
+usz backend_jobs = 1;
 CodegenArchitecture output_arch = ARCH_DEFAULT;
 CodegenTarget output_target = TARGET_DEFAULT;
 enum CodegenCallingConvention output_calling_convention = CG_CALL_CONV_DEFAULT;
 
 int verbosity = 0;
 int optimise = 0;
-bool debug_ir = false;
 bool print_ast = false;
 bool syntax_only = false;
+bool lazy_function_bodies = false;
 bool print_scopes = false;
-bool prefer_using_diagnostics_colours = true;
-bool colours_blink = false;
 bool annotate_code = false;
-bool print_ir2 = false;
-bool print_dot_cfg = false;
-bool print_dot_dj = false;
-const char* print_dot_function = NULL;
+const char *cache_directory = NULL;
+u64 cache_max_size = (u64) 1024 * 1024 * 1024;
+bool cache_stats = false;
 Vector(string) search_paths = {};
 
 static void print_acceptable_architectures() {
@@ -97,6 +118,20 @@ static void print_acceptable_colour_settings() {
          " -> never\n");
 }
 
+/// Parse a positive job count given as the value of `option`.
+/// @return Whether the value was valid; if not, an error is printed.
+static bool parse_job_count(const char *option, const char *value, usz *out) {
+  char *end = NULL;
+  unsigned long long count = strtoull(value, &end, 10);
+  if (*value == '-' || *end || !count) {
+    print("Expected a positive number of jobs after command line argument %s\n"
+          "Instead, got: \"%s\".\n", option, value);
+    return false;
+  }
+  *out = (usz) count;
+  return true;
+}
+
 /// @return Zero if everything goes well, otherwise return non-zero value.
 static int handle_command_line_arguments(int argc, char **argv) {
   /// Default settings.
@@ -121,8 +156,44 @@ static int handle_command_line_arguments(int argc, char **argv) {
       print_scopes = true;
     } else if (strcmp(argument, "--syntax-only") == 0) {
       syntax_only = true;
+    } else if (strcmp(argument, "--lazy-bodies") == 0) {
+      lazy_function_bodies = true;
     } else if (strcmp(argument, "--annotate-code") == 0) {
       annotate_code = true;
+    } else if (strcmp(argument, "--time-report") == 0) {
+      time_report = true;
+    } else if (strcmp(argument, "--mem-report") == 0) {
+      mem_report = true;
+    } else if (strncmp(argument, "--trace-json=", strlen("--trace-json=")) == 0) {
+      trace_json_path = argument + strlen("--trace-json=");
+      if (!*trace_json_path) {
+        print("Expected a file path after `--trace-json=`\n");
+        return 1;
+      }
+    } else if (strncmp(argument, "--stats-json=", strlen("--stats-json=")) == 0) {
+      stats_json_path = argument + strlen("--stats-json=");
+      if (!*stats_json_path) {
+        print("Expected a file path after `--stats-json=`\n");
+        return 1;
+      }
+    } else if (strncmp(argument, "--cache-dir=", strlen("--cache-dir=")) == 0) {
+      cache_directory = argument + strlen("--cache-dir=");
+      if (!*cache_directory) {
+        print("Expected a directory path after `--cache-dir=`\n");
+        return 1;
+      }
+    } else if (strncmp(argument, "--cache-max-size=", strlen("--cache-max-size=")) == 0) {
+      const char *value = argument + strlen("--cache-max-size=");
+      char *end = NULL;
+      unsigned long long mebibytes = strtoull(value, &end, 10);
+      if (!*value || *value == '-' || *end) {
+        print("Expected a size in MiB after `--cache-max-size=`\n"
+              "Instead, got: \"%s\".\n", value);
+        return 1;
+      }
+      cache_max_size = (u64) mebibytes * 1024 * 1024;
+    } else if (strcmp(argument, "--cache-stats") == 0) {
+      cache_stats = true;
     } else if (strcmp(argument, "--dot-cfg") == 0) {
       print_dot_cfg = true;
       if (++i >= argc)
@@ -221,7 +292,7 @@ static int handle_command_line_arguments(int argc, char **argv) {
                "Instead, got what looks like another command line argument.\n"
                " -> \"%s\"", argv[i]);
       }
-      output_filepath_index = i;
+      output_filepath_argument = argv[i];
     } else if (strcmp(argument, "--colours") == 0 || strcmp(argument, "--colors") == 0) {
       i++;
       if (i >= argc) {
@@ -270,6 +341,18 @@ static int handle_command_line_arguments(int argc, char **argv) {
         print_acceptable_calling_conventions();
         return 1;
       }
+    } else if (strcmp(argument, "-j") == 0 || strcmp(argument, "--jobs") == 0) {
+      i++;
+      if (i >= argc) {
+        ICE("Expected number of jobs after command line argument %s", argument);
+      }
+      if (!parse_job_count(argument, argv[i], &jobs)) return 1;
+    } else if (strcmp(argument, "--backend-jobs") == 0) {
+      i++;
+      if (i >= argc) {
+        ICE("Expected number of jobs after command line argument %s", argument);
+      }
+      if (!parse_job_count(argument, argv[i], &backend_jobs)) return 1;
     } else if (strcmp(argument, "-L") == 0) {
       i++;
       if (i >= argc) {
@@ -290,87 +373,12 @@ static int handle_command_line_arguments(int argc, char **argv) {
       system("xdg-open https://www.youtube.com/watch?v=dQw4w9WgXcQ");
 #     endif
     } else {
-      if (input_filepath_index == -1) input_filepath_index = i;
-      else ICE("Error: Unrecognized command line argument: \"%s\"", argument);
+      vector_push(input_filepaths, argument);
     }
   }
   return 0;
 }
 
-// TODO: Dear god, please move this.
-span grab_section_reference_elf(span object_file, const char *section_name) {
-  // TODO: Check if file is actually big enough to be an ELF file.
-  elf64_header* header = (elf64_header*)object_file.data;
-  // TODO: Validate header.
-  if (header->e_machine != EM_X86_64)
-    ICE("ELF has invalid machine type");
-
-  // Offset into file to find section header table.
-  // TODO: Validate offset within file.
-  elf64_shdr* section_header = (elf64_shdr*)(object_file.data + header->e_shoff);
-  elf64_shdr* string_table_header = section_header + header->e_shstrndx;
-  span string_table = {
-    object_file.data + string_table_header->sh_offset,
-    string_table_header->sh_size
-  };
-  for (size_t i = 0; i < header->e_shnum; ++i) {
-    const char *sh_name = string_table.data + section_header->sh_name;
-    if (strcmp(sh_name, section_name) == 0) {
-      span section_reference = {0};
-      section_reference.data = object_file.data + section_header->sh_offset;
-      section_reference.size = section_header->sh_size;
-      return section_reference;
-    }
-    section_header++;
-  }
-  ICE("Could not find section %s within ELF object file", section_name);
-}
-
-span grab_section_reference_coff(span object_file, const char *section_name) {
-  ASSERT(object_file.data, "Invalid argument");
-  ASSERT(section_name, "Invalid argument");
-  const size_t section_name_length = strlen(section_name);
-
-  coff_header *header = (coff_header*)object_file.data;
-  // TODO: Validate header.
-
-  span string_table = {0};
-  // The string table starts after the symbol table.
-  string_table.data = object_file.data + header->f_symptr + ((usz)header->f_nsyms * sizeof(coff_symbol_entry));
-  string_table.size = *(uint32_t*)string_table.data;
-
-  coff_section_header *section_header = (coff_section_header*)(object_file.data + sizeof(*header));
-  for (size_t i = 0; i < header->f_nscns; ++i, ++section_header) {
-    if (section_name_length > sizeof(section_header->s_name)) {
-      if (section_header->s_name[0] != '/') continue;
-      // TODO: Parse unsigned decimal integer from the last seven digits of s_name
-      char *end = NULL;
-      usz name_offset_in_string_table = (usz)strtoull(section_header->s_name + 1, &end, 10);
-      // TODO: Use parsed integer as offset into string table to find name.
-      if (strncmp(string_table.data + name_offset_in_string_table, section_name, section_name_length) == 0) {
-        span section_reference = {0};
-        section_reference.data = object_file.data + section_header->s_scnptr;
-        section_reference.size = (usz)section_header->s_size;
-        return section_reference;
-      }
-    } else {
-      if (strncmp(section_header->s_name, section_name, 8) == 0) {
-        span section_reference = {0};
-        section_reference.data = object_file.data + section_header->s_scnptr;
-        section_reference.size = (usz)section_header->s_size;
-        return section_reference;
-      }
-    }
-  }
-  ICE("Could not find section %s within COFF object file", section_name);
-}
-
-span grab_section_reference(span object_file, const char *section_name) {
-  if (string_starts_with(object_file, literal_span("\x7f""ELF")))
-    return grab_section_reference_elf(object_file, section_name);
-  return grab_section_reference_coff(object_file, section_name);
-}
-
 // TODO: MOVE THIS
 /// Return the file extension expected by a given target.
 const char *target_extension(CodegenTarget target) {
@@ -389,34 +397,130 @@ const char *target_extension(CodegenTarget target) {
   }
 }
 
-int main(int argc, char **argv) {
-  primitive_types[0] = t_integer;
-  primitive_types[1] = t_void;
-  primitive_types[2] = t_byte;
-  primitive_types[3] = NULL;
+/// The state of compiling one input file given on the command line.
+typedef struct CompileFile {
+  const char *infile;
+  PlatformMappedFile input;
+  string output_filepath;
+
+  /// Where code is written until the compilation has succeeded; see
+  /// compiled_file_open_output().
+  string temporary_filepath;
+  FILE *output;
+
+  CacheEntry cache_entry;
+
+  /// Diagnostics issued while compiling, if the output is to be
+  /// stored in the cache; see thread_diagnostics_copy.
+  PlatformMemoryStream diagnostics;
+  int status;
+} CompileFile;
+
+/// Called once an input file has been parsed.
+static bool compiled_file_parsed(void *data, Module *ast) {
+  CompileFile *file = data;
+
+  // If this is a module and the user did not provide output
+  // filename, use the module name.
+  if (ast->is_module && !output_filepath_argument) {
+    // TODO: "contains" isn't the best check, but I don't want to write a
+    // path parser to get the base name right now.
+    if (!strstr(file->infile, ast->module_name.data)) {
+      issue_diagnostic(DIAG_WARN, file->infile, file->input.contents, (loc){0},
+                       "Source file name does not match name of exported module: %s doesn't contain %S",
+                       file->infile, ast->module_name);
+    }
 
-  platform_init();
+    free(file->output_filepath.data);
 
-  if (argc < 2) {
-    print_usage(argv);
-    return 0;
+    // Construct output path from module name
+    string_buffer path = {0};
+    vector_append(path, ast->module_name);
+    format_to(&path, ".%s", target_extension(output_target));
+
+    // MOVE path -> output_filepath
+    file->output_filepath.data = path.data;
+    file->output_filepath.size = path.size;
+    path.data = NULL;
+    path.size = 0;
+    cache_record_output_filepath(&file->cache_entry, as_span(file->output_filepath));
   }
 
-  int status = handle_command_line_arguments(argc, argv);
-  if (status) return status;
-  if (input_filepath_index == -1) {
-    print("Input file path was not provided.");
-    print_usage(argv);
-    return 1;
+  /// Print if requested.
+  if (syntax_only) {
+    if (print_ast) ast_print(stdout, ast);
+    if (print_scopes) ast_print_scope_tree(stdout, ast);
+    return false;
   }
 
-  thread_use_colours = prefer_using_diagnostics_colours;
+  return true;
+}
+
+/// Called for every module that an input file imports.
+static void compiled_file_resolved_import(span module_name, const char *path, void *data) {
+  CompileFile *file = data;
+  print("Resolved module %S at path %s\n", module_name, path);
+  cache_record_import(&file->cache_entry, module_name, path);
+}
+
+/// Called once an input file has been typechecked.
+static void compiled_file_checked(void *data, Module *ast) {
+  (void) data;
 
-  const char *infile = argv[input_filepath_index];
+  /// Print if requested.
+  if (print_ast) ast_print(stdout, ast);
+  if (print_scopes) ast_print_scope_tree(stdout, ast);
+}
+
+/// Open the output file of an input file. Code is written to a
+/// temporary file next to it, which compile_job() renames to the
+/// output filepath once the compilation has succeeded, so that one
+/// that fails never leaves a partial output behind.
+static FILE *compiled_file_open_output(void *data, Module *ast) {
+  (void) ast;
+  CompileFile *file = data;
+  string_buffer path = {0};
+  format_to(&path, "%S.%X.tmp", file->output_filepath, platform_wall_time() ^ (u64) (uintptr_t) file);
+  string_buf_zterm(&path);
+  file->temporary_filepath.data = path.data;
+  file->temporary_filepath.size = path.size;
+
+  file->output = fopen(file->temporary_filepath.data, "wb");
+  if (!file->output) ICE("codegen(): failed to open file at path: \"%S\"\n", file->temporary_filepath);
+  return file->output;
+}
+
+/// Close the output file of an input file.
+static void compiled_file_close_output(void *data, FILE *output) {
+  CompileFile *file = data;
+  file->output = NULL;
+  fclose(output);
+}
+
+/// Get the options for code generation given on the command line.
+static CodegenOptions codegen_options(void) {
+  return (CodegenOptions){
+    .arch = output_arch,
+    .target = output_target,
+    .call_convention = output_calling_convention,
+    .optimise = optimise,
+    .annotate_code = annotate_code,
+    .backend_jobs = backend_jobs,
+  };
+}
 
+/// Compile a single input file, and set `file->status` to zero if
+/// everything goes well, otherwise to the exit code that the compiler
+/// should return. compile_job() cleans up after this.
+///
+/// This may be called from several threads at once, so it must not
+/// modify any global state.
+static void compile_file(void *data) {
+  CompileFile *file = data;
+  const char *infile = file->infile;
   string output_filepath = {0};
-  if (output_filepath_index != -1)
-    output_filepath = string_create(argv[output_filepath_index]);
+  if (output_filepath_argument)
+    output_filepath = string_create(output_filepath_argument);
   else {
     // Create output filepath from infile
 
@@ -433,6 +537,7 @@ int main(int argc, char **argv) {
     string_buffer path = {0};
     for (const char *c = last_path_separator; *c; ++c)
       vector_push(path, *c);
+    string_buf_zterm(&path);
     // Strip file extension
     char *last_dot = strrchr(path.data, '.');
     if (last_dot) {
@@ -451,163 +556,262 @@ int main(int argc, char **argv) {
     path.size = 0;
 
   }
+  file->output_filepath = output_filepath;
   size_t len = strlen(infile);
   bool ok = false;
-  string s = platform_read_file(infile, &ok);
-  if (!ok) ICE("%S", s);
+  file->input = platform_map_file(infile, &ok);
+  if (!ok) {
+    issue_diagnostic(DIAG_ERR, infile, (span){0}, (loc){0}, "%S", file->input.contents);
+    file->status = 1;
+    return;
+  }
 
   /// The input is an IR file.
   if (len >= 3 && memcmp(infile + len - 3, ".ir", 3) == 0) {
-    ASSERT(s.data);
+    ASSERT(file->input.contents.data);
 
     TODO("Development of IR parser and codegen is severely behind right now.");
 
+    FILE *code = compiled_file_open_output(file, NULL);
+    CodegenOptions options = codegen_options();
     if (!codegen(
       LANG_IR,
-      output_arch,
-      output_target,
-      output_calling_convention,
+      &options,
       infile,
-      output_filepath.data,
+      code,
       NULL,
-      s
+      (string){(char *) file->input.contents.data, file->input.contents.size}
      )) {
-      exit(1);
+      file->status = 1;
      }
-
-    free(s.data);
+    compiled_file_close_output(file, code);
   }
 
   /// The input is an Intercept file.
   else {
-    /// Parse the file.
-    Module *ast = parse(as_span(s), infile);
-    if (!ast) exit(1);
-
-    // If this is a module and the user did not provide output
-    // filename, use the module name.
-    if (ast->is_module && output_filepath_index == -1) {
-      // TODO: "contains" isn't the best check, but I don't want to write a
-      // path parser to get the base name right now.
-      if (!strstr(infile, ast->module_name.data)) {
-        issue_diagnostic(DIAG_WARN, infile, as_span(s), (loc){0},
-                         "Source file name does not match name of exported module: %s doesn't contain %S",
-                         infile, ast->module_name);
-      }
-
-      free(output_filepath.data);
-
-      // Construct output path from module name
-      string_buffer path = {0};
-      vector_append(path, ast->module_name);
-      format_to(&path, ".%s", target_extension(output_target));
-
-      // MOVE path -> output_filepath
-      output_filepath.data = path.data;
-      output_filepath.size = path.size;
-      path.data = NULL;
-      path.size = 0;
+    /// Reuse the output of an earlier compilation if we can.
+    bool cacheable = cache_directory && !syntax_only && !print_ast && !print_scopes &&
+                     !debug_ir && !print_ir2 && !print_dot_cfg && !print_dot_dj;
+    if (cacheable && cache_lookup(&file->cache_entry, infile, file->input.contents, &file->output_filepath, output_filepath_argument != NULL))
+      return;
+
+    /// Keep the diagnostics so they can be reported again on a hit.
+    if (cacheable) {
+      platform_memory_stream_open(&file->diagnostics);
+      thread_diagnostics_copy = file->diagnostics.file;
     }
 
-    /// Print if requested.
-    if (syntax_only) {
-      if (print_ast) ast_print(stdout, ast);
-      if (print_scopes) ast_print_scope_tree(stdout, ast);
-      goto done;
+    Vector(const char *) paths = {0};
+    foreach (path, search_paths) vector_push(paths, path->data);
+
+    IntcOptions options = intc_default_options();
+    options.filename = infile;
+    options.codegen = codegen_options();
+    options.search_paths = paths.data;
+    options.search_path_count = paths.size;
+    options.colours = prefer_using_diagnostics_colours;
+    options.lazy_function_bodies = lazy_function_bodies;
+
+    /// The module refers to the mapped source, which stays mapped
+    /// until the module has been freed.
+    IntcHooks hooks = {
+      .data = file,
+      .parsed = compiled_file_parsed,
+      .resolved_import = compiled_file_resolved_import,
+      .checked = compiled_file_checked,
+      .open_output = compiled_file_open_output,
+      .close_output = compiled_file_close_output,
+      .keep_module = platform_fast_exit,
+    };
+
+    file->status = (int) intc_compile_with_hooks(&options, file->input.contents, &hooks, NULL);
+    if (cacheable) {
+      thread_diagnostics_copy = NULL;
+      string diagnostics = platform_memory_stream_close(&file->diagnostics);
+      file->diagnostics.file = NULL;
+      if (file->status == INTC_OK && file->temporary_filepath.data)
+        cache_store(&file->cache_entry, file->temporary_filepath.data, as_span(diagnostics));
+      free(diagnostics.data);
     }
+    vector_delete(paths);
+  }
+}
 
-    // Resolve imported modules
-    vector_push(search_paths, string_create("."));
-
-    Vector(span) extensions_to_try = {0};
-#ifdef _WIN32
-      vector_push(extensions_to_try, literal_span(".obj"));
-      vector_push(extensions_to_try, literal_span(".o"));
-#else
-      vector_push(extensions_to_try, literal_span(".o"));
-      vector_push(extensions_to_try, literal_span(".obj"));
-#endif
-
-    foreach_index (i, ast->imports) {
-      Module *import = ast->imports.data[i];
-
-      string module_object = {0};
-      bool success = false;
-
-      string_buffer search_path = {0};
-      const span dir_sep = literal_span("/");
-      foreach_index(j, search_paths) {
-        vector_clear(search_path);
-        vector_append(search_path, search_paths.data[j]);
-        // TODO: Only do this if path doesn't already end with dir sep.
-        vector_append(search_path, dir_sep);
-        vector_append(search_path, import->module_name);
-        usz module_path_length_without_extension = search_path.size;
-        foreach (extension, extensions_to_try) {
-          search_path.size = module_path_length_without_extension;
-          vector_append(search_path, *extension);
-          //print("Looking for module %S at %S\n", as_span(import->module_name), as_span(search_path));
-          module_object = platform_read_file(search_path.data, &success);
-          if (success) break;
-        }
-        if (success) break;
-      }
-
-      ASSERT(success, "Could not find module description for module %S", import->module_name);
-
-      print("Resolved module %S at path %S\n", import->module_name, as_span(search_path));
-
-      vector_delete(search_path);
+/// The files being compiled, if any; see remove_temporary_files().
+static CompileFile *compile_files = NULL;
+static usz compile_files_count = 0;
 
-      span metadata = grab_section_reference(as_span(module_object), INTC_MODULE_SECTION_NAME);
-      ast->imports.data[i] = deserialise_module(metadata);
-      ast->imports.data[i]->module_name = import->module_name;
+/// Remove the temporary output files of the files being compiled if
+/// a fatal error exits the process, so that we don’t leave them behind.
+static void remove_temporary_files(void) {
+  for (usz i = 0; i < compile_files_count; i++)
+    if (compile_files[i].temporary_filepath.data) remove(compile_files[i].temporary_filepath.data);
+}
 
-      foreach_val (export, ast->imports.data[i]->exports) {
-        if (export->kind == NODE_FUNCTION_REFERENCE) {
-          Scope *global_scope = vector_front(ast->scope_stack);
-          Symbol *func_sym = scope_find_or_add_symbol(global_scope, SYM_FUNCTION, as_span(export->funcref.name), true);
-          /// FIXME: Should probably create function in imported module?
-          func_sym->val.node = ast_make_function(ast, (loc){0}, export->type, LINKAGE_IMPORTED, (Nodes){0}, NULL, as_span(export->funcref.name));
-          export->funcref.scope = global_scope;
-          export->funcref.resolved = func_sym;
-        }
-      }
+/// Compile the input file at `index` into `files[index]`. A fatal error
+/// while doing so only fails that file; the others are still compiled.
+static void compile_job(usz index, void *files) {
+  CompileFile *file = (CompileFile *) files + index;
+  file->infile = input_filepaths.data[index];
+  Timer timer = timer_start_span("Compile", (span){file->infile, strlen(file->infile)});
+
+  /// The error has been reported already; clean up after it.
+  bool use_colours = thread_use_colours;
+  if (!catch_fatal_errors(compile_file, file)) {
+    file->status = 1;
+    if (file->output) fclose(file->output);
+    thread_use_colours = use_colours;
+    thread_diagnostics_stream = NULL;
+    thread_diagnostics_copy = NULL;
+    if (file->diagnostics.file) free(platform_memory_stream_close(&file->diagnostics).data);
+    codegen_forget_thread_state();
+    stats_end_pass(NULL);
+    memory_leave(MEMORY_OTHER);
+  }
 
-      free(module_object.data);
+  /// Put the output in place only if everything went well.
+  if (file->temporary_filepath.data) {
+    if (!file->status && !platform_rename_file(file->temporary_filepath.data, file->output_filepath.data)) {
+      issue_diagnostic(DIAG_ERR, file->infile, (span){0}, (loc){0}, "Could not write output to \"%S\"", file->output_filepath);
+      file->status = 1;
     }
-    vector_delete(extensions_to_try);
+    if (file->status) remove(file->temporary_filepath.data);
+  }
 
-    /// Perform semantic analysis on program expressions.
-    ok = typecheck_expression(ast, ast->root);
-    if (!ok) exit(2);
+  /// Done!
+  if (!file->status && verbosity) print("\nGenerated code at output filepath \"%S\"\n", file->output_filepath);
+
+  /// Unmap the input file and free the paths.
+  platform_unmap_file(&file->input);
+  cache_entry_delete(&file->cache_entry);
+  free(file->output_filepath.data);
+  char *temporary_filepath = file->temporary_filepath.data;
+  file->temporary_filepath.data = NULL;
+  free(temporary_filepath);
+  timer_stop(&timer);
+}
 
-    /// Print if requested.
-    if (print_ast) ast_print(stdout, ast);
-    if (print_scopes) ast_print_scope_tree(stdout, ast);
+/// Compile everything given on the command line.
+static int compile_command_line(int argc, char **argv) {
+  int status = handle_command_line_arguments(argc, argv);
+  if (status) return status;
+  if (cache_stats && !cache_directory) {
+    print("`--cache-stats` requires `--cache-dir=<dir>`\n");
+    return 1;
+  }
+  if (!input_filepaths.size && cache_stats) {
+    cache_print_stats(stderr);
+    return 0;
+  }
+  if (!input_filepaths.size) {
+    print("Input file path was not provided.");
+    print_usage(argv);
+    return 1;
+  }
 
-    /// Generate code.
-    if (!codegen(
-      LANG_FUN,
+  if (input_filepaths.size > 1 && output_filepath_argument) {
+    print("Cannot use `-o` when compiling more than one input file.\n");
+    return 1;
+  }
+
+  thread_use_colours = prefer_using_diagnostics_colours;
+  if (input_filepaths.size > 1) platform_fast_exit = false;
+
+  // Modules are looked up in the current directory last.
+  vector_push(search_paths, string_create("."));
+
+  /// Everything other than the input file that affects the output,
+  /// and the diagnostics, which are stored with it.
+  if (cache_directory) {
+    string_buffer options = {0};
+    format_to(
+      &options,
+      "arch %d, target %d, calling convention %d, optimise %d, annotate %d, lazy %d, colours %d\n",
       output_arch,
       output_target,
       output_calling_convention,
-      infile,
-      output_filepath.data,
-      ast,
-      (string){0}
-    )) exit(3);
+      optimise,
+      annotate_code,
+      lazy_function_bodies,
+      prefer_using_diagnostics_colours
+    );
+    foreach (path, search_paths) format_to(&options, "-L %S\n", as_span(*path));
+    bool ok = cache_init(as_span(options), codegen_isel_table(output_arch), search_paths.data, search_paths.size);
+    vector_delete(options);
+    if (!ok) return 1;
+  }
 
-  done:
-    ast_free(ast);
+  /// Compile all input files. Each file gets its own compilation;
+  /// nothing is shared between them, so they can run in parallel.
+  CompileFile *files = calloc(input_filepaths.size, sizeof *files);
+  compile_files = files;
+  compile_files_count = input_filepaths.size;
+  set_fatal_exit_handler(remove_temporary_files);
+  platform_parallel_for(input_filepaths.size, jobs, compile_job, files);
+  set_fatal_exit_handler(NULL);
+  compile_files = NULL;
+  compile_files_count = 0;
+
+  /// Report failures per file, and exit with the status of the
+  /// first input file that failed.
+  foreach_index (i, input_filepaths) {
+    if (!files[i].status) continue;
+    if (!status) status = files[i].status;
+    if (input_filepaths.size > 1)
+      issue_diagnostic(DIAG_ERR, input_filepaths.data[i], (span){0}, (loc){0}, "Compilation failed");
   }
 
-  /// Free the input file contents.
-  free(s.data);
+  free(files);
+  if (cache_directory) cache_trim();
+  if (cache_stats) cache_print_stats(stderr);
+  if (time_report) timing_report(stderr, verbosity);
+  if (mem_report) memory_report(stderr);
+  if (trace_json_path && !timing_write_trace(trace_json_path)) {
+    issue_diagnostic(DIAG_ERR, trace_json_path, (span){0}, (loc){0}, "Could not write trace: %s", strerror(errno));
+    if (!status) status = 1;
+  }
+  if (stats_json_path && !stats_write_json(stats_json_path)) {
+    issue_diagnostic(DIAG_ERR, stats_json_path, (span){0}, (loc){0}, "Could not write statistics: %s", strerror(errno));
+    if (!status) status = 1;
+  }
+  return status;
+}
 
-  /// Done!
-  if (verbosity) print("\nGenerated code at output filepath \"%S\"\n", output_filepath);
+int main(int argc, char **argv) {
+  platform_init();
+
+  if (argc < 2) {
+    print_usage(argv);
+    return 0;
+  }
+
+  /// Compile server and client.
+  if (strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--connect") == 0) {
+    if (argc < 3) {
+      print("Expected socket path after command line argument %s\n", argv[1]);
+      return 1;
+    }
+
+    if (strcmp(argv[1], "--serve") == 0) {
+      if (argc > 3) {
+        print("Unexpected arguments after `--serve <socket>`\n");
+        return 1;
+      }
+      return server_run(argv[2], compile_command_line);
+    }
+
+    return server_forward(argv[2], argc - 3, argv + 3);
+  }
 
-  /// Free the output filepath.
-  free(output_filepath.data);
+  /// Nothing is freed once a file has been compiled, unless there are
+  /// several of them, in which case we free each one so that we never
+  /// hold on to more than what is being compiled at the moment. The
+  /// output file is closed regardless, and the standard streams are
+  /// flushed by exit().
+#ifndef FULL_TEARDOWN
+  platform_fast_exit = true;
+#endif
+  int status = compile_command_line(argc, argv);
+  if (!platform_fast_exit) codegen_clear_caches();
+  return status;
 }
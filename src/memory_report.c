@@ -0,0 +1,86 @@
+#include <memory_report.h>
+#include <platform.h>
+#include <timing.h>
+
+/// Memory allocated by a subsystem. Frees are not tracked, so
+/// this is the total amount ever allocated, not what is live.
+typedef struct SubsystemMemory {
+  u64 allocations;
+  u64 bytes;
+} SubsystemMemory;
+
+bool mem_report = false;
+
+#define SUBSYSTEM_NAME(name, description) description,
+static const char *subsystem_names[MEMORY_SUBSYSTEM_COUNT] = { ALL_MEMORY_SUBSYSTEMS(SUBSYSTEM_NAME) };
+#undef SUBSYSTEM_NAME
+
+/// Updated atomically since allocations happen on any thread.
+static SubsystemMemory subsystem_memory[MEMORY_SUBSYSTEM_COUNT] = {0};
+
+/// The subsystem that the calling thread is working on.
+static THREAD_LOCAL MemorySubsystem current_subsystem = MEMORY_OTHER;
+
+void memory_record(MemorySubsystem subsystem, usz bytes) {
+  if (!mem_report) return;
+  __atomic_fetch_add(&subsystem_memory[subsystem].allocations, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&subsystem_memory[subsystem].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void memory_record_vector_growth(usz bytes) {
+  memory_record(current_subsystem, bytes);
+}
+
+MemorySubsystem memory_enter(MemorySubsystem subsystem) {
+  MemorySubsystem previous = current_subsystem;
+  current_subsystem = subsystem;
+  return previous;
+}
+
+void memory_leave(MemorySubsystem previous) {
+  current_subsystem = previous;
+}
+
+void memory_report(FILE *file) {
+  u64 total_allocations = 0, total_bytes = 0;
+  for (usz i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+    total_allocations += __atomic_load_n(&subsystem_memory[i].allocations, __ATOMIC_RELAXED);
+    total_bytes += __atomic_load_n(&subsystem_memory[i].bytes, __ATOMIC_RELAXED);
+  }
+
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "                         Memory Report\n");
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "  %-*s %*s %*s %*s\n", 28, "Subsystem", 12, "Allocations", 15, "Allocated (KiB)", 7, "%");
+  for (usz i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+    u64 allocations = __atomic_load_n(&subsystem_memory[i].allocations, __ATOMIC_RELAXED);
+    u64 bytes = __atomic_load_n(&subsystem_memory[i].bytes, __ATOMIC_RELAXED);
+    fprint(
+      file,
+      "  %-*s %*U %*.1f %*.1f%%\n",
+      28, subsystem_names[i],
+      12, allocations,
+      15, (double) bytes / 1024.0,
+      6, total_bytes ? 100.0 * (double) bytes / (double) total_bytes : 0.0
+    );
+  }
+  fprint(file, "  %-*s %*U %*.1f\n", 28, "Total", 12, total_allocations, 15, (double) total_bytes / 1024.0);
+
+  /// Phases that did not run are omitted. The peak reported by the
+  /// OS is updated lazily, so it can lag behind what we measured.
+  u64 peak_rss = platform_peak_rss();
+  fprint(file, "\n  %-*s %*s %*s\n", 28, "Phase", 16, "RSS before (KiB)", 16, "RSS after (KiB)");
+  for (usz i = 0; i < PHASE_COUNT; i++) {
+    u64 before, after;
+    if (!timing_phase_rss((TimedPhase) i, &before, &after)) continue;
+    if (after > peak_rss) peak_rss = after;
+    fprint(
+      file,
+      "  %-*s %*.1f %*.1f\n",
+      28, timing_phase_name((TimedPhase) i),
+      16, (double) before / 1024.0,
+      16, (double) after / 1024.0
+    );
+  }
+  fprint(file, "  %-*s %*s %*.1f\n", 28, "Process peak", 16, "", 16, (double) peak_rss / 1024.0);
+}
@@ -0,0 +1,48 @@
+#ifndef INTERCEPT_MEMORY_REPORT_H
+#define INTERCEPT_MEMORY_REPORT_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <utils.h>
+
+/// Whether to account for allocations and measure the RSS around each phase.
+extern bool mem_report;
+
+/// Parts of the compiler that memory is attributed to.
+#define ALL_MEMORY_SUBSYSTEMS(F)     \
+  F(OTHER, "Other")                  \
+  F(AST, "AST")                      \
+  F(IR, "IR")                        \
+  F(MIR, "MIR")                      \
+  F(RA, "Register allocation graph") \
+  F(OBJECT, "Object buffers")
+
+#define DEFINE_MEMORY_SUBSYSTEM(name, ...) CAT(MEMORY_, name),
+typedef enum MemorySubsystem {
+  ALL_MEMORY_SUBSYSTEMS(DEFINE_MEMORY_SUBSYSTEM)
+  MEMORY_SUBSYSTEM_COUNT
+} MemorySubsystem;
+#undef DEFINE_MEMORY_SUBSYSTEM
+
+/// Record an allocation of `bytes` bytes by a subsystem. This may be
+/// called from any thread and does nothing unless `mem_report` is set.
+void memory_record(MemorySubsystem subsystem, usz bytes);
+
+/// Record that a vector has grown by `bytes` bytes. The memory is
+/// attributed to the subsystem that the calling thread is working on.
+void memory_record_vector_growth(usz bytes);
+
+/// Attribute vectors that grow on this thread to `subsystem`.
+///
+/// \return The subsystem that was active before, which must be
+///   passed to memory_leave().
+MemorySubsystem memory_enter(MemorySubsystem subsystem);
+
+/// Stop attributing vectors to the current subsystem.
+void memory_leave(MemorySubsystem previous);
+
+/// Print the allocations of each subsystem and the RSS of the
+/// process before and after each phase.
+void memory_report(FILE *file);
+
+#endif // INTERCEPT_MEMORY_REPORT_H
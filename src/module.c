@@ -2,7 +2,12 @@
 
 #include <ast.h>
 #include <codegen/codegen_forward.h>
+#include <codegen/coff.h>
+#include <codegen/elf.h>
+#include <error.h>
+#include <platform.h>
 #include <utils.h>
+#include <vector.h>
 
 #include <stdint.h>
 
@@ -219,7 +224,7 @@ uint8_t *deserialise_type(uint8_t *from, Type *type, Type **types) {
     type->named = calloc(1, sizeof(Symbol));
     type->named->kind = SYM_TYPE;
     type->named->val.type = primitive_types[index];
-    type->named->name = string_dup(primitive_types[index]->primitive.name);
+    type->named->name = atom_intern(primitive_types[index]->primitive.name);
 
     return from + 1 + sizeof(uint8_t);
   }
@@ -232,7 +237,7 @@ uint8_t *deserialise_type(uint8_t *from, Type *type, Type **types) {
 
     Symbol *sym = calloc(1, sizeof(Symbol));
     sym->kind = SYM_TYPE;
-    sym->name = string_dup(name);
+    sym->name = atom_intern(name);
     sym->val.type = type;
     // FIXME: Do we need to set scope? Hopefully not..
 
@@ -300,18 +305,8 @@ uint8_t *deserialise_type(uint8_t *from, Type *type, Type **types) {
 
       ASSERT(param_name_length < 1000, "Sorry, parameter names longer than a kilobyte aren't supported, you psycho");
 
-      string_buffer param_name = {0};
-      vector_reserve(param_name, param_name_length);
-      param_name.size = param_name_length;
-      memcpy(param_name.data, from_it, param_name_length);
+      type->function.parameters.data[i].name = atom_intern((span){(const char *) from_it, param_name_length});
       from_it += param_name_length;
-
-      // MOVE param_name vector into param.name string
-      type->function.parameters.data[i].name.data = param_name.data;
-      type->function.parameters.data[i].name.size = param_name.size;
-      param_name.data = NULL;
-      param_name.size = 0;
-      param_name.capacity = 0;
     }
     return from_it;
   }
@@ -348,15 +343,15 @@ Module *deserialise_module(span metadata) {
     ICE("Invalid module description header");
 
   // Preallocate types
-  vector_reserve(module->_types_, desc->type_count);
-  Type *type_blob = calloc(desc->type_count, sizeof(Type));
+  Types types = {0};
+  vector_reserve(types, desc->type_count);
   for (size_t i = 0; i < desc->type_count; ++i)
-    module->_types_.data[i] = type_blob + i;
+    types.data[i] = arena_new(&module->_types_, Type);
 
   // Deserialise type info
   uint8_t *type_table = (uint8_t*)(metadata.data + desc->type_table_offset);
   for (usz i = 0; i < desc->type_count; ++i) {
-    type_table = deserialise_type(type_table, module->_types_.data[i], module->_types_.data);
+    type_table = deserialise_type(type_table, types.data[i], types.data);
   }
 
   // Starting at (metadata.data + sizeof(*desc)),
@@ -367,23 +362,20 @@ Module *deserialise_module(span metadata) {
 
     // Get pointer within preallocated types using type index
     uint64_t type_index = *(uint64_t *)(begin_ptr);
-    Type *type = module->_types_.data[type_index];
+    Type *type = types.data[type_index];
     //print("deserialised type: %T\n", type);
 
     // Get name length and then the name data
     uint32_t name_length = *(uint32_t *)(begin_ptr + sizeof(type_index));
     char *name_ptr = (char *)(begin_ptr + sizeof(type_index) + sizeof(uint32_t));
-    string_buffer name = {0};
-    vector_reserve(name, name_length);
-    name.size = name_length;
-    memcpy(name.data, name_ptr, name_length);
-    //print("deserialised name: %S\n", as_span(name));
+    atom name = atom_intern((span){name_ptr, name_length});
+    //print("deserialised name: %S\n", name);
 
     // Construct an AST node to represent the deserialised declaration
     Node *node = NULL;
     switch (type->kind) {
     case TYPE_FUNCTION: {
-      node = ast_make_function_reference(module, (loc){0}, as_span(name));
+      node = ast_make_function_reference(module, (loc){0}, name);
       node->type = type;
     } break;
     case TYPE_PRIMITIVE:
@@ -393,7 +385,7 @@ Module *deserialise_module(span metadata) {
     case TYPE_ARRAY:
     case TYPE_STRUCT:
     case TYPE_INTEGER: {
-      node = ast_make_declaration(module, (loc){0}, type, LINKAGE_IMPORTED, as_span(name), NULL);
+      node = ast_make_declaration(module, (loc){0}, type, LINKAGE_IMPORTED, name, NULL);
     } break;
 
     case TYPE_COUNT:
@@ -411,6 +403,7 @@ Module *deserialise_module(span metadata) {
     ast_print_node(export);
   }
 
+  vector_delete(types);
   return module;
 }
 
@@ -476,3 +469,258 @@ string serialise_module(CodegenContext *context, Module *module) {
   ret.data = out.data;
   return ret;
 }
+
+static span grab_section_reference_elf(span object_file, const char *section_name) {
+  // TODO: Check if file is actually big enough to be an ELF file.
+  elf64_header* header = (elf64_header*)object_file.data;
+  // TODO: Validate header.
+  if (header->e_machine != EM_X86_64)
+    ICE("ELF has invalid machine type");
+
+  // Offset into file to find section header table.
+  // TODO: Validate offset within file.
+  elf64_shdr* section_header = (elf64_shdr*)(object_file.data + header->e_shoff);
+  elf64_shdr* string_table_header = section_header + header->e_shstrndx;
+  span string_table = {
+    object_file.data + string_table_header->sh_offset,
+    string_table_header->sh_size
+  };
+  for (size_t i = 0; i < header->e_shnum; ++i) {
+    const char *sh_name = string_table.data + section_header->sh_name;
+    if (strcmp(sh_name, section_name) == 0) {
+      span section_reference = {0};
+      section_reference.data = object_file.data + section_header->sh_offset;
+      section_reference.size = section_header->sh_size;
+      return section_reference;
+    }
+    section_header++;
+  }
+  ICE("Could not find section %s within ELF object file", section_name);
+}
+
+static span grab_section_reference_coff(span object_file, const char *section_name) {
+  ASSERT(object_file.data, "Invalid argument");
+  ASSERT(section_name, "Invalid argument");
+  const size_t section_name_length = strlen(section_name);
+
+  coff_header *header = (coff_header*)object_file.data;
+  // TODO: Validate header.
+
+  span string_table = {0};
+  // The string table starts after the symbol table.
+  string_table.data = object_file.data + header->f_symptr + ((usz)header->f_nsyms * sizeof(coff_symbol_entry));
+  string_table.size = *(uint32_t*)string_table.data;
+
+  coff_section_header *section_header = (coff_section_header*)(object_file.data + sizeof(*header));
+  for (size_t i = 0; i < header->f_nscns; ++i, ++section_header) {
+    if (section_name_length > sizeof(section_header->s_name)) {
+      if (section_header->s_name[0] != '/') continue;
+      // TODO: Parse unsigned decimal integer from the last seven digits of s_name
+      char *end = NULL;
+      usz name_offset_in_string_table = (usz)strtoull(section_header->s_name + 1, &end, 10);
+      // TODO: Use parsed integer as offset into string table to find name.
+      if (strncmp(string_table.data + name_offset_in_string_table, section_name, section_name_length) == 0) {
+        span section_reference = {0};
+        section_reference.data = object_file.data + section_header->s_scnptr;
+        section_reference.size = (usz)section_header->s_size;
+        return section_reference;
+      }
+    } else {
+      if (strncmp(section_header->s_name, section_name, 8) == 0) {
+        span section_reference = {0};
+        section_reference.data = object_file.data + section_header->s_scnptr;
+        section_reference.size = (usz)section_header->s_size;
+        return section_reference;
+      }
+    }
+  }
+  ICE("Could not find section %s within COFF object file", section_name);
+}
+
+span grab_section_reference(span object_file, const char *section_name) {
+  if (string_starts_with(object_file, literal_span("\x7f""ELF")))
+    return grab_section_reference_elf(object_file, section_name);
+  return grab_section_reference_coff(object_file, section_name);
+}
+
+/// ===========================================================================
+///  Module cache.
+/// ===========================================================================
+/// A module interface that is kept in memory.
+typedef struct CachedModule {
+  string path;
+  PlatformFileStamp stamp;
+  Module *module;
+
+  /// Compilations modify the modules they import, so
+  /// every cached module can only be used once.
+  bool taken;
+} CachedModule;
+
+static PlatformMutex module_cache_lock = PLATFORM_MUTEX_INIT;
+static Vector(CachedModule) module_cache = {0};
+
+/// NUL-separated paths of the modules read from disk.
+static string_buffer loaded_module_paths = {0};
+
+/// Read the interface of a module from an object file.
+static Module *read_module_interface(const char *path) {
+  bool success = false;
+  string object = platform_read_file(path, &success);
+  if (!success) {
+    free(object.data);
+    return NULL;
+  }
+
+  span metadata = grab_section_reference(as_span(object), INTC_MODULE_SECTION_NAME);
+  Module *module = deserialise_module(metadata);
+  free(object.data);
+  return module;
+}
+
+string module_find(span module_name, const string *search_paths, usz search_path_count) {
+#ifdef _WIN32
+  static const char *extensions[] = {".obj", ".o"};
+#else
+  static const char *extensions[] = {".o", ".obj"};
+#endif
+
+  string_buffer path = {0};
+  for (usz i = 0; i < search_path_count; i++) {
+    for (usz j = 0; j < sizeof extensions / sizeof *extensions; j++) {
+      vector_clear(path);
+      // TODO: Only add a separator if the path doesn't already end with one.
+      format_to(&path, "%S/%S%s", search_paths[i], module_name, extensions[j]);
+      string_buf_zterm(&path);
+
+      PlatformFileStamp stamp;
+      if (platform_file_stamp(path.data, &stamp)) return (string){path.data, path.size};
+    }
+  }
+
+  vector_delete(path);
+  return (string){0};
+}
+
+bool module_resolve_imports(
+  Module *module,
+  const string *search_paths,
+  usz search_path_count,
+  ModuleImportCallback callback,
+  void *data
+) {
+  foreach_index (i, module->imports) {
+    Module *import = module->imports.data[i];
+    string path = module_find(as_span(import->module_name), search_paths, search_path_count);
+    Module *loaded = path.data ? module_load_interface(path.data) : NULL;
+    if (!loaded) {
+      issue_diagnostic(
+        DIAG_ERR,
+        module->filename.data,
+        module->source,
+        (loc){0},
+        "Could not find module description for module %S",
+        import->module_name
+      );
+      free(path.data);
+      return false;
+    }
+
+    if (callback) callback(as_span(import->module_name), path.data, data);
+    free(path.data);
+
+    module->imports.data[i] = loaded;
+    loaded->module_name = import->module_name;
+
+    foreach_val (export, loaded->exports) {
+      if (export->kind == NODE_FUNCTION_REFERENCE) {
+        Scope *global_scope = vector_front(module->scope_stack);
+        Symbol *func_sym = scope_find_or_add_symbol(global_scope, SYM_FUNCTION, export->funcref.name, true);
+        /// FIXME: Should probably create function in imported module?
+        func_sym->val.node = ast_make_function(module, (loc){0}, export->type, LINKAGE_IMPORTED, (Nodes){0}, NULL, export->funcref.name);
+        export->funcref.scope = global_scope;
+        export->funcref.resolved = func_sym;
+      }
+    }
+  }
+
+  return true;
+}
+
+Module *module_load_interface(const char *path) {
+  PlatformFileStamp stamp;
+  if (!platform_file_stamp(path, &stamp)) return NULL;
+  string absolute = platform_absolute_path(path);
+  if (!absolute.data) return NULL;
+
+  /// Use the cached interface if the file hasn’t changed.
+  Module *module = NULL;
+  platform_mutex_lock(&module_cache_lock);
+  foreach (cached, module_cache) {
+    if (
+      !cached->taken &&
+      string_eq(cached->path, absolute) &&
+      cached->stamp.size == stamp.size &&
+      cached->stamp.modified == stamp.modified
+    ) {
+      cached->taken = true;
+      module = cached->module;
+      break;
+    }
+  }
+  platform_mutex_unlock(&module_cache_lock);
+
+  if (!module) {
+    module = read_module_interface(path);
+    if (module) {
+      platform_mutex_lock(&module_cache_lock);
+      vector_append(loaded_module_paths, absolute);
+      vector_push(loaded_module_paths, '\0');
+      platform_mutex_unlock(&module_cache_lock);
+    }
+  }
+
+  free(absolute.data);
+  return module;
+}
+
+bool module_cache_add(const char *path) {
+  PlatformFileStamp stamp;
+  if (!platform_file_stamp(path, &stamp)) return false;
+
+  /// Nothing to do if we already have the current version.
+  platform_mutex_lock(&module_cache_lock);
+  CachedModule *cached = vector_find_if(
+    c,
+    module_cache,
+    strcmp(c->path.data, path) == 0
+  );
+  bool current = cached && cached->stamp.size == stamp.size && cached->stamp.modified == stamp.modified;
+  platform_mutex_unlock(&module_cache_lock);
+  if (current) return true;
+
+  Module *module = read_module_interface(path);
+  if (!module) return false;
+
+  /// TODO: Free the old module once deserialised modules can be freed.
+  platform_mutex_lock(&module_cache_lock);
+  cached = vector_find_if(c, module_cache, strcmp(c->path.data, path) == 0);
+  if (!cached) {
+    CachedModule c = {.path = string_create(path)};
+    vector_push(module_cache, c);
+    cached = &vector_back(module_cache);
+  }
+  cached->stamp = stamp;
+  cached->module = module;
+  cached->taken = false;
+  platform_mutex_unlock(&module_cache_lock);
+  return true;
+}
+
+string module_take_loaded_paths(void) {
+  platform_mutex_lock(&module_cache_lock);
+  string paths = {loaded_module_paths.data, loaded_module_paths.size};
+  loaded_module_paths = (string_buffer){0};
+  platform_mutex_unlock(&module_cache_lock);
+  return paths;
+}
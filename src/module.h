@@ -15,6 +15,50 @@ NODISCARD string serialise_module(CodegenContext *context, Module *module);
 
 Module *deserialise_module(span metadata);
 
+/// Find a section in an ELF or COFF object file.
+span grab_section_reference(span object_file, const char *section_name);
+
+/// Find the object file of a module in the given directories, which
+/// are searched in order. The caller is responsible for freeing the
+/// returned string, which is empty if there is no such file.
+NODISCARD string module_find(span module_name, const string *search_paths, usz search_path_count);
+
+/// Called for every module that module_resolve_imports() finds.
+FUNCTION_POINTER(void, ModuleImportCallback, span module_name, const char *path, void *data);
+
+/// Load the interfaces of all modules that `module` imports from
+/// the given directories, and declare what they export.
+///
+/// \param callback If not NULL, called for every module that is found.
+/// \return Whether all modules were found; if not, an error is issued.
+bool module_resolve_imports(
+  Module *module,
+  const string *search_paths,
+  usz search_path_count,
+  ModuleImportCallback callback,
+  void *data
+);
+
+/// Load the interface of a module from the object file at `path`,
+/// reusing the interface in the module cache if the file is unchanged.
+///
+/// \return The module, or NULL if there is no file at `path`.
+Module *module_load_interface(const char *path);
+
+/// Keep the interface of the module in the object file at `path` in
+/// memory, so module_load_interface() can use it. The cache is only
+/// filled explicitly, because each cached interface can only be used
+/// by one compilation; a server fills it, and then forks for every
+/// compilation, so each of them gets its own copy.
+///
+/// \return Whether the module could be read.
+bool module_cache_add(const char *path);
+
+/// Get the absolute paths of all modules that module_load_interface()
+/// had to read from disk since the last call, separated by NULs. The
+/// caller is responsible for freeing the returned string.
+NODISCARD string module_take_loaded_paths(void);
+
 // ModuleDescription { ModuleDeclaration } <anything trailing>
 typedef struct ModuleDescription {
   // See INTC_MODULE_VERSION macro.
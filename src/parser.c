@@ -11,6 +11,12 @@
 #include <utils.h>
 #include <vector.h>
 
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
 // Forward declares.
 typedef struct Parser Parser;
 static Type *parse_type(Parser *p);
@@ -55,8 +61,13 @@ typedef struct Token {
   // Just a simple number.
   u64 integer;
 
-  // Any text; may be an identifier, keyword, etc.
-  string_buffer text;
+  // Any text; may be an identifier, keyword, etc. This points into the
+  // source code, except for text that the lexer synthesises (strings
+  // with escape sequences, escaped tokens, gensyms), which is interned.
+  span text;
+
+  // The interned text of an identifier or the name of a macro argument.
+  atom ident;
 
   // True iff identifier found in `text` was created via escaping.
   bool artificial;
@@ -78,35 +89,110 @@ typedef enum MacroArgumentSelector {
 
 typedef Vector(Token) TokenVector;
 typedef struct Macro {
-  string name;
+  atom name;
   TokenVector parameters;
+
+  // The expansion is resolved when the macro is defined: the `integer`
+  // of a TK_MACRO_ARG token is the index of the argument it refers to,
+  // and that of a TK_GENSYM token the index of its gensym.
   TokenVector expansion;
   loc source_location;
   usz gensym_count;
 } Macro;
-typedef Vector(Macro) MacroVector;
-
-typedef struct NamedToken {
-  span name;
-  Token token;
-} NamedToken;
+typedef Map(atom, Macro) MacroMap;
 
 typedef struct MacroExpansion {
-  // This is an index into the Parser.macros vector where we will find
+  // This is an index into the Parser.macros map where we will find
   // the macro being expanded by this expansion.
   usz macro_index;
 
   // Index into Macro.expansion vector.
   usz expansion_index;
 
-  Vector(NamedToken) bound_arguments;
+  // The arguments of this expansion are stored in Parser.macro_arguments,
+  // starting at this index, in the order of the parameters.
+  usz arguments_start;
+  usz arguments_count;
 
   loc source_location;
 
-  // Index into this vector using TK_GENSYM.integer value.
-  Vector(string) gensyms;
+  // The gensyms of this expansion are numbered starting at this; add
+  // the TK_GENSYM.integer value to get the number of a gensym.
+  usz gensym_base;
 } MacroExpansion;
 
+/// The tokens of a file. The lexer produces all of them before we
+/// start parsing, and the parser then walks them by index. Macros are
+/// only expanded when the parser gets to them since they depend on
+/// what has been parsed so far, so identifiers, `$` and `\` are kept
+/// as they are in the source.
+///
+/// Tokens are stored as a struct of arrays so the parser only touches
+/// what it needs; the text or value of a token, if it has one, is in
+/// a separate table.
+typedef struct TokenStream {
+  /// The type of each token.
+  Vector(u8) types;
+
+  /// Where each token is in the source.
+  Vector(loc) locations;
+
+  /// The index of the name of each identifier and keyword in `atoms`,
+  /// of the text of each string in `strings`, and of the value of each
+  /// number in `integers`. For the EOF token, whether it keeps the
+  /// location of the token before it.
+  Vector(u32) values;
+
+  /// Names, texts, and values of tokens.
+  Vector(atom) atoms;
+  Vector(span) strings;
+  Vector(u64) integers;
+
+  /// If lexing failed, the stream ends with a TK_INVALID token at the
+  /// location of the error, which is reported once the parser gets to it.
+  const char *error;
+} TokenStream;
+
+/// An operator, call, pair of parentheses, block, `if`, or `while`
+/// whose operand is being parsed; see parse_expr_with_precedence().
+typedef struct ExprFrame {
+  enum {
+    EXPR_FRAME_BINARY,
+    EXPR_FRAME_PREFIX,
+    EXPR_FRAME_DEREF,
+    EXPR_FRAME_PAREN,
+    EXPR_FRAME_SUBSCRIPT,
+    EXPR_FRAME_CALL,
+    EXPR_FRAME_BLOCK,
+    EXPR_FRAME_IF_CONDITION,
+    EXPR_FRAME_IF_THEN,
+    EXPR_FRAME_IF_ELSE,
+    EXPR_FRAME_WHILE_CONDITION,
+    EXPR_FRAME_WHILE_BODY,
+  } kind;
+
+  /// The precedence with which the operand is parsed.
+  isz precedence;
+
+  /// The operator of a binary or prefix expression.
+  enum TokenType op;
+
+  /// Where a prefix expression starts, or how many `@`s there are.
+  usz start_or_count;
+
+  /// Where a block, `if`, or `while` starts.
+  loc location;
+
+  /// The LHS of a binary or subscript expression, the callee of a
+  /// call, or the condition of an `if` or `while`. The arguments of
+  /// a call or the children of a block parsed so far.
+  Node *lhs;
+  Nodes args;
+
+  /// The then branch of an `if` whose else branch is being parsed.
+  Node *then;
+} ExprFrame;
+
 typedef struct Parser {
   /// The source code that we’re parsing.
   span source;
@@ -120,16 +206,50 @@ typedef struct Parser {
   /// Lexer state.
   const char *curr;
   const char *end;
-  MacroVector macros;
+
+  /// Scratch buffer for string literals that contain escape sequences.
+  string_buffer escaped;
+
+  /// For lexer errors.
+  jmp_buf lexer_error_buffer;
+
+  /// The tokens of the file, the index of the next token to read, and
+  /// that of the token at which to stop and return EOF instead.
+  TokenStream tokens;
+  usz token_index;
+  usz tokens_end;
+
+  /// Operators whose operands are being parsed; see
+  /// parse_expr_with_precedence().
+  Vector(ExprFrame) expr_stack;
+
+  MacroMap macros;
   Vector(MacroExpansion) macro_expansion_stack;
+  /// Arguments of all expansions on the stack.
+  TokenVector macro_arguments;
+  /// Arguments of macro invocations that are still being parsed.
+  TokenVector pending_macro_arguments;
   // When true, don't expand anything, like macros.
   bool raw_mode;
 
+  /// Whether to defer parsing the bodies of top-level functions.
+  bool lazy_bodies;
+
   usz gensym_counter;
 
   /// Whether we’re in a function.
   bool in_function;
 
+  /// Whether we’re parsing an exported declaration.
+  bool in_export;
+
+  /// Whether we’re parsing a deferred function body. Deferred bodies
+  /// don’t invoke macros, so we don’t look up macros defined after them.
+  bool in_deferred_body;
+
+  /// How many function bodies we’ve deferred parsing.
+  usz deferred_bodies;
+
   /// The current token.
   Token tok;
 
@@ -162,6 +282,35 @@ const struct {
   {literal_span_raw("export"), TK_EXPORT}
 };
 
+/// Get the type of the keyword spelt by some text, or TK_IDENT if
+/// the text isn’t a keyword.
+static enum TokenType keyword_type(span text) {
+  for (size_t i = 0; i < sizeof keywords / sizeof *keywords; i++)
+    if (string_eq(keywords[i].kw, text))
+      return keywords[i].type;
+  return TK_IDENT;
+}
+
+/// Check if a token type is that of a keyword.
+static bool is_keyword(enum TokenType tt) {
+  switch (tt) {
+    case TK_IF:
+    case TK_ELSE:
+    case TK_WHILE:
+    case TK_EXT:
+    case TK_AS:
+    case TK_TYPE:
+    case TK_VOID:
+    case TK_BYTE:
+    case TK_INTEGER_KW:
+    case TK_FOR:
+    case TK_RETURN:
+    case TK_EXPORT:
+      return true;
+    default: return false;
+  }
+}
+
 /// Check if a character may start an identifier.
 static bool isstart(char c) {
   return isalpha(c) || c == '_';
@@ -172,6 +321,126 @@ static bool iscontinue(char c) {
   return isstart(c) || isdigit(c);
 }
 
+/// Lexer errors are only reported once the parser gets to the token
+/// they occur in; see lex().
+#define LEX_ERR(message) lex_error(p, message)
+static NORETURN void lex_error(Parser *p, const char *message) {
+  p->tokens.error = message;
+  longjmp(p->lexer_error_buffer, 1);
+}
+
+/// ===========================================================================
+///  Lexer fast paths.
+/// ===========================================================================
+/// Runs of characters that the lexer can skip over in bulk. Every run
+/// stops at null bytes and at characters that next_char() would change
+/// (i.e. CR and LF, except in whitespace where it doesn't matter), so
+/// skipping a run and then calling next_char() is the same as calling
+/// next_char() once for each character in it.
+typedef enum LexRun {
+  LEX_RUN_SPACE,     ///< Whitespace.
+  LEX_RUN_DIGITS,    ///< Decimal digits.
+  LEX_RUN_IDENT,     ///< Characters that may be part of an identifier.
+  LEX_RUN_COMMENT,   ///< Anything up to the end of the line.
+  LEX_RUN_SQ_STRING, ///< Anything up to `'` or the end of the line.
+  LEX_RUN_DQ_STRING, ///< Anything up to `"`, `\`, or the end of the line.
+} LexRun;
+
+/// Check if a character belongs to a run.
+static FORCEINLINE bool lex_run_contains(char c, LexRun run) {
+  switch (run) {
+    case LEX_RUN_SPACE: return c == ' ' || (c >= '\t' && c <= '\r');
+    case LEX_RUN_DIGITS: return c >= '0' && c <= '9';
+    case LEX_RUN_IDENT: return iscontinue(c);
+    case LEX_RUN_COMMENT: return c != '\n' && c != '\r' && c != 0;
+    case LEX_RUN_SQ_STRING: return c != '\'' && c != '\n' && c != '\r' && c != 0;
+    case LEX_RUN_DQ_STRING: return c != '"' && c != '\\' && c != '\n' && c != '\r' && c != 0;
+  }
+  UNREACHABLE();
+}
+
+/// Classify a whole block of characters at once if the target supports
+/// it; AVX2 gets 32 characters at a time, SSE2 16. Characters outside
+/// of ASCII are negative as signed bytes, which keeps them out of the
+/// ranges below.
+#if defined(__AVX2__)
+#  define LEX_BLOCK_SIZE 32
+#  define LEX_BLOCK_ALL ((u32) 0xFFFFFFFF)
+typedef __m256i LexBlock;
+#  define lex_load(ptr) _mm256_loadu_si256((const __m256i *) (ptr))
+#  define lex_splat(c) _mm256_set1_epi8((char) (c))
+#  define lex_eq(a, b) _mm256_cmpeq_epi8((a), (b))
+#  define lex_gt(a, b) _mm256_cmpgt_epi8((a), (b))
+#  define lex_or(a, b) _mm256_or_si256((a), (b))
+#  define lex_and(a, b) _mm256_and_si256((a), (b))
+#  define lex_mask(v) ((u32) _mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+#  define LEX_BLOCK_SIZE 16
+#  define LEX_BLOCK_ALL ((u32) 0xFFFF)
+typedef __m128i LexBlock;
+#  define lex_load(ptr) _mm_loadu_si128((const __m128i *) (ptr))
+#  define lex_splat(c) _mm_set1_epi8((char) (c))
+#  define lex_eq(a, b) _mm_cmpeq_epi8((a), (b))
+#  define lex_gt(a, b) _mm_cmpgt_epi8((a), (b))
+#  define lex_or(a, b) _mm_or_si128((a), (b))
+#  define lex_and(a, b) _mm_and_si128((a), (b))
+#  define lex_mask(v) ((u32) _mm_movemask_epi8(v))
+#endif
+
+#ifdef LEX_BLOCK_SIZE
+/// Check if each character in a block is in the range [lo, hi].
+#  define lex_in_range(b, lo, hi) lex_and(lex_gt((b), lex_splat((lo) - 1)), lex_gt(lex_splat((hi) + 1), (b)))
+
+/// Get a mask of the characters in a block that belong to a run.
+static FORCEINLINE u32 lex_block_contains(LexBlock b, LexRun run) {
+  LexBlock nul = lex_eq(b, lex_splat(0));
+  LexBlock eol = lex_or(lex_eq(b, lex_splat('\n')), lex_eq(b, lex_splat('\r')));
+  switch (run) {
+    case LEX_RUN_SPACE: return lex_mask(lex_or(lex_eq(b, lex_splat(' ')), lex_in_range(b, '\t', '\r')));
+    case LEX_RUN_DIGITS: return lex_mask(lex_in_range(b, '0', '9'));
+    case LEX_RUN_IDENT: {
+      /// Setting bit 5 maps upper case letters to lower case ones, and
+      /// nothing else to a lower case letter.
+      LexBlock lower = lex_or(b, lex_splat(0x20));
+      LexBlock alpha = lex_in_range(lower, 'a', 'z');
+      LexBlock digit = lex_in_range(b, '0', '9');
+      return lex_mask(lex_or(lex_or(alpha, digit), lex_eq(b, lex_splat('_'))));
+    }
+    case LEX_RUN_COMMENT: return ~lex_mask(lex_or(nul, eol)) & LEX_BLOCK_ALL;
+    case LEX_RUN_SQ_STRING: {
+      LexBlock stop = lex_or(lex_or(nul, eol), lex_eq(b, lex_splat('\'')));
+      return ~lex_mask(stop) & LEX_BLOCK_ALL;
+    }
+    case LEX_RUN_DQ_STRING: {
+      LexBlock delim = lex_or(lex_eq(b, lex_splat('"')), lex_eq(b, lex_splat('\\')));
+      LexBlock stop = lex_or(lex_or(nul, eol), delim);
+      return ~lex_mask(stop) & LEX_BLOCK_ALL;
+    }
+  }
+  UNREACHABLE();
+}
+#endif
+
+/// Find the first character at or after `curr` that does not belong
+/// to a run. Blocks are only loaded if they end before `end` since
+/// the source may end right before an unmapped page.
+static FORCEINLINE const char *lex_skip_run(const char *curr, const char *end, LexRun run) {
+#ifdef LEX_BLOCK_SIZE
+  while (end - curr >= LEX_BLOCK_SIZE) {
+    u32 outside = ~lex_block_contains(lex_load(curr), run) & LEX_BLOCK_ALL;
+    if (outside) return curr + __builtin_ctz(outside);
+    curr += LEX_BLOCK_SIZE;
+  }
+#endif
+  while (curr < end && lex_run_contains(*curr, run)) curr++;
+  return curr;
+}
+
+/// Skip the rest of a run that Parser.lastc is part of.
+static void skip_run(Parser *p, LexRun run) {
+  p->curr = lex_skip_run(p->curr, p->end, run);
+}
+
 /// Lex the next character.
 static void next_char(Parser *p) {
   /// Keep returning EOF once EOF has been reached.
@@ -182,7 +451,7 @@ static void next_char(Parser *p) {
 
   /// Read the next character.
   p->lastc = *p->curr++;
-  if (p->lastc == 0) ERR("Lexer can not handle null bytes");
+  if (p->lastc == 0) LEX_ERR("Lexer can not handle null bytes");
 
   /// Collapse CRLF and LFCR to a single newline,
   /// but keep CRCR and LFLF as two newlines.
@@ -210,30 +479,39 @@ static void next_char(Parser *p) {
 static void next_identifier(Parser *p) {
   p->tok.type = TK_IDENT;
 
-  /// The start of the identifier.
-  vector_clear(p->tok.text);
-  vector_push(p->tok.text, p->lastc);
+  /// The start of the identifier. Identifiers never contain newlines,
+  /// so each character we read is exactly one character of the source.
+  const char *start = p->curr - 1;
+  skip_run(p, LEX_RUN_IDENT);
+  p->tok.text = (span){start, (usz) (p->curr - start)};
   next_char(p);
 
-  /// Read the rest of the identifier.
-  while (iscontinue(p->lastc)) {
-    vector_push(p->tok.text, p->lastc);
-    next_char(p);
-  }
+  p->tok.ident = atom_intern(p->tok.text);
+}
+
+/// Append the characters of a run in a string literal to the
+/// escaped text of the string.
+static void append_run(Parser *p, LexRun run) {
+  const char *start = p->curr;
+  skip_run(p, run);
+  vector_append(p->escaped, ((span){start, (usz) (p->curr - start)}));
 }
 
 /// Lex a string.
 static void next_string(Parser *p) {
   /// Yeet the delimiter and clear the string.
   char delim = p->lastc;
-  vector_clear(p->tok.text);
+  const char *start = p->curr;
+  bool verbatim = true;
+  vector_clear(p->escaped);
   next_char(p);
 
   /// Single-quoted strings are not escaped.
   if (delim == '\'') {
     while (p->lastc != delim) {
-      if (p->lastc == 0) ERR("Unterminated string literal");
-      vector_push(p->tok.text, p->lastc);
+      if (p->lastc == 0) LEX_ERR("Unterminated string literal");
+      vector_push(p->escaped, p->lastc);
+      append_run(p, LEX_RUN_SQ_STRING);
       next_char(p);
     }
   }
@@ -242,58 +520,73 @@ static void next_string(Parser *p) {
   else {
     ASSERT(delim == '"');
     while (p->lastc != delim) {
-      if (p->lastc == 0) ERR("Unterminated string literal");
+      if (p->lastc == 0) LEX_ERR("Unterminated string literal");
 
       /// Handle escape sequences.
       if (p->lastc == '\\') {
+        verbatim = false;
         next_char(p);
         switch (p->lastc) {
-          case 'n': vector_push(p->tok.text, '\n'); break;
-          case 'r': vector_push(p->tok.text, '\r'); break;
-          case 't': vector_push(p->tok.text, '\t'); break;
-          case 'f': vector_push(p->tok.text, '\f'); break;
-          case 'v': vector_push(p->tok.text, '\v'); break;
-          case 'a': vector_push(p->tok.text, '\a'); break;
-          case 'b': vector_push(p->tok.text, '\b'); break;
-          case 'e': vector_push(p->tok.text, '\033'); break;
-          case '0': vector_push(p->tok.text, '\0'); break;
-          case '\'': vector_push(p->tok.text, '\''); break;
-          case '\"': vector_push(p->tok.text, '\"'); break;
-          case '\\': vector_push(p->tok.text, '\\'); break;
-          default: ERR("Invalid escape sequence");
+          case 'n': vector_push(p->escaped, '\n'); break;
+          case 'r': vector_push(p->escaped, '\r'); break;
+          case 't': vector_push(p->escaped, '\t'); break;
+          case 'f': vector_push(p->escaped, '\f'); break;
+          case 'v': vector_push(p->escaped, '\v'); break;
+          case 'a': vector_push(p->escaped, '\a'); break;
+          case 'b': vector_push(p->escaped, '\b'); break;
+          case 'e': vector_push(p->escaped, '\033'); break;
+          case '0': vector_push(p->escaped, '\0'); break;
+          case '\'': vector_push(p->escaped, '\''); break;
+          case '\"': vector_push(p->escaped, '\"'); break;
+          case '\\': vector_push(p->escaped, '\\'); break;
+          default: LEX_ERR("Invalid escape sequence");
         }
       }
 
       /// Just append the character if it’s not an escape sequence.
-      else { vector_push(p->tok.text, p->lastc); }
+      else { vector_push(p->escaped, p->lastc); }
+      append_run(p, LEX_RUN_DQ_STRING);
       next_char(p);
     }
   }
 
   /// Make sure the string is terminated by the delimiter.
-  if (p->lastc != delim) ERR("Unterminated string literal");
+  if (p->lastc != delim) LEX_ERR("Unterminated string literal");
   p->tok.type = TK_STRING;
+
+  /// Unless the string contains escape sequences or line endings that
+  /// were normalised, its text is exactly what is in the source.
+  span raw = {start, (usz) (p->curr - 1 - start)};
+  if (verbatim && !memchr(raw.data, '\r', raw.size)) p->tok.text = raw;
+  else p->tok.text = as_span(atom_intern(as_span(p->escaped)));
   next_char(p);
 }
 
-/// Parse a number.
-static void parse_number(Parser *p, int base) {
-  /// Zero-terminate the string or else `strtoull()` might try
-  /// to convert data left over from the previous token.
-  string_buf_zterm(&p->tok.text);
-
-  /// Convert the number.
-  char *end;
-  errno = 0;
-  p->tok.integer = (u64) strtoull(p->tok.text.data, &end, base);
-  if (errno == ERANGE) ERR("Integer literal too large");
-  if (end != p->tok.text.data + p->tok.text.size) ERR("Invalid integer literal");
+/// Convert the leading digits of a string to a number.
+///
+/// \return The number of digits, or -1 if the number doesn’t fit in a u64.
+static isz convert_digits(span text, unsigned base, u64 *value) {
+  usz i = 0;
+  for (*value = 0; i < text.size; i++) {
+    unsigned char c = (unsigned char) text.data[i];
+    unsigned digit = isdigit(c) ? (unsigned) (c - '0') : (unsigned) (tolower(c) - 'a' + 10);
+    if (digit >= base) break;
+    if (*value > (UINT64_MAX - digit) / base) return -1;
+    *value = *value * base + digit;
+  }
+  return (isz) i;
+}
+
+/// Parse a number. The lexer has already checked that the
+/// text of the token only contains digits in the given base.
+static void parse_number(Parser *p, unsigned base) {
+  if (convert_digits(p->tok.text, base, &p->tok.integer) < 0) LEX_ERR("Integer literal too large");
 }
 
 /// Lex a number.
 static void next_number(Parser *p) {
   /// Record the start of the number.
-  vector_clear(p->tok.text);
+  p->tok.text = (span){0};
   p->tok.integer = 0;
   p->tok.type = TK_NUMBER;
 
@@ -303,7 +596,7 @@ static void next_number(Parser *p) {
     next_char(p);
 
     /// Another zero is an error.
-    if (p->lastc == '0') ERR("Leading zeroes are not allowed in decimal literals. Use 0o/0O for octal literals.");
+    if (p->lastc == '0') LEX_ERR("Leading zeroes are not allowed in decimal literals. Use 0o/0O for octal literals.");
 
 #define DO_PARSE_NUMBER(name, chars, condition, base)                       \
   /** Read all chars that are part of the literal. **/                      \
@@ -312,14 +605,16 @@ static void next_number(Parser *p) {
     next_char(p);                                                           \
                                                                             \
     /** Lex the digits. **/                                                 \
+    p->tok.text.data = p->curr - 1;                                         \
     while (condition) {                                                     \
-      vector_push(p->tok.text, p->lastc);                                   \
+      p->tok.text.size++;                                                   \
       next_char(p);                                                         \
     }                                                                       \
                                                                             \
     /** We need at least one digit. **/                                     \
     p->tok.source_location.end = (u32) ((p->curr - 1) - p->source.data);    \
-    if (p->tok.text.size == 0) ERR("Expected at least one " name " digit"); \
+    if (p->tok.text.size == 0)                                                  \
+      LEX_ERR("Expected at least one " name " digit");                          \
                                                                             \
     /** Actually parse the number. **/                                      \
     return parse_number(p, base);                                           \
@@ -335,163 +630,529 @@ static void next_number(Parser *p) {
     if (isspace(p->lastc) || !isalpha(p->lastc)) return;
 
     /// Anything else is an error.
-    ERR("Invalid integer literal");
+    LEX_ERR("Invalid integer literal");
   }
 
   /// Any other digit means we have a decimal number.
   if (isdigit(p->lastc)) {
-    do {
-      vector_push(p->tok.text, p->lastc);
-      next_char(p);
-    } while (isdigit(p->lastc));
+    p->tok.text.data = p->curr - 1;
+    skip_run(p, LEX_RUN_DIGITS);
+    p->tok.text.size = (usz) (p->curr - p->tok.text.data);
+    next_char(p);
     return parse_number(p, 10);
   }
 
   /// Anything else is an error.
-  ERR("Invalid integer literal");
+  LEX_ERR("Invalid integer literal");
 }
 
-static bool token_has_string(enum TokenType tt) {
-  return tt == TK_MACRO_ARG || tt == TK_IDENT || tt == TK_STRING;
-}
+/// Lex the next token of the file.
+static void lex_token(Parser *p) {
+  /// Keep returning EOF once EOF has been reached.
+  if (!p->lastc) {
+    p->tok.type = TK_EOF;
+    return;
+  }
 
-static bool token_has_integer(enum TokenType tt) {
-  return tt == TK_ARBITRARY_INT || tt == TK_NUMBER || tt == TK_MACRO_ARG;
-}
+  /// Set the token to invalid in case there is an error.
+  p->tok.type = TK_INVALID;
 
-static Token copy_token(Token token) {
-  Token new_tok = token;
+  /// Skip whitespace.
+  if (isspace(p->lastc)) {
+    skip_run(p, LEX_RUN_SPACE);
+    next_char(p);
+  }
 
-  if (token_has_string(new_tok.type)) {
-    // This horribleness is because we don't have a way to duplicate
-    // string_buffer!
-    string new_string = string_dup(new_tok.text);
-    new_tok.text.data = new_string.data;
-    new_tok.text.size = new_string.size;
-    new_tok.text.capacity = new_tok.text.size;
-  } else new_tok.text = (string_buffer){0};
+  /// Start of the token.
+  p->tok.source_location.start = (u32) (p->curr - p->source.data - 1);
 
-  return new_tok;
-}
+  /// Lex the token.
+  switch (p->lastc) {
+    /// EOF.
+    case 0:
+      p->tok.type = TK_EOF;
+      break;
 
-static string gensym(usz number) {
-  return format("_G_xX_%Z_Xx_G_", number);
-}
+    /// Escapes are handled by the parser.
+    case '\\':
+      p->tok.type = TK_BACKSLASH;
+      next_char(p);
+      break;
 
-static void next_token(Parser *p);
-static void next_macro(Parser *p) {
-  // At this point, the parser state is at the "macro" keyword.
-  p->raw_mode = true;
+    /// `$` starts an identifier or, in raw mode, the name of a macro
+    /// argument; the parser decides which.
+    case '$':
+      next_identifier(p);
+      break;
 
-  // Yeet "macro"
-  next_token(p);
+    case '(':
+      p->tok.type = TK_LPAREN;
+      next_char(p);
+      break;
 
-  // Parse identifier (name of macro)
-  if (p->tok.type != TK_IDENT)
-    ERR("Expected identifier following macro keyword");
+    case ')':
+      p->tok.type = TK_RPAREN;
+      next_char(p);
+      break;
 
-  Macro out = {0};
-  out.source_location = p->tok.source_location;
-  out.name = string_dup(p->tok.text);
+    case '[':
+      p->tok.type = TK_LBRACK;
+      next_char(p);
+      break;
 
-  // Yeet name of macro
-  next_token(p);
+    case ']':
+      p->tok.type = TK_RBRACK;
+      next_char(p);
+      break;
 
-  // Parse token list
-  while (!(p->tok.type == TK_IDENT && !p->tok.artificial && (string_eq(p->tok.text, literal_span("emits")) || string_eq(p->tok.text, literal_span("defines"))))) {
-    if (p->tok.type == TK_EOF)
-      ERR_AT(out.source_location, "Reached EOF when lexing argument tokens of macro");
+    case '{':
+      p->tok.type = TK_LBRACE;
+      next_char(p);
+      break;
 
-    // Ensure macro arg doesn't exist in parameter list
-    if (p->tok.type == TK_MACRO_ARG) {
-      Token *found = vector_find_if(
-        el,
-        out.parameters,
-        el->type == TK_MACRO_ARG && string_eq(el->text, p->tok.text)
-      );
+    case '}':
+      p->tok.type = TK_RBRACE;
+      next_char(p);
+      break;
 
-      if (found) ERR("Duplicate macro argument identifier! Pick another name.");
-    }
+    case ',':
+      p->tok.type = TK_COMMA;
+      next_char(p);
+      break;
 
-    // Push deep-copied token into parameters.
-    Token new_tok = copy_token(p->tok);
-    vector_push(out.parameters, new_tok);
+    case '@':
+      p->tok.type = TK_AT;
+      next_char(p);
+      break;
 
-    next_token(p);
-  }
+    case ':':
+      next_char(p);
+      if (p->lastc == '=') {
+        p->tok.type = TK_COLON_EQ;
+        next_char(p);
+      } else if (p->lastc == ':') {
+        p->tok.type = TK_COLON_COLON;
+        next_char(p);
+      } else if (p->lastc == '>') {
+        p->tok.type = TK_COLON_GT;
+        next_char(p);
+      } else {
+        p->tok.type = TK_COLON;
+      }
+      break;
 
-  // If we hit a "defines" contextual keyword, then we need to parse a
-  // list of definitions and keep track of them for proper handling during
-  // lexing of the expansion tokens.
-  Vector(string) gensym_definitions = {0};
-  if (string_eq(p->tok.text, literal_span("defines"))) {
-    // Skip "defines"
-    next_token(p);
-    while (!(p->tok.type == TK_IDENT && !p->tok.artificial && string_eq(p->tok.text, literal_span("emits")))) {
-      if (p->tok.type == TK_EOF)
-        ERR_AT(out.source_location, "Reached EOF when lexing gensym definitions of macro");
+    case ';':
+      // Yeet ';'
+      next_char(p);
+      // Line comments begin with `;;`
+      if (p->lastc == ';') {
+        skip_run(p, LEX_RUN_COMMENT);
+        next_char(p);
+        return lex_token(p);
+      }
+      p->tok.type = TK_SEMICOLON;
+      break;
 
-      if (p->tok.type != TK_IDENT)
-        ERR("Expected identifier within macro's \"defines\" list");
+    case '#':
+      next_char(p);
+      p->tok.type = TK_HASH;
+      break;
 
-      if (vector_find_if(dup, gensym_definitions, string_eq(p->tok.text, *dup)))
-        ERR("Duplicate identifier in gensym definitions of macro");
+    case '.':
+      next_char(p);
+      p->tok.type = TK_DOT;
+      break;
 
-      vector_push(gensym_definitions, string_dup(p->tok.text));
+    case '+':
+      next_char(p);
+      p->tok.type = TK_PLUS;
+      break;
 
-      next_token(p);
+    case '-':
+      next_char(p);
+      if (isdigit(p->lastc)) {
+        next_number(p);
+        p->tok.integer = -p->tok.integer;
 
-      // Eat commas in-between definitions.
-      if (p->tok.type == TK_COMMA) next_token(p);
-    }
-  }
+        /// The character after a number must be a whitespace or delimiter.
+        if (isalpha(p->lastc)) LEX_ERR("Invalid integer literal");
+      } else {
+        p->tok.type = TK_MINUS;
+      }
+      break;
 
-  // Skip "emits"
-  next_token(p);
+    case '*':
+      next_char(p);
+      p->tok.type = TK_STAR;
+      break;
 
-  // Parse output token list
-  while (!(p->tok.type == TK_IDENT && !p->tok.artificial && string_eq(p->tok.text, literal_span("endmacro")))) {
-    if (p->tok.type == TK_EOF)
-      ERR_AT(out.source_location, "Reached EOF when lexing expansion tokens of macro; expected \"endmacro\" keyword.");
+    case '/':
+      next_char(p);
+      p->tok.type = TK_SLASH;
+      break;
 
-    if (p->tok.type == TK_MACRO_ARG) {
-      // Ensure macro arg exists in parameter list
-      Token *found = vector_find_if(
-        t,
-        out.parameters,
-        t->type == TK_MACRO_ARG && string_eq(t->text, p->tok.text)
-      );
+    case '%':
+      next_char(p);
+      p->tok.type = TK_PERCENT;
+      break;
 
-      if (!found) ERR("Macro argument identifier does not refer to a bound macro argument! Maybe a typo?");
-    } else if (p->tok.type == TK_IDENT && gensym_definitions.size) {
-      // If the token in the expansion list is an identifier and there
-      // are gensym definitions for this macro, we need to replace the
-      // uses of the gensym'd identifier with a gensym token, which the
-      // parser will replace with a generated identifier.
-      foreach_index (i, gensym_definitions) {
-        string *def = gensym_definitions.data + i;
-        if (string_eq(*def, p->tok.text)) {
-          p->tok.type = TK_GENSYM;
-          p->tok.integer = i;
-          break;
-        }
-      }
-    }
+    case '&':
+      next_char(p);
+      p->tok.type = TK_AMPERSAND;
+      break;
 
-    // Push deep-copied token into parameters.
-    Token new_tok = copy_token(p->tok);
-    vector_push(out.expansion, new_tok);
+    case '|':
+      next_char(p);
+      p->tok.type = TK_PIPE;
+      break;
 
+    case '^':
+      next_char(p);
+      p->tok.type = TK_CARET;
+      break;
+
+    case '~':
+      next_char(p);
+      p->tok.type = TK_TILDE;
+      break;
+
+    case '!':
+      next_char(p);
+      if (p->lastc == '=') {
+        p->tok.type = TK_NE;
+        next_char(p);
+      } else {
+        p->tok.type = TK_EXCLAM;
+      }
+      break;
+
+    case '=':
+      next_char(p);
+      p->tok.type = TK_EQ;
+      break;
+
+    case '<':
+      next_char(p);
+      if (p->lastc == '=') {
+        p->tok.type = TK_LE;
+        next_char(p);
+      } else if (p->lastc == '<') {
+        p->tok.type = TK_SHL;
+        next_char(p);
+      } else {
+        p->tok.type = TK_LT;
+      }
+      break;
+
+    case '>':
+      next_char(p);
+      if (p->lastc == '=') {
+        p->tok.type = TK_GE;
+        next_char(p);
+      } else if (p->lastc == '>') {
+        p->tok.type = TK_SHR;
+        next_char(p);
+      } else {
+        p->tok.type = TK_GT;
+      }
+      break;
+
+    // String.
+    case '"':
+    case '\'':
+      next_string(p);
+      break;
+
+    /// Number or identifier.
+    default:
+      /// Identifier.
+      if (isstart(p->lastc)) {
+        next_identifier(p);
+        break;
+      }
+
+      /// Number.
+      if (isdigit(p->lastc)) {
+        next_number(p);
+
+        /// The character after a number must be a whitespace or delimiter.
+        if (isalpha(p->lastc)) LEX_ERR("Invalid integer literal");
+        break;
+      }
+
+      /// Anything else is invalid.
+      LEX_ERR("Invalid token");
+  }
+
+  /// Set the end of the token. next_char() doesn’t advance past the
+  /// end of the file, so a token that ends there includes `curr - 1`.
+  p->tok.source_location.end = (u32) (p->curr - p->source.data - (p->lastc != 0));
+}
+
+/// Get a location on the last line of the file that isn’t blank, for
+/// diagnostics at the end of the file that have no token to point at.
+static loc last_line_location(Parser *p) {
+  u32 end = (u32) p->source.size;
+  while (end && isspace(p->source.data[end - 1])) end--;
+  if (!end) return (loc){0};
+  return (loc){end - 1, end};
+}
+
+/// Add the current token to the token stream.
+static void push_token(Parser *p, u32 value) {
+  vector_push(p->tokens.types, (u8) p->tok.type);
+  vector_push(p->tokens.locations, p->tok.source_location);
+  vector_push(p->tokens.values, value);
+}
+
+/// Lex the entire file into the token stream, which always ends with
+/// an EOF token. If there is an error, it is preceded by a TK_INVALID
+/// token at the location of the error.
+static void lex(Parser *p) {
+  TokenStream *s = &p->tokens;
+  if (setjmp(p->lexer_error_buffer)) {
+    /// The error is at what we’ve lexed of the current token, up
+    /// to the end of the line it starts on.
+    loc *l = &p->tok.source_location;
+    u32 pos = (u32) (p->curr - p->source.data);
+    for (l->end = l->start; l->end < pos && p->source.data[l->end] != '\n'; l->end++);
+    if (l->start == l->end) *l = last_line_location(p);
+    p->tok.type = TK_INVALID;
+    push_token(p, 0);
+    p->tok.type = TK_EOF;
+    push_token(p, true);
+    p->tokens_end = s->types.size - 1;
+    return;
+  }
+
+  vector_reserve(s->types, p->source.size / 4);
+  vector_reserve(s->locations, p->source.size / 4);
+  vector_reserve(s->values, p->source.size / 4);
+  vector_reserve(s->atoms, p->source.size / 64);
+  struct {
+    const char *data;
+    u32 index;
+    enum TokenType type;
+  } recent[1024] = {0};
+  next_char(p);
+  do {
+    /// If the last token ended at the end of the file, the
+    /// EOF token has the same location as it.
+    u32 value = !p->lastc;
+    lex_token(p);
+    switch (p->tok.type) {
+      default: break;
+      case TK_IDENT: {
+        /// Most identifiers occur many times, so remember where we put
+        /// the ones we’ve seen recently and what keyword they are, if
+        /// any, rather than adding and classifying them again.
+        usz slot = ((uintptr_t) p->tok.ident.data >> 3) % (sizeof recent / sizeof *recent);
+        if (recent[slot].data == p->tok.ident.data) {
+          value = recent[slot].index;
+          p->tok.type = recent[slot].type;
+        } else {
+          value = (u32) s->atoms.size;
+          vector_push(s->atoms, p->tok.ident);
+          p->tok.type = keyword_type(p->tok.text);
+          recent[slot].data = p->tok.ident.data;
+          recent[slot].index = value;
+          recent[slot].type = p->tok.type;
+        }
+      } break;
+      case TK_STRING:
+        value = (u32) s->strings.size;
+        vector_push(s->strings, p->tok.text);
+        break;
+      case TK_NUMBER:
+        value = (u32) s->integers.size;
+        vector_push(s->integers, p->tok.integer);
+        break;
+    }
+    push_token(p, value);
+  } while (p->tok.type != TK_EOF);
+  p->tokens_end = s->types.size - 1;
+
+  /// Point diagnostics at the end of the file at the last token rather
+  /// than past the end of the last line.
+  if (!vector_back(s->values)) {
+    vector_back(s->locations) = s->types.size > 1
+      ? s->locations.data[s->types.size - 2]
+      : last_line_location(p);
+  }
+}
+
+/// Read the next token of the token stream.
+static void read_token(Parser *p) {
+  TokenStream *s = &p->tokens;
+  usz i = p->token_index;
+
+  /// Keep returning EOF once EOF has been reached; this leaves
+  /// everything but the location of the last token as it is.
+  if (i == p->tokens_end) {
+    p->tok.type = TK_EOF;
+    p->tok.artificial = false;
+    if (s->types.data[i] == TK_EOF && !s->values.data[i])
+      p->tok.source_location = s->locations.data[i];
+    return;
+  }
+
+  p->token_index++;
+  p->tok = (Token){
+    .type = (enum TokenType) s->types.data[i],
+    .source_location = s->locations.data[i],
+  };
+
+  switch (p->tok.type) {
+    default:
+      if (!is_keyword(p->tok.type)) break;
+      FALLTHROUGH;
+    case TK_IDENT:
+      p->tok.ident = s->atoms.data[s->values.data[i]];
+      p->tok.text = as_span(p->tok.ident);
+      break;
+    case TK_STRING:
+      p->tok.text = s->strings.data[s->values.data[i]];
+      break;
+    case TK_NUMBER:
+      p->tok.integer = s->integers.data[s->values.data[i]];
+      break;
+  }
+}
+
+static bool token_has_string(enum TokenType tt) {
+  return tt == TK_MACRO_ARG || tt == TK_IDENT || tt == TK_STRING;
+}
+
+static bool token_has_integer(enum TokenType tt) {
+  return tt == TK_ARBITRARY_INT || tt == TK_NUMBER || tt == TK_MACRO_ARG;
+}
+
+/// Get the name of a gensym. This is kept out of line since the parser
+/// recurses through the callers of this and the buffer is large.
+static NOINLINE atom gensym(usz number) {
+  char name[64];
+  int size = snprintf(name, sizeof name, "_G_xX_%zu_Xx_G_", (size_t) number);
+  return atom_intern((span){name, (usz) size});
+}
+
+static void next_token(Parser *p);
+static void next_macro(Parser *p) {
+  // At this point, the parser state is at the "macro" keyword.
+  p->raw_mode = true;
+
+  // Yeet "macro"
+  next_token(p);
+
+  // Parse identifier (name of macro)
+  if (p->tok.type != TK_IDENT)
+    ERR("Expected identifier following macro keyword");
+
+  Macro out = {0};
+  out.source_location = p->tok.source_location;
+  out.name = p->tok.ident;
+
+  // Yeet name of macro
+  next_token(p);
+
+  // Parse token list
+  while (!(p->tok.type == TK_IDENT && !p->tok.artificial && (string_eq(p->tok.text, literal_span("emits")) || string_eq(p->tok.text, literal_span("defines"))))) {
+    if (p->tok.type == TK_EOF)
+      ERR_AT(out.source_location, "Reached EOF when lexing argument tokens of macro");
+
+    // Ensure macro arg doesn't exist in parameter list
+    if (p->tok.type == TK_MACRO_ARG) {
+      Token *found = vector_find_if(
+        el,
+        out.parameters,
+        el->type == TK_MACRO_ARG && atom_eq(el->ident, p->tok.ident)
+      );
+
+      if (found) ERR("Duplicate macro argument identifier! Pick another name.");
+    }
+
+    // Push token into parameters. Its text, if any, outlives the macro.
+    vector_push(out.parameters, p->tok);
+
+    next_token(p);
+  }
+
+  // If we hit a "defines" contextual keyword, then we need to parse a
+  // list of definitions and keep track of them for proper handling during
+  // lexing of the expansion tokens.
+  Vector(atom) gensym_definitions = {0};
+  if (string_eq(p->tok.text, literal_span("defines"))) {
+    // Skip "defines"
     next_token(p);
+    while (!(p->tok.type == TK_IDENT && !p->tok.artificial && string_eq(p->tok.text, literal_span("emits")))) {
+      if (p->tok.type == TK_EOF)
+        ERR_AT(out.source_location, "Reached EOF when lexing gensym definitions of macro");
+
+      if (p->tok.type != TK_IDENT)
+        ERR("Expected identifier within macro's \"defines\" list");
+
+      if (vector_find_if(dup, gensym_definitions, atom_eq(p->tok.ident, *dup)))
+        ERR("Duplicate identifier in gensym definitions of macro");
+
+      vector_push(gensym_definitions, p->tok.ident);
+
+      next_token(p);
+
+      // Eat commas in-between definitions.
+      if (p->tok.type == TK_COMMA) next_token(p);
+    }
   }
 
-  if (vector_find_if(m, p->macros, string_eq(m->name, out.name)))
+  // Skip "emits"
+  next_token(p);
+
+  // Parse output token list
+  while (!(p->tok.type == TK_IDENT && !p->tok.artificial && string_eq(p->tok.text, literal_span("endmacro")))) {
+    if (p->tok.type == TK_EOF)
+      ERR_AT(out.source_location, "Reached EOF when lexing expansion tokens of macro; expected \"endmacro\" keyword.");
+
+    if (p->tok.type == TK_MACRO_ARG) {
+      // Ensure macro arg exists in parameter list, and record which
+      // argument it refers to.
+      bool found = false;
+      usz argument_index = 0;
+      foreach (t, out.parameters) {
+        if (t->type != TK_MACRO_ARG) continue;
+        if (atom_eq(t->ident, p->tok.ident)) {
+          found = true;
+          break;
+        }
+        argument_index++;
+      }
+
+      if (!found) ERR("Macro argument identifier does not refer to a bound macro argument! Maybe a typo?");
+      p->tok.integer = argument_index;
+    } else if (p->tok.type == TK_IDENT && gensym_definitions.size) {
+      // If the token in the expansion list is an identifier and there
+      // are gensym definitions for this macro, we need to replace the
+      // uses of the gensym'd identifier with a gensym token, which the
+      // parser will replace with a generated identifier.
+      foreach_index (i, gensym_definitions) {
+        if (atom_eq(gensym_definitions.data[i], p->tok.ident)) {
+          p->tok.type = TK_GENSYM;
+          p->tok.integer = i;
+          break;
+        }
+      }
+    }
+
+    // Push token into expansion.
+    vector_push(out.expansion, p->tok);
+
+    next_token(p);
+  }
+
+  if (map_get(p->macros, out.name))
     ERR("Redefinition of macro %S", out.name);
 
   out.gensym_count = gensym_definitions.size;
   vector_delete(gensym_definitions);
 
-  vector_push(p->macros, out);
+  map_set(p->macros, out.name, out);
 
   // Skip "endmacro"
   p->raw_mode = false;
@@ -509,9 +1170,17 @@ static bool token_equals(Token *A, Token *B) {
 static void expand_macro(Parser *p, Macro *m) {
   // Found macro invocation, do expansion things!
   MacroExpansion expansion = {0};
-  expansion.macro_index = (usz)(m - p->macros.data);
+  // The macro is the value of an entry in the map; dividing rounds its
+  // offset down to the start of that entry.
+  expansion.macro_index = (usz) ((char *) m - (char *) p->macros.data) / sizeof *p->macros.data;
   expansion.source_location.start = p->tok.source_location.start;
 
+  // Parsing an argument may expand other macros, so we can only add
+  // the arguments to the stack once we’re done with all of them. Any
+  // invocation in an argument is done with its own arguments before
+  // we get to ours, so pending arguments are added and removed LIFO.
+  usz pending_start = p->pending_macro_arguments.size;
+
   p->raw_mode = true;
 
   foreach (param_tok, m->parameters) {
@@ -523,10 +1192,7 @@ static void expand_macro(Parser *p, Macro *m) {
     if (param_tok->type == TK_MACRO_ARG) {
       switch ((MacroArgumentSelector)param_tok->integer) {
       case MACRO_ARG_SEL_TOKEN: {
-        NamedToken bound_arg = {0};
-        bound_arg.name = as_span(param_tok->text);
-        bound_arg.token = copy_token(p->tok);
-        vector_push(expansion.bound_arguments, bound_arg);
+        vector_push(p->pending_macro_arguments, p->tok);
       } break;
       case MACRO_ARG_SEL_EXPR_ONCE: FALLTHROUGH;
       case MACRO_ARG_SEL_EXPR: {
@@ -535,14 +1201,13 @@ static void expand_macro(Parser *p, Macro *m) {
         // Yes, this is cursed. The lexer calls into the parser. This is called
         // mutual recursion. But macros go brr, amirite?
         Node *expr = parse_expr(p);
-        NamedToken bound_arg = {0};
-        bound_arg.name = as_span(param_tok->text);
-        bound_arg.token.type = TK_AST_NODE;
-        bound_arg.token.node = expr;
-        bound_arg.token.source_location.start = beg;
-        bound_arg.token.source_location.end = p->tok.source_location.end;
-        bound_arg.token.expr_once = param_tok->integer == MACRO_ARG_SEL_EXPR_ONCE;
-        vector_push(expansion.bound_arguments, bound_arg);
+        Token arg = {0};
+        arg.type = TK_AST_NODE;
+        arg.node = expr;
+        arg.source_location.start = beg;
+        arg.source_location.end = p->tok.source_location.end;
+        arg.expr_once = param_tok->integer == MACRO_ARG_SEL_EXPR_ONCE;
+        vector_push(p->pending_macro_arguments, arg);
       } break;
       default: ICE("Unhandled macro argument selector type");
       }
@@ -555,8 +1220,14 @@ static void expand_macro(Parser *p, Macro *m) {
 
   expansion.source_location.end = p->tok.source_location.end;
 
-  for (usz i = 0; i < m->gensym_count; ++i)
-    vector_push(expansion.gensyms, gensym(p->gensym_counter++));
+  expansion.gensym_base = p->gensym_counter;
+  p->gensym_counter += m->gensym_count;
+
+  expansion.arguments_start = p->macro_arguments.size;
+  expansion.arguments_count = p->pending_macro_arguments.size - pending_start;
+  for (usz i = pending_start; i < p->pending_macro_arguments.size; i++)
+    vector_push(p->macro_arguments, p->pending_macro_arguments.data[i]);
+  p->pending_macro_arguments.size = pending_start;
 
   vector_push(p->macro_expansion_stack, expansion);
   p->raw_mode = false;
@@ -573,33 +1244,24 @@ static void handle_identifier(Parser *p) {
     return;
   }
 
-  Macro *found_macro = vector_find_if(m, p->macros, string_eq(m->name, p->tok.text));
+  Macro *found_macro = p->in_deferred_body ? NULL : map_get(p->macros, p->tok.ident);
   if (found_macro) {
     expand_macro(p, found_macro);
     return;
   }
 
-  for (size_t i = 0; i < sizeof keywords / sizeof *keywords; i++) {
-    if (string_eq(keywords[i].kw, p->tok.text)) {
-      p->tok.type = keywords[i].type;
-      return;
-    }
-  }
+  /// The lexer has already told keywords apart from identifiers.
+  if (p->tok.type != TK_IDENT) return;
 
   // Try and parse a number just after encountering `s` or `u` at the
   // beginning of an identifier.
   if (p->tok.text.size > 1 && (p->tok.text.data[0] == 's' || p->tok.text.data[0] == 'i' || p->tok.text.data[0] == 'u') && isdigit(p->tok.text.data[1])) {
-    /// Zero-terminate the string or else `strtoull()` might try
-    /// to convert data left over from the previous token.
-    string_buf_zterm(&p->tok.text);
-
     /// Convert the number.
-    char *end;
-    errno = 0;
-    p->tok.integer = (u64) strtoull(p->tok.text.data + 1, &end, 10);
-    if (errno == ERANGE) ERR("Bit width of integer is too large.");
+    span digits = {p->tok.text.data + 1, p->tok.text.size - 1};
+    isz length = convert_digits(digits, 10, &p->tok.integer);
+    if (length < 0) ERR("Bit width of integer is too large.");
     // If the identifier is something like `s64iam`, it's simply an identifier.
-    if (end != p->tok.text.data + p->tok.text.size) return;
+    if ((usz) length != digits.size) return;
 
     p->tok.type = TK_ARBITRARY_INT;
   }
@@ -609,36 +1271,24 @@ static void handle_identifier(Parser *p) {
 static void next_token(Parser *p) {
   // Pop empty macro expansions off of the expansion stack.
   foreach_rev (expansion, p->macro_expansion_stack) {
-    Macro *expandee = p->macros.data + expansion->macro_index;
+    Macro *expandee = &p->macros.data[expansion->macro_index].value;
     if (expansion->expansion_index >= expandee->expansion.size) {
-      foreach (s, expansion->gensyms) {
-        if (s->data) free(s->data);
-      }
-      vector_delete(expansion->gensyms);
-      vector_delete(expansion->bound_arguments);
-      (void)vector_pop(p->macro_expansion_stack);
+      MacroExpansion popped = vector_pop(p->macro_expansion_stack);
+      p->macro_arguments.size = popped.arguments_start;
     }
   }
   // Iff there are macro expansions to handle, get tokens from there
   // instead of from the file.
   if (p->macro_expansion_stack.size) {
     MacroExpansion *expansion = &vector_back(p->macro_expansion_stack);
-    Macro *expandee = p->macros.data + expansion->macro_index;
+    Macro *expandee = &p->macros.data[expansion->macro_index].value;
     Token *macro_expansion_token = expandee->expansion.data + expansion->expansion_index;
     if (macro_expansion_token->type == TK_MACRO_ARG) {
-      ASSERT(expansion->bound_arguments.size,
-             "Macro argument \"%S\" encountered, but none are defined for this macro",
-             as_span(macro_expansion_token->text));
-      // Get it from bound arguments
-      NamedToken *found = vector_find_if(
-        t,
-        expansion->bound_arguments,
-        string_eq(t->name, macro_expansion_token->text)
-      );
-      ASSERT(found, "Macro argument \"%S\" does not exist (lexer screwed up!)",
-             as_span(macro_expansion_token->text));
-      p->tok = copy_token(found->token);
-    } else p->tok = copy_token(*macro_expansion_token);
+      ASSERT(macro_expansion_token->integer < expansion->arguments_count,
+             "Macro argument \"%S\" does not exist (lexer screwed up!)",
+             macro_expansion_token->text);
+      p->tok = p->macro_arguments.data[expansion->arguments_start + macro_expansion_token->integer];
+    } else p->tok = *macro_expansion_token;
     ++expansion->expansion_index;
 
     // Set artificial to false, because, for example, if we are inserting
@@ -649,316 +1299,135 @@ static void next_token(Parser *p) {
     if (p->tok.type == TK_IDENT && string_eq(p->tok.text, literal_span("macro")))
       next_macro(p);
 
-    return;
-  }
-
-  // Reset artificial flag.
-  p->tok.artificial = false;
-
-  /// Keep returning EOF once EOF has been reached.
-  if (!p->lastc) {
-    p->tok.type = TK_EOF;
-    return;
-  }
-
-  /// Set the token to invalid in case there is an error.
-  p->tok.type = TK_INVALID;
-
-  /// Skip whitespace.
-  while (isspace(p->lastc)) next_char(p);
-
-  /// Start of the token.
-  p->tok.source_location.start = (u32) (p->curr - p->source.data - 1);
-
-  /// Lex the token.
-  switch (p->lastc) {
-    /// EOF.
-    case 0:
-      p->tok.type = TK_EOF;
-      break;
-
-    case '\\': {
-      // Yeet backslash;
-      next_char(p);
-      // Get identifier
-      bool in_raw_mode = p->raw_mode;
-      p->raw_mode = true;
-      next_token(p);
-      p->raw_mode = in_raw_mode;
-      if (p->tok.type != TK_IDENT) {
-        switch (p->tok.type) {
-        case TK_IDENT: break;
-        case TK_MACRO_ARG: {
-          // Prepend dollar sign.
-          string text = format("$%S", as_span(p->tok.text));
-          p->tok.text = as_string_buffer(text);
-        } break;
-        case TK_STRING: {
-          // Wrap in double quotes.
-          string text = format("\"%S\"", as_span(p->tok.text));
-          p->tok.text = as_string_buffer(text);
-        } break;
-        case TK_NUMBER: {
-          // Convert number to string
-          string text = format("%U", p->tok.integer);
-          p->tok.text = as_string_buffer(text);
-        } break;
-        case TK_ARBITRARY_INT: {
-          string text = format("%c%U", p->tok.text.data[0], p->tok.integer);
-          p->tok.text = as_string_buffer(text);
-        } break;
-        default: {
-          string text = string_create(token_type_to_string(p->tok.type));
-          p->tok.text = as_string_buffer(text);
-        } break;
-        }
-      }
-      p->tok.type = TK_IDENT;
-      p->tok.artificial = true;
-    } break;
-
-    case '$': {
-      if (p->raw_mode) {
-        // Yeet '$';
-        next_char(p);
-        // Get name of macro argument (identifier)
-        next_token(p);
-        if (p->tok.type != TK_IDENT)
-          ERR("Expected identifier following '$' to name macro argument");
-
-        string name = string_dup(p->tok.text);
-
-        // Parse token category term or whatever (sets integer token member)
-        if (p->lastc == ':') {
-          // Yeet ':'
-          next_char(p);
-          // Get selector identifier.
-          next_token(p);
-          if (p->tok.type != TK_IDENT)
-            ERR("Expected identifier following ':' in named macro argument");
-
-          MacroArgumentSelector selector = MACRO_ARG_SEL_TOKEN;
-          if (string_eq(p->tok.text, literal_span("expr")))
-            selector = MACRO_ARG_SEL_EXPR;
-          else if (string_eq(p->tok.text, literal_span("expr_once")))
-            selector = MACRO_ARG_SEL_EXPR_ONCE;
-          else if (string_eq(p->tok.text, literal_span("token")))
-            ;
-          else ERR("Unrecognised macro argument selector identifier");
-
-          p->tok.integer = (usz)selector;
-        }
-
-        p->tok.text = as_string_buffer(name);
-        p->tok.type = TK_MACRO_ARG;
-      } else {
-        next_identifier(p);
-        handle_identifier(p);
-        break;
-      }
-    } break;
-
-    case '(':
-      p->tok.type = TK_LPAREN;
-      next_char(p);
-      break;
-
-    case ')':
-      p->tok.type = TK_RPAREN;
-      next_char(p);
-      break;
-
-    case '[':
-      p->tok.type = TK_LBRACK;
-      next_char(p);
-      break;
-
-    case ']':
-      p->tok.type = TK_RBRACK;
-      next_char(p);
-      break;
-
-    case '{':
-      p->tok.type = TK_LBRACE;
-      next_char(p);
-      break;
-
-    case '}':
-      p->tok.type = TK_RBRACE;
-      next_char(p);
-      break;
-
-    case ',':
-      p->tok.type = TK_COMMA;
-      next_char(p);
-      break;
-
-    case '@':
-      p->tok.type = TK_AT;
-      next_char(p);
-      break;
-
-    case ':':
-      next_char(p);
-      if (p->lastc == '=') {
-        p->tok.type = TK_COLON_EQ;
-        next_char(p);
-      } else if (p->lastc == ':') {
-        p->tok.type = TK_COLON_COLON;
-        next_char(p);
-      } else if (p->lastc == '>') {
-        p->tok.type = TK_COLON_GT;
-        next_char(p);
-      } else {
-        p->tok.type = TK_COLON;
-      }
-      break;
-
-    case ';':
-      // Yeet ';'
-      next_char(p);
-      // Line comments begin with `;;`
-      if (p->lastc == ';') {
-        while (p->lastc && p->lastc != '\n') next_char(p);
-        return next_token(p);
-      }
-      p->tok.type = TK_SEMICOLON;
-      break;
-
-    case '#':
-      next_char(p);
-      p->tok.type = TK_HASH;
-      break;
-
-    case '.':
-      next_char(p);
-      p->tok.type = TK_DOT;
-      break;
-
-    case '+':
-      next_char(p);
-      p->tok.type = TK_PLUS;
-      break;
-
-    case '-':
-      next_char(p);
-      if (isdigit(p->lastc)) {
-        next_number(p);
-        p->tok.integer = -p->tok.integer;
-
-        /// The character after a number must be a whitespace or delimiter.
-        if (isalpha(p->lastc)) ERR("Invalid integer literal");
-      } else {
-        p->tok.type = TK_MINUS;
-      }
-      break;
-
-    case '*':
-      next_char(p);
-      p->tok.type = TK_STAR;
-      break;
-
-    case '/':
-      next_char(p);
-      p->tok.type = TK_SLASH;
-      break;
-
-    case '%':
-      next_char(p);
-      p->tok.type = TK_PERCENT;
-      break;
-
-    case '&':
-      next_char(p);
-      p->tok.type = TK_AMPERSAND;
-      break;
-
-    case '|':
-      next_char(p);
-      p->tok.type = TK_PIPE;
-      break;
-
-    case '^':
-      next_char(p);
-      p->tok.type = TK_CARET;
-      break;
-
-    case '~':
-      next_char(p);
-      p->tok.type = TK_TILDE;
-      break;
-
-    case '!':
-      next_char(p);
-      if (p->lastc == '=') {
-        p->tok.type = TK_NE;
-        next_char(p);
-      } else {
-        p->tok.type = TK_EXCLAM;
-      }
-      break;
-
-    case '=':
-      next_char(p);
-      p->tok.type = TK_EQ;
-      break;
+    return;
+  }
 
-    case '<':
-      next_char(p);
-      if (p->lastc == '=') {
-        p->tok.type = TK_LE;
-        next_char(p);
-      } else if (p->lastc == '<') {
-        p->tok.type = TK_SHL;
-        next_char(p);
-      } else {
-        p->tok.type = TK_LT;
-      }
+  /// Otherwise, read the next token of the file.
+  read_token(p);
+  switch (p->tok.type) {
+    /// Keywords may still be the names of macros.
+    default:
+      if (is_keyword(p->tok.type)) handle_identifier(p);
       break;
 
-    case '>':
-      next_char(p);
-      if (p->lastc == '=') {
-        p->tok.type = TK_GE;
-        next_char(p);
-      } else if (p->lastc == '>') {
-        p->tok.type = TK_SHR;
-        next_char(p);
-      } else {
-        p->tok.type = TK_GT;
+    /// Keep returning EOF once EOF has been reached.
+    case TK_EOF: return;
+
+    /// Report lexer errors once we get to them.
+    case TK_INVALID: ERR("%s", p->tokens.error);
+
+    /// Escape the next token.
+    case TK_BACKSLASH: {
+      bool in_raw_mode = p->raw_mode;
+      p->raw_mode = true;
+      next_token(p);
+      p->raw_mode = in_raw_mode;
+      if (p->tok.type != TK_IDENT) {
+        switch (p->tok.type) {
+        case TK_IDENT: break;
+        case TK_MACRO_ARG: {
+          // Prepend dollar sign.
+          string text = format("$%S", p->tok.text);
+          p->tok.ident = atom_intern(as_span(text));
+          free(text.data);
+        } break;
+        case TK_STRING: {
+          // Wrap in double quotes.
+          string text = format("\"%S\"", p->tok.text);
+          p->tok.ident = atom_intern(as_span(text));
+          free(text.data);
+        } break;
+        case TK_NUMBER: {
+          // Convert number to string
+          string text = format("%U", p->tok.integer);
+          p->tok.ident = atom_intern(as_span(text));
+          free(text.data);
+        } break;
+        case TK_ARBITRARY_INT: {
+          string text = format("%c%U", p->tok.text.data[0], p->tok.integer);
+          p->tok.ident = atom_intern(as_span(text));
+          free(text.data);
+        } break;
+        default: {
+          const char *text = token_type_to_string(p->tok.type);
+          p->tok.ident = atom_intern((span){text, strlen(text)});
+        } break;
+        }
       }
-      break;
 
-    // String.
-    case '"':
-    case '\'':
-      next_string(p);
-      break;
+      // The text of the identifier is the interned text.
+      p->tok.type = TK_IDENT;
+      p->tok.text = as_span(p->tok.ident);
+      p->tok.artificial = true;
+    } break;
 
-    /// Number or identifier.
-    default:
-      /// Identifier.
-      if (isstart(p->lastc)) {
-        next_identifier(p);
+    case TK_IDENT: {
+      if (!p->raw_mode || p->tok.text.data[0] != '$') {
         handle_identifier(p);
         break;
       }
 
-      /// Number.
-      if (isdigit(p->lastc)) {
-        next_number(p);
+      // In raw mode, `$` starts the name of a macro argument. The lexer
+      // has made it part of an identifier, so take it apart again.
+      span rest = {p->tok.text.data + 1, p->tok.text.size - 1};
+      if (!rest.size) next_token(p);
+      else {
+        p->tok.source_location.start++;
+        if (!isstart(rest.data[0]))
+          ERR("Expected identifier following '$' to name macro argument");
+        p->tok.ident = atom_intern(rest);
+        p->tok.text = as_span(p->tok.ident);
+        p->tok.type = keyword_type(rest);
+        handle_identifier(p);
+      }
 
-        /// The character after a number must be a whitespace or delimiter.
-        if (isalpha(p->lastc)) ERR("Invalid integer literal");
-        break;
+      // Get name of macro argument (identifier)
+      if (p->tok.type != TK_IDENT)
+        ERR("Expected identifier following '$' to name macro argument");
+
+      span name = p->tok.text;
+      atom ident = p->tok.ident;
+
+      // Parse token category term or whatever (sets integer token member).
+      // The selector is only parsed if the `:` immediately follows the name.
+      MacroArgumentSelector selector = MACRO_ARG_SEL_TOKEN;
+      u32 name_end = p->tokens.locations.data[p->token_index - 1].end;
+      if (name_end < p->source.size && p->source.data[name_end] == ':') {
+        // Yeet ':'. If the lexer has combined it with the character
+        // after it, that character can’t start an identifier.
+        ASSERT(p->token_index < p->tokens_end);
+        if (p->tokens.types.data[p->token_index] != TK_COLON) {
+          p->tok.source_location = p->tokens.locations.data[p->token_index];
+          p->tok.source_location.start++;
+          ERR("Expected identifier following ':' in named macro argument");
+        }
+        p->token_index++;
+
+        // Get selector identifier.
+        next_token(p);
+        if (p->tok.type != TK_IDENT)
+          ERR("Expected identifier following ':' in named macro argument");
+
+        if (string_eq(p->tok.text, literal_span("expr")))
+          selector = MACRO_ARG_SEL_EXPR;
+        else if (string_eq(p->tok.text, literal_span("expr_once")))
+          selector = MACRO_ARG_SEL_EXPR_ONCE;
+        else if (string_eq(p->tok.text, literal_span("token")))
+          ;
+        else ERR("Unrecognised macro argument selector identifier");
       }
 
-      /// Anything else is invalid.
-      ERR("Invalid token");
+      p->tok.integer = (usz) selector;
+      p->tok.text = name;
+      p->tok.ident = ident;
+      p->tok.type = TK_MACRO_ARG;
+    } break;
   }
 
-  /// Set the end of the token.
-  p->tok.source_location.end = (u32) (p->curr - p->source.data - 1);
+  /// Set the end of the token. If it is made up of several tokens of
+  /// the file, or is the result of a macro expansion, it ends where the
+  /// last token that we’ve read ends.
+  p->tok.source_location.end = p->tokens.locations.data[p->token_index - 1].end;
 }
 
 /// ===========================================================================
@@ -1134,68 +1603,6 @@ static Node *parse_block(Parser *p, bool create_new_scope) {
   return ast_make_block(p->ast, pos, children);
 }
 
-/// <expr-if>        ::= IF <expression> <expr-block> [ ELSE <expr-block> ]
-static Node *parse_if_expr(Parser *p) {
-  /// Yeet "if".
-  loc if_loc = p->tok.source_location;
-  consume(p, TK_IF);
-
-  /// Parse the condition.
-  Node *cond = parse_expr(p);
-
-  /// Parse the "then" block.
-  scope_push(p->ast);
-  Node *then_block = parse_expr(p);
-  scope_pop(p->ast);
-
-  /// Parse the "else" block if there is one.
-  Node *else_block = NULL;
-  if (p->tok.type == TK_ELSE) {
-    next_token(p);
-    scope_push(p->ast);
-    else_block = parse_expr(p);
-    scope_pop(p->ast);
-  }
-
-  /// Done.
-  return ast_make_if(p->ast, if_loc, cond, then_block, else_block);
-}
-
-/// <expr-while>     ::= WHILE <expression> <expression>
-static Node *parse_while_expr(Parser *p) {
-  /// Yeet "while".
-  loc while_loc = p->tok.source_location;
-  consume(p, TK_WHILE);
-
-  /// Parse the condition.
-  Node *cond = parse_expr(p);
-
-  /// Parse the body.
-  scope_push(p->ast);
-  Node *body = parse_expr(p);
-  scope_pop(p->ast);
-
-  /// Done.
-  return ast_make_while(p->ast, while_loc, cond, body);
-}
-
-/// <expr-call> ::= <expression> "(" { <expression> [ "," ] } ")"
-static Node *parse_call_expr(Parser *p, Node *callee) {
-  consume(p, TK_LPAREN);
-
-  /// Collect the arguments.
-  Nodes args = {0};
-  while (p->tok.type != TK_RPAREN) {
-    vector_push(args, parse_expr(p));
-    if (p->tok.type == TK_COMMA) next_token(p);
-  }
-
-  /// Done.
-  Node *call = ast_make_call(p->ast, (loc){callee->source_location.start, p->tok.source_location.end}, callee, args);
-  consume(p, TK_RPAREN);
-  return call;
-}
-
 /// Parse function attributes.
 static void parse_function_attributes(Parser *p, Attributes *attribs) {
   while (p->tok.type == TK_IDENT) {
@@ -1222,30 +1629,102 @@ static void parse_function_attributes(Parser *p, Attributes *attribs) {
   }
 }
 
-static void ensure_hygienic_declaration_if_within_macro(Parser *p, span ident, loc *source_location) {
+static void ensure_hygienic_declaration_if_within_macro(Parser *p, atom ident, loc *source_location) {
   // If we are
   //   1. reading from a macro expansion, and
   //   2. encounter a variable declaration,
   // we need to **ensure** that there are no identifiers with the same
   // name passed as macro arguments (hygiene).
   if (p->macro_expansion_stack.size) {
-    foreach (t, p->macro_expansion_stack.data[0].bound_arguments) {
-      if ((t->token.type == TK_IDENT && string_eq(t->token.text, ident)) || (t->token.type == TK_AST_NODE && t->token.node->kind == NODE_VARIABLE_REFERENCE && string_eq(t->token.node->var->name, ident))) {
+    MacroExpansion *outermost = p->macro_expansion_stack.data;
+    for (usz i = 0; i < outermost->arguments_count; i++) {
+      Token *t = p->macro_arguments.data + outermost->arguments_start + i;
+      if ((t->type == TK_IDENT && atom_eq(t->ident, ident)) || (t->type == TK_AST_NODE && t->node->kind == NODE_VARIABLE_REFERENCE && atom_eq(t->node->var->name, ident))) {
         if (source_location)
           ISSUE_DIAGNOSTIC(DIAG_NOTE, *source_location, p, "This declaration within a macro would shadow a passed identifier\n");
-        ERR_AT(p->macro_expansion_stack.data[0].source_location, "Unhygienic expansion of macro. Probably need \"defines %S\" specified for macro\n", as_span(ident));
+        ERR_AT(p->macro_expansion_stack.data[0].source_location, "Unhygienic expansion of macro. Probably need \"defines %S\" specified for macro\n", ident);
       }
     }
   }
 }
 
+/// Check if the token at an index is definitely not part of the same
+/// expression as the block that ends before it. This only allows tokens
+/// that can’t be operators, and identifiers that can’t be macros or `as`.
+static bool block_ends_expression(Parser *p, usz index) {
+  enum TokenType tt = (enum TokenType) p->tokens.types.data[index];
+  switch (tt) {
+    default:
+      if (!is_keyword(tt) || tt == TK_AS) return false;
+      FALLTHROUGH;
+    case TK_IDENT: {
+      atom ident = p->tokens.atoms.data[p->tokens.values.data[index]];
+      return !p->macros.size || !map_get(p->macros, ident);
+    }
+    case TK_EOF:
+    case TK_SEMICOLON:
+    case TK_LBRACE:
+    case TK_STRING:
+    case TK_NUMBER:
+      return true;
+  }
+}
+
+/// Find the end of the block that starts at the current token if parsing
+/// that block later can’t change its meaning, i.e. if it contains no macro
+/// definitions or invocations, no escaped tokens, and no lexer errors, and
+/// if it isn’t followed by something that would make it part of a larger
+/// expression.
+///
+/// \return The index of the token after the closing brace, or 0 if the
+///         block can’t be deferred or isn’t closed.
+static usz find_deferrable_block_end(Parser *p) {
+  ASSERT(p->tok.type == TK_LBRACE && p->tokens.types.data[p->token_index - 1] == TK_LBRACE);
+  atom macro_keyword = atom_intern(literal_span("macro"));
+  usz depth = 1;
+  for (usz i = p->token_index; i < p->tokens_end; i++) {
+    enum TokenType tt = (enum TokenType) p->tokens.types.data[i];
+    switch (tt) {
+      default:
+        if (is_keyword(tt) && p->macros.size && map_get(p->macros, p->tokens.atoms.data[p->tokens.values.data[i]])) return 0;
+        break;
+      case TK_LBRACE: depth++; break;
+      case TK_RBRACE:
+        if (--depth == 0) return block_ends_expression(p, i + 1) ? i + 1 : 0;
+        break;
+
+      /// Escaped tokens can turn anything into an identifier.
+      case TK_BACKSLASH: return 0;
+
+      /// Errors must be reported in order.
+      case TK_INVALID: return 0;
+
+      /// Identifiers may be macros; check for ones that are defined
+      /// at this point, since later ones must not be expanded.
+      case TK_IDENT: {
+        atom ident = p->tokens.atoms.data[p->tokens.values.data[i]];
+        if (atom_eq(ident, macro_keyword)) return 0;
+        if (p->macros.size && map_get(p->macros, ident)) return 0;
+      } break;
+    }
+  }
+  return 0;
+}
+
 /// Parse the body of a function.
 ///
 /// This is basically just a wrapper around `parse_block()` that
 /// also injects declarations for all the function parameters.
-static Node *parse_function_body(Parser *p, Type *function_type, Nodes *param_decls, Attributes *attribs) {
+///
+/// If `deferred` is not NULL and the function is a top-level one whose
+/// body can be parsed later, we skip the body, store where it is in the
+/// token stream in `deferred->deferred_body` and `deferred_body_end`
+/// and the number of visible global symbols in `deferred_globals`, and
+/// return NULL.
+static Node *parse_function_body(Parser *p, Type *function_type, Nodes *param_decls, Attributes *attribs, NodeFunction *deferred) {
   /// Save state.
   bool save_in_function = p->in_function;
+  bool top_level = !p->in_function && p->ast->scope_stack.size == 1;
   p->in_function = true;
 
   // Collect attributes and return them through an out parameter.
@@ -1260,15 +1739,43 @@ static Node *parse_function_body(Parser *p, Type *function_type, Nodes *param_de
 
   /// Create a declaration for each parameter.
   foreach (param, function_type->function.parameters) {
-    Node *var = ast_make_declaration(p->ast, param->source_location, param->type, LINKAGE_LOCALVAR, as_span(param->name), NULL);
-    ensure_hygienic_declaration_if_within_macro(p, as_span(param->name), &param->source_location);
-    if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, as_span(var->declaration.name), var))
+    Node *var = ast_make_declaration(p->ast, param->source_location, param->type, LINKAGE_LOCALVAR, param->name, NULL);
+    ensure_hygienic_declaration_if_within_macro(p, param->name, &param->source_location);
+    if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, var->declaration.name, var))
       ERR_AT(var->source_location, "Redefinition of parameter '%S'", var->declaration.name);
     vector_push(*param_decls, var);
   }
 
+  /// Functions that are `used` are always emitted, and exported
+  /// ones may be called from elsewhere.
+  bool used = false;
+  foreach (attr, *attribs) used = used || attr->kind == FUNC_ATTR_USED;
+
+  /// Skip the body if we can parse it later.
+  Node *block = NULL;
+  usz end;
+  if (
+    deferred &&
+    p->lazy_bodies &&
+    top_level &&
+    !used &&
+    !p->in_export &&
+    !p->macro_expansion_stack.size &&
+    p->tok.type == TK_LBRACE &&
+    (end = find_deferrable_block_end(p))
+  ) {
+    deferred->deferred_body = (u32) (p->token_index - 1);
+    deferred->deferred_body_end = (u32) end;
+    deferred->deferred_globals = (u32) p->ast->scope_stack.data[0]->symbols.size;
+    p->deferred_bodies++;
+
+    /// Continue after the body.
+    p->token_index = end;
+    next_token(p);
+  }
+
   /// Parse the body.
-  Node *block = parse_expr(p);
+  else block = parse_expr(p);
 
   /// Pop the scope.
   scope_pop(p->ast);
@@ -1287,14 +1794,14 @@ static Node *parse_type_expr(Parser *p, Type *type) {
     /// Parse the function body.
     Nodes params = {0};
     Attributes attribs = {0};
-    Node *body = parse_function_body(p, type, &params, &attribs);
+    Node *body = parse_function_body(p, type, &params, &attribs, NULL);
 
     apply_function_attributes(p, type, attribs);
     vector_delete(attribs);
 
     /// Create a function for the lambda.
     string name = format("_XLambda_%Z", p->ast->counter++);
-    Node *func = ast_make_function(p->ast, type->source_location, type, LINKAGE_INTERNAL, params, body, as_span(name));
+    Node *func = ast_make_function(p->ast, type->source_location, type, LINKAGE_INTERNAL, params, body, atom_intern(as_span(name)));
     free(name.data);
     return func;
   }
@@ -1309,7 +1816,7 @@ static Parameter parse_param_decl(Parser *p) {
   loc start = p->tok.source_location;
 
   /// Parse the name, colon, and type.
-  string name = string_dup(p->tok.text);
+  atom name = p->tok.ident;
   consume(p, TK_IDENT);
   consume(p, TK_COLON);
   Type *type = parse_type(p);
@@ -1326,7 +1833,7 @@ static Member parse_struct_member(Parser *p) {
   loc start = p->tok.source_location;
 
   /// Parse the name, colon, and type.
-  string name = string_dup(p->tok.text);
+  atom name = p->tok.ident;
   consume(p, TK_IDENT);
   consume(p, TK_COLON);
   Type *type = parse_type(p);
@@ -1418,8 +1925,8 @@ static Type *parse_type(Parser *p) {
 
   case TK_IDENT: {
     /// Make sure the identifier is a type.
-    Symbol *sym = scope_find_or_add_symbol(curr_scope(p), SYM_TYPE, as_span(p->tok.text), false);
-    if (sym->kind != SYM_TYPE) ERR("'%S' is not a type!", as_span(p->tok.text));
+    Symbol *sym = scope_find_or_add_symbol(curr_scope(p), SYM_TYPE, p->tok.ident, false);
+    if (sym->kind != SYM_TYPE) ERR("'%S' is not a type!", p->tok.ident);
 
     /// Create a named type from it.
     out = ast_make_type_named(p->ast, p->tok.source_location, sym);
@@ -1489,7 +1996,7 @@ static Type *parse_type(Parser *p) {
         }
       }
       if (attr_kind == ATTR_COUNT)
-        ERR("Unexpected identifier when parsing type attributes: \"%S\"", as_span(p->tok.text));
+        ERR("Unexpected identifier when parsing type attributes: \"%S\"", p->tok.text);
 
       // Yeet the attribute identifier that gave us the attribute kind.
       next_token(p);
@@ -1547,7 +2054,7 @@ static Type *parse_type(Parser *p) {
 /// <decl-rest>      ::= <type-function> <expression>
 ///                    | <type> [ "=" <expression> ]
 ///                    | <decl-start> EXT <type-function>
-static Node *parse_decl_rest(Parser *p, string ident, loc location) {
+static Node *parse_decl_rest(Parser *p, atom ident, loc location) {
   /// If the next token is "ext", then this is an external declaration.
   bool is_ext = false;
   if (p->tok.type == TK_EXT) {
@@ -1563,22 +2070,26 @@ static Node *parse_decl_rest(Parser *p, string ident, loc location) {
     /// Not external.
     if (!is_ext) {
       /// Create a symbol table entry before parsing the body.
-      Symbol *sym = scope_add_symbol_unconditional(curr_scope(p), SYM_FUNCTION, as_span(ident), NULL);
+      Symbol *sym = scope_add_symbol_unconditional(curr_scope(p), SYM_FUNCTION, ident, NULL);
 
       if (sym->kind != SYM_FUNCTION || sym->val.node)
-        ERR_AT(location, "Redefinition of symbol '%S'", as_span(ident));
+        ERR_AT(location, "Redefinition of symbol '%S'", ident);
 
       /// Parse the body, create the function, and update the symbol table.
       Nodes params = {0};
       Attributes attribs = {0};
-      Node *body = parse_function_body(p, type, &params, &attribs);
+      NodeFunction deferred = {0};
+      Node *body = parse_function_body(p, type, &params, &attribs, &deferred);
 
       apply_function_attributes(p, type, attribs);
       vector_delete(attribs);
 
-      Node *func = ast_make_function(p->ast, location, type, LINKAGE_INTERNAL, params, body, as_span(ident));
+      Node *func = ast_make_function(p->ast, location, type, LINKAGE_INTERNAL, params, body, ident);
+      func->function->deferred_body = deferred.deferred_body;
+      func->function->deferred_body_end = deferred.deferred_body_end;
+      func->function->deferred_globals = deferred.deferred_globals;
       sym->val.node = func;
-      Node *funcref = ast_make_function_reference(p->ast, location, as_span(ident));
+      Node *funcref = ast_make_function_reference(p->ast, location, ident);
       funcref->funcref.resolved = sym;
       funcref->type = type;
       return funcref;
@@ -1587,9 +2098,9 @@ static Node *parse_decl_rest(Parser *p, string ident, loc location) {
     /// External.
     else {
       /// Create a symbol table entry.
-      Symbol *sym = scope_find_or_add_symbol(curr_scope(p), SYM_FUNCTION, as_span(ident), true);
+      Symbol *sym = scope_find_or_add_symbol(curr_scope(p), SYM_FUNCTION, ident, true);
       if (sym->kind != SYM_FUNCTION || sym->val.node)
-        ERR_AT(location, "Redefinition of symbol '%S'", as_span(ident));
+        ERR_AT(location, "Redefinition of symbol '%S'", ident);
 
       /// Parse the function's attributes, if any.
       Attributes attribs = {0};
@@ -1598,10 +2109,10 @@ static Node *parse_decl_rest(Parser *p, string ident, loc location) {
       vector_delete(attribs);
 
       /// Create the function.
-      Node *func = ast_make_function(p->ast, location, type, LINKAGE_IMPORTED, (Nodes){0}, NULL, as_span(ident));
+      Node *func = ast_make_function(p->ast, location, type, LINKAGE_IMPORTED, (Nodes){0}, NULL, ident);
       type->function.attr_nomangle = true;
       sym->val.node = func;
-      Node *funcref = ast_make_function_reference(p->ast, location, as_span(ident));
+      Node *funcref = ast_make_function_reference(p->ast, location, ident);
       funcref->funcref.resolved = sym;
       funcref->type = type;
       return funcref;
@@ -1610,11 +2121,11 @@ static Node *parse_decl_rest(Parser *p, string ident, loc location) {
 
   /// Create the declaration.
   SymbolLinkage linkage = p->ast->scope_stack.size == 1 ? LINKAGE_INTERNAL : LINKAGE_LOCALVAR;
-  Node *decl = ast_make_declaration(p->ast, location, type, linkage, as_span(ident), NULL);
-  ensure_hygienic_declaration_if_within_macro(p, as_span(ident), &location);
+  Node *decl = ast_make_declaration(p->ast, location, type, linkage, ident, NULL);
+  ensure_hygienic_declaration_if_within_macro(p, ident, &location);
 
   /// Add the declaration to the current scope.
-  if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, as_span(ident), decl))
+  if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, ident, decl))
     ERR_AT(location, "Redefinition of symbol '%S'", ident);
 
   /// A non-external declaration may have an initialiser.
@@ -1632,7 +2143,7 @@ static Node *parse_decl_rest(Parser *p, string ident, loc location) {
   return decl;
 }
 
-static Node *parse_declaration(Parser *p, string ident, loc location) {
+static Node *parse_declaration(Parser *p, atom ident, loc location) {
   /// If the next token is a colon, then this is some sort of declaration.
   switch (p->tok.type) {
   default: break;
@@ -1640,9 +2151,7 @@ static Node *parse_declaration(Parser *p, string ident, loc location) {
   case TK_COLON: {
     /// Parse the rest of the declaration.
     next_token(p);
-    Node *decl = parse_decl_rest(p, ident, location);
-    free(ident.data);
-    return decl;
+    return parse_decl_rest(p, ident, location);
   }
 
   case TK_COLON_GT: {
@@ -1652,26 +2161,24 @@ static Node *parse_declaration(Parser *p, string ident, loc location) {
     Type *type = parse_type(p);
 
     if (type->kind == TYPE_STRUCT) {
-      Symbol *struct_decl_sym = scope_find_or_add_symbol(curr_scope(p), SYM_TYPE, as_span(ident), true);
+      Symbol *struct_decl_sym = scope_find_or_add_symbol(curr_scope(p), SYM_TYPE, ident, true);
       struct_decl_sym->val.type = type;
       Node *struct_decl = ast_make_structure_declaration(p->ast, location, struct_decl_sym);
       type->structure.decl = struct_decl;
       struct_decl->type = type;
-      free(ident.data);
       return struct_decl;
     }
-    free(ident.data);
     TODO("Named type alias not implemented");
   }
 
   case TK_COLON_COLON: {
     /// Create the declaration.
     SymbolLinkage linkage = p->ast->scope_stack.size == 1 ? LINKAGE_INTERNAL : LINKAGE_LOCALVAR;
-    Node *decl = ast_make_declaration(p->ast, location, NULL, linkage, as_span(ident), NULL);
-    ensure_hygienic_declaration_if_within_macro(p, as_span(ident), &location);
+    Node *decl = ast_make_declaration(p->ast, location, NULL, linkage, ident, NULL);
+    ensure_hygienic_declaration_if_within_macro(p, ident, &location);
 
     /// Add the declaration to the current scope.
-    if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, as_span(ident), decl))
+    if (!scope_add_symbol(curr_scope(p), SYM_VARIABLE, ident, decl))
       ERR_AT(location, "Redefinition of symbol '%S'", ident);
 
     /// A type-inferred declaration MUST have an initialiser.
@@ -1683,7 +2190,6 @@ static Node *parse_declaration(Parser *p, string ident, loc location) {
     decl->declaration.init->parent = decl;
 
     /// Done.
-    free(ident.data);
     return decl;
   }
 
@@ -1700,7 +2206,7 @@ static Node *parse_ident_expr(Parser *p) {
   ASSERT(p->tok.type == TK_IDENT,
          "parse_ident_expr() may only be called with identifier token, but it was called with %s.",
          token_type_to_string(p->tok.type));
-  string ident = string_dup(p->tok.text);
+  atom ident = p->tok.ident;
   loc location = p->tok.source_location;
   next_token(p);
 
@@ -1717,18 +2223,11 @@ static Node *parse_ident_expr(Parser *p) {
 
   /// Otherwise, check if the identifier is a declared symbol; if it isn’t,
   /// it can only be a function name, so add it as a symbol.
-  Symbol *sym = scope_find_symbol(curr_scope(p), as_span(ident), false);
+  Symbol *sym = scope_find_symbol(curr_scope(p), ident, false);
 
   /// If the symbol is a variable or function, then create a variable or
   /// function reference, and we’re done here.
-  if (!sym || sym->kind == SYM_FUNCTION) {
-    Node *ref = ast_make_function_reference(p->ast, location, as_span(ident));
-    free(ident.data);
-    return ref;
-  }
-
-  /// Identifier is no longer needed at this point.
-  free(ident.data);
+  if (!sym || sym->kind == SYM_FUNCTION) return ast_make_function_reference(p->ast, location, ident);
   if (sym->kind == SYM_VARIABLE) return ast_make_variable_reference(p->ast, location, sym);
 
   /// If the symbol is a type, then parse the rest of the type and delegate.
@@ -1741,43 +2240,24 @@ static Node *parse_ident_expr(Parser *p) {
   UNREACHABLE();
 }
 
-/// Parse an expression. This function handles the following rules:
-///
-/// <expression> ::= <expr-decl>
-///              | <expr-if>
-///              | <expr-while>
-///              | <expr-block>
-///              | <expr-lambda>
-///              | <expr-call>
-///              | <expr-cast>
-///              | <expr-subs>
-///              | <expr-paren>
-///              | <expr-prefix>
-///              | <expr-binary>
-///              | <expr-primary>
+/// Parse an expression that doesn’t start with an operator.
 ///
-/// <expr-subs>    ::= <expression> "[" <expression> "]"
-/// <expr-paren>   ::= "(" <expression> ")"
-/// <expr-prefix>  ::= <prefix> <expression>
-/// <expr-binary>  ::= <expression> <binary> <expression>
 /// <expr-primary> ::= NUMBER | IDENTIFIER
-static Node *parse_expr_with_precedence(Parser *p, isz current_precedence) {
-  /// Left-hand side of operator.
+static Node *parse_primary_expr(Parser *p) {
+  /// Primary expression.
   Node *lhs = NULL;
 
-  /// Parse the LHS.
   switch (p->tok.type) {
     default: ERR("Expected expression, got %s", token_type_to_string(p->tok.type));
 
   case TK_GENSYM: {
     ASSERT(p->macro_expansion_stack.size, "Sorry, cannot currently handle GENSYM token when not inside of macro expansion");
 
-    vector_clear(p->tok.text);
-    // Cursed use of macro to append string (non-vector) to string buffer
-    string generated_sym = vector_back(p->macro_expansion_stack).gensyms.data[p->tok.integer];
-    vector_append(p->tok.text, generated_sym);
+    atom generated_sym = gensym(vector_back(p->macro_expansion_stack).gensym_base + p->tok.integer);
+    p->tok.text = as_span(generated_sym);
     // From this point on, matches TK_IDENTIFIER handling.
     p->tok.type = TK_IDENT;
+    p->tok.ident = generated_sym;
     lhs = parse_ident_expr(p);
   } break;
 
@@ -1804,10 +2284,12 @@ static Node *parse_expr_with_precedence(Parser *p, isz current_precedence) {
       next_token(p);
 
       if (p->tok.type != TK_IDENT) ERR("Expected identifier following \"export\"");
-      string ident = string_dup(p->tok.text);
+      atom ident = p->tok.ident;
 
       next_token(p);
+      p->in_export = true;
       lhs = parse_declaration(p, ident, p->tok.source_location);
+      p->in_export = false;
       lhs->declaration.linkage = lhs->declaration.linkage == LINKAGE_IMPORTED
         ? LINKAGE_REEXPORTED
         : LINKAGE_EXPORTED;
@@ -1858,161 +2340,338 @@ static Node *parse_expr_with_precedence(Parser *p, isz current_precedence) {
       lhs = ast_make_return(p->ast, source_location, expr);
       next_token(p);
     } break;
-    case TK_IF: lhs = parse_if_expr(p); break;
     case TK_ELSE: ERR("'else' without 'if'");
-    case TK_WHILE: lhs = parse_while_expr(p); break;
-    case TK_LBRACE: lhs = parse_block(p, true); break;
     case TK_NUMBER:
       lhs = ast_make_integer_literal(p->ast, p->tok.source_location, p->tok.integer);
       next_token(p);
       break;
     case TK_STRING:
-      lhs = ast_make_string_literal(p->ast, p->tok.source_location, as_span(p->tok.text));
+      lhs = ast_make_string_literal(p->ast, p->tok.source_location, p->tok.text);
       next_token(p);
       break;
     case TK_LBRACK: {
-      lhs = ast_make_compound_literal(p->ast, p->tok.source_location);
+      loc l = p->tok.source_location;
+      Nodes elements = {0};
       next_token(p); //> Yeet "["
       while (p->tok.type != TK_RBRACK) {
         Node *expr = parse_expr(p);
-        vector_push(lhs->literal.compound, expr);
+        vector_push(elements, expr);
         if (p->tok.type == TK_COMMA) next_token(p);
       }
+      lhs = ast_make_compound_literal(p->ast, l, elements);
       lhs->source_location.end = p->tok.source_location.end - 1;
       consume(p, TK_RBRACK);
     } break;
-    case TK_LPAREN:
-      next_token(p); //> Yeet "("
-      lhs = parse_expr(p);
-      consume(p, TK_RPAREN);
-      break;
     case TK_RPAREN: ERR("Unmatched ')'");
     case TK_RBRACK: ERR("Unmatched ']'");
     case TK_RBRACE: ERR("Unmatched '}'");
-
-    /// '@' is complicated because it can either be a dereference or a cast.
-    case TK_AT: {
-      /// Collect all at signs.
-      usz at_count = 0;
-      do {
-        at_count++;
-        next_token(p);
-      } while (p->tok.type == TK_AT);
-
-      /// If the next token can be the start of a <type-base>, then this is
-      /// a type; parse the type and wrap it in a pointer type.
-      if (p->tok.type == TK_IDENT) {
-        Symbol *sym = scope_find_symbol(curr_scope(p), as_span(p->tok.text), false);
-        if (sym && sym->kind == SYM_TYPE) {
-          Type *type = ast_make_type_named(p->ast, p->tok.source_location, sym);
-          next_token(p);
-          while (at_count--) type = ast_make_type_pointer(p->ast, p->tok.source_location, parse_type_derived(p, type));
-          lhs = parse_type_expr(p, type);
-          break;
-        }
-      }
-
-      /// Otherwise, this is a dereference.
-      lhs = parse_expr_with_precedence(p, PREFIX_PRECEDENCE);
-
-      /// Wrap it in an appropriate number of dereferences.
-      for (usz i = 0; i < at_count; i++) {
-        loc l = lhs->source_location;
-        lhs = ast_make_unary(p->ast, (loc){.start = l.start - 1, .end = l.end}, TK_AT, false, lhs);
-      }
-    } break;
-
-    /// Unary operators.
-    case TK_MINUS:
-    case TK_AMPERSAND:
-    case TK_TILDE:
-    case TK_EXCLAM:
-    case TK_STAR: {
-      u32 start = p->tok.source_location.start;
-      enum TokenType tt = p->tok.type;
-      next_token(p);
-      Node *operand = parse_expr_with_precedence(p, PREFIX_PRECEDENCE);
-      lhs = ast_make_unary(p->ast, (loc){.start = start, .end = operand->source_location.end}, tt, false, operand);
-    } break;
   }
 
   /// This *must* not be NULL.
   if (!lhs) ICE("LHS is NULL");
+  return lhs;
+}
+
+/// Start parsing the operand of an operator.
+static void push_expr_frame(Parser *p, isz *precedence, ExprFrame frame) {
+  *precedence = frame.precedence;
+  vector_push(p->expr_stack, frame);
+}
 
-  /// The rules for operator precedence parsing are as follows:
-  ///     - unary prefix operators are unambiguously handled up above;
-  ///     - if the current token is a, unary postfix operator, then the
-  ///       current LHS is its operand;
-  ///     - if the current token is a binary operator whose precedence is
-  ///       higher than the current precedence, or higher than or equal to
-  ///       the current precedence if the operator is right-associative, then
-  ///       the current LHS is the LHS of that operator;
-  ///     - if the current token is "(" or "[", then this is a call/subscript
-  ///       expression. We handle these explicitly here since they usually have
-  ///       the highest precedence anyway.
-  ///     - otherwise, return the current LHS as its own expression.
+/// Parse an expression. This function handles the following rules:
+///
+/// <expression> ::= <expr-decl>
+///              | <expr-if>
+///              | <expr-while>
+///              | <expr-block>
+///              | <expr-lambda>
+///              | <expr-call>
+///              | <expr-cast>
+///              | <expr-subs>
+///              | <expr-paren>
+///              | <expr-prefix>
+///              | <expr-binary>
+///              | <expr-primary>
+///
+/// <expr-if>      ::= IF <expression> <expression> [ ELSE <expression> ]
+/// <expr-while>   ::= WHILE <expression> <expression>
+/// <expr-subs>    ::= <expression> "[" <expression> "]"
+/// <expr-call>    ::= <expression> "(" { <expression> [ "," ] } ")"
+/// <expr-paren>   ::= "(" <expression> ")"
+/// <expr-prefix>  ::= <prefix> <expression>
+/// <expr-binary>  ::= <expression> <binary> <expression>
+///
+/// Generated code can nest operators, blocks, and control flow
+/// arbitrarily deeply, so rather than recursing to parse the operand of
+/// an operator or the children of a block, we push the operator or block
+/// onto the expression stack and combine it with its operand once that
+/// has been parsed. Frames below `base` belong to enclosing calls of
+/// this, e.g. for the condition of an `if` within parentheses.
+static Node *parse_expr_with_precedence(Parser *p, isz current_precedence) {
+  usz base = p->expr_stack.size;
+  isz precedence = current_precedence;
   for (;;) {
-    /// TODO: Postfix operators also need to respect precedence.
-    /// Handle unary postfix operators.
-    if (is_postfix_operator(p->tok.type)) {
-      lhs = ast_make_unary(p->ast, (loc){.start = lhs->source_location.start, p->tok.source_location.end}, p->tok.type, true, lhs);
-      next_token(p);
-      continue;
-    }
+    /// Left-hand side of operator.
+    Node *lhs = NULL;
+
+    /// Parse the LHS. Prefix operators and parentheses are pushed onto
+    /// the stack, and we parse their operand next.
+    while (!lhs) {
+      switch (p->tok.type) {
+        default: lhs = parse_primary_expr(p); break;
+
+        case TK_LPAREN:
+          next_token(p); //> Yeet "("
+          push_expr_frame(p, &precedence, (ExprFrame){.kind = EXPR_FRAME_PAREN, .precedence = 0});
+          break;
 
-    /// Handle calls.
-    if (p->tok.type == TK_LPAREN) {
-      lhs = parse_call_expr(p, lhs);
-      continue;
-    }
+        /// Blocks get a new scope; see also parse_block().
+        case TK_LBRACE: {
+          loc pos = p->tok.source_location;
+          consume(p, TK_LBRACE);
+          scope_push(p->ast);
+          if (p->tok.type == TK_RBRACE) {
+            consume(p, TK_RBRACE);
+            scope_pop(p->ast);
+            lhs = ast_make_block(p->ast, pos, (Nodes){0});
+            break;
+          }
+
+          push_expr_frame(p, &precedence, (ExprFrame){.kind = EXPR_FRAME_BLOCK, .precedence = 0, .location = pos});
+        } break;
 
-    /// Handle subscripts.
-    if (p->tok.type == TK_LBRACK) {
-      next_token(p);
-      Node *index = parse_expr(p);
-      consume(p, TK_RBRACK);
-      lhs = ast_make_binary(p->ast, (loc){.start = lhs->source_location.start, .end = index->source_location.end}, TK_LBRACK, lhs, index);
-      continue;
+        /// Parse the condition; the branches and body are parsed once
+        /// we have it.
+        case TK_IF:
+        case TK_WHILE: {
+          ExprFrame frame = {
+            .kind = p->tok.type == TK_IF ? EXPR_FRAME_IF_CONDITION : EXPR_FRAME_WHILE_CONDITION,
+            .precedence = 0,
+            .location = p->tok.source_location,
+          };
+          next_token(p);
+          push_expr_frame(p, &precedence, frame);
+        } break;
+
+        /// '@' is complicated because it can either be a dereference or a cast.
+        case TK_AT: {
+          /// Collect all at signs.
+          usz at_count = 0;
+          do {
+            at_count++;
+            next_token(p);
+          } while (p->tok.type == TK_AT);
+
+          /// If the next token can be the start of a <type-base>, then this is
+          /// a type; parse the type and wrap it in a pointer type.
+          if (p->tok.type == TK_IDENT) {
+            Symbol *sym = scope_find_symbol(curr_scope(p), p->tok.ident, false);
+            if (sym && sym->kind == SYM_TYPE) {
+              Type *type = ast_make_type_named(p->ast, p->tok.source_location, sym);
+              next_token(p);
+              while (at_count--) type = ast_make_type_pointer(p->ast, p->tok.source_location, parse_type_derived(p, type));
+              lhs = parse_type_expr(p, type);
+              break;
+            }
+          }
+
+          /// Otherwise, this is a dereference.
+          push_expr_frame(p, &precedence, (ExprFrame){
+            .kind = EXPR_FRAME_DEREF,
+            .precedence = PREFIX_PRECEDENCE,
+            .start_or_count = at_count,
+          });
+        } break;
+
+        /// Unary operators.
+        case TK_MINUS:
+        case TK_AMPERSAND:
+        case TK_TILDE:
+        case TK_EXCLAM:
+        case TK_STAR: {
+          ExprFrame frame = {
+            .kind = EXPR_FRAME_PREFIX,
+            .precedence = PREFIX_PRECEDENCE,
+            .op = p->tok.type,
+            .start_or_count = p->tok.source_location.start,
+          };
+          next_token(p);
+          push_expr_frame(p, &precedence, frame);
+        } break;
+      }
     }
 
-    /// Handle binary operators. We can just check if the precedence of the current
-    /// token is less than the current precedence, even if the current token is not
-    /// an operator because `binary_operator_precedence` returns -1 in that case.
-    isz prec = binary_operator_precedence(p, p->tok);
+    /// The rules for operator precedence parsing are as follows:
+    ///     - unary prefix operators are unambiguously handled up above;
+    ///     - if the current token is a, unary postfix operator, then the
+    ///       current LHS is its operand;
+    ///     - if the current token is a binary operator whose precedence is
+    ///       higher than the current precedence, or higher than or equal to
+    ///       the current precedence if the operator is right-associative, then
+    ///       the current LHS is the LHS of that operator;
+    ///     - if the current token is "(" or "[", then this is a call/subscript
+    ///       expression. We handle these explicitly here since they usually have
+    ///       the highest precedence anyway.
+    ///     - otherwise, the current LHS is the operand of the operator on top
+    ///       of the stack, or the result if there is none.
+    while (lhs) {
+      /// TODO: Postfix operators also need to respect precedence.
+      /// Handle unary postfix operators.
+      if (is_postfix_operator(p->tok.type)) {
+        lhs = ast_make_unary(p->ast, (loc){.start = lhs->source_location.start, p->tok.source_location.end}, p->tok.type, true, lhs);
+        next_token(p);
+        continue;
+      }
 
-    /// If the precedence of the current token is less than the current precedence,
-    /// then we're done.
-    if (prec < current_precedence) return lhs;
+      /// Handle calls.
+      if (p->tok.type == TK_LPAREN) {
+        consume(p, TK_LPAREN);
+        if (p->tok.type == TK_RPAREN) {
+          lhs = ast_make_call(p->ast, (loc){lhs->source_location.start, p->tok.source_location.end}, lhs, (Nodes){0});
+          consume(p, TK_RPAREN);
+          continue;
+        }
 
-    /// If the precedence is the same, we’re done if the token is left-associative.
-    if (prec == current_precedence && !is_right_associative(p, p->tok)) return lhs;
+        push_expr_frame(p, &precedence, (ExprFrame){.kind = EXPR_FRAME_CALL, .precedence = 0, .lhs = lhs});
+        break;
+      }
 
-    /// Otherwise, we need to parse the RHS.
-    enum TokenType tt = p->tok.type;
-    next_token(p);
+      /// Handle subscripts.
+      if (p->tok.type == TK_LBRACK) {
+        next_token(p);
+        push_expr_frame(p, &precedence, (ExprFrame){.kind = EXPR_FRAME_SUBSCRIPT, .precedence = 0, .lhs = lhs});
+        break;
+      }
 
-    /// The `as` operator is special because its RHS is a type.
-    if (tt == TK_AS) {
-      Type *type = parse_type(p);
-      lhs = ast_make_cast(p->ast, (loc){.start = lhs->source_location.start, .end = type->source_location.end}, type, lhs);
-      continue;
-    }
+      /// Handle binary operators. We can just check if the precedence of the current
+      /// token is less than the current precedence, even if the current token is not
+      /// an operator because `binary_operator_precedence` returns -1 in that case.
+      isz prec = binary_operator_precedence(p, p->tok);
+
+      /// If the precedence of the current token is less than the current precedence,
+      /// or if it is the same and the token is left-associative, then the current
+      /// LHS is complete.
+      if (prec < precedence || (prec == precedence && !is_right_associative(p, p->tok))) {
+        if (p->expr_stack.size == base) return lhs;
+        ExprFrame *frame = &vector_back(p->expr_stack);
+        switch (frame->kind) {
+          case EXPR_FRAME_BINARY:
+            lhs = ast_make_binary(p->ast, (loc){.start = frame->lhs->source_location.start, .end = lhs->source_location.end}, frame->op, frame->lhs, lhs);
+            break;
+
+          case EXPR_FRAME_PREFIX:
+            lhs = ast_make_unary(p->ast, (loc){.start = (u32) frame->start_or_count, .end = lhs->source_location.end}, frame->op, false, lhs);
+            break;
+
+          /// Wrap the operand in an appropriate number of dereferences.
+          case EXPR_FRAME_DEREF:
+            for (usz i = 0; i < frame->start_or_count; i++) {
+              loc l = lhs->source_location;
+              lhs = ast_make_unary(p->ast, (loc){.start = l.start - 1, .end = l.end}, TK_AT, false, lhs);
+            }
+            break;
+
+          case EXPR_FRAME_PAREN:
+            consume(p, TK_RPAREN);
+            break;
+
+          case EXPR_FRAME_SUBSCRIPT: {
+            Node *index = lhs;
+            consume(p, TK_RBRACK);
+            lhs = ast_make_binary(p->ast, (loc){.start = frame->lhs->source_location.start, .end = index->source_location.end}, TK_LBRACK, frame->lhs, index);
+          } break;
+
+          /// Parse the next argument, if there is one.
+          case EXPR_FRAME_CALL:
+            vector_push(frame->args, lhs);
+            if (p->tok.type == TK_COMMA) next_token(p);
+            if (p->tok.type != TK_RPAREN) {
+              lhs = NULL;
+              continue;
+            }
+
+            lhs = ast_make_call(p->ast, (loc){frame->lhs->source_location.start, p->tok.source_location.end}, frame->lhs, frame->args);
+            consume(p, TK_RPAREN);
+            break;
+
+          /// Parse the next child of a block, if there is one.
+          case EXPR_FRAME_BLOCK:
+            vector_push(frame->args, lhs);
+            if (p->tok.type != TK_RBRACE) {
+              lhs = NULL;
+              continue;
+            }
+
+            consume(p, TK_RBRACE);
+            scope_pop(p->ast);
+            lhs = ast_make_block(p->ast, frame->location, frame->args);
+            break;
+
+          /// The branches of an `if` and the body of a `while` each get
+          /// a new scope.
+          case EXPR_FRAME_IF_CONDITION:
+          case EXPR_FRAME_WHILE_CONDITION:
+            frame->lhs = lhs;
+            frame->kind = frame->kind == EXPR_FRAME_IF_CONDITION ? EXPR_FRAME_IF_THEN : EXPR_FRAME_WHILE_BODY;
+            scope_push(p->ast);
+            lhs = NULL;
+            continue;
+
+          /// Parse the else branch, if there is one.
+          case EXPR_FRAME_IF_THEN:
+            scope_pop(p->ast);
+            if (p->tok.type == TK_ELSE) {
+              next_token(p);
+              frame->then = lhs;
+              frame->kind = EXPR_FRAME_IF_ELSE;
+              scope_push(p->ast);
+              lhs = NULL;
+              continue;
+            }
+
+            lhs = ast_make_if(p->ast, frame->location, frame->lhs, lhs, NULL);
+            break;
+
+          case EXPR_FRAME_IF_ELSE:
+            scope_pop(p->ast);
+            lhs = ast_make_if(p->ast, frame->location, frame->lhs, frame->then, lhs);
+            break;
+
+          case EXPR_FRAME_WHILE_BODY:
+            scope_pop(p->ast);
+            lhs = ast_make_while(p->ast, frame->location, frame->lhs, lhs);
+            break;
+        }
+
+        /// Continue with the operator below it.
+        (void) vector_pop(p->expr_stack);
+        precedence = p->expr_stack.size == base ? current_precedence : vector_back(p->expr_stack).precedence;
+        continue;
+      }
 
-    /// The `as` operator is special because its RHS is a type.
-    if (tt == TK_DOT) {
-      if (p->tok.type != TK_IDENT) ERR("RHS of operator '.' must be an identifier.");
-      lhs = ast_make_member_access(p->ast, (loc){.start = lhs->source_location.start, .end = p->tok.source_location.end}, as_span(p->tok.text), lhs);
-      // Yeet identifier token
+      /// Otherwise, we need to parse the RHS.
+      enum TokenType tt = p->tok.type;
       next_token(p);
-      continue;
-    }
 
-    /// Otherwise, the RHS is a regular expression.
-    else {
-      Node *rhs = parse_expr_with_precedence(p, prec);
+      /// The `as` operator is special because its RHS is a type.
+      if (tt == TK_AS) {
+        Type *type = parse_type(p);
+        lhs = ast_make_cast(p->ast, (loc){.start = lhs->source_location.start, .end = type->source_location.end}, type, lhs);
+        continue;
+      }
+
+      /// The `as` operator is special because its RHS is a type.
+      if (tt == TK_DOT) {
+        if (p->tok.type != TK_IDENT) ERR("RHS of operator '.' must be an identifier.");
+        lhs = ast_make_member_access(p->ast, (loc){.start = lhs->source_location.start, .end = p->tok.source_location.end}, p->tok.ident, lhs);
+        // Yeet identifier token
+        next_token(p);
+        continue;
+      }
 
-      /// Combine the LHS and RHS into a binary expression.
-      lhs = ast_make_binary(p->ast, (loc){.start = lhs->source_location.start, .end = rhs->source_location.end}, tt, lhs, rhs);
+      /// Otherwise, the RHS is a regular expression.
+      push_expr_frame(p, &precedence, (ExprFrame){.kind = EXPR_FRAME_BINARY, .precedence = prec, .op = tt, .lhs = lhs});
+      break;
     }
   }
 }
@@ -2026,27 +2685,50 @@ static Node *parse_expr_with_precedence(Parser *p, isz current_precedence) {
 #ifndef __clang__
 PUSH_IGNORE_WARNING("-Wclobbered");
 #endif
-Module *parse(span source, const char *filename) {
+/// Free the lexer state and macros of a parser.
+static void parser_free(Parser *p) {
+  foreach (entry, p->macros) {
+    vector_delete(entry->value.parameters);
+    vector_delete(entry->value.expansion);
+  }
+  map_delete(p->macros);
+  vector_delete(p->macro_expansion_stack);
+  vector_delete(p->macro_arguments);
+  vector_delete(p->pending_macro_arguments);
+  vector_delete(p->escaped);
+  foreach (frame, p->expr_stack) vector_delete(frame->args);
+  vector_delete(p->expr_stack);
+  vector_delete(p->tokens.types);
+  vector_delete(p->tokens.locations);
+  vector_delete(p->tokens.values);
+  vector_delete(p->tokens.atoms);
+  vector_delete(p->tokens.strings);
+  vector_delete(p->tokens.integers);
+}
+
+Module *parse(span source, const char *filename, bool lazy_bodies) {
   Parser p = {0};
   p.source = source;
   p.filename = filename;
+  p.lazy_bodies = lazy_bodies;
   p.curr = source.data;
-  p.end = source.data + source.size - 1;
+  p.end = source.data + source.size;
   p.raw_mode = false;
   p.lastc = ' ';
   p.ast = ast_create();
   p.ast->filename = string_create(filename);
-  p.ast->source = string_dup(source);
+  p.ast->source = source;
 
   /// Set up error handling.
   if (setjmp(p.error_buffer)) {
+    parser_free(&p);
     ast_free(p.ast);
     return NULL;
   }
 
 
-  /// Lex the first character and token.
-  next_char(&p);
+  /// Lex the file and read the first token.
+  lex(&p);
   next_token(&p);
 
   if (p.tok.type == TK_IDENT && string_eq(p.tok.text, literal_span("module")) && !p.tok.artificial) {
@@ -2090,15 +2772,83 @@ Module *parse(span source, const char *filename) {
     expr->parent = p.ast->root;
   }
 
+  /// Keep the parser around if we still need to parse some bodies.
+  if (p.deferred_bodies) {
+    p.ast->parser = malloc(sizeof(Parser));
+    *p.ast->parser = p;
+  } else {
+    parser_free(&p);
+  }
   return p.ast;
 }
 
+bool parse_deferred_body(Module *ast, Node *function) {
+  Parser *p = ast->parser;
+  NodeFunction *f = function->function;
+  ASSERT(p && f->deferred_body, "Function '%S' has no deferred body", f->name);
+
+  /// Only the global symbols that were declared before the function
+  /// are visible in its body. Nothing is added to the global scope
+  /// while parsing a body, so we can just hide the others.
+  Scope *global = ast->scope_stack.data[0];
+  usz global_symbols = global->symbols.size;
+  usz body = f->deferred_body;
+  usz body_end = f->deferred_body_end;
+  f->deferred_body = f->deferred_body_end = 0;
+
+  /// Set up error handling.
+  if (setjmp(p->error_buffer)) {
+    ast->deferred_parse_error = true;
+    global->symbols.size = global_symbols;
+    p->tokens_end = p->tokens.types.size - 1;
+    while (ast->scope_stack.size > 1) scope_pop(ast);
+    p->in_function = false;
+    p->in_deferred_body = false;
+    return false;
+  }
+
+  /// Read the `{` that starts the body. Stop reading after the `}` that
+  /// ends it, since what follows it has already been parsed.
+  global->symbols.size = f->deferred_globals;
+  p->token_index = body;
+  p->tokens_end = body_end;
+  p->in_function = true;
+  p->in_deferred_body = true;
+  next_token(p);
+  ASSERT(p->tok.type == TK_LBRACE);
+
+  /// Declare the parameters again and parse the body.
+  scope_push(ast);
+  foreach_val (param, f->param_decls) {
+    Symbol *sym = scope_add_symbol(curr_scope(p), SYM_VARIABLE, param->declaration.name, param);
+    ASSERT(sym, "Parameters of function '%S' have already been checked", f->name);
+  }
+  f->body = parse_expr(p);
+  f->body->parent = function;
+  scope_pop(ast);
+
+  ASSERT(p->tok.type == TK_EOF, "Deferred body of '%S' must be a single block", f->name);
+  ASSERT(global->symbols.size == f->deferred_globals);
+  global->symbols.size = global_symbols;
+  p->tokens_end = p->tokens.types.size - 1;
+  p->in_function = false;
+  p->in_deferred_body = false;
+  return true;
+}
+
+void parse_free_deferred(Module *ast) {
+  if (!ast->parser) return;
+  parser_free(ast->parser);
+  free(ast->parser);
+  ast->parser = NULL;
+}
+
 #ifndef __clang__
 POP_WARNINGS();
 #endif
 
 NODISCARD const char *token_type_to_string(enum TokenType type) {
-  STATIC_ASSERT(TK_COUNT == 54, "Exhaustive handling of token types in token type to string conversion");
+  STATIC_ASSERT(TK_COUNT == 55, "Exhaustive handling of token types in token type to string conversion");
   switch (type) {
     case TK_COUNT:
     case TK_INVALID: return "invalid";
@@ -2155,6 +2905,7 @@ NODISCARD const char *token_type_to_string(enum TokenType type) {
     case TK_GENSYM: return "gensym";
     case TK_MACRO_ARG: return "macro_arg";
     case TK_AST_NODE: return "ast_node";
+    case TK_BACKSLASH: return "\"\\\"";
   }
   UNREACHABLE();
 }
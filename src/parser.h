@@ -10,10 +10,24 @@
 
 /// Parse a program.
 ///
-/// \param source The source code to parse.
+/// \param source The source code to parse. It need not be NUL-terminated,
+///        and it must stay alive for as long as the returned module, which
+///        refers to it instead of making a copy.
 /// \param filename The name of the file that we’re parsing.
+/// \param lazy_bodies Whether to defer parsing the bodies of top-level
+///        functions until they are first referenced.
 /// \return An AST representing the source code on success, NULL on failure.
-NODISCARD Module *parse(span source, const char* filename);
+NODISCARD Module *parse(span source, const char* filename, bool lazy_bodies);
+
+/// Parse the body of a function whose parsing was deferred by parse().
+/// This is called by the typechecker when the function is first
+/// referenced; functions that never are never get a body.
+///
+/// \return False if the body contains a syntax error.
+NODISCARD bool parse_deferred_body(Module *ast, Node *function);
+
+/// Free the parser that a module keeps for deferred function bodies.
+void parse_free_deferred(Module *ast);
 
 /// Get the string representation of a token type.
 NODISCARD const char *token_type_to_string(enum TokenType type);
@@ -6,12 +6,24 @@
 #  include <fcntl.h>
 #  include <sys/stat.h>
 #  include <sys/mman.h>
+#  include <sys/resource.h>
+#  include <dirent.h>
 #  include <errno.h>
+#  ifdef __linux__
+#    include <sys/ioctl.h>
+#    include <linux/fs.h>
+#  endif
+#  ifdef __APPLE__
+#    include <mach/mach.h>
+#  endif
 #  define ADDR2LINE_BUFFER_SIZE 1024
 #else
 #  include <Windows.h>
 #  include <dbghelp.h>
+#  include <psapi.h>
 #  include <io.h>
+#  include <direct.h>
+#  include <sys/utime.h>
 #  define isatty _isatty
 #endif
 
@@ -25,12 +37,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <locale.h>
 
 #if defined(ENABLE_ASAN) && defined(ASAN_IGNORE_LEAKS)
 const char* __asan_default_options() { return "detect_leaks=0"; }
 #endif
 
+bool platform_fast_exit = false;
+
 /// ===========================================================================
 ///  Initialisation
 /// ===========================================================================
@@ -63,7 +78,7 @@ void platform_init(void) {
   /// Install signal handlers.
   struct sigaction sa = {0};
   sigemptyset(&sa.sa_mask);
-  sa.sa_flags = SA_SIGINFO;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
   sa.sa_sigaction = ice_signal_handler;
   if (sigaction(SIGSEGV, &sa, NULL)) ICE("Failed to install SIGSEGV handler");
   if (sigaction(SIGABRT, &sa, NULL)) ICE("Failed to install SIGABRT handler");
@@ -369,3 +384,508 @@ string platform_read_file(const char *path, bool *success) {
   return standard_read_file_contents(path, success);
 #endif
 }
+
+PlatformMappedFile platform_map_file(const char *path, bool *success) {
+  PlatformMappedFile file = {0};
+#ifndef _WIN32
+  /// Try to open the file.
+  if (success) *success = false;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    file.contents = as_span(format("Could not open file \"%s\" for reading: %s", path, strerror(errno)));
+    return file;
+  }
+
+  /// Stat it to determine its size, and make sure it’s a regular file.
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    (void) close(fd);
+    file.contents = as_span(format("Path \"%s\" is not a regular file", path));
+    return file;
+  }
+
+  /// Empty files can’t be mapped, and don’t need to be.
+  if (st.st_size == 0) {
+    (void) close(fd);
+    if (success) *success = true;
+    return file;
+  }
+
+  /// Map the file into memory. The descriptor is no longer needed
+  /// once the mapping exists.
+  void *data = mmap(NULL, (usz) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  (void) close(fd);
+  if (data == MAP_FAILED) goto read;
+  file.contents = (span){data, (usz) st.st_size};
+  file.mapped = true;
+  if (success) *success = true;
+  return file;
+
+read:
+#endif
+  /// Read the file instead; drop the NUL terminator on success.
+  bool ok = false;
+  string contents = standard_read_file_contents(path, &ok);
+  if (ok && contents.size) contents.size--;
+  file.contents = as_span(contents);
+  if (success) *success = ok;
+  return file;
+}
+
+void platform_unmap_file(PlatformMappedFile *file) {
+#ifndef _WIN32
+  if (file->mapped) (void) munmap((void *) file->contents.data, file->contents.size);
+  else free((void *) file->contents.data);
+#else
+  free((void *) file->contents.data);
+#endif
+  *file = (PlatformMappedFile){0};
+}
+
+bool platform_file_stamp(const char *path, PlatformFileStamp *stamp) {
+#ifndef _WIN32
+  struct stat st;
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) return false;
+  stamp->size = (u64) st.st_size;
+#  ifdef __APPLE__
+  stamp->modified = (u64) st.st_mtimespec.tv_sec * 1000000000 + (u64) st.st_mtimespec.tv_nsec;
+#  else
+  stamp->modified = (u64) st.st_mtim.tv_sec * 1000000000 + (u64) st.st_mtim.tv_nsec;
+#  endif
+#else
+  struct _stat64 st;
+  if (_stat64(path, &st) < 0 || !(st.st_mode & _S_IFREG)) return false;
+  stamp->size = (u64) st.st_size;
+  stamp->modified = (u64) st.st_mtime * 1000000000;
+#endif
+  return true;
+}
+
+string platform_absolute_path(const char *path) {
+#ifndef _WIN32
+  char *absolute = realpath(path, NULL);
+#else
+  char *absolute = _fullpath(NULL, path, 0);
+#endif
+  if (!absolute) return (string){0};
+  string s = string_create(absolute);
+  free(absolute);
+  return s;
+}
+
+string platform_executable_path(void) {
+#ifndef _WIN32
+  return platform_absolute_path("/proc/self/exe");
+#else
+  char path[MAX_PATH];
+  DWORD length = GetModuleFileNameA(NULL, path, sizeof path);
+  if (!length || length == sizeof path) return (string){0};
+  return string_create(path);
+#endif
+}
+
+bool platform_create_directory(const char *path) {
+#ifndef _WIN32
+  if (mkdir(path, 0777) == 0 || errno == EEXIST) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+  }
+  return false;
+#else
+  if (_mkdir(path) == 0) return true;
+  DWORD attributes = GetFileAttributesA(path);
+  return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#endif
+}
+
+bool platform_copy_file(const char *from, const char *to) {
+#ifndef _WIN32
+  int in = open(from, O_RDONLY);
+  if (in < 0) return false;
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+
+  /// On Linux, try to share the extents of the file first.
+  bool ok = true;
+#  if defined(__linux__) && defined(FICLONE)
+  if (ioctl(out, FICLONE, in) == 0) goto done;
+#  endif
+
+  /// Otherwise, copy its contents.
+  char buffer[64 * 1024];
+  for (;;) {
+    ssize_t got = read(in, buffer, sizeof buffer);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) {
+      ok = got == 0;
+      break;
+    }
+
+    for (ssize_t written = 0; written < got;) {
+      ssize_t w = write(out, buffer + written, (usz) (got - written));
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) {
+        ok = false;
+        goto done;
+      }
+      written += w;
+    }
+  }
+
+done:
+  close(in);
+  if (close(out) < 0) ok = false;
+  return ok;
+#else
+  return CopyFileA(from, to, FALSE);
+#endif
+}
+
+bool platform_rename_file(const char *from, const char *to) {
+#ifndef _WIN32
+  return rename(from, to) == 0;
+#else
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING);
+#endif
+}
+
+bool platform_touch_file(const char *path) {
+#ifndef _WIN32
+  return utimensat(AT_FDCWD, path, NULL, 0) == 0;
+#else
+  return _utime(path, NULL) == 0;
+#endif
+}
+
+bool platform_list_directory(const char *path, PlatformDirectoryEntries *entries) {
+  string_buffer file_path = {0};
+#ifndef _WIN32
+  DIR *dir = opendir(path);
+  if (!dir) return false;
+  for (struct dirent *ent; (ent = readdir(dir));) {
+    vector_clear(file_path);
+    format_to(&file_path, "%s" PLATFORM_PATH_SEPARATOR "%s", path, ent->d_name);
+    string_buf_zterm(&file_path);
+
+    PlatformDirectoryEntry entry = {0};
+    if (!platform_file_stamp(file_path.data, &entry.stamp)) continue;
+    entry.name = string_create(ent->d_name);
+    vector_push(*entries, entry);
+  }
+  closedir(dir);
+#else
+  format_to(&file_path, "%s\\*", path);
+  string_buf_zterm(&file_path);
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA(file_path.data, &data);
+  if (find == INVALID_HANDLE_VALUE) {
+    vector_delete(file_path);
+    return GetLastError() == ERROR_FILE_NOT_FOUND;
+  }
+  do {
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+    PlatformDirectoryEntry entry = {0};
+    entry.name = string_create(data.cFileName);
+    entry.stamp.size = ((u64) data.nFileSizeHigh << 32) | data.nFileSizeLow;
+
+    /// FILETIMEs count 100ns intervals.
+    entry.stamp.modified = (((u64) data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime) * 100;
+    vector_push(*entries, entry);
+  } while (FindNextFileA(find, &data));
+  FindClose(find);
+#endif
+  vector_delete(file_path);
+  return true;
+}
+
+void platform_memory_stream_open(PlatformMemoryStream *stream) {
+  *stream = (PlatformMemoryStream){0};
+#ifndef _WIN32
+  stream->file = open_memstream(&stream->data, &stream->size);
+#else
+  stream->file = tmpfile();
+#endif
+  if (!stream->file) ICE("Could not open memory stream: %s", strerror(errno));
+}
+
+string platform_memory_stream_close(PlatformMemoryStream *stream) {
+  string out = {0};
+#ifndef _WIN32
+  fclose(stream->file);
+  out.data = stream->data;
+  out.size = stream->size;
+#else
+  fflush(stream->file);
+  long size = ftell(stream->file);
+  if (size < 0) ICE("Could not determine size of memory stream: %s", strerror(errno));
+  out.size = (usz) size;
+  out.data = malloc(out.size + 1);
+  rewind(stream->file);
+  if (fread(out.data, 1, out.size, stream->file) != out.size)
+    ICE("Could not read contents of memory stream: %s", strerror(errno));
+  out.data[out.size] = 0;
+  fclose(stream->file);
+#endif
+  *stream = (PlatformMemoryStream){0};
+  return out;
+}
+
+/// ===========================================================================
+///  Time.
+/// ===========================================================================
+/// CPU time used by threads of finished platform_parallel_for() calls.
+static THREAD_LOCAL u64 parallel_for_cpu_time = 0;
+
+u64 platform_wall_time(void) {
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64) ts.tv_sec * 1000000000 + (u64) ts.tv_nsec;
+#else
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return (u64) (count.QuadPart / frequency.QuadPart) * 1000000000
+       + (u64) (count.QuadPart % frequency.QuadPart) * 1000000000 / (u64) frequency.QuadPart;
+#endif
+}
+
+u64 platform_cpu_time(void) {
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  u64 own = (u64) ts.tv_sec * 1000000000 + (u64) ts.tv_nsec;
+#else
+  FILETIME creation, exit, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+  u64 k = ((u64) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+  u64 u = ((u64) user.dwHighDateTime << 32) | user.dwLowDateTime;
+  /// FILETIMEs are in units of 100ns.
+  u64 own = (k + u) * 100;
+#endif
+  return own + parallel_for_cpu_time;
+}
+
+/// ===========================================================================
+///  Memory.
+/// ===========================================================================
+u64 platform_peak_rss(void) {
+#ifndef _WIN32
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  /// macOS reports this in bytes, Linux in kilobytes.
+#  ifdef __APPLE__
+  return (u64) usage.ru_maxrss;
+#  else
+  return (u64) usage.ru_maxrss * 1024;
+#  endif
+#else
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) return 0;
+  return (u64) counters.PeakWorkingSetSize;
+#endif
+}
+
+u64 platform_current_rss(void) {
+#if defined(__APPLE__)
+  /// There is no /proc on macOS.
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) return 0;
+  return (u64) info.resident_size;
+#elif !defined(_WIN32)
+  /// The second field is the number of resident pages.
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (!statm) return 0;
+  unsigned long long size = 0, resident = 0;
+  int fields = fscanf(statm, "%llu %llu", &size, &resident);
+  fclose(statm);
+  if (fields != 2) return 0;
+  return (u64) resident * (u64) sysconf(_SC_PAGESIZE);
+#else
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) return 0;
+  return (u64) counters.WorkingSetSize;
+#endif
+}
+
+void *platform_allocate_pages(usz size) {
+#ifndef _WIN32
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) ICE("Could not allocate %Z bytes: %s", size, strerror(errno));
+#else
+  void *ptr = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  if (!ptr) ICE("Could not allocate %Z bytes", size);
+#endif
+  return ptr;
+}
+
+void platform_free_pages(void *ptr, usz size) {
+#ifndef _WIN32
+  munmap(ptr, size);
+#else
+  (void) size;
+  VirtualFree(ptr, 0, MEM_RELEASE);
+#endif
+}
+
+/// ===========================================================================
+///  Threads.
+/// ===========================================================================
+/// The number of mutexes that the calling thread holds.
+static THREAD_LOCAL usz mutexes_held = 0;
+
+void platform_mutex_lock(PlatformMutex *mutex) {
+#ifndef _WIN32
+  pthread_mutex_lock(mutex);
+#else
+  AcquireSRWLockExclusive((PSRWLOCK) mutex);
+#endif
+  mutexes_held++;
+}
+
+void platform_mutex_unlock(PlatformMutex *mutex) {
+  mutexes_held--;
+#ifndef _WIN32
+  pthread_mutex_unlock(mutex);
+#else
+  ReleaseSRWLockExclusive((PSRWLOCK) mutex);
+#endif
+}
+
+bool platform_mutex_held(void) {
+  return mutexes_held != 0;
+}
+
+usz platform_cpu_count(void) {
+#ifndef _WIN32
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (usz) count : 1;
+#else
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors ? (usz) info.dwNumberOfProcessors : 1;
+#endif
+}
+
+/// Worker threads recurse just as deeply as the main thread does
+/// (parser, typechecker, codegen), so don’t settle for whatever
+/// tiny default stack the platform hands out.
+#define PLATFORM_THREAD_STACK_SIZE ((usz) 64 * 1024 * 1024)
+
+typedef struct ParallelForState {
+  PlatformMutex lock;
+  usz next;
+  usz count;
+  PlatformParallelCallback callback;
+  void *data;
+  bool use_colours;
+  bool disable_type_colours;
+
+  /// Whether the calling thread catches fatal errors, and whether any
+  /// thread raised one.
+  bool catch_fatal_errors;
+  bool failed;
+
+  /// CPU time used by the spawned threads.
+  u64 cpu_time;
+} ParallelForState;
+
+static void parallel_for_work(void *arg) {
+  ParallelForState *state = arg;
+  for (;;) {
+    platform_mutex_lock(&state->lock);
+    usz index = state->next++;
+    platform_mutex_unlock(&state->lock);
+    if (index >= state->count) break;
+    state->callback(index, state->data);
+  }
+}
+
+/// If the calling thread catches fatal errors, a fatal error in any
+/// thread stops handing out indices; the calling thread raises it once
+/// all threads are done, since we can’t jump across threads.
+static void parallel_for_worker(ParallelForState *state) {
+  if (!state->catch_fatal_errors) {
+    parallel_for_work(state);
+    return;
+  }
+
+  if (!catch_fatal_errors(parallel_for_work, state)) {
+    platform_mutex_lock(&state->lock);
+    state->failed = true;
+    state->next = state->count;
+    platform_mutex_unlock(&state->lock);
+  }
+}
+
+#ifndef _WIN32
+static void *parallel_for_thread(void *arg) {
+#else
+static DWORD WINAPI parallel_for_thread(LPVOID arg) {
+#endif
+  ParallelForState *state = arg;
+  thread_use_colours = state->use_colours;
+  thread_disable_type_colours = state->disable_type_colours;
+  u64 start = platform_cpu_time();
+  parallel_for_worker(state);
+  u64 used = platform_cpu_time() - start;
+  platform_mutex_lock(&state->lock);
+  state->cpu_time += used;
+  platform_mutex_unlock(&state->lock);
+  return 0;
+}
+
+void platform_parallel_for(usz count, usz jobs, PlatformParallelCallback callback, void *data) {
+  if (!jobs) jobs = platform_cpu_count();
+  if (jobs > count) jobs = count;
+
+  /// Don’t bother spawning threads if we’d only use one anyway.
+  if (jobs <= 1) {
+    for (usz i = 0; i < count; ++i) callback(i, data);
+    return;
+  }
+
+  ParallelForState state = {
+    .lock = PLATFORM_MUTEX_INIT,
+    .count = count,
+    .callback = callback,
+    .data = data,
+    .use_colours = thread_use_colours,
+    .disable_type_colours = thread_disable_type_colours,
+    .catch_fatal_errors = fatal_errors_are_caught(),
+  };
+
+  /// The calling thread takes part in the work too, so we only
+  /// need to spawn `jobs - 1` additional threads.
+#ifndef _WIN32
+  pthread_t *threads = calloc(jobs - 1, sizeof(*threads));
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, PLATFORM_THREAD_STACK_SIZE);
+  for (usz i = 0; i < jobs - 1; ++i) {
+    int err = pthread_create(threads + i, &attr, parallel_for_thread, &state);
+    if (err) ICE("Failed to create thread: %s", strerror(err));
+  }
+  pthread_attr_destroy(&attr);
+  parallel_for_worker(&state);
+  for (usz i = 0; i < jobs - 1; ++i) pthread_join(threads[i], NULL);
+#else
+  HANDLE *threads = calloc(jobs - 1, sizeof(*threads));
+  for (usz i = 0; i < jobs - 1; ++i) {
+    threads[i] = CreateThread(NULL, PLATFORM_THREAD_STACK_SIZE, parallel_for_thread, &state, 0, NULL);
+    if (!threads[i]) ICE("Failed to create thread: error %lu", GetLastError());
+  }
+  parallel_for_worker(&state);
+  for (usz i = 0; i < jobs - 1; ++i) {
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+  }
+#endif
+  free(threads);
+  parallel_for_cpu_time += state.cpu_time;
+  if (state.failed) rethrow_fatal_error();
+}
@@ -2,9 +2,12 @@
 #define FUNCOMPILER_PLATFORM_H
 
 #include <stdbool.h>
+#include <stdio.h>
 #include <utils.h>
+#include <vector.h>
 
 #ifndef _WIN32
+#  include <pthread.h>
 #  define PLATFORM_PATH_SEPARATOR "/"
 #else
 #  define PLATFORM_PATH_SEPARATOR "\\"
@@ -19,6 +22,18 @@
 # define ASAN_UNPOISON(ptr, size) ((void) 0)
 #endif
 
+/// Leak checkers report everything that is still allocated at exit,
+/// so sanitiser builds always free everything.
+#if defined(ENABLE_ASAN) && !defined(FULL_TEARDOWN)
+# define FULL_TEARDOWN 1
+#endif
+
+/// Whether memory that would only be freed just before the process
+/// exits should be left for the OS to reclaim instead. This is only
+/// ever set by the command line interface, never by the library or
+/// the compile server, and never if FULL_TEARDOWN is defined.
+extern bool platform_fast_exit;
+
 /// Initialise the program for the host platform.
 void platform_init(void);
 
@@ -37,4 +52,165 @@ void platform_print_backtrace(int ignore);
 /// \return The contents of the file, or an error message on failure.
 string platform_read_file(const char *path, bool *success);
 
+/// A file whose contents are mapped into memory.
+typedef struct PlatformMappedFile {
+  /// The contents of the file. These are not NUL-terminated.
+  span contents;
+
+  /// Whether `contents` is a mapping, rather than a copy on the heap.
+  bool mapped;
+} PlatformMappedFile;
+
+/// Map a file into memory, read-only, instead of copying it. If the file
+/// can’t be mapped, it is read instead. Either way, the contents stay valid
+/// until the file is unmapped.
+///
+/// \param path The path to the file to map.
+/// \param success Whether the file could be mapped or read.
+/// \return The file. On failure, its contents are an error message.
+PlatformMappedFile platform_map_file(const char *path, bool *success);
+
+/// Unmap a file mapped by platform_map_file(), or free its error message.
+void platform_unmap_file(PlatformMappedFile *file);
+
+/// Information that changes whenever a file is modified.
+typedef struct PlatformFileStamp {
+  u64 size;
+  u64 modified;
+} PlatformFileStamp;
+
+/// Get the stamp of a regular file.
+///
+/// \return Whether `path` names a regular file.
+bool platform_file_stamp(const char *path, PlatformFileStamp *stamp);
+
+/// Get the absolute path of a file. The caller is responsible for
+/// freeing the returned string, which is empty on failure.
+string platform_absolute_path(const char *path);
+
+/// Get the absolute path of the running executable. The caller is
+/// responsible for freeing the returned string, which is empty on failure.
+string platform_executable_path(void);
+
+/// Create a directory. It is not an error if it already exists.
+///
+/// \return Whether the directory exists now.
+bool platform_create_directory(const char *path);
+
+/// Copy a file, replacing `to` if it exists. Where the file system
+/// supports it, the copy shares its storage with the original.
+///
+/// \return Whether the file was copied.
+bool platform_copy_file(const char *from, const char *to);
+
+/// Atomically replace `to` with `from`.
+///
+/// \return Whether the file was renamed.
+bool platform_rename_file(const char *from, const char *to);
+
+/// Set the modification time of a file to the current time.
+///
+/// \return Whether the file exists and was updated.
+bool platform_touch_file(const char *path);
+
+/// A regular file in a directory.
+typedef struct PlatformDirectoryEntry {
+  string name;
+  PlatformFileStamp stamp;
+} PlatformDirectoryEntry;
+
+typedef Vector(PlatformDirectoryEntry) PlatformDirectoryEntries;
+
+/// Get all regular files in a directory. The caller is responsible
+/// for freeing the names and the vector.
+///
+/// \return Whether the directory could be read.
+bool platform_list_directory(const char *path, PlatformDirectoryEntries *entries);
+
+/// A stream that writes into memory.
+typedef struct PlatformMemoryStream {
+  FILE *file;
+  char *data;
+  size_t size;
+} PlatformMemoryStream;
+
+/// Open a stream that writes into memory. Write to `stream->file`.
+void platform_memory_stream_open(PlatformMemoryStream *stream);
+
+/// Close a memory stream and return everything that was written to
+/// it. The caller is responsible for freeing the returned string.
+string platform_memory_stream_close(PlatformMemoryStream *stream);
+
+/// ===========================================================================
+///  Time.
+/// ===========================================================================
+/// Get the current time of a monotonic clock, in nanoseconds.
+u64 platform_wall_time(void);
+
+/// Get the CPU time used by the calling thread, in nanoseconds. This
+/// includes the time used by the threads of all calls to
+/// platform_parallel_for() made by this thread that have returned.
+u64 platform_cpu_time(void);
+
+/// ===========================================================================
+///  Memory.
+/// ===========================================================================
+/// Get the largest amount of physical memory that this process
+/// has used so far, in bytes.
+u64 platform_peak_rss(void);
+
+/// Get the amount of physical memory that this process is using
+/// right now, in bytes, or 0 if that can’t be determined.
+u64 platform_current_rss(void);
+
+/// Allocate zero-initialised memory directly from the operating
+/// system. Use this for large blocks only, since the size is rounded
+/// up to a multiple of the page size.
+///
+/// \return The memory; the process is aborted if none is available.
+void *platform_allocate_pages(usz size);
+
+/// Free memory allocated with platform_allocate_pages(). `size` must
+/// be the size that was passed when it was allocated.
+void platform_free_pages(void *ptr, usz size);
+
+/// ===========================================================================
+///  Threads.
+/// ===========================================================================
+/// A mutex that can be initialised statically with PLATFORM_MUTEX_INIT.
+#ifndef _WIN32
+typedef pthread_mutex_t PlatformMutex;
+#  define PLATFORM_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#else
+/// Layout-compatible with an SRWLOCK; we don’t want to drag in
+/// <Windows.h> everywhere this header is included.
+typedef struct PlatformMutex { void *ptr; } PlatformMutex;
+#  define PLATFORM_MUTEX_INIT {0}
+#endif
+
+void platform_mutex_lock(PlatformMutex *mutex);
+void platform_mutex_unlock(PlatformMutex *mutex);
+
+/// Whether the calling thread holds any mutex.
+bool platform_mutex_held(void);
+
+/// Get the number of processors that are available to this process.
+usz platform_cpu_count(void);
+
+/// Callback for platform_parallel_for().
+FUNCTION_POINTER(void, PlatformParallelCallback, usz index, void *data);
+
+/// Call `callback(i, data)` for every `i` in `[0, count)`, using up
+/// to `jobs` threads. Indices are handed out in ascending order, but
+/// may complete in any order; callers that need deterministic output
+/// should store results by index. Returns once all calls are done.
+///
+/// If `jobs` is 0, the number of available processors is used. If
+/// only one thread would be used, everything is run on the calling
+/// thread. Worker threads inherit the diagnostics colour settings of
+/// the calling thread. If the calling thread catches fatal errors, a
+/// fatal error in any thread is raised again in the calling thread
+/// once all threads are done; see catch_fatal_errors().
+void platform_parallel_for(usz count, usz jobs, PlatformParallelCallback callback, void *data);
+
 #endif // FUNCOMPILER_PLATFORM_H
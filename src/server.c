@@ -0,0 +1,401 @@
+/// For SO_PEERCRED.
+#ifdef __linux__
+#  define _GNU_SOURCE
+#endif
+
+#include <codegen.h>
+#include <errno.h>
+#include <error.h>
+#include <module.h>
+#include <server.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector.h>
+
+#ifndef _WIN32
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/socket.h>
+#  include <sys/stat.h>
+#  include <sys/un.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+
+/// Identifies requests and the version of the protocol.
+#define SERVER_MAGIC 0x43544E49 /// "INTC"
+#define SERVER_VERSION 1
+
+/// Sent by the client along with its stdout and stderr. This is
+/// followed by the working directory of the client and then the
+/// arguments, each terminated by a NUL. Once the compilation is
+/// done, the server replies with its exit status as an i32.
+typedef struct ServerRequest {
+  u32 magic;
+  u32 version;
+  u32 argc;
+  u32 payload_size;
+} ServerRequest;
+
+/// A compilation that is in progress in a child process.
+typedef struct ServerChild {
+  pid_t pid;
+  int client;
+
+  /// The child writes the paths of the modules it had to read from
+  /// disk to this pipe; it is closed once the child has exited.
+  int modules;
+  string_buffer module_paths;
+} ServerChild;
+
+static bool write_all(int fd, const void *data, usz size) {
+  const char *ptr = data;
+  while (size) {
+    ssize_t written = write(fd, ptr, size);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return false;
+    ptr += written;
+    size -= (usz) written;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *data, usz size) {
+  char *ptr = data;
+  while (size) {
+    ssize_t got = read(fd, ptr, size);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return false;
+    ptr += got;
+    size -= (usz) got;
+  }
+  return true;
+}
+
+/// Get the address of the socket at `socket_path`.
+static bool socket_address(const char *socket_path, struct sockaddr_un *address) {
+  *address = (struct sockaddr_un){0};
+  address->sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof address->sun_path) {
+    fprint(stderr, "Socket path \"%s\" is too long\n", socket_path);
+    return false;
+  }
+  strcpy(address->sun_path, socket_path);
+  return true;
+}
+
+/// Handle a request in a child process. Never returns.
+static NORETURN void serve_request(int client, int modules, ServerCompileCallback compile) {
+  /// Receive the header together with the stdout and stderr of the client.
+  ServerRequest request = {0};
+  int streams[2] = {-1, -1};
+  union {
+    char buffer[CMSG_SPACE(sizeof streams)];
+    struct cmsghdr align;
+  } control = {0};
+  struct iovec iov = {&request, sizeof request};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof control.buffer;
+
+  ssize_t received = recvmsg(client, &msg, MSG_WAITALL);
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  if (
+    received != sizeof request ||
+    request.magic != SERVER_MAGIC ||
+    request.version != SERVER_VERSION ||
+    !c ||
+    c->cmsg_level != SOL_SOCKET ||
+    c->cmsg_type != SCM_RIGHTS ||
+    c->cmsg_len != CMSG_LEN(sizeof streams)
+  ) {
+    fprint(stderr, "Received invalid request\n");
+    exit(1);
+  }
+  memcpy(streams, CMSG_DATA(c), sizeof streams);
+
+  /// Receive the working directory and arguments.
+  char *payload = calloc(request.payload_size + 1, 1);
+  if (!payload || !read_all(client, payload, request.payload_size)) {
+    fprint(stderr, "Received truncated request\n");
+    exit(1);
+  }
+  close(client);
+
+  /// Compile using the stdout and stderr of the client from now on.
+  dup2(streams[0], STDOUT_FILENO);
+  dup2(streams[1], STDERR_FILENO);
+  close(streams[0]);
+  close(streams[1]);
+
+  const char *end = payload + request.payload_size;
+  const char *cwd = payload;
+  char **argv = calloc(request.argc + 2, sizeof *argv);
+  argv[0] = "intc";
+  const char *arg = cwd + strlen(cwd) + 1;
+  for (u32 i = 1; i <= request.argc; i++) {
+    if (arg >= end) {
+      fprint(stderr, "Received truncated request\n");
+      exit(1);
+    }
+    argv[i] = (char *) arg;
+    arg += strlen(arg) + 1;
+  }
+
+  if (chdir(cwd) < 0) {
+    fprint(stderr, "Could not change to directory \"%s\": %s\n", cwd, strerror(errno));
+    exit(1);
+  }
+
+  int status = compile((int) request.argc + 1, argv);
+  fflush(stdout);
+  fflush(stderr);
+
+  /// Tell the server which modules it should keep in memory.
+  string paths = module_take_loaded_paths();
+  write_all(modules, paths.data, paths.size);
+  exit(status);
+}
+
+/// Read what a child has written about the modules it loaded.
+///
+/// \return Whether the child is done.
+static bool read_child_modules(ServerChild *child) {
+  char buffer[4096];
+  ssize_t got = read(child->modules, buffer, sizeof buffer);
+  if (got < 0) return errno != EINTR && errno != EAGAIN;
+  if (got == 0) return true;
+  vector_append(child->module_paths, ((span){buffer, (usz) got}));
+  return false;
+}
+
+/// Send the exit status of a child to its client and clean up.
+static void finish_child(ServerChild *child) {
+  int wait_status = 0;
+  while (waitpid(child->pid, &wait_status, 0) < 0 && errno == EINTR);
+
+  i32 status = 1;
+  if (WIFEXITED(wait_status)) status = WEXITSTATUS(wait_status);
+  else if (WIFSIGNALED(wait_status)) status = 128 + WTERMSIG(wait_status);
+  write_all(child->client, &status, sizeof status);
+  close(child->client);
+  close(child->modules);
+
+  /// Keep the interfaces of the modules it loaded for later requests.
+  string_buf_zterm(&child->module_paths);
+  for (usz i = 0; i < child->module_paths.size; i += strlen(child->module_paths.data + i) + 1)
+    module_cache_add(child->module_paths.data + i);
+  vector_delete(child->module_paths);
+}
+
+/// Check that a client is run by the same user as the server.
+static bool client_is_trusted(int client) {
+#  ifdef __linux__
+  struct ucred credentials;
+  socklen_t size = sizeof credentials;
+  if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &credentials, &size) < 0) return false;
+  return credentials.uid == geteuid();
+#  else
+  uid_t uid;
+  gid_t gid;
+  if (getpeereid(client, &uid, &gid) < 0) return false;
+  return uid == geteuid();
+#  endif
+}
+
+int server_run(const char *socket_path, ServerCompileCallback compile) {
+  struct sockaddr_un address;
+  if (!socket_address(socket_path, &address)) return 1;
+
+  /// Replace stale sockets, but not servers that are still running.
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    fprint(stderr, "Could not create socket: %s\n", strerror(errno));
+    return 1;
+  }
+  if (connect(listener, (struct sockaddr *) &address, sizeof address) == 0) {
+    fprint(stderr, "A compile server is already listening on \"%s\"\n", socket_path);
+    close(listener);
+    return 1;
+  }
+  close(listener);
+
+  struct stat st;
+  if (lstat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(socket_path);
+
+  /// A client can make us write files anywhere we can, so only the
+  /// user running the server may connect to it.
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+  int bound = listener < 0 ? -1 : bind(listener, (struct sockaddr *) &address, sizeof address);
+  umask(mask);
+  if (bound < 0 || listen(listener, SOMAXCONN) < 0) {
+    fprint(stderr, "Could not listen on \"%s\": %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+
+  /// Clients may disconnect before we reply.
+  signal(SIGPIPE, SIG_IGN);
+
+  /// Everything loaded here is inherited by every child.
+  codegen_warm_caches();
+  fprint(stderr, "Listening on \"%s\"\n", socket_path);
+
+  Vector(ServerChild) children = {0};
+  Vector(struct pollfd) polled = {0};
+  for (;;) {
+    vector_clear(polled);
+    vector_push(polled, ((struct pollfd){.fd = listener, .events = POLLIN}));
+    foreach (child, children) vector_push(polled, ((struct pollfd){.fd = child->modules, .events = POLLIN}));
+    if (poll(polled.data, (nfds_t) polled.size, -1) < 0) {
+      if (errno == EINTR) continue;
+      fprint(stderr, "Could not poll: %s\n", strerror(errno));
+      break;
+    }
+
+    /// Finish compilations that are done. Iterate backwards
+    /// since this removes children from the list.
+    foreach_index_rev (i, children) {
+      if (!polled.data[i + 1].revents) continue;
+      if (!read_child_modules(children.data + i)) continue;
+      finish_child(children.data + i);
+      vector_remove_index(children, i);
+    }
+
+    /// Start new compilations.
+    if (!(polled.data[0].revents & POLLIN)) continue;
+    int client = accept(listener, NULL, NULL);
+    if (client < 0) continue;
+    if (!client_is_trusted(client)) {
+      fprint(stderr, "Rejected a client run by another user\n");
+      close(client);
+      continue;
+    }
+
+    int modules[2];
+    if (pipe(modules) < 0) {
+      fprint(stderr, "Could not create pipe: %s\n", strerror(errno));
+      close(client);
+      continue;
+    }
+
+    /// Don’t let the child flush what we have buffered.
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(listener);
+      close(modules[0]);
+      foreach (child, children) {
+        close(child->client);
+        close(child->modules);
+      }
+      serve_request(client, modules[1], compile);
+    }
+
+    close(modules[1]);
+    if (pid < 0) {
+      fprint(stderr, "Could not fork: %s\n", strerror(errno));
+      close(client);
+      close(modules[0]);
+      continue;
+    }
+
+    ServerChild child = {.pid = pid, .client = client, .modules = modules[0]};
+    vector_push(children, child);
+  }
+
+  close(listener);
+  return 1;
+}
+
+int server_forward(const char *socket_path, int argc, char **argv) {
+  struct sockaddr_un address;
+  if (!socket_address(socket_path, &address)) return 1;
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0 || connect(server, (struct sockaddr *) &address, sizeof address) < 0) {
+    fprint(stderr, "Could not connect to compile server at \"%s\": %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+
+  /// The server compiles in our working directory.
+  char *cwd = getcwd(NULL, 0);
+  if (!cwd) {
+    fprint(stderr, "Could not get working directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  string_buffer payload = {0};
+  vector_append(payload, ((span){cwd, strlen(cwd) + 1}));
+  for (int i = 0; i < argc; i++) vector_append(payload, ((span){argv[i], strlen(argv[i]) + 1}));
+  free(cwd);
+
+  /// Send the header along with our stdout and stderr.
+  ServerRequest request = {
+    .magic = SERVER_MAGIC,
+    .version = SERVER_VERSION,
+    .argc = (u32) argc,
+    .payload_size = (u32) payload.size,
+  };
+  int streams[2] = {STDOUT_FILENO, STDERR_FILENO};
+  union {
+    char buffer[CMSG_SPACE(sizeof streams)];
+    struct cmsghdr align;
+  } control = {0};
+  struct iovec iov = {&request, sizeof request};
+  struct msghdr msg = {0};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof control.buffer;
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(sizeof streams);
+  memcpy(CMSG_DATA(c), streams, sizeof streams);
+
+  /// Our output may be interleaved with that of the server.
+  fflush(stdout);
+  fflush(stderr);
+
+  /// Report it if the server hangs up on us, e.g. because
+  /// it was started by another user.
+  signal(SIGPIPE, SIG_IGN);
+
+  i32 status = 1;
+  if (
+    sendmsg(server, &msg, 0) != sizeof request ||
+    !write_all(server, payload.data, payload.size) ||
+    !read_all(server, &status, sizeof status)
+  ) {
+    fprint(stderr, "Lost connection to compile server at \"%s\"\n", socket_path);
+    status = 1;
+  }
+
+  vector_delete(payload);
+  close(server);
+  return status;
+}
+
+#else
+
+int server_run(const char *socket_path, ServerCompileCallback compile) {
+  (void) socket_path;
+  (void) compile;
+  fprint(stderr, "The compile server is not supported on this platform\n");
+  return 1;
+}
+
+int server_forward(const char *socket_path, int argc, char **argv) {
+  (void) socket_path;
+  (void) argc;
+  (void) argv;
+  fprint(stderr, "The compile server is not supported on this platform\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef INTERCEPT_SERVER_H
+#define INTERCEPT_SERVER_H
+
+#include <utils.h>
+
+/// Compile according to a command line; returns the exit status.
+FUNCTION_POINTER(int, ServerCompileCallback, int argc, char **argv);
+
+/// Run a compile server that listens on the Unix domain socket at
+/// `socket_path` and never returns unless there is an error.
+///
+/// The server parses the ISel tables once and keeps the interfaces of
+/// all modules that were imported in memory. Every request is handled
+/// by a fork of the server, which compiles using `compile` in the
+/// working directory of the client and with its stdout and stderr, so
+/// requests are isolated from one another and can run concurrently.
+///
+/// \return The exit status of the server.
+int server_run(const char *socket_path, ServerCompileCallback compile);
+
+/// Forward a command line to the server at `socket_path`, which
+/// compiles it as if it were passed to intc in this process.
+///
+/// \param argc The number of arguments, excluding the program name.
+/// \param argv The arguments, excluding the program name.
+/// \return The exit status of the compilation.
+int server_forward(const char *socket_path, int argc, char **argv);
+
+#endif // INTERCEPT_SERVER_H
@@ -0,0 +1,150 @@
+#include <platform.h>
+#include <stats.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector.h>
+
+struct PassStats {
+  const char *name;
+  u64 created;
+  u64 removed;
+};
+
+/// Size of a section, summed over all object files.
+typedef struct SectionStats {
+  const char *name;
+  u64 bytes;
+} SectionStats;
+
+const char *stats_json_path = NULL;
+
+#define STATISTIC_NAME(name, json_name) json_name,
+static const char *statistic_names[STAT_COUNT] = { ALL_STATISTICS(STATISTIC_NAME) };
+#undef STATISTIC_NAME
+
+/// Counters are updated atomically; the tables of passes
+/// and sections are protected by the lock.
+static u64 statistics[STAT_COUNT] = {0};
+static PlatformMutex stats_lock = PLATFORM_MUTEX_INIT;
+static Vector(PassStats *) passes = {0};
+static Vector(SectionStats) sections = {0};
+
+/// The pass that is currently running on this thread, if any.
+static THREAD_LOCAL PassStats *current_pass = NULL;
+
+void stats_add(Statistic stat, u64 value) {
+  if (!STATS_ENABLED()) return;
+  __atomic_fetch_add(statistics + stat, value, __ATOMIC_RELAXED);
+}
+
+void stats_max(Statistic stat, u64 value) {
+  if (!STATS_ENABLED()) return;
+  u64 current = __atomic_load_n(statistics + stat, __ATOMIC_RELAXED);
+  while (current < value) {
+    /// On failure, this reloads the current value.
+    if (__atomic_compare_exchange_n(statistics + stat, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+}
+
+PassStats *stats_begin_pass(const char *name) {
+  PassStats *previous = current_pass;
+  if (!STATS_ENABLED()) return previous;
+
+  /// Passes are identified by their name.
+  platform_mutex_lock(&stats_lock);
+  PassStats *pass = NULL;
+  foreach_val (p, passes) {
+    if (strcmp(p->name, name) == 0) {
+      pass = p;
+      break;
+    }
+  }
+
+  if (!pass) {
+    pass = calloc(1, sizeof *pass);
+    pass->name = name;
+    vector_push(passes, pass);
+  }
+  platform_mutex_unlock(&stats_lock);
+
+  current_pass = pass;
+  return previous;
+}
+
+void stats_end_pass(PassStats *previous) {
+  current_pass = previous;
+}
+
+void stats_ir_instruction_created(void) {
+  if (!STATS_ENABLED()) return;
+  __atomic_fetch_add(statistics + STAT_IR_INSTRUCTIONS_CREATED, 1, __ATOMIC_RELAXED);
+  if (current_pass) __atomic_fetch_add(&current_pass->created, 1, __ATOMIC_RELAXED);
+}
+
+void stats_ir_instruction_removed(void) {
+  if (!STATS_ENABLED()) return;
+  __atomic_fetch_add(statistics + STAT_IR_INSTRUCTIONS_REMOVED, 1, __ATOMIC_RELAXED);
+  if (current_pass) __atomic_fetch_add(&current_pass->removed, 1, __ATOMIC_RELAXED);
+}
+
+void stats_add_section(const char *name, u64 bytes) {
+  if (!STATS_ENABLED()) return;
+  platform_mutex_lock(&stats_lock);
+  SectionStats *section = NULL;
+  foreach (s, sections) {
+    if (strcmp(s->name, name) == 0) {
+      section = s;
+      break;
+    }
+  }
+
+  if (section) section->bytes += bytes;
+  else {
+    /// Section names are owned by the object file.
+    SectionStats s = {strdup(name), bytes};
+    vector_push(sections, s);
+  }
+  platform_mutex_unlock(&stats_lock);
+}
+
+bool stats_write_json(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) return false;
+
+  /// None of the names need to be escaped.
+  platform_mutex_lock(&stats_lock);
+  fprint(file, "{");
+  for (usz i = 0; i < STAT_COUNT; i++) {
+    u64 value = __atomic_load_n(statistics + i, __ATOMIC_RELAXED);
+    fprint(file, "\n  \"%s\": %U,", statistic_names[i], value);
+  }
+
+  fprint(file, "\n  \"opt.passes\": {");
+  foreach_val (p, passes) {
+    fprint(
+      file,
+      "%s\n    \"%s\": {\"instructions_created\": %U, \"instructions_removed\": %U}",
+      p == passes.data[0] ? "" : ",",
+      p->name,
+      __atomic_load_n(&p->created, __ATOMIC_RELAXED),
+      __atomic_load_n(&p->removed, __ATOMIC_RELAXED)
+    );
+  }
+  fprint(file, "%s},", passes.size ? "\n  " : "");
+
+  fprint(file, "\n  \"object.section_bytes\": {");
+  foreach (s, sections) {
+    fprint(
+      file,
+      "%s\n    \"%s\": %U",
+      s == sections.data ? "" : ",",
+      s->name,
+      s->bytes
+    );
+  }
+  fprint(file, "%s}\n}\n", sections.size ? "\n  " : "");
+
+  platform_mutex_unlock(&stats_lock);
+  return !fclose(file);
+}
@@ -0,0 +1,72 @@
+#ifndef INTERCEPT_STATS_H
+#define INTERCEPT_STATS_H
+
+#include <stdbool.h>
+#include <utils.h>
+
+/// If set, the path of the file to write compiler statistics to.
+extern const char *stats_json_path;
+
+/// Counters that are collected while compiling. Most of them are
+/// totals; the ones whose name contains `max` are maxima.
+#define ALL_STATISTICS(F)                                   \
+  F(AST_NODES, "ast.nodes")                                 \
+  F(AST_TYPES, "ast.types")                                 \
+  F(AST_SCOPES, "ast.scopes")                               \
+  F(IR_INSTRUCTIONS_CREATED, "ir.instructions_created")     \
+  F(IR_INSTRUCTIONS_REMOVED, "ir.instructions_removed")     \
+  F(OPT_CALLS_INLINED, "opt.calls_inlined")                 \
+  F(OPT_TAIL_CALLS, "opt.tail_calls")                       \
+  F(ISEL_MIR_BEFORE, "isel.mir_instructions_before")        \
+  F(ISEL_MIR_AFTER, "isel.mir_instructions_after")          \
+  F(RA_VIRTUAL_REGISTERS, "ra.virtual_registers")           \
+  F(RA_INTERFERENCE_EDGES, "ra.interference_edges")         \
+  F(RA_MAX_COLOURS_USED, "ra.max_colours_used")             \
+  F(OBJECT_RELOCATIONS, "object.relocations")
+
+#define DEFINE_STATISTIC(name, ...) CAT(STAT_, name),
+typedef enum Statistic {
+  ALL_STATISTICS(DEFINE_STATISTIC)
+  STAT_COUNT
+} Statistic;
+#undef DEFINE_STATISTIC
+
+/// Counters of an optimisation pass.
+typedef struct PassStats PassStats;
+
+/// Whether statistics are being collected.
+#define STATS_ENABLED() (stats_json_path != NULL)
+
+/// Add `value` to a counter. This may be called from any thread
+/// and does nothing unless statistics are being collected.
+void stats_add(Statistic stat, u64 value);
+
+/// Raise a counter to `value` if it is smaller. This may be called
+/// from any thread and does nothing unless statistics are being
+/// collected.
+void stats_max(Statistic stat, u64 value);
+
+/// Start attributing IR instructions that are created or removed on
+/// this thread to the pass `name`, which must be a string literal.
+///
+/// \return The pass that was active before, which must be passed
+///   to stats_end_pass().
+PassStats *stats_begin_pass(const char *name);
+
+/// Stop attributing IR instructions to the current pass.
+void stats_end_pass(PassStats *previous);
+
+/// Record that an IR instruction was created or removed. This also
+/// updates the counters of the pass that is running on this thread.
+void stats_ir_instruction_created(void);
+void stats_ir_instruction_removed(void);
+
+/// Record the size of a section in an object file.
+void stats_add_section(const char *name, u64 bytes);
+
+/// Write all statistics collected so far to a file as one JSON object.
+///
+/// \return Whether the file could be written.
+bool stats_write_json(const char *path);
+
+#endif // INTERCEPT_STATS_H
@@ -0,0 +1,313 @@
+#include <error.h>
+#include <platform.h>
+#include <stdlib.h>
+#include <string.h>
+#include <timing.h>
+#include <vector.h>
+
+/// Number of functions listed per phase in verbose reports.
+#define TIMING_REPORT_FUNCTIONS 10
+
+/// Time spent in a phase, in nanoseconds.
+typedef struct PhaseTime {
+  u64 wall;
+  u64 cpu;
+} PhaseTime;
+
+/// Time spent on a single function in a phase.
+typedef struct FunctionTime {
+  TimedPhase phase;
+  string name;
+  PhaseTime time;
+} FunctionTime;
+
+/// A complete event in the trace.
+typedef struct TraceEvent {
+  TimerKind kind;
+  TimedPhase phase;
+  const char *name;
+  string detail;
+  u32 thread;
+  u64 start;
+  u64 duration;
+} TraceEvent;
+
+bool time_report = false;
+const char *trace_json_path = NULL;
+
+#define PHASE_NAME(name, description, subsystem) description,
+static const char *phase_names[PHASE_COUNT] = { ALL_TIMED_PHASES(PHASE_NAME) };
+#undef PHASE_NAME
+
+#define PHASE_SUBSYSTEM(name, description, subsystem) CAT(MEMORY_, subsystem),
+static const MemorySubsystem phase_subsystems[PHASE_COUNT] = { ALL_TIMED_PHASES(PHASE_SUBSYSTEM) };
+#undef PHASE_SUBSYSTEM
+
+/// Measurements are recorded from any thread.
+static PlatformMutex timing_lock = PLATFORM_MUTEX_INIT;
+static PhaseTime phase_times[PHASE_COUNT] = {0};
+static struct {
+  bool ran;
+  u64 before;
+  u64 after;
+} phase_rss[PHASE_COUNT] = {0};
+static Vector(FunctionTime) function_times = {0};
+static Vector(TraceEvent) trace_events = {0};
+
+/// Trace events are grouped by thread; threads are numbered in the
+/// order in which they first record something.
+static THREAD_LOCAL u32 trace_thread_id = 0;
+static u32 trace_thread_count = 0;
+
+static Timer timer_start_impl(TimerKind kind, TimedPhase phase, const char *name, span detail) {
+  Timer timer = {0};
+  if (!time_report && !trace_json_path && !mem_report) return timer;
+  timer.kind = kind;
+  timer.phase = phase;
+  timer.name = name;
+  timer.detail = detail;
+  timer.wall_start = platform_wall_time();
+  timer.cpu_start = platform_cpu_time();
+  if (kind != TIMER_SPAN) timer.previous_subsystem = memory_enter(phase_subsystems[phase]);
+  if (mem_report && kind == TIMER_PHASE) timer.rss_start = platform_current_rss();
+  return timer;
+}
+
+Timer timer_start(TimedPhase phase) {
+  return timer_start_impl(TIMER_PHASE, phase, NULL, (span){0});
+}
+
+Timer timer_start_function(TimedPhase phase, span function) {
+  return timer_start_impl(TIMER_FUNCTION, phase, NULL, function);
+}
+
+Timer timer_start_span(const char *name, span detail) {
+  return timer_start_impl(TIMER_SPAN, PHASE_COUNT, name, detail);
+}
+
+void timer_stop(Timer *timer) {
+  if (timer->kind == TIMER_NONE) return;
+  PhaseTime time = {
+    .wall = platform_wall_time() - timer->wall_start,
+    .cpu = platform_cpu_time() - timer->cpu_start,
+  };
+
+  if (timer->kind != TIMER_SPAN) memory_leave(timer->previous_subsystem);
+  bool measure_rss = mem_report && timer->kind == TIMER_PHASE;
+  u64 rss = measure_rss ? platform_current_rss() : 0;
+
+  platform_mutex_lock(&timing_lock);
+  if (measure_rss) {
+    /// Keep the run during which the RSS grew the most.
+    i64 growth = (i64) rss - (i64) timer->rss_start;
+    i64 max_growth = (i64) phase_rss[timer->phase].after - (i64) phase_rss[timer->phase].before;
+    if (!phase_rss[timer->phase].ran || growth > max_growth) {
+      phase_rss[timer->phase].ran = true;
+      phase_rss[timer->phase].before = timer->rss_start;
+      phase_rss[timer->phase].after = rss;
+    }
+  }
+  if (time_report && timer->kind == TIMER_FUNCTION) {
+    FunctionTime f = {
+      .phase = timer->phase,
+      .name = string_dup(timer->detail),
+      .time = time,
+    };
+    vector_push(function_times, f);
+  } else if (time_report && timer->kind == TIMER_PHASE) {
+    phase_times[timer->phase].wall += time.wall;
+    phase_times[timer->phase].cpu += time.cpu;
+  }
+
+  if (trace_json_path) {
+    if (!trace_thread_id) trace_thread_id = ++trace_thread_count;
+    TraceEvent event = {
+      .kind = timer->kind,
+      .phase = timer->phase,
+      .name = timer->name,
+      .thread = trace_thread_id,
+      .start = timer->wall_start,
+      .duration = time.wall,
+    };
+    if (timer->detail.data) event.detail = string_dup(timer->detail);
+    vector_push(trace_events, event);
+  }
+  platform_mutex_unlock(&timing_lock);
+  timer->kind = TIMER_NONE;
+}
+
+const char *timing_phase_name(TimedPhase phase) {
+  return phase_names[phase];
+}
+
+bool timing_phase_rss(TimedPhase phase, u64 *before, u64 *after) {
+  platform_mutex_lock(&timing_lock);
+  bool ran = phase_rss[phase].ran;
+  *before = phase_rss[phase].before;
+  *after = phase_rss[phase].after;
+  platform_mutex_unlock(&timing_lock);
+  return ran;
+}
+
+/// Sort functions by phase, and then by name.
+static int compare_function_names(const void *a, const void *b) {
+  const FunctionTime *x = a, *y = b;
+  if (x->phase != y->phase) return x->phase < y->phase ? -1 : 1;
+  int order = memcmp(x->name.data, y->name.data, x->name.size < y->name.size ? x->name.size : y->name.size);
+  if (order) return order;
+  if (x->name.size != y->name.size) return x->name.size < y->name.size ? -1 : 1;
+  return 0;
+}
+
+/// Sort functions by phase, and then by descending wall time.
+static int compare_function_times(const void *a, const void *b) {
+  const FunctionTime *x = a, *y = b;
+  if (x->phase != y->phase) return x->phase < y->phase ? -1 : 1;
+  if (x->time.wall != y->time.wall) return x->time.wall > y->time.wall ? -1 : 1;
+  return 0;
+}
+
+void timing_report(FILE *file, bool verbose) {
+  platform_mutex_lock(&timing_lock);
+
+  PhaseTime total = {0};
+  for (usz i = 0; i < PHASE_COUNT; i++) {
+    total.wall += phase_times[i].wall;
+    total.cpu += phase_times[i].cpu;
+  }
+
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "                          Time Report\n");
+  fprint(file, "===-------------------------------------------------------------===\n");
+  fprint(file, "  %-*s %*s %*s %*s %*s\n", 24, "Phase", 12, "Wall (ms)", 7, "%", 12, "CPU (ms)", 7, "%");
+  for (usz i = 0; i < PHASE_COUNT; i++) {
+    PhaseTime t = phase_times[i];
+    fprint(
+      file,
+      "  %-*s %*.3f %*.1f%% %*.3f %*.1f%%\n",
+      24, phase_names[i],
+      12, (double) t.wall / 1e6,
+      6, total.wall ? 100.0 * (double) t.wall / (double) total.wall : 0.0,
+      12, (double) t.cpu / 1e6,
+      6, total.cpu ? 100.0 * (double) t.cpu / (double) total.cpu : 0.0
+    );
+  }
+  fprint(file, "  %-*s %*.3f %*s %*.3f\n", 24, "Total", 12, (double) total.wall / 1e6, 7, "", 12, (double) total.cpu / 1e6);
+
+  if (verbose && function_times.size) {
+    /// A function may be timed more than once per phase, e.g. once
+    /// per optimisation pass; add those runs up.
+    qsort(function_times.data, function_times.size, sizeof *function_times.data, compare_function_names);
+    usz merged = 0;
+    for (usz i = 0; i < function_times.size; i++) {
+      FunctionTime *f = function_times.data + i;
+      FunctionTime *last = merged ? function_times.data + merged - 1 : NULL;
+      if (last && last->phase == f->phase && string_eq(last->name, f->name)) {
+        last->time.wall += f->time.wall;
+        last->time.cpu += f->time.cpu;
+        free(f->name.data);
+      } else {
+        function_times.data[merged++] = *f;
+      }
+    }
+    function_times.size = merged;
+
+    qsort(function_times.data, function_times.size, sizeof *function_times.data, compare_function_times);
+    for (usz i = 0; i < function_times.size;) {
+      TimedPhase phase = function_times.data[i].phase;
+      fprint(file, "\n  Slowest functions in %s:\n", phase_names[phase]);
+      fprint(file, "  %*s %*s  %s\n", 12, "Wall (ms)", 12, "CPU (ms)", "Function");
+      for (usz listed = 0; i < function_times.size && function_times.data[i].phase == phase; i++, listed++) {
+        if (listed >= TIMING_REPORT_FUNCTIONS) continue;
+        FunctionTime *f = function_times.data + i;
+        fprint(
+          file,
+          "  %*.3f %*.3f  %S\n",
+          12, (double) f->time.wall / 1e6,
+          12, (double) f->time.cpu / 1e6,
+          f->name
+        );
+      }
+    }
+  }
+
+  platform_mutex_unlock(&timing_lock);
+}
+
+/// Write a JSON string literal.
+static void write_json_string(FILE *file, span s) {
+  fputc('"', file);
+  foreach (c, s) {
+    switch (*c) {
+      case '"': fputs("\\\"", file); break;
+      case '\\': fputs("\\\\", file); break;
+      case '\n': fputs("\\n", file); break;
+      case '\t': fputs("\\t", file); break;
+      default:
+        if ((unsigned char) *c < 0x20) fprint(file, "\\u00%c%c", "0123456789abcdef"[*c >> 4], "0123456789abcdef"[*c & 15]);
+        else fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+bool timing_write_trace(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) return false;
+
+  platform_mutex_lock(&timing_lock);
+
+  /// Timestamps are relative to the first event.
+  u64 base = (u64) -1;
+  foreach (e, trace_events)
+    if (e->start < base) base = e->start;
+
+  fprint(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  foreach (e, trace_events) {
+    if (e != trace_events.data) fputc(',', file);
+
+    /// Phases are named after the phase, functions after the
+    /// function, and spans after whatever they measure.
+    const char *category = "";
+    span name = {0};
+    STATIC_ASSERT(TIMER_SPAN == 3, "Exhaustive handling of timer kinds");
+    switch (e->kind) {
+      case TIMER_NONE: UNREACHABLE();
+      case TIMER_PHASE:
+        category = "phase";
+        name = (span){phase_names[e->phase], strlen(phase_names[e->phase])};
+        break;
+      case TIMER_FUNCTION:
+        category = "function";
+        name = as_span(e->detail);
+        break;
+      case TIMER_SPAN:
+        category = "span";
+        name = (span){e->name, strlen(e->name)};
+        break;
+    }
+
+    fprint(file, "\n{\"name\":");
+    write_json_string(file, name);
+    fprint(
+      file,
+      ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+      category,
+      (unsigned) e->thread,
+      (double) (e->start - base) / 1e3,
+      (double) e->duration / 1e3
+    );
+    if (e->kind == TIMER_FUNCTION) {
+      fprint(file, "\"phase\":");
+      write_json_string(file, (span){phase_names[e->phase], strlen(phase_names[e->phase])});
+    } else if (e->kind == TIMER_SPAN && e->detail.data) {
+      fprint(file, "\"detail\":");
+      write_json_string(file, as_span(e->detail));
+    }
+    fprint(file, "}}");
+  }
+  fprint(file, "\n]}\n");
+
+  platform_mutex_unlock(&timing_lock);
+  return !fclose(file);
+}
@@ -0,0 +1,110 @@
+#ifndef INTERCEPT_TIMING_H
+#define INTERCEPT_TIMING_H
+
+#include <memory_report.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <utils.h>
+
+/// Whether to measure how long each phase of the compiler takes.
+extern bool time_report;
+
+/// If set, the path of the file to write Chrome trace events to.
+extern const char *trace_json_path;
+
+/// Phases of the compiler that are measured, and the subsystem
+/// that vectors which grow during each phase are attributed to.
+#define ALL_TIMED_PHASES(F)                           \
+  F(PARSE, "Parsing", AST)                            \
+  F(IMPORTS, "Module resolution", AST)                \
+  F(TYPECHECK, "Type checking", AST)                  \
+  F(IRGEN, "IR generation", IR)                       \
+  F(INLINE, "Mandatory inlining", IR)                 \
+  F(OPTIMISE, "Optimisation", IR)                     \
+  F(LOWER, "IR lowering", IR)                         \
+  F(MIR, "MIR generation", MIR)                       \
+  F(ISEL, "Instruction selection", MIR)               \
+  F(RA, "Register allocation", RA)                    \
+  F(EMIT, "Code emission", OBJECT)                    \
+  F(OBJECT, "Object writing", OBJECT)
+
+#define DEFINE_TIMED_PHASE(name, ...) CAT(PHASE_, name),
+typedef enum TimedPhase {
+  ALL_TIMED_PHASES(DEFINE_TIMED_PHASE)
+  PHASE_COUNT
+} TimedPhase;
+#undef DEFINE_TIMED_PHASE
+
+typedef enum TimerKind {
+  TIMER_NONE,
+  TIMER_PHASE,
+  TIMER_FUNCTION,
+  TIMER_SPAN,
+} TimerKind;
+
+/// A measurement that is in progress.
+typedef struct Timer {
+  TimerKind kind;
+  TimedPhase phase;
+
+  /// Name of the span, if this is a span.
+  const char *name;
+
+  /// Name of the function being measured, or what the span is about.
+  span detail;
+
+  /// Times at which the measurement was started, in nanoseconds.
+  u64 wall_start;
+  u64 cpu_start;
+
+  /// RSS of the process when a phase was started, in bytes.
+  u64 rss_start;
+
+  /// Subsystem that memory was attributed to before this phase.
+  MemorySubsystem previous_subsystem;
+} Timer;
+
+/// Start measuring a phase.
+///
+/// The measurement includes everything that is done on other threads
+/// by calls to platform_parallel_for() made until it is stopped. This
+/// does nothing unless `time_report`, `trace_json_path` or `mem_report`
+/// is set. Vectors that grow on this thread while the phase is being
+/// measured are attributed to the subsystem of the phase.
+NODISCARD Timer timer_start(TimedPhase phase);
+
+/// Start measuring the work done by a phase for a single function.
+///
+/// Function timers are not added to the totals of their phase, so
+/// they can be used while the phase itself is being measured.
+NODISCARD Timer timer_start_function(TimedPhase phase, span function);
+
+/// Start a span that only shows up in the trace, e.g. a single pass
+/// over a function. `name` must outlive the timer; `detail` is copied.
+NODISCARD Timer timer_start_span(const char *name, span detail);
+
+/// Stop a measurement and record it.
+void timer_stop(Timer *timer);
+
+/// Print the times of all phases measured so far. If `verbose` is
+/// set, also print the functions that took the longest per phase.
+void timing_report(FILE *file, bool verbose);
+
+/// Get the name of a phase.
+const char *timing_phase_name(TimedPhase phase);
+
+/// Get the RSS of the process, in bytes, when a phase started and
+/// when it ended. If the phase ran more than once, this is the run
+/// during which the RSS grew the most. Only measured if `mem_report`
+/// is set.
+///
+/// \return Whether the phase has run.
+bool timing_phase_rss(TimedPhase phase, u64 *before, u64 *after);
+
+/// Write everything measured so far to a file in the Chrome trace
+/// event format, which can be opened in chrome://tracing or Perfetto.
+///
+/// \return Whether the file could be written.
+bool timing_write_trace(const char *path);
+
+#endif // INTERCEPT_TIMING_H
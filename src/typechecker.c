@@ -11,11 +11,11 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define DIAG(diag, loc, ...) issue_diagnostic(diag, (ast)->filename.data, as_span((ast)->source), (loc), __VA_ARGS__)
+#define DIAG(diag, loc, ...) issue_diagnostic(diag, (ast)->filename.data, (ast)->source, (loc), __VA_ARGS__)
 
 #define ERR(loc, ...)                                                   \
   do {                                                                  \
-    issue_diagnostic(DIAG_ERR, (ast)->filename.data, as_span((ast)->source), (loc), __VA_ARGS__); \
+    issue_diagnostic(DIAG_ERR, (ast)->filename.data, (ast)->source, (loc), __VA_ARGS__); \
     return false;                                                       \
   } while (0)
 #define SORRY(loc, ...)                         \
@@ -24,7 +24,7 @@
     return false;                               \
   } while (0)
 
-#define ERR_DONT_RETURN(loc, ...) issue_diagnostic(DIAG_ERR, (ast)->filename.data, as_span((ast)->source), (loc), __VA_ARGS__)
+#define ERR_DONT_RETURN(loc, ...) issue_diagnostic(DIAG_ERR, (ast)->filename.data, (ast)->source, (loc), __VA_ARGS__)
 
 #define ERR_NOT_CONVERTIBLE(where, to, from) ERR(where, "Type '%T' is not convertible to '%T'", from, to)
 
@@ -177,7 +177,7 @@ static OverloadSet collect_overload_set(Node *func) {
       if (sym->kind != SYM_FUNCTION) {
         continue;
       }
-      if (string_eq(sym->name, func->funcref.name)) {
+      if (atom_eq(sym->name, func->funcref.name)) {
         Candidate s = {0};
         s.symbol = sym;
         s.score = 0;
@@ -249,7 +249,7 @@ NODISCARD static bool resolve_overload(
     foreach (c, *overload_set) {
       if (ambiguous && c->validity != candidate_valid) continue;
       u32 line;
-      seek_location(as_span(ast->source), c->symbol->val.node->source_location, &line, NULL, NULL);
+      seek_location(ast->source, c->symbol->val.node->source_location, &line, NULL, NULL);
       eprint("    %B38(%Z) %32%S %31: %T %m(%S:%u)\n",
         index++, c->symbol->name, c->symbol->val.node->type, ast->filename, line);
     }
@@ -259,7 +259,7 @@ NODISCARD static bool resolve_overload(
 
     /// We might want to print dependent overload sets.
     Vector(Node*) dependent_functions = {0};
-    Vector(span) dependent_function_names = {0};
+    Vector(atom) dependent_function_names = {0};
 
     /// Explain why each one is invalid.
     eprint("\n    %B38Invalid Overloads%m\n");
@@ -312,14 +312,14 @@ NODISCARD static bool resolve_overload(
         /// validity.
         case invalid_no_dependent_arg: {
           Node * arg = funcref->parent->call.arguments.data[c->invalid_arg_index];
-          Node * param = c->symbol->val.node->function.param_decls.data[c->invalid_arg_index];
+          Node * param = c->symbol->val.node->function->param_decls.data[c->invalid_arg_index];
           eprint("No overload of %32%S%m with type %T", arg->funcref.name, param->type);
 
           /// Mark that we need to print the overload set of this function too.
-          span *ptr = vector_find_if(n, dependent_function_names, string_eq(*n, arg->funcref.name));
+          atom *ptr = vector_find_if(n, dependent_function_names, atom_eq(*n, arg->funcref.name));
           if (!ptr) {
             vector_push(dependent_functions, arg);
-            vector_push(dependent_function_names, as_span(arg->funcref.name));
+            vector_push(dependent_function_names, arg->funcref.name);
           }
         } break;
       }
@@ -335,7 +335,7 @@ NODISCARD static bool resolve_overload(
         OverloadSet o = collect_overload_set(n);
         foreach (c, o) {
           u32 line;
-          seek_location(as_span(ast->source), c->symbol->val.node->source_location, &line, NULL, NULL);
+          seek_location(ast->source, c->symbol->val.node->source_location, &line, NULL, NULL);
           eprint("        %32%S %31: %T %m(%S:%u)\n",
             c->symbol->name, c->symbol->val.node->type, ast->filename, line);
         }
@@ -856,7 +856,7 @@ NODISCARD static bool typecheck_intrinsic(Module *ast, Node *expr) {
             ERR(expr->source_location, "__builtin_line() takes no arguments");
 
           u32 line = 0;
-          seek_location(as_span(ast->source), expr->source_location, &line, NULL, NULL);
+          seek_location(ast->source, expr->source_location, &line, NULL, NULL);
 
           expr->type = t_integer_literal;
           expr->kind = NODE_LITERAL;
@@ -890,7 +890,7 @@ NODISCARD static bool typecheck_intrinsic(Module *ast, Node *expr) {
             }
           );
 
-          string s = ast->strings.data[expr->literal.string_index];
+          atom s = ast->strings.data[expr->literal.string_index];
           expr->type = ast_make_type_array(ast, expr->source_location, t_byte, s.size + 1);
           return true;
         }
@@ -930,13 +930,52 @@ NODISCARD static bool typecheck_intrinsic(Module *ast, Node *expr) {
     UNREACHABLE();
 }
 
-NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
-  /// Don’t typecheck the same expression twice.
-  if (expr->type_checked) return true;
-  expr->type_checked = true;
+/// Check if a child of the root is the declaration of a function
+/// whose body hasn’t been parsed yet.
+static bool is_deferred_function_declaration(Node *node) {
+  if (node->kind == NODE_FUNCTION) return node->function->deferred_body;
+  if (node->kind != NODE_FUNCTION_REFERENCE || !node->funcref.resolved) return false;
+  Node *func = node->funcref.resolved->val.node;
+  return func &&
+         func->kind == NODE_FUNCTION &&
+         func->function->deferred_body &&
+         func->source_location.start == node->source_location.start &&
+         func->source_location.end == node->source_location.end;
+}
 
+/// Typecheck the type of an expression, if it has one. This is done
+/// before its operands are typechecked.
+NODISCARD static bool typecheck_expression_type(Module *ast, Node *expr) {
   if (expr->type && !typecheck_type(ast, expr->type)) return false;
 
+  // TO any incomplete type is DISALLOWED
+  if (expr->kind == NODE_CAST && type_is_incomplete(expr->type))
+    ERR(expr->type->source_location, "Cannot cast to incomplete type %T", expr->type);
+
+  return true;
+}
+
+/// Check that the value of an expression that isn’t the last one in
+/// a block can be discarded.
+NODISCARD static bool typecheck_discarded_value(Module *ast, Node *node) {
+  if (node->kind == NODE_BINARY && node->binary.op == TK_EQ)
+    ERR(node->source_location,
+        "Comparison result unused. Did you mean to assign using %s?",
+        token_type_to_string(TK_COLON_EQ));
+
+  // If the function being called doesn't return void, it is being discarded.
+  if (node->kind == NODE_CALL
+      && !node->call.callee->type->function.attr_discardable
+      && node->call.callee->type->function.return_type != t_void) {
+    ERR(node->source_location,
+        "Discarding return value of function that does not return void.");
+  }
+
+  return true;
+}
+
+/// Typecheck an expression whose type has already been typechecked.
+NODISCARD static bool typecheck_node(Module *ast, Node *expr) {
   /// Typecheck the expression.
   switch (expr->kind) {
     default: ICE("Invalid node type");
@@ -944,6 +983,14 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
     /// Typecheck each child of the root.
     case NODE_ROOT:
     foreach_val (node, expr->root.children) {
+        /// Functions whose bodies haven’t been parsed are only
+        /// typechecked if they’re referenced, but their signatures
+        /// are always checked.
+        if (is_deferred_function_declaration(node)) {
+          Node *func = node->kind == NODE_FUNCTION ? node : node->funcref.resolved->val.node;
+          if (!typecheck_type(ast, func->type)) return false;
+          continue;
+        }
         if (!typecheck_expression(ast, node))
           return false;
 
@@ -968,7 +1015,7 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
             ERR(
               node->source_location,
               "Discarding return value of function `%S` that was not declared `discardable`.",
-              node->call.callee->function.name
+              node->call.callee->function->name
             );
           }
         }
@@ -1018,23 +1065,34 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
         ASSERT(typecheck_expression(ast, lit));
       }
 
+      /// Drop the declarations of functions that were never referenced
+      /// and thus never parsed; there is nothing to emit for them.
+      if (ast->parser) {
+        usz kept = 0;
+        foreach_val (node, expr->root.children)
+          if (!is_deferred_function_declaration(node))
+            expr->root.children.data[kept++] = node;
+        expr->root.children.size = kept;
+      }
+
       break;
 
     case NODE_MODULE_REFERENCE: break;
 
     /// Typecheck the function body if there is one.
     case NODE_FUNCTION: {
-      if (!expr->function.body) break;
-      if (!typecheck_expression(ast, expr->function.body)) return false;
+      if (expr->function->deferred_body && !parse_deferred_body(ast, expr)) return false;
+      if (!expr->function->body) break;
+      if (!typecheck_expression(ast, expr->function->body)) return false;
 
       /// Make sure the return type of the body is convertible to that of the function.
       Type *ret = expr->type->function.return_type;
-      Type *body = expr->function.body->type;
+      Type *body = expr->function->body->type;
       if (!convertible(ret, body)) {
         loc l = {0};
-        if (expr->function.body->kind == NODE_BLOCK)
-          l = vector_back_or(expr->function.body->block.children, expr)->source_location;
-        else l = expr->function.body->source_location;
+        if (expr->function->body->kind == NODE_BLOCK)
+          l = vector_back_or(expr->function->body->block.children, expr)->source_location;
+        else l = expr->function->body->source_location;
         ERR(l,
             "Type '%T' of function body is not convertible to return type '%T'.",
             body, ret);
@@ -1055,9 +1113,9 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
 
       /// Make sure `used` doesn’t override any other linkage type.
       if (ftype->attr_used) {
-        if (expr->function.linkage != LINKAGE_INTERNAL)
+        if (expr->function->linkage != LINKAGE_INTERNAL)
           ERR(expr->source_location, "Attribute `used` is not valid for this function");
-        expr->function.linkage = LINKAGE_USED;
+        expr->function->linkage = LINKAGE_USED;
       }
 
       /// Warn about functions returning void annotated as discardable.
@@ -1148,20 +1206,8 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
         if (!typecheck_expression(ast, node))
           return false;
 
-        if (node != vector_back(expr->block.children)) {
-          if (node->kind == NODE_BINARY && node->binary.op == TK_EQ)
-            ERR(node->source_location,
-                "Comparison result unused. Did you mean to assign using %s?",
-                token_type_to_string(TK_COLON_EQ));
-
-          // If the function being called doesn't return void, it is being discarded.
-          if (node->kind == NODE_CALL
-              && !node->call.callee->type->function.attr_discardable
-              && node->call.callee->type->function.return_type != t_void) {
-            ERR(node->source_location,
-                "Discarding return value of function that does not return void.");
-          }
-        }
+        if (node != vector_back(expr->block.children) && !typecheck_discarded_value(ast, node))
+          return false;
       }
       expr->type = expr->block.children.size ? vector_back(expr->block.children)->type : t_void;
     } break;
@@ -1232,10 +1278,6 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
     /// Make sure a cast is even possible.
     case NODE_CAST: {
       Type *t_to = expr->type;
-      // TO any incomplete type is DISALLOWED
-      if (type_is_incomplete(t_to))
-        ERR(t_to->source_location, "Cannot cast to incomplete type %T", t_to);
-
       if (!typecheck_expression(ast, expr->cast.value))
         return false;
 
@@ -1467,7 +1509,7 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
       switch (expr->literal.type) {
       case TK_NUMBER: expr->type = t_integer_literal; break;
       case TK_STRING: {
-        string s = ast->strings.data[expr->literal.string_index];
+        atom s = ast->strings.data[expr->literal.string_index];
         expr->type = ast_make_type_array(ast, expr->source_location, t_byte, s.size + 1);
       } break;
       case TK_LBRACK:
@@ -1528,13 +1570,13 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
 
         Node *found = NULL;
         foreach_val (n, module->exports) {
-          string *name = NULL;
+          atom *name = NULL;
           if (n->kind == NODE_DECLARATION)
             name = &n->declaration.name;
           else if (n->kind == NODE_FUNCTION_REFERENCE)
             name = &n->funcref.name;
           else ICE("Unexpected node type exported by module");
-          if (string_eq(*name, expr->member_access.ident)) {
+          if (atom_eq(*name, expr->member_access.ident)) {
             found = n;
             break;
           }
@@ -1548,12 +1590,12 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
           expr->kind = NODE_VARIABLE_REFERENCE;
           expr->var = calloc(1, sizeof(Symbol));
           expr->var->kind = SYM_VARIABLE;
-          expr->var->name = string_dup(found->declaration.name);
+          expr->var->name = found->declaration.name;
           expr->var->val.node = found;
           expr->type = found->type;
         } else if (found->kind == NODE_FUNCTION_REFERENCE) {
           expr->kind = NODE_FUNCTION_REFERENCE;
-          expr->funcref.name = string_dup(found->funcref.name);
+          expr->funcref.name = found->funcref.name;
           expr->funcref.resolved = found->funcref.resolved;
           expr->funcref.scope = found->funcref.scope;
           expr->type = found->type;
@@ -1569,7 +1611,7 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
               "Cannot access member of type %T", struct_type);
 
         Member *member = vector_find_if(m, struct_type->structure.members,
-                         string_eq(m->name, expr->member_access.ident));
+                         atom_eq(m->name, expr->member_access.ident));
         if (!member)
           ERR(expr->source_location,
               "Cannot access member \"%S\" that does not exist in \"%S\", an instance of %T",
@@ -1637,3 +1679,86 @@ NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
   /// Done.
   return true;
 }
+
+/// Get the next operand of an expression that is typechecked before
+/// it, in the order in which typecheck_node() would typecheck them, or
+/// NULL if there are no more.
+static Node *typecheck_operand(Node *expr, usz *step) {
+  usz i = (*step)++;
+  switch (expr->kind) {
+    default: return NULL;
+    case NODE_BINARY: return i == 0 ? expr->binary.lhs : i == 1 ? expr->binary.rhs : NULL;
+    case NODE_UNARY: return i == 0 ? expr->unary.value : NULL;
+    case NODE_CAST: return i == 0 ? expr->cast.value : NULL;
+    case NODE_WHILE: return i == 0 ? expr->while_.condition : i == 1 ? expr->while_.body : NULL;
+    case NODE_BLOCK: return i < expr->block.children.size ? expr->block.children.data[i] : NULL;
+    case NODE_IF:
+      if (i == 0) return expr->if_.condition;
+      if (i == 1) return expr->if_.then;
+      return i == 2 ? expr->if_.else_ : NULL;
+
+    /// Intrinsics are typechecked all at once. If the callee has yet to
+    /// be resolved, resolve_function() typechecks the arguments first,
+    /// except for function references; otherwise, the callee goes first.
+    case NODE_CALL: {
+      Node *callee = expr->call.callee;
+      if (i == 0 && intrinsic_kind(callee) != INTRIN_COUNT) return NULL;
+      bool unresolved = callee->kind == NODE_FUNCTION_REFERENCE && !callee->funcref.resolved;
+      for (; i <= expr->call.arguments.size; i = (*step)++) {
+        Node *operand = i ? expr->call.arguments.data[i - 1] : callee;
+        if (!unresolved || (i && operand->kind != NODE_FUNCTION_REFERENCE)) return operand;
+      }
+      return NULL;
+    }
+  }
+}
+
+NODISCARD bool typecheck_expression(Module *ast, Node *expr) {
+  /// Don’t typecheck the same expression twice.
+  if (expr->type_checked) return true;
+
+  /// Since generated code can nest expressions arbitrarily deeply,
+  /// typecheck their operands using an explicit stack: each expression
+  /// is visited before its operands and typechecked after them, in the
+  /// same order as if we recursed. Frames below `base` belong to
+  /// callers that are typechecking other expressions.
+  usz base = ast->typecheck_stack.size;
+  vector_push(ast->typecheck_stack, ((TypecheckFrame){.node = expr}));
+  while (ast->typecheck_stack.size > base) {
+    /// Typechecking the type of an expression may push frames and
+    /// thus move the stack, so we refer to ours by index.
+    usz index = ast->typecheck_stack.size - 1;
+    Node *node = ast->typecheck_stack.data[index].node;
+    usz step = ast->typecheck_stack.data[index].step;
+    bool ok = true;
+
+    /// Visit the expression.
+    if (step == 0) {
+      node->type_checked = true;
+      ok = typecheck_expression_type(ast, node);
+    }
+
+    /// Check each child of a block but the last once it is done.
+    else if (node->kind == NODE_BLOCK && step < node->block.children.size) {
+      ok = typecheck_discarded_value(ast, node->block.children.data[step - 1]);
+    }
+
+    /// Typecheck the next operand, or the expression once they’re done.
+    if (ok) {
+      Node *operand = typecheck_operand(node, &ast->typecheck_stack.data[index].step);
+      if (!operand) {
+        (void) vector_pop(ast->typecheck_stack);
+        ok = typecheck_node(ast, node);
+      } else if (!operand->type_checked) {
+        vector_push(ast->typecheck_stack, ((TypecheckFrame){.node = operand}));
+      }
+    }
+
+    if (!ok) {
+      ast->typecheck_stack.size = base;
+      return false;
+    }
+  }
+
+  return true;
+}
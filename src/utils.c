@@ -24,6 +24,8 @@ static char *strndup(const char *str, usz sz) {
 #endif
 POP_WARNINGS()
 
+bool prefer_using_diagnostics_colours = true;
+bool colours_blink = false;
 THREAD_LOCAL bool thread_use_colours = false;
 THREAD_LOCAL bool thread_disable_type_colours = false;
 
@@ -69,6 +71,31 @@ void sb_replace(string_buffer *buf, span from, span to) {
 /// ===========================================================================
 ///  String formatting.
 /// ===========================================================================
+/// A value that is formatted before it is padded. Values that fit in
+/// `small`, which are all of them in practice, never touch the heap.
+typedef struct PaddedField {
+  char *data;
+  usz size;
+  usz capacity;
+  char small[64];
+} PaddedField;
+
+/// Callback to write to a padded field.
+static void write_string_to_field(const char *str, usz size, void *to) {
+  PaddedField *field = to;
+  if (field->size + size > field->capacity) {
+    usz capacity = (field->size + size) * 2;
+    char *data = malloc(capacity);
+    ASSERT(data, "Memory allocation failure");
+    memcpy(data, field->data, field->size);
+    if (field->data != field->small) free(field->data);
+    field->data = data;
+    field->capacity = capacity;
+  }
+  memcpy(field->data + field->size, str, size);
+  field->size += size;
+}
+
 /// This function handles the actual formatting.
 ///
 /// If colours are disabled, this function will strip all terminal escape codes.
@@ -90,6 +117,7 @@ void sb_replace(string_buffer *buf, span from, span to) {
 ///   - %zi: isz
 ///   - %x: hexadecimal (32-bit)
 ///   - %X: hexadecimal (64-bit)
+///   - %f: double
 ///   - %p: void *
 ///   - %b: bool
 ///   - %T: Type *
@@ -99,6 +127,12 @@ void sb_replace(string_buffer *buf, span from, span to) {
 ///   - %X, where X is ESCAPE: A literal escape character if you need that for some ungodly reason.
 ///   - %XX, where X is in [0-9]: "\033[XXm" if colours are enabled, and "" otherwise.
 ///   - %BXX, where X is in [0-9]: "\033[1;XXm" if colours are enabled, and "" otherwise.
+///
+/// As in printf(), a specifier may be preceded by '-' to align it to the
+/// left, by '*' to pad it to the width passed as an int argument, and
+/// by '.N' to print N digits after the decimal point (for %f only; the
+/// default is 6). Widths are only ever passed as arguments because
+/// digits after a '%' are colour codes. Widths count bytes, not columns.
 static inline void vformat_to_impl(
   const char* fmt,
   va_list args,
@@ -144,28 +178,59 @@ static inline void vformat_to_impl(
 
     /// Formatting state.
     bool bold = false;
+    bool left_align = false;
+    int width = 0;
+    int precision = -1;
+    if (*fmt == '-') {
+      left_align = true;
+      fmt++;
+    }
+    if (*fmt == '*') {
+      width = va_arg(args, int);
+      fmt++;
+      if (width < 0) {
+        left_align = true;
+        width = -width;
+      }
+    }
+    if (*fmt == '.') {
+      precision = 0;
+      for (fmt++; *fmt >= '0' && *fmt <= '9'; fmt++) precision = precision * 10 + (*fmt - '0');
+    }
+
+    /// Padded values are formatted into a buffer first.
+    PaddedField field;
+    void (*emit)(const char *str, usz size, void *to) = write_string;
+    void *emit_to = to;
+    if (width) {
+      field.data = field.small;
+      field.size = 0;
+      field.capacity = sizeof field.small;
+      emit = write_string_to_field;
+      emit_to = &field;
+    }
 
     /// Handle the format specifier.
     switch (*fmt++) {
       case 'c': {
         /// Variadic arguments smaller than char are promoted to int.
         char c = (char) va_arg(args, int);
-        write_string(&c, 1, to);
+        emit(&c, 1, emit_to);
       } break;
 
       case 's': {
         const char *str = va_arg(args, const char *);
-        write_string(str, strlen(str), to);
+        emit(str, strlen(str), emit_to);
       } break;
 
       case 'S': {
         span str = va_arg(args, span);
-        write_string(str.data, str.size, to);
+        emit(str.data, str.size, emit_to);
       } break;
 
       case 'C': {
         const char *str = va_arg(args, const char *);
-        if (thread_use_colours) write_string(str, strlen(str), to);
+        if (thread_use_colours) emit(str, strlen(str), emit_to);
       } break;
 
       case 'd':
@@ -173,14 +238,14 @@ static inline void vformat_to_impl(
         int n = va_arg(args, int);
         char buf[32];
         sprintf(buf, "%d", n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'u': {
         unsigned n = va_arg(args, unsigned);
         char buf[32];
         sprintf(buf, "%u", n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'D':
@@ -188,14 +253,14 @@ static inline void vformat_to_impl(
         int64_t n = va_arg(args, int64_t);
         char buf[32];
         sprintf(buf, "%" PRId64, n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'U': {
         uint64_t n = va_arg(args, uint64_t);
         char buf[32];
         sprintf(buf, "%" PRIu64, n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'z': {
@@ -204,7 +269,7 @@ static inline void vformat_to_impl(
             isz n = va_arg(args, isz);
             char buf[32];
             sprintf(buf, "%zi", n);
-            write_string(buf, strlen(buf), to);
+            emit(buf, strlen(buf), emit_to);
             break;
         }
 
@@ -216,38 +281,45 @@ static inline void vformat_to_impl(
         usz n = va_arg(args, usz);
         char buf[32];
         sprintf(buf, "%zu", n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'x': {
         unsigned n = va_arg(args, unsigned);
         char buf[32];
         sprintf(buf, "%x", n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'X': {
         uint64_t n = va_arg(args, uint64_t);
         char buf[32];
         sprintf(buf, "%" PRIx64, n);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
+      } break;
+
+      case 'f': {
+        double n = va_arg(args, double);
+        char buf[64];
+        snprintf(buf, sizeof buf, "%.*f", precision < 0 ? 6 : precision, n);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'p': {
         void *ptr = va_arg(args, void *);
         char buf[32];
         sprintf(buf, "%p", ptr);
-        write_string(buf, strlen(buf), to);
+        emit(buf, strlen(buf), emit_to);
       } break;
 
       case 'b': {
         bool b = va_arg(args, int);
-        write_string(b ? "true" : "false", b ? 4 : 5, to);
+        emit(b ? "true" : "false", b ? 4 : 5, emit_to);
       } break;
 
       case 'T': {
         string s = typename(va_arg(args, Type *), !thread_disable_type_colours && thread_use_colours);
-        write_string(s.data, s.size, to);
+        emit(s.data, s.size, emit_to);
         free(s.data);
       } break;
 
@@ -258,8 +330,8 @@ static inline void vformat_to_impl(
           // Hardware registers are green.
           // Virtual registers are blue.
           if (reg < MIR_ARCH_START)
-            write_string("\033[32m", 5, to);
-          else write_string("\033[34m", 5, to);
+            emit("\033[32m", 5, emit_to);
+          else emit("\033[34m", 5, emit_to);
         }
 
         char buf[32];
@@ -270,20 +342,20 @@ static inline void vformat_to_impl(
           reg -= MIR_ARCH_START;
         }
         sprintf(buf + 1, "%zu", (size_t)reg);
-        write_string(buf, strlen(buf), to);
-        if (thread_use_colours) write_string("\033[m", 3, to);
+        emit(buf, strlen(buf), emit_to);
+        if (thread_use_colours) emit("\033[m", 3, emit_to);
       } break;
 
       case '%': {
-        write_string("%", 1, to);
+        emit("%", 1, emit_to);
       } break;
 
       case '\033': {
-        write_string("\033", 1, to);
+        emit("\033", 1, emit_to);
       } break;
 
       case 'm': {
-        if (thread_use_colours) write_string("\033[m", 3, to);
+        if (thread_use_colours) emit("\033[m", 3, emit_to);
       } break;
 
       case 'B': {
@@ -313,17 +385,26 @@ static inline void vformat_to_impl(
         if (!thread_use_colours) break;
 
         /// Reset the colour.
-        write_string("\033[m", 3, to);
+        emit("\033[m", 3, emit_to);
 
         /// Write the colour code.
-        write_string("\033[", 2, to);
-        if (bold) write_string("1;", 2, to);
-        write_string(fmt - 2, 2, to);
-        write_string("m", 1, to);
+        emit("\033[", 2, emit_to);
+        if (bold) emit("1;", 2, emit_to);
+        emit(fmt - 2, 2, emit_to);
+        emit("m", 1, emit_to);
       } break;
 
       default: ICE("Invalid format specifier: '%%%c'", fmt[-1]);
     }
+
+    /// Pad the value to the width.
+    if (width) {
+      usz padding = field.size < (usz) width ? (usz) width - field.size : 0;
+      if (!left_align) for (usz i = 0; i < padding; i++) write_string(" ", 1, to);
+      write_string(field.data, field.size, to);
+      if (left_align) for (usz i = 0; i < padding; i++) write_string(" ", 1, to);
+      if (field.data != field.small) free(field.data);
+    }
   }
 }
 
@@ -1,6 +1,7 @@
 #ifndef FUNCOMPILER_UTILS_H
 #define FUNCOMPILER_UTILS_H
 
+#include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -32,6 +33,7 @@ typedef ptrdiff_t isz;
 #ifndef FORCEINLINE
 #  define FORCEINLINE __attribute__((always_inline)) inline
 #endif
+#define NOINLINE __attribute__((noinline))
 #define PRETTY_FUNCTION __PRETTY_FUNCTION__
 #define NODISCARD __attribute__((warn_unused_result))
 #define BUILTIN_UNREACHABLE() __builtin_unreachable()
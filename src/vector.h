@@ -1,6 +1,8 @@
 #ifndef VECTOR_H
 #define VECTOR_H
 
+#include <hash.h>
+#include <memory_report.h>
 #include <stdlib.h>
 #include <string.h>
 #include <utils.h>
@@ -66,6 +68,7 @@
 #define vector_reserve(vector, elements)                                                                       \
   do {                                                                                                         \
     if ((vector).capacity < (vector).size + (elements)) {                                                      \
+      size_t _old_capacity = (vector).capacity;                                                                \
       (vector).capacity += (elements);                                                                         \
       (vector).capacity *= 2;                                                                                  \
       if (!(vector).data) {                                                                                    \
@@ -74,6 +77,7 @@
         (vector).data = realloc((vector).data, (vector).capacity * sizeof *(vector).data);                     \
         memset((vector).data + (vector).size, 0, ((vector).capacity - (vector).size) * sizeof *(vector).data); \
       }                                                                                                        \
+      memory_record_vector_growth(((vector).capacity - _old_capacity) * sizeof *(vector).data);                \
     }                                                                                                          \
   } while (0)
 
@@ -242,6 +246,17 @@
     _ptr;                                       \
 })
 
+/// Remove all elements of a vector that satisfy a predicate in a
+/// single pass. The order of the remaining elements is preserved.
+#define vector_remove_if(element, vector, ...)               \
+  do {                                                       \
+    size_t _kept = 0;                                        \
+    foreach_val (element, (vector)) {                        \
+      if (!(__VA_ARGS__)) (vector).data[_kept++] = element;  \
+    }                                                        \
+    (vector).size = _kept;                                   \
+  } while (0)
+
 /// Move all elements from a vector into another vector
 /// using memcpy, starting at a certain index.
 #define vector_move_to(to, from, _index)                                                         \
@@ -265,6 +280,70 @@
     }                                                           \
   } while (0)
 
+/// Define a vector of `type` that stores its first `N` elements inline
+/// and only allocates once it grows beyond that. Until then, `data`
+/// points to the inline storage, so a small vector must not be copied
+/// or moved once an element has been added to it. A zero-initialised
+/// small vector is empty.
+///
+/// Small vectors can be used with any of the vector macros above that
+/// neither grow the vector nor free its data. Use small_vector_push()
+/// and small_vector_delete() instead of vector_push() and vector_delete(),
+/// and call small_vector_reserve() before inserting elements.
+#define SmallVector(type, N) \
+  struct {                   \
+    type *data;              \
+    size_t size;             \
+    size_t capacity;         \
+    type inline_storage[N];  \
+  }
+
+/// Get the number of elements that a small vector can store inline.
+#define small_vector_inline_capacity(vector) (sizeof (vector).inline_storage / sizeof *(vector).inline_storage)
+
+/// Check whether the data of a small vector is *not* on the heap.
+#define small_vector_is_inline(vector) (!(vector).data || (vector).data == (vector).inline_storage)
+
+/// Ensure that there is space for at least (vector->size + elements) many elements.
+#define small_vector_reserve(vector, elements)                                                                 \
+  do {                                                                                                         \
+    if ((vector).capacity < (vector).size + (elements)) {                                                      \
+      size_t _capacity = 2 * ((vector).capacity + (elements));                                                 \
+      if (!(vector).data && (elements) <= small_vector_inline_capacity(vector)) {                              \
+        (vector).data = (vector).inline_storage;                                                               \
+        (vector).capacity = small_vector_inline_capacity(vector);                                              \
+      } else if (small_vector_is_inline(vector)) {                                                             \
+        __typeof__((vector).data) _data = calloc(_capacity, sizeof *(vector).data);                            \
+        if ((vector).size) memcpy(_data, (vector).data, (vector).size * sizeof *(vector).data);                \
+        (vector).data = _data;                                                                                 \
+        (vector).capacity = _capacity;                                                                         \
+        memory_record_vector_growth(_capacity * sizeof *(vector).data);                                        \
+      } else {                                                                                                 \
+        memory_record_vector_growth((_capacity - (vector).capacity) * sizeof *(vector).data);                  \
+        (vector).data = realloc((vector).data, _capacity * sizeof *(vector).data);                             \
+        memset((vector).data + (vector).size, 0, (_capacity - (vector).size) * sizeof *(vector).data);         \
+        (vector).capacity = _capacity;                                                                         \
+      }                                                                                                        \
+    }                                                                                                          \
+  } while (0)
+
+/// Push an element onto a small vector.
+#define small_vector_push(vector, ...)              \
+  do {                                              \
+    small_vector_reserve((vector), 1);              \
+    (vector).data[(vector).size++] = (__VA_ARGS__); \
+  } while (0)
+
+/// Free the memory used by a small vector, if any. The vector is
+/// left in an empty, but valid, state and can be reused.
+#define small_vector_delete(vector)                           \
+  do {                                                        \
+    if (!small_vector_is_inline(vector)) free((vector).data); \
+    (vector).data = NULL;                                     \
+    (vector).size = 0;                                        \
+    (vector).capacity = 0;                                    \
+  } while (0)
+
 /// These are deprecated and should be removed in the future.
 /*#define list_node(type) \
   struct {              \
@@ -378,9 +457,106 @@
 #define list_foreach_rev(it, list) \
   for (__typeof__(*(list).first) *it = (list).last; it; it = it->prev)
 
-/// Should eventually be a hash map implementation, but this is good enough for now.
-#define Map(key_t, value_t)      Vector(struct { key_t key; value_t value; })
-#define MultiMap(key_t, value_t) Vector(struct { key_t key; Vector(value_t) value; })
+/// ===========================================================================
+///  Maps.
+/// ===========================================================================
+/// A map stores its entries in a vector, in insertion order, so it can
+/// be iterated over with foreach(). Entries are looked up using an
+/// open-addressing hash table of indices into that vector. Entries
+/// can’t be removed, but the map can be cleared.
+///
+/// Keys are compared bytewise, except for spans and strings, which are
+/// compared by content. Since atoms are unique, comparing them bytewise
+/// is the same as comparing them by content.
+///
+/// Never push to a map with vector_push() as that bypasses the index.
+#define Map(key_t, value_t) \
+  struct {                  \
+    struct {                \
+      key_t key;            \
+      value_t value;        \
+    } *data;                \
+    size_t size;            \
+    size_t capacity;        \
+    MapIndex index;         \
+  }
+
+#define MultiMap(key_t, value_t) Map(key_t, Vector(value_t))
+
+/// A slot in the index of a map. `entry` is the index of the entry
+/// plus one, or 0 if the slot is empty.
+typedef struct MapSlot {
+  u64 hash;
+  usz entry;
+} MapSlot;
+
+/// The index of a map. The capacity is always a power of two.
+typedef struct MapIndex {
+  MapSlot *slots;
+  usz capacity;
+} MapIndex;
+
+/// Minimum number of slots in the index of a map.
+#define MAP_MIN_INDEX_CAPACITY ((usz) 16)
+
+static inline u64 map_hash_mix(u64 k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static inline u64 map_hash_bytes(const void *key, usz size) {
+  if (size > sizeof(u64)) return hash64((span){key, size});
+  u64 k = 0;
+  memcpy(&k, key, size);
+  return map_hash_mix(k);
+}
+
+static inline u64 map_hash_span(const void *key, usz size) {
+  (void) size;
+  return hash64(*(const span *) key);
+}
+
+static inline bool map_eq_bytes(const void *a, const void *b, usz size) {
+  return memcmp(a, b, size) == 0;
+}
+
+static inline bool map_eq_span(const void *a, const void *b, usz size) {
+  (void) size;
+  const span *x = a, *y = b;
+  return string_eq(*x, *y);
+}
+
+/// Pick the hash and comparison functions for a key type. Note that
+/// spans and strings have the same layout.
+#define map_hash_fn(key) _Generic((key), span: map_hash_span, string: map_hash_span, default: map_hash_bytes)
+#define map_eq_fn(key) _Generic((key), span: map_eq_span, string: map_eq_span, default: map_eq_bytes)
+
+/// Add an entry to the index. The index must have room for it.
+static inline void map_index_insert(MapIndex *index, u64 hash, usz entry) {
+  usz mask = index->capacity - 1;
+  usz i = hash & mask;
+  while (index->slots[i].entry) i = (i + 1) & mask;
+  index->slots[i] = (MapSlot){hash, entry + 1};
+}
+
+/// Make sure the index has room for `count` entries.
+static inline void map_index_reserve(MapIndex *index, usz count) {
+  /// Keep the load factor below 1/2; probe sequences stay short.
+  if (2 * count <= index->capacity) return;
+  usz capacity = index->capacity ? index->capacity : MAP_MIN_INDEX_CAPACITY;
+  while (2 * count > capacity) capacity *= 2;
+
+  MapIndex grown = {calloc(capacity, sizeof(MapSlot)), capacity};
+  memory_record_vector_growth((capacity - index->capacity) * sizeof(MapSlot));
+  for (usz i = 0; i < index->capacity; i++)
+    if (index->slots[i].entry)
+      map_index_insert(&grown, index->slots[i].hash, index->slots[i].entry - 1);
+
+  free(index->slots);
+  *index = grown;
+}
 
 /// Get the value type of a map.
 ///
@@ -391,51 +567,74 @@
 /// ```
 #define MapValue(map) __typeof__((map).data->value)
 
+/// Find the entry for a key, given its hash. Returns NULL if there is none.
+#define map_find_entry_impl(map, key_, hash_) ({                                         \
+  __typeof__(*(map).data) *_found = NULL;                                                \
+  if ((map).size) {                                                                      \
+    usz _mask = (map).index.capacity - 1;                                                \
+    for (usz _i = (hash_) & _mask; (map).index.slots[_i].entry; _i = (_i + 1) & _mask) { \
+      MapSlot *_slot = (map).index.slots + _i;                                           \
+      __typeof__(*(map).data) *_e = (map).data + _slot->entry - 1;                       \
+      if (_slot->hash == (hash_) && map_eq_fn(key_)(&_e->key, &(key_), sizeof(key_))) {  \
+        _found = _e;                                                                     \
+        break;                                                                           \
+      }                                                                                  \
+    }                                                                                    \
+  }                                                                                      \
+  _found;                                                                                \
+})
+
+/// Find the entry for a key, adding a zero-initialised one if there is none.
+#define map_find_or_add_entry_impl(map, key_) ({                           \
+  u64 _hash = map_hash_fn(key_)(&(key_), sizeof(key_));                    \
+  __typeof__(*(map).data) *_entry = map_find_entry_impl(map, key_, _hash); \
+  if (!_entry) {                                                           \
+    map_index_reserve(&(map).index, (map).size + 1);                       \
+    map_index_insert(&(map).index, _hash, (map).size);                     \
+    vector_push((map), (__typeof__(*(map).data)){0});                      \
+    _entry = &vector_back((map));                                          \
+    _entry->key = key_;                                                    \
+  }                                                                        \
+  _entry;                                                                  \
+})
+
 /// Set an element in a map.
-#define map_set(map, _key_, _val_)                                                                                     \
-  do {                                                                                                                 \
-    __typeof__(_key_) _key = _key_;                                                                                    \
-    __typeof__(_val_) _val = _val_;                                                                                    \
-    __typeof__(*(map).data) *_element_ptr = vector_find_if(el, (map), memcmp(&el->key, &(_key), sizeof el->key) == 0); \
-    if (_element_ptr) _element_ptr->value = _val;                                                                      \
-    else vector_push((map), (__typeof__(*_element_ptr)){.key = _key, .value = _val});                                  \
+#define map_set(map, _key_, _val_)                         \
+  do {                                                     \
+    __typeof__(_key_) _key = _key_;                        \
+    __typeof__(_val_) _val = _val_;                        \
+    map_find_or_add_entry_impl((map), _key)->value = _val; \
   } while (0)
 
 /// Get an element from a map.
-#define map_get(map, _key_) ({                                                                                       \
-  __typeof__(_key_) _key = _key_;                                                                                    \
-  __typeof__(*(map).data) *_element_ptr = vector_find_if(el, (map), memcmp(&el->key, &(_key), sizeof el->key) == 0); \
-  _element_ptr ? &_element_ptr->value : NULL;                                                                        \
+#define map_get(map, _key_) ({                                                         \
+  __typeof__(_key_) _key = _key_;                                                      \
+  u64 _key_hash = map_hash_fn(_key)(&_key, sizeof _key);                               \
+  __typeof__(*(map).data) *_element_ptr = map_find_entry_impl((map), _key, _key_hash); \
+  _element_ptr ? &_element_ptr->value : NULL;                                          \
 })
 
 /// Insert an element into a multimap.
-#define mmap_insert(map, _key_, _val_)                                                                                 \
-  do {                                                                                                                 \
-    __typeof__(_key_) _key = _key_;                                                                                    \
-    __typeof__(_val_) _val = _val_;                                                                                    \
-    __typeof__(*(map).data) *_element_ptr = vector_find_if(el, (map), memcmp(&el->key, &(_key), sizeof el->key) == 0); \
-    if (_element_ptr) vector_push(_element_ptr->value, _val);                                                          \
-    else {                                                                                                             \
-      vector_push((map), (__typeof__(*_element_ptr)){0});                                                              \
-      _element_ptr = &vector_back((map));                                                                              \
-      _element_ptr->key = _key;                                                                                        \
-      vector_push(_element_ptr->value, _val);                                                                          \
-    }                                                                                                                  \
+#define mmap_insert(map, _key_, _val_)                                            \
+  do {                                                                            \
+    __typeof__(_key_) _key = _key_;                                               \
+    __typeof__(_val_) _val = _val_;                                               \
+    __typeof__(*(map).data) *_mm_entry = map_find_or_add_entry_impl((map), _key); \
+    vector_push(_mm_entry->value, _val);                                          \
   } while (0)
 
 /// Get an element from a map or insert a zero-initialised element otherwise.
-#define map_get_default(map, _key_) ({                                                                               \
-  __typeof__(_key_) _key = _key_;                                                                                    \
-  __typeof__(*(map).data) *_element_ptr = vector_find_if(el, (map), memcmp(&el->key, &(_key), sizeof el->key) == 0); \
-  if (!_element_ptr) {                                                                                               \
-    vector_push((map), (__typeof__(*(map).data)){0});                                                                \
-    _element_ptr = &vector_back((map));                                                                              \
-  }                                                                                                                  \
-  _element_ptr ? &_element_ptr->value : NULL;                                                                        \
+#define map_get_default(map, _key_) ({             \
+  __typeof__(_key_) _key = _key_;                  \
+  &map_find_or_add_entry_impl((map), _key)->value; \
 })
 
 /// Clear a map.
-#define map_clear(map) vector_clear((map))
+#define map_clear(map)                                                                           \
+  do {                                                                                           \
+    vector_clear(map);                                                                           \
+    if ((map).index.slots) memset((map).index.slots, 0, (map).index.capacity * sizeof(MapSlot)); \
+  } while (0)
 
 /// Clear a multimap.
 #define mmap_clear(map)                             \
@@ -445,7 +644,12 @@
   } while (0)
 
 /// Free a map.
-#define map_delete(map) vector_delete((map))
+#define map_delete(map)          \
+  do {                           \
+    vector_delete(map);          \
+    free((map).index.slots);     \
+    (map).index = (MapIndex){0}; \
+  } while (0)
 
 /// Free a multimap.
 #define mmap_delete(map)                            \
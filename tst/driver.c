@@ -0,0 +1,242 @@
+/// Test the parts of the intc driver that take more than one
+/// invocation: the output cache and the compile server.
+///
+/// Usage: driver_test <intc>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOCKET_PATH "server.sock"
+
+static const char *intc;
+static int failures = 0;
+
+#define CHECK(cond, ...)                          \
+  do {                                            \
+    if (!(cond)) {                                \
+      fprintf(stderr, "FAILURE: " __VA_ARGS__);   \
+      fprintf(stderr, "\n");                      \
+      failures++;                                 \
+    }                                             \
+  } while (0)
+
+/// The output of an intc invocation.
+typedef struct Run {
+  int status;
+  char output[8192];
+} Run;
+
+static void write_file(const char *path, const char *contents) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  fputs(contents, f);
+  fclose(f);
+}
+
+static bool file_exists(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0;
+}
+
+/// Run intc with the given arguments and collect its stdout and stderr.
+static Run run(const char *arguments) {
+  char command[1024];
+  snprintf(command, sizeof command, "\"%s\" %s 2>&1", intc, arguments);
+
+  Run r = {0};
+  FILE *pipe = popen(command, "r");
+  if (!pipe) {
+    fprintf(stderr, "Could not run %s: %s\n", command, strerror(errno));
+    exit(1);
+  }
+
+  size_t size = fread(r.output, 1, sizeof r.output - 1, pipe);
+  r.output[size] = 0;
+  int status = pclose(pipe);
+  r.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+  return r;
+}
+
+/// Get a number from the output of `--cache-stats`, or -1 if it isn't there.
+static long long cache_statistic(const Run *r, const char *name) {
+  const char *line = strstr(r->output, name);
+  long long value;
+  if (!line || sscanf(line + strlen(name), "%lld", &value) != 1) return -1;
+  return value;
+}
+
+/// Compile the same file three times: the second run should reuse the
+/// output of the first, and the third changes an option.
+static void test_cache(void) {
+  write_file("cache_test.int", "42\n");
+
+  static const struct {
+    const char *flags;
+    long long hits, misses, stored;
+  } runs[] = {
+    {"", 0, 1, 1},
+    {"", 1, 0, 0},
+    {"-O", 0, 1, 1},
+  };
+
+  for (size_t i = 0; i < sizeof runs / sizeof *runs; i++) {
+    remove("cache_test.s");
+
+    char arguments[256];
+    snprintf(arguments, sizeof arguments, "--cache-dir=cache --cache-stats %s cache_test.int -o cache_test.s", runs[i].flags);
+    Run r = run(arguments);
+
+    CHECK(r.status == 0, "cache run %zu exited with %d:\n%s", i, r.status, r.output);
+    CHECK(file_exists("cache_test.s"), "cache run %zu did not write its output", i);
+    CHECK(cache_statistic(&r, "Hits") == runs[i].hits, "cache run %zu: expected %lld hits:\n%s", i, runs[i].hits, r.output);
+    CHECK(cache_statistic(&r, "Misses") == runs[i].misses, "cache run %zu: expected %lld misses:\n%s", i, runs[i].misses, r.output);
+    CHECK(cache_statistic(&r, "Outputs stored") == runs[i].stored, "cache run %zu: expected %lld stores:\n%s", i, runs[i].stored, r.output);
+  }
+}
+
+/// A hit should report the same diagnostics as the compilation that
+/// stored the output.
+static void test_cache_diagnostics(void) {
+  write_file("cache_warning.int", "f : void() discardable {}\n");
+
+  for (int i = 0; i < 2; i++) {
+    remove("cache_warning.s");
+    Run r = run("--cache-dir=cache --cache-stats cache_warning.int -o cache_warning.s");
+
+    CHECK(r.status == 0, "cache warning run %d exited with %d:\n%s", i, r.status, r.output);
+    CHECK(file_exists("cache_warning.s"), "cache warning run %d did not write its output", i);
+    CHECK(cache_statistic(&r, "Hits") == i, "cache warning run %d: expected %d hits:\n%s", i, i, r.output);
+    CHECK(
+      strstr(r.output, "cache_warning.int:1:0: Warning: `discardable` has no effect"),
+      "cache warning run %d did not report the warning:\n%s",
+      i,
+      r.output
+    );
+  }
+}
+
+/// Wait until the server accepts connections.
+static bool wait_for_server(pid_t server) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  strcpy(address.sun_path, SOCKET_PATH);
+
+  for (int attempt = 0; attempt < 500; attempt++) {
+    if (waitpid(server, NULL, WNOHANG) == server) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    bool connected = connect(fd, (struct sockaddr *) &address, sizeof address) == 0;
+    close(fd);
+    if (connected) return true;
+
+    nanosleep(&(struct timespec){.tv_nsec = 10 * 1000 * 1000}, NULL);
+  }
+  return false;
+}
+
+/// Compile through a server and check that the client exits with the
+/// status the compilation would have had without one.
+static void test_server(void) {
+  write_file("server_ok.int", "42\n");
+  write_file("server_parse_error.int", "1 + +\n");
+  write_file("server_type_error.int", "undeclared + 1\n");
+
+  pid_t server = fork();
+  if (server < 0) {
+    fprintf(stderr, "Could not fork: %s\n", strerror(errno));
+    exit(1);
+  }
+  if (server == 0) {
+    /// Don't mix the server's messages into those of the test.
+    freopen("/dev/null", "w", stderr);
+    execl(intc, intc, "--serve", SOCKET_PATH, (char *) NULL);
+    _exit(127);
+  }
+
+  if (!wait_for_server(server)) {
+    CHECK(false, "the compile server did not start");
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return;
+  }
+
+  static const struct {
+    const char *file;
+    int status;
+  } compilations[] = {
+    {"server_ok.int", 0},
+    {"server_parse_error.int", 1},
+    {"server_type_error.int", 2},
+  };
+
+  for (size_t i = 0; i < sizeof compilations / sizeof *compilations; i++) {
+    remove("server_test.s");
+
+    char arguments[256];
+    snprintf(arguments, sizeof arguments, "--connect " SOCKET_PATH " %s -o server_test.s", compilations[i].file);
+    Run r = run(arguments);
+
+    CHECK(
+      r.status == compilations[i].status,
+      "compiling %s through the server exited with %d, expected %d:\n%s",
+      compilations[i].file,
+      r.status,
+      compilations[i].status,
+      r.output
+    );
+    CHECK(
+      file_exists("server_test.s") == (compilations[i].status == 0),
+      "compiling %s through the server %s its output",
+      compilations[i].file,
+      compilations[i].status == 0 ? "did not write" : "wrote"
+    );
+  }
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <intc>\n", argv[0]);
+    return 127;
+  }
+
+  /// Run in a directory of our own; relative paths keep the socket
+  /// path short.
+  char directory[] = "driver_test_XXXXXX";
+  if (!mkdtemp(directory)) {
+    fprintf(stderr, "Could not create a temporary directory: %s\n", strerror(errno));
+    return 1;
+  }
+
+  char *intc_path = realpath(argv[1], NULL);
+  if (!intc_path || chdir(directory) < 0) {
+    fprintf(stderr, "Could not set up test directory: %s\n", strerror(errno));
+    return 1;
+  }
+  intc = intc_path;
+
+  test_cache();
+  test_cache_diagnostics();
+  test_server();
+
+  chdir("..");
+  char command[128];
+  snprintf(command, sizeof command, "rm -rf %s", directory);
+  system(command);
+  free(intc_path);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+/// Test that intc_compile() can be called from several threads at once,
+/// that it reports errors, and that it honours its options. Also test
+/// that fatal errors in several threads at once don't hang, and that
+/// one raised with a lock held exits rather than being caught.
+///
+/// Usage: libintc_test <linker>
+#include <codegen/instruction_selection.h>
+#include <error.h>
+#include <intc.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PROGRAM_COUNT 8
+
+typedef struct Program {
+  IntcStatus status;
+  string output;
+} Program;
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                          \
+  do {                                            \
+    if (!(cond)) {                                \
+      fprintf(stderr, "FAILURE: " __VA_ARGS__);   \
+      fprintf(stderr, "\n");                      \
+      failures++;                                 \
+    }                                             \
+  } while (0)
+
+/// Compile a program that returns 40 + `index`.
+static void compile_program(usz index, void *programs) {
+  char source[32];
+  int size = snprintf(source, sizeof source, "x :: 40\nx + %zu\n", (size_t) index);
+
+  IntcOptions options = intc_default_options();
+  options.filename = "libintc_test.int";
+  options.codegen.target = TARGET_GNU_ASM_ATT;
+
+  Program *program = (Program *) programs + index;
+  program->status = intc_compile(&options, (span){source, (usz) size}, &program->output);
+}
+
+/// Look up an ISel table that doesn't exist, which is an ICE.
+static void get_missing_isel_table(usz index, void *data) {
+  (void) index;
+  (void) data;
+  isel_patterns_get("libintc_test_missing.isel");
+}
+
+/// Run get_missing_isel_table() on several threads at once.
+static void get_missing_isel_tables(void *data) {
+  (void) data;
+  platform_parallel_for(3, 3, get_missing_isel_table, NULL);
+}
+
+/// Raise an ICE with a lock held.
+static void ice_with_lock_held(void *data) {
+  PlatformMutex *mutex = data;
+  platform_mutex_lock(mutex);
+  ICE("ICE with a lock held");
+}
+
+/// Compile a program and check the status.
+static void check_status(const char *source, bool lazy_bodies, IntcStatus expected) {
+  IntcOptions options = intc_default_options();
+  options.lazy_function_bodies = lazy_bodies;
+  string output;
+  IntcStatus status = intc_compile(&options, (span){source, strlen(source)}, &output);
+  CHECK(status == expected, "compiling \"%s\" returned %d, expected %d", source, (int) status, (int) expected);
+  CHECK((output.size != 0) == (expected == INTC_OK), "compiling \"%s\" produced wrong output", source);
+  free(output.data);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <linker>\n", argv[0]);
+    return 127;
+  }
+
+  Program programs[PROGRAM_COUNT] = {0};
+  platform_parallel_for(PROGRAM_COUNT, 4, compile_program, programs);
+
+  /// Link and run each program.
+  for (usz i = 0; i < PROGRAM_COUNT; i++) {
+    Program *program = programs + i;
+    CHECK(program->status == INTC_OK, "program %zu returned %d", (size_t) i, (int) program->status);
+    if (program->status != INTC_OK) continue;
+
+    char asm_path[64], exe_path[64], command[512];
+    snprintf(asm_path, sizeof asm_path, "libintc_test_%zu.s", (size_t) i);
+    snprintf(exe_path, sizeof exe_path, "./libintc_test_%zu", (size_t) i);
+
+    FILE *f = fopen(asm_path, "wb");
+    CHECK(f, "could not open %s", asm_path);
+    if (!f) continue;
+    fwrite(program->output.data, 1, program->output.size, f);
+    fclose(f);
+
+    snprintf(command, sizeof command, "\"%s\" -o %s %s", argv[1], exe_path, asm_path);
+    int status = system(command);
+    CHECK(status == 0, "could not link %s: %s", asm_path, command);
+
+    if (status == 0) {
+      status = system(exe_path);
+      CHECK(
+        WIFEXITED(status) && WEXITSTATUS(status) == 40 + (int) i,
+        "program %zu returned %d, expected %d",
+        (size_t) i,
+        WIFEXITED(status) ? WEXITSTATUS(status) : -1,
+        40 + (int) i
+      );
+    }
+
+    remove(asm_path);
+    remove(exe_path + 2);
+    free(program->output.data);
+  }
+
+  check_status("1 + +\n", false, INTC_PARSE_ERROR);
+  check_status("undeclared + 1\n", false, INTC_TYPE_ERROR);
+
+  /// The body of an unreferenced function is only parsed if bodies
+  /// aren't parsed lazily.
+  static const char unreferenced_error[] = "unused : integer() {\n  1 + +\n}\n42\n";
+  check_status(unreferenced_error, false, INTC_PARSE_ERROR);
+  check_status(unreferenced_error, true, INTC_OK);
+
+  /// Callers that only care whether a program compiles needn't take the code.
+  IntcOptions options = intc_default_options();
+  IntcStatus status = intc_compile(&options, (span){"42\n", 3}, NULL);
+  CHECK(status == INTC_OK, "compiling without output returned %d", (int) status);
+
+  /// The ISel table is looked up under a lock; failing to read it in
+  /// several threads must fail each of them without hanging the others.
+  /// Run this in a child process so that a hang can be detected.
+  pid_t pid = fork();
+  if (pid == 0) {
+    alarm(5);
+    bool caught = catch_fatal_errors(get_missing_isel_tables, NULL);
+    _Exit(caught ? 2 : 0);
+  }
+  int wait_status;
+  waitpid(pid, &wait_status, 0);
+  CHECK(
+    WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 0,
+    "missing ISel table was not reported as a fatal error (wait status %d)",
+    wait_status
+  );
+
+  /// A fatal error raised with a lock held can't be caught, because
+  /// whoever took the lock next would hang; it exits instead.
+  pid = fork();
+  if (pid == 0) {
+    alarm(5);
+    static PlatformMutex mutex = PLATFORM_MUTEX_INIT;
+    catch_fatal_errors(ice_with_lock_held, &mutex);
+    platform_mutex_lock(&mutex);
+    _Exit(0);
+  }
+  waitpid(pid, &wait_status, 0);
+  CHECK(
+    WIFEXITED(wait_status) && WEXITSTATUS(wait_status) == 1,
+    "ICE with a lock held did not exit (wait status %d)",
+    wait_status
+  );
+  return failures ? 1 : 0;
+}
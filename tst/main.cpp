@@ -5,11 +5,15 @@
 #include <cstring>
 #include <filesystem>
 #include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <fmt/std.h>
 #include <fstream>
 #include <iterator>
+#include <optional>
 #include <random>
 #include <regex>
+#include <set>
+#include <sstream>
 #include <string>
 #include <thread>
 
@@ -359,14 +363,48 @@ int main(int argc_, char **argv_) {
     std::ifstream testfile(testpath);
     std::string line{};
     ASSERT(std::getline(testfile, line), "Sorry, but the test file at \"{}\" appears to be empty", testpath);
-    while (line.starts_with(";; LABELS")) {
+
+    /// Extra compiler flags, already escaped, more input files to
+    /// compile along with the test, relative to the test’s directory,
+    /// and the names of the outputs that those should leave behind.
+    std::string flags{};
+    std::vector<fs::path> files{};
+    std::optional<std::set<std::string>> outputs{};
+    for (;;) {
+        if (line.starts_with(";; FLAGS ")) {
+            std::istringstream words{line.substr(9)};
+            for (std::string word; words >> word;) {
+                if (not flags.empty()) flags += ' ';
+                write_command_line_arg(flags, word);
+            }
+        } else if (line.starts_with(";; FILES ")) {
+            std::istringstream words{line.substr(9)};
+            for (std::string word; words >> word;) {
+                fs::path file = fs::absolute(testpath).parent_path() / word;
+                ASSERT(fs::exists(file), "Sorry, but the file \"{}\" used by test \"{}\" does not exist", file, testpath);
+                files.push_back(std::move(file));
+            }
+        } else if (line.starts_with(";; OUTPUTS ")) {
+            std::istringstream words{line.substr(11)};
+            outputs.emplace();
+            for (std::string word; words >> word;) outputs->insert(std::move(word));
+        } else if (not line.starts_with(";; LABELS")) {
+            break;
+        }
+
         ASSERT(
             std::getline(testfile, line),
-            "Sorry, but the test file at \"{}\" appears to be malformed (LABELS nonsense)",
+            "Sorry, but the test file at \"{}\" appears to be malformed (LABELS, FLAGS, FILES, or OUTPUTS nonsense)",
             testpath
         );
     }
 
+    ASSERT(
+        not outputs or not files.empty(),
+        "Sorry, but the test file at \"{}\" declares OUTPUTS without FILES",
+        testpath
+    );
+
     ASSERT(
         line.starts_with(";; "),
         "Sorry, but the test file at \"{}\" appears to be a malformed test.\n"
@@ -377,14 +415,27 @@ int main(int argc_, char **argv_) {
 
     bool expected_error{false};
     int expected_status{0};
+    int expected_error_status{-1};
     if (line == ";; SKIP") {
         //VERBOSE("Skipping test {}", testpath);
         return 0;
     }
 
-    if (line == ";; ERROR") {
+    if (line == ";; ERROR" or line.starts_with(";; ERROR ")) {
         //VERBOSE("Test should error");
         expected_error = true;
+
+        /// Optionally, the status code that intc should return.
+        if (line != ";; ERROR") {
+            char *end;
+            errno = 0;
+            expected_error_status = (int) std::strtoull(line.c_str() + 9, &end, 10);
+            ASSERT(
+                errno == 0 and *end == 0,
+                "Expected intc exit code must be an integer, but was \"{}\"",
+                std::string_view{line}.substr(9)
+            );
+        }
     } else {
         char *end;
         errno = 0;
@@ -408,38 +459,81 @@ int main(int argc_, char **argv_) {
     //VERBOSE("Expected output: {:?}", expected_output);
 
     /// Construct Intercept compiler invocation.
+    ///
+    /// If there are several input files, we can’t use `-o`, so intc
+    /// is run in a temporary directory and every file it creates there
+    /// is one of its outputs.
     fs::path intc_outpath{}, intc_logpath = temppath("log");
-    if (target.starts_with("asm")) intc_outpath = temppath("s");
+    if (not files.empty()) intc_outpath = temppath("");
+    else if (target.starts_with("asm")) intc_outpath = temppath("s");
     else intc_outpath = temppath(target == "llvm" ? "ll" : "o");
+
+    std::string inputs{};
+    write_command_line_arg(inputs, fs::absolute(testpath).string());
+    for (const auto& file : files) {
+        inputs += ' ';
+        write_command_line_arg(inputs, file.string());
+    }
+
+    auto cwd = fs::current_path();
+    if (not files.empty()) {
+        intcpath = fs::absolute(intcpath);
+        fs::create_directory(intc_outpath);
+        fs::current_path(intc_outpath);
+    }
+
     auto intc_status = run_command(
         intcpath,
         "-cc",
         CALLING_CONVENTION,
         "-t",
         target,
-        "-o",
-        intc_outpath.string(),
-        testpath.string(),
+        files.empty() ? "-o" : ARG_NONE,
+        files.empty() ? intc_outpath.string() : ARG_NONE,
+        ARG_NO_ESCAPE + inputs,
         optimise ? "-O" : ARG_NONE,
+        ARG_NO_ESCAPE + flags,
         ARG_NO_ESCAPE ">",
         intc_logpath.string(),
         ARG_NO_ESCAPE "2>&1"
     );
 
+    fs::current_path(cwd);
+
     //VERBOSE("Intercept compiler invocation: {}", intc_status.escaped_command_line);
     defer {
-        delete_file(intc_outpath);
+        fs::remove_all(intc_outpath);
         delete_file(intc_logpath);
     };
 
-    /// Check for ICEs.
+    /// Check for ICEs, unless the test expects one.
     std::string log = map_file(intc_logpath.string());
     ASSERT(
-        log.find("Internal Compiler Error") == std::string::npos,
+        log.find("Internal Compiler Error") == std::string::npos or
+            (expected_error and expected_output.find("Internal Compiler Error") != std::string::npos),
         "Intercept compiler suffered Internal Compiler Error: {}",
         log
     );
 
+    /// Check that exactly the expected outputs were left behind.
+    if (outputs) {
+        std::set<std::string> actual_outputs{};
+        for (const auto& entry : fs::directory_iterator{intc_outpath})
+            actual_outputs.insert(entry.path().stem().string());
+        ASSERT(
+            actual_outputs == *outputs,
+            "FAILURE: Intercept compiler did not produce the expected outputs\n"
+            "  intc_invocation: {}\n"
+            "  outputs:         {}\n"
+            "  expected:        {}\n"
+            "  output:\n{}",
+            intc_status.escaped_command_line,
+            actual_outputs,
+            *outputs,
+            log
+        );
+    }
+
     /// If we were expecting an error, check for that.
     if (expected_error) {
         ASSERT(
@@ -449,6 +543,35 @@ int main(int argc_, char **argv_) {
             intc_status.escaped_command_line
         );
 
+        /// Check the status code, if there is one.
+        ASSERT(
+            expected_error_status == -1 or intc_status.code == expected_error_status,
+            "FAILURE: Intercept compiler returned unexpected exit code\n"
+            "  intc_invocation: {}\n"
+            "  return code:     {}\n"
+            "  expected:        {}\n"
+            "  output:\n{}",
+            intc_status.escaped_command_line,
+            intc_status.code,
+            expected_error_status,
+            log
+        );
+
+        /// The expected output of an error test is lines that must
+        /// appear in the diagnostics.
+        std::istringstream expected_lines{expected_output};
+        for (std::string expected_line; std::getline(expected_lines, expected_line);) {
+            ASSERT(
+                log.find(expected_line) != std::string::npos,
+                "FAILURE: Intercept compiler output does not contain {:?}\n"
+                "  intc_invocation: {}\n"
+                "  output:\n{}",
+                expected_line,
+                intc_status.escaped_command_line,
+                log
+            );
+        }
+
         /// If unsuccessful and error was expected, we good.
         return 0;
     }
@@ -465,93 +588,100 @@ int main(int argc_, char **argv_) {
         log
     );
 
-    /// Run linker.
-    auto ld_outpath = temppath(PLATFORM_EXE_SUFFIX);
-    auto ld_status = run_command(
-        ldpath.string(),
-        "-o",
-        ld_outpath.string(),
-        intc_outpath.string()
-    );
-    defer { delete_file(ld_outpath); };
-    //VERBOSE("Linker command line is: {}", ld_status.escaped_command_line);
-    ASSERT(
-        ld_status.success,
-        "FAILURE: Linker errored\n"
-        "  intc_invocation:   {}\n"
-        "  ld_invocation:     {}\n"
-        "  return status:     {}",
-        intc_status.escaped_command_line,
-        ld_status.escaped_command_line,
-        ld_status.raw_code
-    );
+    /// Link and run a program that intc generated, and check that it
+    /// behaves as expected.
+    const auto check_program = [&](const fs::path& program) {
+        /// Run linker.
+        auto ld_outpath = temppath(PLATFORM_EXE_SUFFIX);
+        auto ld_status = run_command(
+            ldpath.string(),
+            "-o",
+            ld_outpath.string(),
+            program.string()
+        );
+        defer { delete_file(ld_outpath); };
+        //VERBOSE("Linker command line is: {}", ld_status.escaped_command_line);
+        ASSERT(
+            ld_status.success,
+            "FAILURE: Linker errored\n"
+            "  intc_invocation:   {}\n"
+            "  ld_invocation:     {}\n"
+            "  return status:     {}",
+            intc_status.escaped_command_line,
+            ld_status.escaped_command_line,
+            ld_status.raw_code
+        );
 
-    /// Run the test.
-    fs::path outpath = temppath("txt");
-    auto test_status = run_command(
-        ld_outpath.is_absolute() ? ld_outpath : fs::current_path() / ld_outpath,
-        ARG_NO_ESCAPE ">",
-        outpath.string(),
-        ARG_NO_ESCAPE "2>&1"
-    );
-    //VERBOSE("Running test executable: {}", test_status.escaped_command_line);
-    defer { delete_file(outpath); };
+        /// Run the test.
+        fs::path outpath = temppath("txt");
+        auto test_status = run_command(
+            ld_outpath.is_absolute() ? ld_outpath : fs::current_path() / ld_outpath,
+            ARG_NO_ESCAPE ">",
+            outpath.string(),
+            ARG_NO_ESCAPE "2>&1"
+        );
+        //VERBOSE("Running test executable: {}", test_status.escaped_command_line);
+        defer { delete_file(outpath); };
 
 #ifdef __linux__
-    /// Check for signals on Linux.
-    ASSERT(
-        test_status.exited,
-        "FAILURE: Test was terminated by signal\n"
-        "  intc_invocation:   {}\n"
-        "  ld_invocation:     {}\n"
-        "  test_invocation:   {}\n"
-        "  signal:            {}",
-        intc_status.escaped_command_line,
-        ld_status.escaped_command_line,
-        test_status.escaped_command_line,
-        WTERMSIG(test_status.code)
-    );
+        /// Check for signals on Linux.
+        ASSERT(
+            test_status.exited,
+            "FAILURE: Test was terminated by signal\n"
+            "  intc_invocation:   {}\n"
+            "  ld_invocation:     {}\n"
+            "  test_invocation:   {}\n"
+            "  signal:            {}",
+            intc_status.escaped_command_line,
+            ld_status.escaped_command_line,
+            test_status.escaped_command_line,
+            WTERMSIG(test_status.code)
+        );
 #endif
 
-    /// Check status code.
-    ASSERT(
-        test_status.code == expected_status,
-        "FAILURE: Test returned unexpected exit code\n"
-        "  intc_invocation:   {}\n"
-        "  ld_invocation:     {}\n"
-        "  test_invocation:   {}\n"
-        "  return code:       {}\n"
-        "  expected:          {}\n",
-        intc_status.escaped_command_line,
-        ld_status.escaped_command_line,
-        test_status.escaped_command_line,
-        test_status.code,
-        expected_status
-    );
+        /// Check status code.
+        ASSERT(
+            test_status.code == expected_status,
+            "FAILURE: Test returned unexpected exit code\n"
+            "  intc_invocation:   {}\n"
+            "  ld_invocation:     {}\n"
+            "  test_invocation:   {}\n"
+            "  return code:       {}\n"
+            "  expected:          {}\n",
+            intc_status.escaped_command_line,
+            ld_status.escaped_command_line,
+            test_status.escaped_command_line,
+            test_status.code,
+            expected_status
+        );
 
-    /// Get test output.
-    std::string output = map_file(outpath.string());
+        /// Get test output.
+        std::string output = map_file(outpath.string());
 
-    /// Convert \r\n to \n.
-    output = std::regex_replace(output, std::regex{"\r\n"}, "\n");
+        /// Convert \r\n to \n.
+        output = std::regex_replace(output, std::regex{"\r\n"}, "\n");
 
-    /// Remove trailing newlines from output and expected output, for consistency.
-    while (output.ends_with("\n")) output.pop_back();
-    while (expected_output.ends_with("\n")) expected_output.pop_back();
+        /// Remove trailing newlines from output and expected output, for consistency.
+        while (output.ends_with("\n")) output.pop_back();
+        while (expected_output.ends_with("\n")) expected_output.pop_back();
 
-    /// Check output.
-    ASSERT(
-        output == expected_output,
-        "FAILURE: Test generated unexpected output\n"
-        "  Output:          {:?}\n"
-        "  Expected:        {:?}\n"
-        "  intc_invocation: {}\n"
-        "  ld_invocation:   {}\n"
-        "  test_invocation: {}",
-        output,
-        expected_output,
-        intc_status.escaped_command_line,
-        ld_status.escaped_command_line,
-        test_status.escaped_command_line
-    );
+        /// Check output.
+        ASSERT(
+            output == expected_output,
+            "FAILURE: Test generated unexpected output\n"
+            "  Output:          {:?}\n"
+            "  Expected:        {:?}\n"
+            "  intc_invocation: {}\n"
+            "  ld_invocation:   {}\n"
+            "  test_invocation: {}",
+            output,
+            expected_output,
+            intc_status.escaped_command_line,
+            ld_status.escaped_command_line,
+            test_status.escaped_command_line
+        );
+    };
+
+    if (files.empty()) check_program(intc_outpath);
+    else for (const auto& entry : fs::directory_iterator{intc_outpath}) check_program(entry.path());
 }